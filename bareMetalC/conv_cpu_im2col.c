@@ -0,0 +1,176 @@
+// See LICENSE for license details.
+
+// Checks that conv_cpu, which runs convs as matmuls of their implicit
+// im2col, gives exactly the same results as a plain loop over the kernel, with
+// and without pooling, bias, and residuals
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define MAX_BATCH 2
+#define MAX_IN_DIM 24
+#define MAX_CHANNELS 70
+#define MAX_KERNEL_DIM 7
+
+struct conv_case_t {
+    int batch_size, in_dim, in_channels, out_channels;
+    int stride, padding, kernel_dim;
+    int pool_size, pool_stride, pool_padding;
+    bool bias, residual;
+};
+
+static const struct conv_case_t cases[] = {
+    {2, 12, 17, 31, 1, 1, 3, 0, 0, 0, true, true},
+    {2, 13, 3, 64, 2, 3, 7, 3, 2, 1, true, false},
+    {1, 20, 70, 40, 1, 1, 3, 3, 2, 1, false, true},
+    {2, 9, 5, 7, 2, 0, 1, 2, 2, 0, true, true},
+    {1, 24, 40, 20, 1, 2, 5, 0, 0, 0, true, false},
+    {1, 24, 8, 33, 1, 1, 3, 3, 3, 0, true, true},
+};
+
+static elem_t input[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_CHANNELS];
+static elem_t weights[MAX_KERNEL_DIM * MAX_KERNEL_DIM * MAX_CHANNELS * MAX_CHANNELS];
+static acc_t bias[MAX_CHANNELS];
+static elem_t residual[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_CHANNELS];
+static elem_t unpooled[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_CHANNELS];
+static elem_t gold[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_CHANNELS];
+static elem_t output[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_CHANNELS];
+
+// Accumulates the bias, then the residual, and then every element of the
+// kernel in order, including the padding
+static void naive_conv(const struct conv_case_t * c, int out_dim,
+        int act, acc_scale_t scale) {
+    for (int b = 0; b < c->batch_size; b++)
+        for (int orow = 0; orow < out_dim; orow++)
+            for (int ocol = 0; ocol < out_dim; ocol++)
+                for (int och = 0; och < c->out_channels; och++) {
+                    const int opixel_idx = ((b * out_dim + orow) * out_dim + ocol) * c->out_channels + och;
+
+                    acc_t opixel = c->bias ? bias[och] : 0;
+                    if (c->residual)
+                        opixel += MVIN_SCALE(residual[opixel_idx], MVIN_SCALE_IDENTITY);
+
+                    for (int krow = 0; krow < c->kernel_dim; krow++) {
+                        const int irow = orow * c->stride + krow - c->padding;
+
+                        for (int kcol = 0; kcol < c->kernel_dim; kcol++) {
+                            const int icol = ocol * c->stride + kcol - c->padding;
+
+                            for (int kch = 0; kch < c->in_channels; kch++) {
+                                const acc_t ipixel = irow < 0 || irow >= c->in_dim || icol < 0 || icol >= c->in_dim ?
+                                    0 : input[((b * c->in_dim + irow) * c->in_dim + icol) * c->in_channels + kch];
+                                const acc_t weight = weights[((krow * c->kernel_dim + kcol) * c->in_channels + kch) * c->out_channels + och];
+
+                                opixel += weight * ipixel;
+                            }
+                        }
+                    }
+
+                    unpooled[opixel_idx] = scale_and_sat(opixel, act, scale, 0);
+                }
+}
+
+// Max-pools the unpooled output, where the padding counts as zeros
+static void naive_pool(const struct conv_case_t * c, int out_dim, int pool_out_dim) {
+    for (int b = 0; b < c->batch_size; b++)
+        for (int porow = 0; porow < pool_out_dim; porow++)
+            for (int pocol = 0; pocol < pool_out_dim; pocol++)
+                for (int och = 0; och < c->out_channels; och++) {
+                    bool initialized = false;
+                    elem_t result = 0;
+
+                    for (int pwrow = 0; pwrow < c->pool_size; pwrow++)
+                        for (int pwcol = 0; pwcol < c->pool_size; pwcol++) {
+                            const int orow = porow * c->pool_stride + pwrow - c->pool_padding;
+                            const int ocol = pocol * c->pool_stride + pwcol - c->pool_padding;
+
+                            const elem_t x = orow < 0 || orow >= out_dim || ocol < 0 || ocol >= out_dim ?
+                                0 : unpooled[((b * out_dim + orow) * out_dim + ocol) * c->out_channels + och];
+
+                            if (!initialized || x > result)
+                                result = x;
+                            initialized = true;
+                        }
+
+                    gold[((b * pool_out_dim + porow) * pool_out_dim + pocol) * c->out_channels + och] = result;
+                }
+}
+
+static elem_t rand_elem(int range) {
+#ifdef ELEM_T_IS_FLOAT
+    return ((rand() % (2 * range + 1)) - range) * 0.37;
+#else
+    return (rand() % (2 * range + 1)) - range;
+#endif
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    for (int n = 0; n < sizeof(cases) / sizeof(cases[0]); n++) {
+        const struct conv_case_t * c = &cases[n];
+        const int out_dim = (c->in_dim + 2 * c->padding - c->kernel_dim) / c->stride + 1;
+        const int pool_out_dim = c->pool_stride == 0 ? out_dim :
+            (out_dim + 2 * c->pool_padding - c->pool_size) / c->pool_stride + 1;
+
+        for (int i = 0; i < c->batch_size * c->in_dim * c->in_dim * c->in_channels; i++)
+            input[i] = rand_elem(5);
+        for (int i = 0; i < c->kernel_dim * c->kernel_dim * c->in_channels * c->out_channels; i++)
+            weights[i] = rand_elem(2);
+        for (int i = 0; i < c->out_channels; i++)
+            bias[i] = rand_elem(8);
+        for (int i = 0; i < c->batch_size * out_dim * out_dim * c->out_channels; i++)
+            residual[i] = rand_elem(5);
+
+        const int acts[] = {NO_ACTIVATION, RELU};
+        const acc_scale_t scale = 0.25;
+
+        for (int a = 0; a < sizeof(acts) / sizeof(acts[0]); a++) {
+            printf("Conv %d, act %d\n", n, acts[a]);
+
+            naive_conv(c, out_dim, acts[a], scale);
+            if (c->pool_stride == 0) {
+                for (int i = 0; i < c->batch_size * out_dim * out_dim * c->out_channels; i++)
+                    gold[i] = unpooled[i];
+            } else {
+                naive_pool(c, out_dim, pool_out_dim);
+            }
+
+            uint64_t start = read_cycles();
+
+            conv_cpu(c->batch_size, c->in_dim, c->in_channels,
+                c->out_channels, out_dim,
+                c->stride, c->padding, c->kernel_dim,
+                input, weights, c->bias ? bias : NULL, output,
+                c->residual ? residual : NULL, MVIN_SCALE_IDENTITY,
+                acts[a], scale, 0,
+                c->pool_size, c->pool_stride, c->pool_padding);
+
+            uint64_t end = read_cycles();
+            printf("Cycles taken: %llu\n", end - start);
+
+            // Compare the bits, so that even the signs of zeros have to match
+            for (int i = 0; i < c->batch_size * pool_out_dim * pool_out_dim * c->out_channels; i++)
+                if (memcmp(&output[i], &gold[i], sizeof(elem_t)) != 0) {
+                    printf("Output %d is different from the plain loop's\n", i);
+                    exit(1);
+                }
+        }
+    }
+
+    printf("Correct\n");
+    exit(0);
+}
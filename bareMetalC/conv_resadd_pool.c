@@ -0,0 +1,221 @@
+// See LICENSE for license details.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+// A conv whose outputs have a residual added to them before they're activated
+// and pooled, like the last conv of a residual block, run in one pass with
+// tiled_conv_auto_resadd, and checked against the same conv, residual add,
+// and pool run one after another. A 1x1 conv which adds its residual in place
+// is checked too
+
+#define BATCH_SIZE 2
+#define IN_DIM 12
+#define IN_CHANNELS 17
+#define OUT_CHANNELS 31
+#define KERNEL_DIM 3
+#define PADDING 1
+#define STRIDE 1
+
+#define POOL_SIZE 3
+#define POOL_STRIDE 2
+#define POOL_PADDING 1
+
+#define OUT_DIM ((IN_DIM + 2*PADDING - KERNEL_DIM) / STRIDE + 1)
+#define POOL_OUT_DIM ((OUT_DIM + 2*POOL_PADDING - POOL_SIZE) / POOL_STRIDE + 1)
+
+#define DS_CHANNELS (2*DIM)
+
+// The host emulator doesn't model the im2col unit that Gemmini's convs use,
+// except for 1x1, stride 1 convs, so the 1x1 convs below run on Gemmini
+// everywhere
+#ifdef GEMMINI_HOST_EMU
+#define CONV_TYPE CPU
+#else
+#define CONV_TYPE WS
+#endif
+#define DS_CONV_TYPE WS
+
+void pool(int batch_size, int channels, int in_dim, int out_dim,
+        int window_dim, int stride, int padding,
+        elem_t input[batch_size][in_dim][in_dim][channels],
+        elem_t output[batch_size][out_dim][out_dim][channels]) {
+
+    for (int b = 0; b < batch_size; b++) {
+        for (int orow = 0; orow < out_dim; orow++) {
+            for (int ocol = 0; ocol < out_dim; ocol++) {
+                for (int ch = 0; ch < channels; ch++) {
+                    output[b][orow][ocol][ch] = elem_t_min;
+
+                    for (int wrow = 0; wrow < window_dim; wrow++) {
+                        for (int wcol = 0; wcol < window_dim; wcol++) {
+                            int irow = orow * stride + wrow - padding;
+                            int icol = ocol * stride + wcol - padding;
+
+                            elem_t pixel = irow < 0 || irow >= in_dim ||
+                                icol < 0 || icol >= in_dim ?
+                                0 : input[b][irow][icol][ch];
+
+                            if (pixel > output[b][orow][ocol][ch]) {
+                                output[b][orow][ocol][ch] = pixel;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void init_random(elem_t * buf, int len) {
+    for (elem_t * ptr = buf; ptr < buf + len; ptr++)
+        *ptr = (rand() % 5) - 2;
+}
+
+void init_random_acc(acc_t * buf, int len) {
+    for (acc_t * ptr = buf; ptr < buf + len; ptr++)
+        *ptr = (rand() % 5) - 2;
+}
+
+bool vec_is_equal(elem_t * a, elem_t * b, int len) {
+    for (int i = 0; i < len; i++)
+        if (a[i] != b[i])
+            return false;
+    return true;
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t input[BATCH_SIZE][IN_DIM][IN_DIM][IN_CHANNELS];
+    static elem_t weights[KERNEL_DIM * KERNEL_DIM * IN_CHANNELS][OUT_CHANNELS];
+    static acc_t bias[OUT_CHANNELS];
+    static elem_t residual[BATCH_SIZE][OUT_DIM][OUT_DIM][OUT_CHANNELS];
+
+    static elem_t conv_output[BATCH_SIZE][OUT_DIM][OUT_DIM][OUT_CHANNELS];
+    static elem_t gold[BATCH_SIZE][POOL_OUT_DIM][POOL_OUT_DIM][OUT_CHANNELS];
+    static elem_t output[BATCH_SIZE][POOL_OUT_DIM][POOL_OUT_DIM][OUT_CHANNELS];
+
+    init_random(&input[0][0][0][0], sizeof(input) / sizeof(elem_t));
+    init_random(&weights[0][0], sizeof(weights) / sizeof(elem_t));
+    init_random_acc(&bias[0], sizeof(bias) / sizeof(acc_t));
+    init_random(&residual[0][0][0][0], sizeof(residual) / sizeof(elem_t));
+
+    printf("Unfused conv, resadd, and pool...\n");
+    uint64_t start = read_cycles();
+
+    tiled_conv_auto(
+        BATCH_SIZE, IN_DIM, IN_CHANNELS,
+        OUT_CHANNELS, OUT_DIM,
+        STRIDE, PADDING, KERNEL_DIM,
+
+        (elem_t*)input, (elem_t*)weights, bias, (elem_t*)conv_output,
+
+        NO_ACTIVATION, ACC_SCALE_IDENTITY, 0,
+        0, 0, 0,
+
+        CONV_TYPE);
+
+    tiled_resadd_auto(BATCH_SIZE * OUT_DIM * OUT_DIM, OUT_CHANNELS,
+        MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, ACC_SCALE_IDENTITY,
+        (elem_t*)residual, (elem_t*)conv_output, (elem_t*)conv_output,
+        true, CONV_TYPE == CPU ? CPU : WS);
+
+    pool(BATCH_SIZE, OUT_CHANNELS, OUT_DIM, POOL_OUT_DIM,
+        POOL_SIZE, POOL_STRIDE, POOL_PADDING,
+        conv_output, gold);
+
+    uint64_t end = read_cycles();
+    printf("Unfused took %llu cycles\n", end - start);
+
+    printf("Fused conv, resadd, and pool...\n");
+    start = read_cycles();
+
+    tiled_conv_auto_resadd(
+        BATCH_SIZE, IN_DIM, IN_CHANNELS,
+        OUT_CHANNELS, OUT_DIM,
+        STRIDE, PADDING, KERNEL_DIM,
+
+        (elem_t*)input, (elem_t*)weights, bias, (elem_t*)output,
+        (elem_t*)residual, MVIN_SCALE_IDENTITY,
+
+        RELU, ACC_SCALE_IDENTITY, 0,
+        POOL_SIZE, POOL_STRIDE, POOL_PADDING,
+
+        CONV_TYPE);
+
+    end = read_cycles();
+    printf("Fused took %llu cycles\n", end - start);
+
+    if (!vec_is_equal(&output[0][0][0][0], &gold[0][0][0][0], sizeof(output) / sizeof(elem_t))) {
+        printf("Fused conv, resadd, and pool is incorrect\n");
+        exit(1);
+    }
+
+    // A 1x1 conv whose residual is its own output
+    static elem_t ds_input[BATCH_SIZE][OUT_DIM][OUT_DIM][DS_CHANNELS];
+    static elem_t ds_weights[DS_CHANNELS][DS_CHANNELS];
+    static acc_t ds_bias[DS_CHANNELS];
+    static elem_t ds_gold[BATCH_SIZE][OUT_DIM][OUT_DIM][DS_CHANNELS];
+    static elem_t ds_output[BATCH_SIZE][OUT_DIM][OUT_DIM][DS_CHANNELS];
+
+    init_random(&ds_input[0][0][0][0], sizeof(ds_input) / sizeof(elem_t));
+    init_random(&ds_weights[0][0], sizeof(ds_weights) / sizeof(elem_t));
+    init_random_acc(&ds_bias[0], sizeof(ds_bias) / sizeof(acc_t));
+    init_random(&ds_output[0][0][0][0], sizeof(ds_output) / sizeof(elem_t));
+
+    conv_cpu(
+        BATCH_SIZE, OUT_DIM, DS_CHANNELS,
+        DS_CHANNELS, OUT_DIM,
+        1, 0, 1,
+        (elem_t*)ds_input, (elem_t*)ds_weights, ds_bias, (elem_t*)ds_gold,
+        NULL, 0,
+        NO_ACTIVATION, ACC_SCALE_IDENTITY, 0,
+        0, 0, 0);
+
+    resadd_cpu(BATCH_SIZE * OUT_DIM * OUT_DIM, DS_CHANNELS,
+        MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, ACC_SCALE_IDENTITY,
+        (elem_t*)ds_output, (elem_t*)ds_gold, (elem_t*)ds_gold,
+        true);
+
+    printf("Fused 1x1 conv and in-place resadd...\n");
+    start = read_cycles();
+
+    tiled_conv_auto_resadd(
+        BATCH_SIZE, OUT_DIM, DS_CHANNELS,
+        DS_CHANNELS, OUT_DIM,
+        1, 0, 1,
+
+        (elem_t*)ds_input, (elem_t*)ds_weights, ds_bias, (elem_t*)ds_output,
+        (elem_t*)ds_output, MVIN_SCALE_IDENTITY,
+
+        RELU, ACC_SCALE_IDENTITY, 0,
+        0, 0, 0,
+
+        DS_CONV_TYPE);
+
+    end = read_cycles();
+    printf("Fused 1x1 took %llu cycles\n", end - start);
+
+    if (!vec_is_equal(&ds_output[0][0][0][0], &ds_gold[0][0][0][0], sizeof(ds_output) / sizeof(elem_t))) {
+        printf("Fused 1x1 conv and in-place resadd is incorrect\n");
+        exit(1);
+    }
+
+    printf("Correct\n");
+    exit(0);
+}
@@ -0,0 +1,180 @@
+// See LICENSE for license details.
+
+// Checks that 3x3 stride-1 convs which run with Winograd's F(2x2, 3x3)
+// algorithm are close to a plain loop over the kernel in float, with odd
+// output dims, padding, bias, residuals, and enough channels that the
+// transformed tiles have to be split up. Convs that Winograd can't run fall
+// back to direct convs
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define MAX_BATCH 2
+#define MAX_IN_DIM 17
+#define MAX_IN_CHANNELS 300
+#define MAX_OUT_CHANNELS 70
+#define MAX_KERNEL_DIM 3
+
+// Small enough that the largest conv is split into chunks of output channels
+// and of tiles
+#define WINOGRAD_ELEMS (16 * MAX_IN_CHANNELS * DIM)
+
+struct conv_case_t {
+    int batch_size, in_dim, in_channels, out_channels;
+    int stride, padding, kernel_dim;
+    bool bias, residual;
+};
+
+static const struct conv_case_t cases[] = {
+    {2, 8, 16, 32, 1, 1, 3, true, false},
+    {1, 17, 21, 70, 1, 1, 3, true, true},
+    {2, 11, 5, 3, 1, 0, 3, false, true},
+    {1, 12, 300, 40, 1, 1, 3, true, false},
+#ifndef GEMMINI_HOST_EMU
+    // The host emulator doesn't model the im2col unit that WS convs use
+    {1, 10, 16, 16, 2, 1, 3, true, false},
+#endif
+};
+
+static elem_t input[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_IN_CHANNELS];
+static elem_t weights[MAX_KERNEL_DIM * MAX_KERNEL_DIM * MAX_IN_CHANNELS * MAX_OUT_CHANNELS];
+static acc_t bias[MAX_OUT_CHANNELS];
+static elem_t residual[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_OUT_CHANNELS];
+static float gold[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_OUT_CHANNELS];
+static float gold_abs[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_OUT_CHANNELS];
+static elem_t output[MAX_BATCH * MAX_IN_DIM * MAX_IN_DIM * MAX_OUT_CHANNELS];
+
+#ifdef ELEM_T_IS_FLOAT
+static elem_t winograd_V[WINOGRAD_ELEMS] row_align(1);
+static elem_t winograd_U[WINOGRAD_ELEMS] row_align(1);
+static acc_t winograd_M[WINOGRAD_ELEMS] row_align_acc(1);
+#endif
+
+// Computes the conv in float, before the activation and scale, along with
+// the sum of the magnitudes of everything that was added up
+static void naive_conv(const struct conv_case_t * c, int out_dim) {
+    for (int b = 0; b < c->batch_size; b++)
+        for (int orow = 0; orow < out_dim; orow++)
+            for (int ocol = 0; ocol < out_dim; ocol++)
+                for (int och = 0; och < c->out_channels; och++) {
+                    const int opixel_idx = ((b * out_dim + orow) * out_dim + ocol) * c->out_channels + och;
+
+                    float opixel = c->bias ? bias[och] : 0;
+                    if (c->residual)
+                        opixel += residual[opixel_idx];
+                    float opixel_abs = fabsf(opixel);
+
+                    for (int krow = 0; krow < c->kernel_dim; krow++) {
+                        const int irow = orow * c->stride + krow - c->padding;
+
+                        for (int kcol = 0; kcol < c->kernel_dim; kcol++) {
+                            const int icol = ocol * c->stride + kcol - c->padding;
+
+                            if (irow < 0 || irow >= c->in_dim || icol < 0 || icol >= c->in_dim)
+                                continue;
+
+                            for (int kch = 0; kch < c->in_channels; kch++) {
+                                const float ipixel = input[((b * c->in_dim + irow) * c->in_dim + icol) * c->in_channels + kch];
+                                const float weight = weights[((krow * c->kernel_dim + kcol) * c->in_channels + kch) * c->out_channels + och];
+
+                                opixel += weight * ipixel;
+                                opixel_abs += fabsf(weight * ipixel);
+                            }
+                        }
+                    }
+
+                    gold[opixel_idx] = opixel;
+                    gold_abs[opixel_idx] = opixel_abs;
+                }
+}
+
+static elem_t rand_elem(int range) {
+    return ((rand() % (2 * range + 1)) - range) * 0.37;
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+#ifndef ELEM_T_IS_FLOAT
+    printf("This test needs a float elem_t\n");
+    exit(0);
+#else
+    gemmini_flush(0);
+
+    const struct tiled_conv_winograd_scratch_t winograd = {
+        winograd_V, winograd_U, winograd_M, WINOGRAD_ELEMS,
+    };
+
+    for (int n = 0; n < sizeof(cases) / sizeof(cases[0]); n++) {
+        const struct conv_case_t * c = &cases[n];
+        const int out_dim = (c->in_dim + 2 * c->padding - c->kernel_dim) / c->stride + 1;
+
+        for (int i = 0; i < c->batch_size * c->in_dim * c->in_dim * c->in_channels; i++)
+            input[i] = rand_elem(5);
+        for (int i = 0; i < c->kernel_dim * c->kernel_dim * c->in_channels * c->out_channels; i++)
+            weights[i] = rand_elem(2);
+        for (int i = 0; i < c->out_channels; i++)
+            bias[i] = rand_elem(8);
+        for (int i = 0; i < c->batch_size * out_dim * out_dim * c->out_channels; i++)
+            residual[i] = rand_elem(5);
+
+        naive_conv(c, out_dim);
+
+        const int acts[] = {NO_ACTIVATION, RELU};
+        const acc_scale_t scale = 0.25;
+
+        for (int a = 0; a < sizeof(acts) / sizeof(acts[0]); a++) {
+            printf("Conv %d, act %d\n", n, acts[a]);
+
+            uint64_t start = read_cycles();
+
+            tiled_conv_auto_algorithm(c->batch_size, c->in_dim, c->in_channels,
+                c->out_channels, out_dim,
+                c->stride, c->padding, c->kernel_dim,
+                input, weights, c->bias ? bias : NULL, output,
+                c->residual ? residual : NULL, MVIN_SCALE_IDENTITY,
+                acts[a], scale, 0,
+                0, 0, 0,
+                WS, WINOGRAD_CONV, &winograd);
+
+            uint64_t end = read_cycles();
+            printf("Cycles taken: %llu\n", end - start);
+
+            // The transforms and the matmuls round their sums at every add,
+            // so the error is bounded by the sum of the magnitudes of the
+            // products, rather than by the result. The transformed inputs and
+            // weights are also rounded to elem_ts
+            for (int i = 0; i < c->batch_size * out_dim * out_dim * c->out_channels; i++) {
+                float expected = gold[i];
+                if (acts[a] == RELU && expected < 0)
+                    expected = 0;
+                expected *= scale;
+
+                const float err = fabsf((float)output[i] - expected);
+                const float tolerance = scale * 16 * ldexpf(gold_abs[i], 1 - ELEM_T_SIG_BITS);
+
+                if (err > tolerance) {
+                    printf("Output %d is %f rather than %f\n", i, (float)output[i], expected);
+                    exit(1);
+                }
+            }
+        }
+    }
+
+    printf("Correct\n");
+    exit(0);
+#endif
+}
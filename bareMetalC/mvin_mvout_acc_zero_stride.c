@@ -58,7 +58,10 @@ int main() {
   for (size_t n = 0; n < N; ++n)
     for (size_t i = 0; i < DIM; ++i)
       for (size_t j = 0; j < DIM; ++j) {
-        Out_gold[n][i][j] = ACC_SCALE(In[n][j], ACC_SCALE_IDENTITY);
+        // mvout saturates, rather than truncates, integers which don't fit
+        const acc_t scaled = ACC_SCALE(In[n][j], ACC_SCALE_IDENTITY);
+        Out_gold[n][i][j] = scaled > elem_t_max ? elem_t_max :
+          (scaled < elem_t_min ? elem_t_min : scaled);
       }
 
   const uint32_t acc_addr = 1 << (ADDR_LEN-1);
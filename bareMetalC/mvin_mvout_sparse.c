@@ -1,5 +1,11 @@
 // See LICENSE for license details.
 
+// Moves a sparse matrix into the scratchpad one DIM x DIM tile at a time with
+// the COO mvin, and back out again. The COO matrix is built by sparse_util.h
+// in tile order, so each tile is moved in straight from its entry in the tile
+// offset table. The same matrix is also shuffled and re-sorted, to check that
+// sparse_coo_sort gets back to the same order.
+
 #include <stdint.h>
 #include <stddef.h>
 #include <assert.h>
@@ -9,35 +15,16 @@
 #include <sys/mman.h>
 #endif
 #include "include/gemmini_testutils.h"
+#include "include/sparse_util.h"
 
-#define N 1
+#define N_I 2
+#define N_K 3
 #define SPARSITY 10
 
-#if (N*DIM) > (BANK_NUM*BANK_ROWS)
+#if (N_I*N_K*DIM) > (BANK_NUM*BANK_ROWS)
 #error not enough scratchpad space
 #endif
 
-void printSparseMat(elem_t data[DIM*DIM], ind_t coo[DIM*DIM][2]) {
-  for (size_t i = 0; i < DIM*DIM; ++i) {
-#ifndef ELEM_T_IS_FLOAT
-      if (data[i])
-          printf("[%d] %d (%d, %d), ", i, data[i], coo[i][0], coo[i][1]);
-#else
-      if (data[i])
-          printf("[%d] %x (%d, %d), ", i, elem_t_to_elem_t_bits(data[i]), coo[i][0], coo[i][1]);
-#endif
-  }
-  printf("\n");
-}
-
-void printFMatrix(float m[DIM][DIM]) {
-  for (size_t i = 0; i < DIM; ++i) {
-    for (size_t j = 0; j < DIM; ++j)
-      printf("%f ", m[i][j]);
-    printf("\n");
-  }
-}
-
 int main() {
 #ifndef BAREMETAL
     if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
@@ -49,72 +36,82 @@ int main() {
   printf("Flush\n");
   gemmini_flush(0);
   gemmini_config_ld(DIM * sizeof(elem_t));
-  gemmini_config_st(DIM * sizeof(elem_t));
-
-  // create
-  static elem_t InDense[N][DIM][DIM] row_align(1);
-  static elem_t OutDense[N][DIM][DIM] row_align(1);
-
-  // the current mvin requires that this is 1 element larger than the number of nonzero values to avoid segfaults
-  static elem_t InSpData[N][DIM*DIM]; row_align(1);  // it can be smaller, but I'm maxing it for now
-  static ind_t InSpCoo[N][DIM*DIM][2]; row_align(1); 
-  
-  printf("pre-populate\n");
-  unsigned int sparse_index = 0;
-  for (size_t n = 0; n < N; ++n) {
-    for (size_t i = 0; i < DIM; ++i)
-      for (size_t j = 0; j < DIM; ++j)
-        if ((rand() % 100) < SPARSITY) { 
-          //int value = (i*DIM + j + n); // / 2; there is some sort of clamping going on here
-          float value = (float) (rand() % 128); 
-          InDense[n][i][j]          = value;
-          InSpData[n][sparse_index] = value;
-          InSpCoo[n][sparse_index][0] = i;
-          InSpCoo[n][sparse_index][1] = j;
-          sparse_index += 1;
-        }
-    printf("Input Matrix[%d]\n",n);
-    printMatrix(InDense[n]);
-    printSparseMat(InSpData[n], InSpCoo[n]);
+  gemmini_config_st(N_K * DIM * sizeof(elem_t));
+
+  static elem_t InDense[N_I*DIM][N_K*DIM] row_align(1);
+  static elem_t OutDense[N_I*DIM][N_K*DIM] row_align(1);
+
+  for (size_t i = 0; i < N_I*DIM; ++i)
+    for (size_t j = 0; j < N_K*DIM; ++j)
+      InDense[i][j] = (rand() % 100) < SPARSITY ? (elem_t)(rand() % 128) : 0;
+
+  printf("Input Matrix\n");
+  for (size_t i = 0; i < N_I*DIM; ++i) {
+    for (size_t j = 0; j < N_K*DIM; ++j)
+      printf("%d ", (int)InDense[i][j]);
+    printf("\n");
   }
 
-  printf("Addr SpData: %p %p %p\n", InSpData, &InSpData[0], &InSpData[0][0]);
-  printf("Addr SpCoo : %p %p %p\n", InSpCoo, &InSpCoo[0], &InSpCoo[0][1]);
-  printf("InSpData[0] %d\n", ((elem_t*) InSpData)[0]);
-  printf("InSpData[0] %d\n", InSpData[0][0]);
-  printf("InSpCoo[0]  (%d,%d)\n", InSpCoo[0][0][0], InSpCoo[0][0][1]);
-  printf("InDnData[0] %d\n", InDense[0][0][0]);
+  struct sparse_coo_t sp = sparse_dense_to_coo(N_I*DIM, N_K*DIM,
+      &InDense[0][0], N_K*DIM, true);
+  ind_t * offsets = sparse_coo_tile_offsets(&sp);
+
+  printf("%u nonzeros\n", (unsigned)sp.nnz);
+
+  // Shuffle the nonzeros, and check that sorting them gets back to the same
+  // order
+  struct sparse_coo_t shuffled = sparse_dense_to_coo(N_I*DIM, N_K*DIM,
+      &InDense[0][0], N_K*DIM, false);
+  for (size_t n = shuffled.nnz; n > 1; n--) {
+    const size_t m = rand() % n;
+    const elem_t d = shuffled.data[n-1];
+    const ind_t r = shuffled.coo[2*(n-1)], c = shuffled.coo[2*(n-1)+1];
+    shuffled.data[n-1] = shuffled.data[m];
+    shuffled.coo[2*(n-1)] = shuffled.coo[2*m];
+    shuffled.coo[2*(n-1)+1] = shuffled.coo[2*m+1];
+    shuffled.data[m] = d;
+    shuffled.coo[2*m] = r;
+    shuffled.coo[2*m+1] = c;
+  }
+
+  sparse_coo_sort(&shuffled, true);
+
+  for (size_t n = 0; n < sp.nnz; ++n)
+    if (shuffled.data[n] != sp.data[n] || shuffled.coo[2*n] != sp.coo[2*n] ||
+        shuffled.coo[2*n+1] != sp.coo[2*n+1]) {
+      printf("Sorted nonzero %u is out of order\n", (unsigned)n);
+      exit(1);
+    }
 
-  printf("Fence");
+  printf("Fence\n");
   gemmini_fence();
 
-  // Apply mvin mvout
-  for (size_t n = 0; n < N; ++n) {
-    printf("Mvin %d\n", n);
-    // the current spike implementation requires that the addresses of data and coo passed in 
-    // point to the first nonzero value after or including (start_row, start_col) (in this case 0,0)
-    gemmini_extended_mvin_sparse_coo(&InSpData[n], &InSpCoo[n], DIM*DIM, n*DIM, 0, DIM, 0, DIM); 
-    printf("Mvout %d\n", n);
-    gemmini_mvout(&OutDense[n], n*DIM);
+  // Apply mvin mvout, in reverse order, since each tile can be found directly
+  for (int t = N_I*N_K - 1; t >= 0; --t) {
+    const size_t i = t / N_K, k = t % N_K;
+    printf("Mvin %d\n", t);
+    gemmini_extended_mvin_sparse_coo(sp.data + offsets[t], sp.coo + 2*offsets[t],
+        offsets[t+1] - offsets[t], t*DIM, k*DIM, DIM, i*DIM, DIM);
+    printf("Mvout %d\n", t);
+    gemmini_mvout(&OutDense[i*DIM][k*DIM], t*DIM);
   }
 
   printf("Fence\n");
   gemmini_fence();
 
   // check equal
-  for (size_t n = 0; n < N; ++n) {
-    if (!is_equal(&InDense[0], &OutDense[0])) {
-      printf("Matrix %u:\n", n);
-      printMatrix(InDense);
-      printf("Matrix %u output:\n", n);
-      printMatrix(OutDense);
-      printf("\n");
-      exit(1);
-    } else {
-      printf("Comp[%d] PASS\n", n);
-    }
-  }
+  for (size_t i = 0; i < N_I*DIM; ++i)
+    for (size_t j = 0; j < N_K*DIM; ++j)
+      if (InDense[i][j] != OutDense[i][j]) {
+        printf("Output differs at (%u, %u)\n", (unsigned)i, (unsigned)j);
+        exit(1);
+      }
+
+  printf("PASS\n");
+
+  sparse_free_coo(&sp);
+  sparse_free_coo(&shuffled);
+  free(offsets);
 
   exit(0);
 }
-
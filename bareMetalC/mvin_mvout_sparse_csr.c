@@ -0,0 +1,148 @@
+// See LICENSE for license details.
+
+// Converts a sparse matrix from COO to CSR and blocked CSR, builds their tile
+// pointers, and then moves every DIM x DIM tile of it in with the CSR and
+// blocked-CSR mvins, in a scrambled order, checking each one against the
+// dense matrix. The matrix's
+// dimensions aren't multiples of DIM, so the edge tiles are partial. The
+// converted matrices are also checked against sparse_util.h's conversions
+// straight from the dense matrix.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+#include "include/sparse_util.h"
+
+#define MAT_DIM_I 70
+#define MAT_DIM_K 100
+#define DENSITY_PERCENT 10
+
+#define I_BLOCKS (MAT_DIM_I / DIM + (MAT_DIM_I % DIM != 0))
+#define K_BLOCKS (MAT_DIM_K / DIM + (MAT_DIM_K % DIM != 0))
+
+#if (2*DIM) > (BANK_NUM*BANK_ROWS)
+#error not enough scratchpad space
+#endif
+
+static elem_t dense[MAT_DIM_I][MAT_DIM_K];
+
+static elem_t data[MAT_DIM_I * MAT_DIM_K];
+static ind_t coo[MAT_DIM_I * MAT_DIM_K][2];
+
+static ind_t col_idx[MAT_DIM_I * MAT_DIM_K];
+static ind_t row_ptr[MAT_DIM_I + 1];
+static ind_t tile_ptr[MAT_DIM_I * K_BLOCKS + 1];
+
+static elem_t block_data[I_BLOCKS * K_BLOCKS][DIM][DIM];
+static ind_t block_col_idx[I_BLOCKS * K_BLOCKS];
+static ind_t block_row_ptr[I_BLOCKS + 1];
+static ind_t block_tile_ptr[I_BLOCKS * K_BLOCKS + 1];
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+  gemmini_flush(0);
+  gemmini_config_ld(DIM * sizeof(elem_t));
+  gemmini_config_st(DIM * sizeof(elem_t));
+
+  size_t nnz = 0;
+  for (size_t i = 0; i < MAT_DIM_I; i++)
+    for (size_t k = 0; k < MAT_DIM_K; k++) {
+      dense[i][k] = 0;
+      // Leave some blocks of rows entirely empty
+      if ((i / DIM) % 3 != 1 && rand() % 100 < DENSITY_PERCENT) {
+        dense[i][k] = 1 + rand() % 100;
+        data[nnz] = dense[i][k];
+        coo[nnz][0] = i;
+        coo[nnz][1] = k;
+        nnz++;
+      }
+    }
+
+  spmm_coo_to_csr(MAT_DIM_I, (ind_t*)coo, nnz, col_idx, row_ptr);
+
+  const size_t blocks = spmm_csr_nnz_blocks(MAT_DIM_I, MAT_DIM_K, col_idx, row_ptr);
+  spmm_csr_to_bcsr(MAT_DIM_I, MAT_DIM_K, data, col_idx, row_ptr,
+      (elem_t*)block_data, block_col_idx, block_row_ptr);
+
+  spmm_csr_tile_ptr(MAT_DIM_I, K_BLOCKS, DIM, col_idx, row_ptr, tile_ptr);
+  spmm_csr_tile_ptr(I_BLOCKS, K_BLOCKS, 1, block_col_idx, block_row_ptr, block_tile_ptr);
+
+  printf("%u nonzeros in %u of %u blocks\n", (unsigned)nnz, (unsigned)blocks,
+      (unsigned)(I_BLOCKS * K_BLOCKS));
+
+  if (block_row_ptr[I_BLOCKS] != blocks) {
+    printf("spmm_csr_nnz_blocks and spmm_csr_to_bcsr disagree\n");
+    exit(1);
+  }
+
+  struct sparse_csr_t csr = sparse_dense_to_csr(MAT_DIM_I, MAT_DIM_K, &dense[0][0], MAT_DIM_K);
+  struct sparse_bcsr_t bcsr = sparse_dense_to_bcsr(MAT_DIM_I, MAT_DIM_K, &dense[0][0], MAT_DIM_K);
+
+  if (csr.nnz != nnz || bcsr.blocks != blocks ||
+      memcmp(csr.data, data, nnz * sizeof(elem_t)) != 0 ||
+      memcmp(csr.col_idx, col_idx, nnz * sizeof(ind_t)) != 0 ||
+      memcmp(csr.row_ptr, row_ptr, sizeof(row_ptr)) != 0 ||
+      csr.tile_cols != K_BLOCKS ||
+      memcmp(csr.tile_ptr, tile_ptr, sizeof(tile_ptr)) != 0 ||
+      memcmp(bcsr.data, block_data, blocks * DIM * DIM * sizeof(elem_t)) != 0 ||
+      memcmp(bcsr.col_idx, block_col_idx, blocks * sizeof(ind_t)) != 0 ||
+      memcmp(bcsr.row_ptr, block_row_ptr, sizeof(block_row_ptr)) != 0 ||
+      bcsr.tile_cols != K_BLOCKS ||
+      memcmp(bcsr.tile_ptr, block_tile_ptr, sizeof(block_tile_ptr)) != 0) {
+    printf("sparse_util.h's conversions don't match\n");
+    exit(1);
+  }
+
+  sparse_free_csr(&csr);
+  sparse_free_bcsr(&bcsr);
+
+  static elem_t csr_out[DIM][DIM] row_align(1);
+  static elem_t bcsr_out[DIM][DIM] row_align(1);
+
+  // Visit the tiles out of order, since any tile should be found from its
+  // tile pointers, without going through the tiles before it
+  for (size_t t = 0; t < I_BLOCKS * K_BLOCKS; t++) {
+    const size_t tile = (t * 7) % (I_BLOCKS * K_BLOCKS);
+    const size_t i = tile / K_BLOCKS, k = tile % K_BLOCKS;
+
+    const size_t rows = i*DIM + DIM <= MAT_DIM_I ? DIM : MAT_DIM_I - i*DIM;
+    const size_t cols = k*DIM + DIM <= MAT_DIM_K ? DIM : MAT_DIM_K - k*DIM;
+
+    gemmini_extended_mvin_sparse_csr(data, col_idx, tile_ptr, K_BLOCKS,
+        0, k*DIM, cols, i*DIM, rows);
+    gemmini_extended_mvin_sparse_bcsr((elem_t*)block_data, block_tile_ptr, K_BLOCKS,
+        DIM, k, cols, i, rows);
+
+    gemmini_extended_mvout(csr_out, 0, cols, rows);
+    gemmini_extended_mvout(bcsr_out, DIM, cols, rows);
+    gemmini_fence();
+
+    for (size_t r = 0; r < rows; r++)
+      for (size_t c = 0; c < cols; c++) {
+        if (csr_out[r][c] != dense[i*DIM + r][k*DIM + c]) {
+          printf("CSR tile (%u, %u) is wrong at (%u, %u)\n", i, k, r, c);
+          exit(1);
+        }
+        if (bcsr_out[r][c] != dense[i*DIM + r][k*DIM + c]) {
+          printf("Blocked-CSR tile (%u, %u) is wrong at (%u, %u)\n", i, k, r, c);
+          exit(1);
+        }
+      }
+  }
+
+  printf("All tiles match\n");
+
+  exit(0);
+}
@@ -0,0 +1,211 @@
+// See LICENSE for license details.
+
+// Describes a small residual network as a table of layers, runs it with the
+// graph runtime in gemmini_nn.h on Gemmini and on the CPU, and checks that
+// both give the same predictions. A second network, of a 3x3 conv and a
+// pointwise conv which are each followed by a pool, is run on the CPU with
+// and without convs, which checks that only the first pool is fused.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+#include "include/gemmini_nn.h"
+
+#define BATCH_SIZE 2
+#define IN_DIM 8
+#define IN_CHANNELS 8
+#define MID_CHANNELS 16
+#define OUT_CHANNELS 32
+#define CLASSES 10
+
+#define POOLED_DIM (IN_DIM / 2)
+#define POOLED_DIM_2 (POOLED_DIM / 2)
+
+#define CONV_PARAMS(in_dim_, in_ch, out_ch, kernel, stride_, pad) { \
+    .batch_size = BATCH_SIZE, \
+    .in_dim = (in_dim_), .out_dim = ((in_dim_) + 2*(pad) - (kernel)) / (stride_) + 1, \
+    .kernel_size = (kernel), \
+    .in_channels = (in_ch), .out_channels = (out_ch), \
+    .stride = (stride_), .padding = (pad), \
+    .bias = true, .depthwise = false, \
+    .n_patches = BATCH_SIZE * (((in_dim_) + 2*(pad) - (kernel)) / (stride_) + 1) * (((in_dim_) + 2*(pad) - (kernel)) / (stride_) + 1), \
+    .patch_size = (kernel) * (kernel) * (in_ch), \
+    .output_scale = 0.125, .res_scale = MVIN_SCALE_IDENTITY, \
+    .pool_size = 2, .pool_stride = 2, .pool_padding = 0, \
+    .out_dim_pooled = (((in_dim_) + 2*(pad) - (kernel)) / (stride_) + 1) / 2, \
+    .I = BATCH_SIZE * (((in_dim_) + 2*(pad) - (kernel)) / (stride_) + 1) * (((in_dim_) + 2*(pad) - (kernel)) / (stride_) + 1), \
+    .J = (out_ch), .K = (kernel) * (kernel) * (in_ch), \
+}
+
+static const struct ConvParams conv_1_params = CONV_PARAMS(IN_DIM, IN_CHANNELS, MID_CHANNELS, 3, 1, 1);
+static const struct ConvParams conv_dw_2_params = CONV_PARAMS(POOLED_DIM, MID_CHANNELS, MID_CHANNELS, 3, 1, 1);
+static const struct ConvParams conv_3_params = CONV_PARAMS(POOLED_DIM, MID_CHANNELS, OUT_CHANNELS, 1, 1, 0);
+static const struct ConvParams conv_4_params = CONV_PARAMS(POOLED_DIM, MID_CHANNELS, OUT_CHANNELS, 1, 1, 0);
+static const struct ConvParams conv_pw_params = CONV_PARAMS(POOLED_DIM, MID_CHANNELS, MID_CHANNELS, 1, 1, 0);
+static const struct FcParams fc_5_params = {BATCH_SIZE, OUT_CHANNELS, CLASSES, 0.25, true,
+    BATCH_SIZE, CLASSES, OUT_CHANNELS};
+
+static elem_t conv_1_w[3*3*IN_CHANNELS][MID_CHANNELS];
+static elem_t conv_dw_2_w[MID_CHANNELS][3][3];
+static elem_t conv_3_w[MID_CHANNELS][OUT_CHANNELS];
+static elem_t conv_4_w[MID_CHANNELS][OUT_CHANNELS];
+static elem_t conv_pw_w[MID_CHANNELS][MID_CHANNELS];
+static elem_t fc_5_w[OUT_CHANNELS][CLASSES];
+
+static acc_t conv_1_b[MID_CHANNELS];
+static acc_t conv_dw_2_b[MID_CHANNELS];
+static acc_t conv_3_b[OUT_CHANNELS];
+static acc_t conv_4_b[OUT_CHANNELS];
+static acc_t conv_pw_b[MID_CHANNELS];
+static acc_t fc_5_b[CLASSES];
+
+// conv_3 and fc_5 are scaled per output channel, by powers of two so that
+// floats stay exact
+static acc_scale_t conv_3_scales[OUT_CHANNELS];
+static acc_scale_t fc_5_scales[CLASSES];
+
+// Tensors: 0 is the input image, and the rest are written by the layers below
+static const struct nn_layer_t layers[] = {
+    {NN_CONV, "conv_1", &conv_1_params, NULL, (elem_t*)conv_1_w, NULL, conv_1_b, RELU, 0, 0, 1},
+    {NN_POOL, "pool_1", &conv_1_params, NULL, NULL, NULL, NULL, NO_ACTIVATION, 1, 0, 2},
+    {NN_CONV_DW, "conv_dw_2", &conv_dw_2_params, NULL, (elem_t*)conv_dw_2_w, NULL, conv_dw_2_b, RELU, 2, 0, 3},
+    {NN_CONV, "conv_3", &conv_3_params, NULL, (elem_t*)conv_3_w, NULL, conv_3_b, NO_ACTIVATION, 3, 0, 4, conv_3_scales},
+    // The shortcut, from the pooled output of conv_1
+    {NN_CONV, "conv_4", &conv_4_params, NULL, (elem_t*)conv_4_w, NULL, conv_4_b, NO_ACTIVATION, 2, 0, 5},
+    {NN_RESADD, "resadd_4", &conv_3_params, NULL, NULL, NULL, NULL, RELU, 4, 5, 4},
+    {NN_GLOBAL_AVG_POOL, "avg_pool", &conv_3_params, NULL, NULL, NULL, NULL, NO_ACTIVATION, 4, 0, 6},
+    {NN_FC, "fc_5", NULL, &fc_5_params, (elem_t*)fc_5_w, NULL, fc_5_b, NO_ACTIVATION, 6, 0, 7, fc_5_scales},
+};
+
+#define N_LAYERS (sizeof(layers) / sizeof(layers[0]))
+
+// With convs, conv_1 runs with tiled_conv_auto, which can pool its output,
+// but conv_pw runs as a matmul, so pool_pw has to run on its own
+static const struct nn_layer_t pool_layers[] = {
+    {NN_CONV, "conv_1", &conv_1_params, NULL, (elem_t*)conv_1_w, NULL, conv_1_b, RELU, 0, 0, 1},
+    {NN_POOL, "pool_1", &conv_1_params, NULL, NULL, NULL, NULL, NO_ACTIVATION, 1, 0, 2},
+    {NN_CONV, "conv_pw", &conv_pw_params, NULL, (elem_t*)conv_pw_w, NULL, conv_pw_b, RELU, 2, 0, 3},
+    {NN_POOL, "pool_pw", &conv_pw_params, NULL, NULL, NULL, NULL, NO_ACTIVATION, 3, 0, 4},
+};
+
+#define N_POOL_LAYERS (sizeof(pool_layers) / sizeof(pool_layers[0]))
+#define POOL_OUT_ELEMS (BATCH_SIZE * POOLED_DIM_2 * POOLED_DIM_2 * MID_CHANNELS)
+
+#define ARENA_BYTES (64 * 1024)
+
+static void randomize(elem_t * x, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        x[i] = (rand() % 5) - 2;
+}
+
+static void randomize_bias(acc_t * x, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        x[i] = (rand() % 9) - 4;
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t images[BATCH_SIZE][IN_DIM][IN_DIM][IN_CHANNELS];
+
+    randomize((elem_t*)images, sizeof(images) / sizeof(elem_t));
+    randomize((elem_t*)conv_1_w, sizeof(conv_1_w) / sizeof(elem_t));
+    randomize((elem_t*)conv_dw_2_w, sizeof(conv_dw_2_w) / sizeof(elem_t));
+    randomize((elem_t*)conv_3_w, sizeof(conv_3_w) / sizeof(elem_t));
+    randomize((elem_t*)conv_4_w, sizeof(conv_4_w) / sizeof(elem_t));
+    randomize((elem_t*)conv_pw_w, sizeof(conv_pw_w) / sizeof(elem_t));
+    randomize((elem_t*)fc_5_w, sizeof(fc_5_w) / sizeof(elem_t));
+    randomize_bias(conv_1_b, MID_CHANNELS);
+    randomize_bias(conv_dw_2_b, MID_CHANNELS);
+    randomize_bias(conv_3_b, OUT_CHANNELS);
+    randomize_bias(conv_4_b, OUT_CHANNELS);
+    randomize_bias(conv_pw_b, MID_CHANNELS);
+    randomize_bias(fc_5_b, CLASSES);
+
+    for (size_t j = 0; j < OUT_CHANNELS; j++)
+        conv_3_scales[j] = 1.0 / (1 << (j % 3));
+    for (size_t j = 0; j < CLASSES; j++)
+        fc_5_scales[j] = 1.0 / (1 << (j % 2));
+
+    static int8_t arena[2][ARENA_BYTES] row_align(1);
+    static struct nn_runtime_t rt[2];
+    elem_t * out[2];
+
+    const enum tiled_matmul_type_t types[2] = {WS, CPU};
+
+    for (int t = 0; t < 2; t++) {
+        printf("Running network on %s\n", types[t] == CPU ? "the CPU" : "Gemmini");
+
+        const size_t arena_bytes = nn_runtime_init(&rt[t], layers, N_LAYERS,
+            (elem_t*)images, BATCH_SIZE * IN_DIM * IN_DIM, IN_CHANNELS,
+            arena[t], ARENA_BYTES,
+            false, types[t], false);
+
+        if (arena_bytes > ARENA_BYTES) {
+            printf("The network needs a %u byte arena\n", arena_bytes);
+            exit(1);
+        }
+
+        nn_print_memory(&rt[t]);
+
+        // Tensors which are never live at the same time should share space
+        if (rt[t].arena_bytes >= rt[t].total_bytes || rt[t].arena_bytes < rt[t].peak_bytes) {
+            printf("The arena isn't planned correctly\n");
+            exit(1);
+        }
+
+        // Run it twice, to make sure that the arena can be reused
+        nn_run(&rt[t]);
+        out[t] = nn_run(&rt[t]);
+
+        nn_print_cycles(&rt[t]);
+    }
+
+    for (size_t i = 0; i < BATCH_SIZE * CLASSES; i++)
+        if (out[0][i] != out[1][i]) {
+            printf("Output %u is different on Gemmini and on the CPU\n", i);
+            exit(1);
+        }
+
+    for (int conv = 0; conv < 2; conv++) {
+        printf("Running the pooling network on the CPU, %s convs\n", conv ? "with" : "without");
+
+        const size_t arena_bytes = nn_runtime_init(&rt[conv], pool_layers, N_POOL_LAYERS,
+            (elem_t*)images, BATCH_SIZE * IN_DIM * IN_DIM, IN_CHANNELS,
+            arena[conv], ARENA_BYTES,
+            conv, CPU, false);
+
+        if (arena_bytes > ARENA_BYTES) {
+            printf("The pooling network needs a %u byte arena\n", arena_bytes);
+            exit(1);
+        }
+
+        out[conv] = nn_run(&rt[conv]);
+    }
+
+    if (!rt[1].fused[1] || rt[1].fused[3]) {
+        printf("Only pool_1 should be fused into the conv before it\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < POOL_OUT_ELEMS; i++)
+        if (out[0][i] != out[1][i]) {
+            printf("Pooled output %u is different with and without convs\n", i);
+            exit(1);
+        }
+
+    exit(0);
+}
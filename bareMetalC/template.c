@@ -19,8 +19,10 @@ int main() {
 
   elem_t Identity[DIM][DIM];
   for (size_t i = 0; i < DIM; i++)
-    for (size_t j = 0; j < DIM; j++)
+    for (size_t j = 0; j < DIM; j++) {
+      In[i][j] = i*DIM + j;
       Identity[i][j] = i == j;
+    }
 
   printf("Calculate the scratchpad addresses of all our matrices\n");
   printf("  Note: The scratchpad is \"row-addressed\", where each address contains one matrix row\n");
@@ -0,0 +1,135 @@
+// See LICENSE for license details.
+
+// Issues two dependent matmuls with tiled_matmul_auto_async, checks which
+// buffers are reported as still in use while they run, and computes the gold
+// results on the CPU in the meantime.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define MAT_DIM_I 100
+#define MAT_DIM_K 90
+#define MAT_DIM_J 80
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t A[MAT_DIM_I][MAT_DIM_K] row_align(1);
+    static elem_t B1[MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static elem_t B2[MAT_DIM_J][MAT_DIM_J] row_align(1);
+    static elem_t C1[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t C2[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t gold1[MAT_DIM_I][MAT_DIM_J];
+    static elem_t gold2[MAT_DIM_I][MAT_DIM_J];
+    static elem_t unrelated[DIM];
+
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t k = 0; k < MAT_DIM_K; k++)
+        A[i][k] = (rand() % 3) - 1;
+
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        B1[k][j] = (rand() % 3) - 1;
+
+    for (size_t k = 0; k < MAT_DIM_J; k++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        B2[k][j] = (rand() % 3) - 1;
+
+    printf("Starting async matmuls\n");
+    uint64_t start = read_cycles();
+
+    // C1 = A * B1
+    const gemmini_handle_t h1 = tiled_matmul_auto_async(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+            (elem_t*)A, (elem_t*)B1, NULL, (elem_t*)C1,
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            RELU, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            false, false,
+            WS);
+
+    if (gemmini_is_done(h1)) {
+      printf("The first matmul was finished before it was waited on\n");
+      exit(1);
+    }
+
+    // C1 can't be read yet, and A can't be written to, but A can still be read
+    if (gemmini_buffer_handle(C1, sizeof(C1), false) != h1 ||
+        gemmini_buffer_handle(A, sizeof(A), true) != h1 ||
+        !gemmini_is_done(gemmini_buffer_handle(A, sizeof(A), false)) ||
+        !gemmini_is_done(gemmini_buffer_handle(unrelated, sizeof(unrelated), true))) {
+      printf("The first matmul's buffers are tracked incorrectly\n");
+      exit(1);
+    }
+
+    // C2 = C1 * B2, which has to wait for C1 first
+    const gemmini_handle_t h2 = tiled_matmul_auto_async(MAT_DIM_I, MAT_DIM_J, MAT_DIM_J,
+            (elem_t*)C1, (elem_t*)B2, NULL, (elem_t*)C2,
+            MAT_DIM_J, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            false, false,
+            WS);
+
+    if (!gemmini_is_done(h1) || gemmini_is_done(h2)) {
+      printf("The second matmul didn't wait for the first one\n");
+      exit(1);
+    }
+
+    uint64_t issued = read_cycles();
+
+    // Compute the gold results on the CPU while Gemmini works on C2
+    tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+            (elem_t*)A, (elem_t*)B1, NULL, (elem_t*)gold1,
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            RELU, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            false, false,
+            CPU);
+
+    tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_J,
+            (elem_t*)gold1, (elem_t*)B2, NULL, (elem_t*)gold2,
+            MAT_DIM_J, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            false, false,
+            CPU);
+
+    gemmini_wait(h2);
+
+    uint64_t end = read_cycles();
+    printf("Cycles taken to issue: %llu\n", issued-start);
+    printf("Cycles taken: %llu\n", end-start);
+
+    if (!gemmini_is_done(h2) ||
+        !gemmini_is_done(gemmini_buffer_handle(C2, sizeof(C2), true))) {
+      printf("The second matmul wasn't finished after waiting for it\n");
+      exit(1);
+    }
+
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        if (C1[i][j] != gold1[i][j] || C2[i][j] != gold2[i][j]) {
+          printf("C1[%u][%u] or C2[%u][%u] is different from the CPU's\n", i, j, i, j);
+          exit(1);
+        }
+
+    exit(0);
+}
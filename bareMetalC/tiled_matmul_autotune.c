@@ -0,0 +1,110 @@
+// See LICENSE for license details.
+
+// Autotunes the tiling factors of a few matmuls, checks that each of them
+// still gives the right answer both while it is being tuned and afterwards,
+// and prints the tuned tilings as a header which can be passed back in with
+// -DGEMMINI_TUNED_TILINGS.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+
+#define GEMMINI_AUTOTUNE
+
+#include "include/gemmini_testutils.h"
+
+// The largest number of elements in any of the matrices below
+#define MAX_ELEMS (256 * 256)
+
+// {dim_I, dim_J, dim_K}
+static const size_t shapes[][3] = {
+  {256, 256, 256},
+  {64, 256, 100},
+  {200, 16, 256},
+};
+
+#define N_SHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+static elem_t A[MAX_ELEMS] row_align(1);
+static elem_t B[MAX_ELEMS] row_align(1);
+static acc_t D[MAX_ELEMS] row_align_acc(1);
+static elem_t C[MAX_ELEMS] row_align(1);
+static elem_t gold[MAX_ELEMS] row_align(1);
+
+static void check(size_t dim_I, size_t dim_J, size_t dim_K, const char * when) {
+  for (size_t i = 0; i < dim_I * dim_J; i++)
+    if (C[i] != gold[i]) {
+      printf("%llux%llux%llu is incorrect %s\n", (unsigned long long)dim_I,
+          (unsigned long long)dim_J, (unsigned long long)dim_K, when);
+      exit(1);
+    }
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    for (size_t i = 0; i < MAX_ELEMS; i++) {
+      A[i] = (rand() % 3) - 1;
+      B[i] = (rand() % 3) - 1;
+      D[i] = (rand() % 3) - 1;
+    }
+
+    for (size_t s = 0; s < N_SHAPES; s++) {
+      const size_t dim_I = shapes[s][0], dim_J = shapes[s][1], dim_K = shapes[s][2];
+
+      tiled_matmul_auto(dim_I, dim_J, dim_K,
+              A, B, D, gold,
+              dim_K, dim_J, dim_J, dim_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+              false, false,
+              false, false,
+              CPU);
+
+      // The first run tunes the tiling factors, and the second one uses them
+      for (int run = 0; run < 2; run++) {
+        for (size_t i = 0; i < dim_I * dim_J; i++)
+          C[i] = 0;
+
+        uint64_t start = read_cycles();
+
+        tiled_matmul_auto(dim_I, dim_J, dim_K,
+                A, B, D, C,
+                dim_K, dim_J, dim_J, dim_J,
+                MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+                NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+                false, false,
+                false, false,
+                WS);
+
+        uint64_t end = read_cycles();
+        printf("%llux%llux%llu: Cycles taken %s: %llu\n",
+            (unsigned long long)dim_I, (unsigned long long)dim_J, (unsigned long long)dim_K,
+            run == 0 ? "while tuning" : "after tuning", end-start);
+
+        check(dim_I, dim_J, dim_K, run == 0 ? "while tuning" : "after tuning");
+      }
+    }
+
+    if (tiled_matmul_autotuned_n != N_SHAPES) {
+      printf("Expected %d tuned matmuls, but found %d\n", (int)N_SHAPES,
+          (int)tiled_matmul_autotuned_n);
+      exit(1);
+    }
+
+    gemmini_autotune_dump(NULL);
+
+    exit(0);
+}
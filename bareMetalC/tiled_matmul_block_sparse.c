@@ -0,0 +1,128 @@
+// See LICENSE for license details.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define NO_BIAS 0
+#define REPEATING_BIAS 0
+
+// Percentage of DIM x DIM blocks of A which have nonzeros in them
+#define BLOCK_DENSITY_PERCENT 10
+
+#define MAT_DIM_I 250
+#define MAT_DIM_K 300
+#define MAT_DIM_J 70
+
+void full_printMatrix(elem_t m[MAT_DIM_I][MAT_DIM_J]) {
+  for (size_t i = 0; i < MAT_DIM_I; ++i) {
+    for (size_t j = 0; j < MAT_DIM_J; ++j)
+#ifndef ELEM_T_IS_FLOAT
+      printf("%d ", m[i][j]);
+#else
+      printf("%x ", elem_t_to_elem_t_bits(m[i][j]));
+#endif
+    printf("\n");
+  }
+}
+
+int full_is_equal(elem_t x[MAT_DIM_I][MAT_DIM_J], elem_t y[MAT_DIM_I][MAT_DIM_J]) {
+  for (size_t i = 0; i < MAT_DIM_I; ++i)
+    for (size_t j = 0; j < MAT_DIM_J; ++j)
+      if (x[i][j] != y[i][j])
+        return 0;
+  return 1;
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t full_A[MAT_DIM_I][MAT_DIM_K] row_align(1);
+    static elem_t full_B[MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static elem_t full_C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static acc_t full_D[MAT_DIM_I][MAT_DIM_J] row_align_acc(1);
+    static elem_t gold[MAT_DIM_I][MAT_DIM_J];
+
+    static uint8_t A_occupancy[BLOCK_OCCUPANCY_BYTES(MAT_DIM_I, MAT_DIM_K)];
+
+    // printf("Init A\n");
+    for (size_t i0 = 0; i0 < MAT_DIM_I; i0 += DIM) {
+      for (size_t k0 = 0; k0 < MAT_DIM_K; k0 += DIM) {
+        // Leave the bottom rows of A empty, so that some tiles of C only get
+        // the bias
+        const bool occupied = i0 < MAT_DIM_I / 2 &&
+          (rand() % 100) < BLOCK_DENSITY_PERCENT;
+
+        for (size_t i = i0; i < i0 + DIM && i < MAT_DIM_I; i++)
+          for (size_t k = k0; k < k0 + DIM && k < MAT_DIM_K; k++)
+            full_A[i][k] = occupied ? (rand() % 5) - 2 : 0;
+      }
+    }
+
+    // printf("Init B\n");
+    for (size_t k = 0; k < MAT_DIM_K; ++k) {
+      for (size_t j = 0; j < MAT_DIM_J; ++j) {
+        full_B[k][j] = (rand() % 5) - 2;
+      }
+    }
+
+    // printf("Init D\n");
+    for (size_t i = 0; i < MAT_DIM_I; ++i) {
+      for (size_t j = 0; j < MAT_DIM_J; ++j) {
+        full_D[i][j] = NO_BIAS ? 0 : (rand() % 5) - 2;
+      }
+    }
+
+    block_occupancy(MAT_DIM_I, MAT_DIM_K, (elem_t*)full_A, MAT_DIM_K, A_occupancy);
+
+    printf("Starting CPU matmul\n");
+    tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+            (elem_t*)full_A, (elem_t*)full_B, NO_BIAS ? NULL : &full_D[0][0], (elem_t*)gold,
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            RELU, ACC_SCALE_IDENTITY, 0, REPEATING_BIAS,
+            false, false,
+            false, false,
+            CPU);
+
+    printf("Starting gemmini matmul\n");
+    unsigned long start = read_cycles();
+
+    tiled_matmul_block_sparse_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+            (elem_t*)full_A, (elem_t*)full_B, NO_BIAS ? NULL : &full_D[0][0], (elem_t*)full_C,
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            RELU, ACC_SCALE_IDENTITY, 0, REPEATING_BIAS,
+            false, false,
+            false, false,
+            A_occupancy, NULL,
+            WS);
+
+    unsigned long end = read_cycles();
+    printf("Cycles taken: %u\n", end-start);
+
+    if (!full_is_equal(full_C, gold)) {
+      printf("C:\n");
+      full_printMatrix(full_C);
+      printf("Gold:\n");
+      full_printMatrix(gold);
+      printf("\n");
+
+      exit(1);
+    }
+
+  exit(0);
+}
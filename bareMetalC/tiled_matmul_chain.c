@@ -0,0 +1,126 @@
+// See LICENSE for license details.
+
+// Runs a chain of MLP-like layers with tiled_matmul_chain, which keeps the
+// activations between layers on-chip where it can, and checks the final
+// output against the CPU. The layers are sized so that the chain has to
+// continue on-chip, spill to DRAM, fall back to tiled_matmul_auto, and reload
+// from DRAM along the way.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define BATCH 64
+#define N_LAYERS 5
+
+static const size_t dims[N_LAYERS + 1] = {200, 300, 130, 1000, 100, 10};
+
+#define MAX_FEATURES 1000
+
+static elem_t input[BATCH * MAX_FEATURES] row_align(1);
+static elem_t weights[N_LAYERS][MAX_FEATURES * MAX_FEATURES / 3] row_align(1);
+static acc_t biases[N_LAYERS][MAX_FEATURES] row_align_acc(1);
+static elem_t outputs[N_LAYERS][BATCH * MAX_FEATURES] row_align(1);
+static elem_t gold[2][BATCH * MAX_FEATURES] row_align(1);
+
+// Keeps most weights at zero, so that the activations stay small enough to be
+// exact in every elem_t
+static elem_t rand_weight() {
+  const int r = rand() % 16;
+  return r == 0 ? 1 : (r == 1 ? -1 : 0);
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    for (size_t i = 0; i < BATCH * dims[0]; i++)
+      input[i] = (rand() % 5) - 2;
+
+    for (size_t l = 0; l < N_LAYERS; l++) {
+      for (size_t i = 0; i < dims[l] * dims[l+1]; i++)
+        weights[l][i] = rand_weight();
+      for (size_t j = 0; j < dims[l+1]; j++)
+        biases[l][j] = (rand() % 5) - 2;
+    }
+
+    const elem_t * B[N_LAYERS];
+    elem_t * C[N_LAYERS];
+    int acts[N_LAYERS];
+    acc_scale_t scales[N_LAYERS];
+
+    for (int with_bias = 0; with_bias <= 1; with_bias++) {
+      const acc_t * D[N_LAYERS];
+
+      for (size_t l = 0; l < N_LAYERS; l++) {
+        B[l] = weights[l];
+        C[l] = outputs[l];
+        D[l] = with_bias ? biases[l] : NULL;
+        acts[l] = l == N_LAYERS-1 ? NO_ACTIVATION : RELU;
+        scales[l] = ACC_SCALE_IDENTITY;
+      }
+
+      // Check the chain against the CPU, layer by layer
+      const elem_t * A = input;
+      for (size_t l = 0; l < N_LAYERS; l++) {
+        tiled_matmul_auto(BATCH, dims[l+1], dims[l],
+                A, B[l], D[l], gold[l % 2],
+                dims[l], dims[l+1], dims[l+1], dims[l+1],
+                MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+                acts[l], scales[l], 0, D[l] != NULL,
+                false, false,
+                false, false,
+                CPU);
+        A = gold[l % 2];
+      }
+
+      uint64_t start = read_cycles();
+
+      tiled_matmul_chain(N_LAYERS, BATCH, dims,
+              input, B, D, C,
+              acts, scales, 0,
+              WS);
+
+      uint64_t end = read_cycles();
+      printf("Chained cycles taken: %llu\n", end-start);
+
+      for (size_t i = 0; i < BATCH * dims[N_LAYERS]; i++)
+        if (C[N_LAYERS-1][i] != A[i]) {
+          printf("Chained output is incorrect, with_bias: %d\n", with_bias);
+          exit(1);
+        }
+
+      // For comparison, run the same layers one at a time
+      start = read_cycles();
+
+      A = input;
+      for (size_t l = 0; l < N_LAYERS; l++) {
+        tiled_matmul_auto(BATCH, dims[l+1], dims[l],
+                A, B[l], D[l], C[l],
+                dims[l], dims[l+1], dims[l+1], dims[l+1],
+                MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+                acts[l], scales[l], 0, D[l] != NULL,
+                false, false,
+                false, false,
+                WS);
+        A = C[l];
+      }
+
+      end = read_cycles();
+      printf("Layer-by-layer cycles taken: %llu\n", end-start);
+    }
+
+    exit(0);
+}
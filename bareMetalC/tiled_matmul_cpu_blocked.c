@@ -0,0 +1,128 @@
+// See LICENSE for license details.
+
+// Checks that the blocked, multi-threaded matmul_cpu gives bit-identical
+// results to a naive triple loop, for matrices whose dimensions don't divide
+// evenly into its blocks, and for every way of splitting them up between
+// threads.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+
+#define MAX_THREADS 5
+
+// Make sure matmul_cpu has a set of buffers for every thread we test
+#define MATMUL_CPU_THREADS MAX_THREADS
+
+#include "include/gemmini_testutils.h"
+
+#define MAT_DIM_I 75
+#define MAT_DIM_K 301
+#define MAT_DIM_J 139
+
+void naive_matmul(elem_t A[MAT_DIM_I][MAT_DIM_K], elem_t B[MAT_DIM_K][MAT_DIM_J],
+        acc_t D[MAT_DIM_I][MAT_DIM_J], elem_t C[MAT_DIM_I][MAT_DIM_J],
+        bool no_bias, bool repeating_bias, int act, acc_scale_t scale) {
+  for (size_t i = 0; i < MAT_DIM_I; i++)
+    for (size_t j = 0; j < MAT_DIM_J; j++) {
+      acc_t result = no_bias ? 0 : D[repeating_bias ? 0 : i][j];
+      for (size_t k = 0; k < MAT_DIM_K; k++)
+        result += A[i][k] * B[k][j];
+      C[i][j] = scale_and_sat(result, act, scale, 0);
+    }
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    static elem_t A[MAT_DIM_I][MAT_DIM_K];
+    static elem_t B[MAT_DIM_K][MAT_DIM_J];
+    static acc_t D[MAT_DIM_I][MAT_DIM_J];
+    static elem_t C[MAT_DIM_I][MAT_DIM_J];
+    static elem_t gold[MAT_DIM_I][MAT_DIM_J];
+
+    // Use values which aren't exactly representable in a float, so that any
+    // change in the order in which products are summed changes the result
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t k = 0; k < MAT_DIM_K; k++)
+        A[i][k] = (rand() % 41 - 20) / 7.0;
+
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        B[k][j] = (rand() % 41 - 20) / 3.0;
+
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        D[i][j] = (rand() % 41 - 20) / 9.0;
+
+    for (int act = NO_ACTIVATION; act <= RELU; act++) {
+      for (int no_bias = 0; no_bias <= 1; no_bias++) {
+        for (int repeating_bias = 0; repeating_bias <= 1; repeating_bias++) {
+          const acc_scale_t scale = 0.3;
+
+          naive_matmul(A, B, D, gold, no_bias, repeating_bias, act, scale);
+
+          printf("act: %d, no_bias: %d, repeating_bias: %d\n", act, no_bias, repeating_bias);
+
+          uint64_t start = read_cycles();
+
+          tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+                  (elem_t*)A, (elem_t*)B, no_bias ? NULL : &D[0][0], (elem_t*)C,
+                  MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+                  MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+                  act, scale, 0, repeating_bias,
+                  false, false,
+                  false, false,
+                  CPU);
+
+          uint64_t end = read_cycles();
+          printf("Cycles taken: %llu\n", end-start);
+
+          for (size_t i = 0; i < MAT_DIM_I; i++)
+            for (size_t j = 0; j < MAT_DIM_J; j++)
+              if (C[i][j] != gold[i][j]) {
+                printf("C[%u][%u] is different from the naive matmul's\n", i, j);
+                exit(1);
+              }
+
+          // Split the matmul up between different numbers of threads, running
+          // each thread's share one after another
+          for (size_t threads = 2; threads <= MAX_THREADS; threads++) {
+            const struct matmul_cpu_args_t args = {
+              MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+              (elem_t*)A, (elem_t*)B, no_bias ? NULL : &D[0][0], (elem_t*)C,
+              MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              act, scale, 0, repeating_bias,
+            };
+
+            for (size_t i = 0; i < MAT_DIM_I; i++)
+              for (size_t j = 0; j < MAT_DIM_J; j++)
+                C[i][j] = 0;
+
+            for (size_t tid = 0; tid < threads; tid++)
+              matmul_cpu_thread(tid, threads, &args);
+
+            for (size_t i = 0; i < MAT_DIM_I; i++)
+              for (size_t j = 0; j < MAT_DIM_J; j++)
+                if (C[i][j] != gold[i][j]) {
+                  printf("C[%u][%u] is different from the naive matmul's, with %u threads\n", i, j, threads);
+                  exit(1);
+                }
+          }
+        }
+      }
+    }
+
+    exit(0);
+}
@@ -10,11 +10,22 @@
 #endif
 #include "include/gemmini_testutils.h"
 
-#define CHECK_RESULT 0
+#define CHECK_RESULT 1
 
 #define NO_BIAS 1
 #define FULL_BIAS_WIDTH 1
 
+// Skip the all-zero DIM x DIM blocks of the adjacency matrix
+#define BLOCK_SPARSE 1
+
+// The graph's nodes are in communities of COMMUNITY_SIZE consecutive nodes,
+// like a graph whose nodes have been reordered to cluster its communities.
+// Each node has about INTRA_DEGREE edges within its community, and
+// INTER_PERCENT percent of the nodes also have an edge to any other node
+#define COMMUNITY_SIZE 40
+#define INTRA_DEGREE 6
+#define INTER_PERCENT 10
+
 #if FULL_BIAS_WIDTH
 typedef acc_t ACC_T;
 #else
@@ -41,13 +52,42 @@ void print_tile(elem_t* in, int tile_dim) {
   }
 }
 
+// Fills A with the symmetric adjacency matrix of the graph, with self-loops.
+// The blocks along the diagonal are dense, and most of the others are empty
+void gcn_adjacency(elem_t A[MAT_DIM_I][MAT_DIM_K]) {
+  for (size_t i = 0; i < MAT_DIM_I; i++)
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      A[i][k] = 0;
+
+  for (size_t i = 0; i < MAT_DIM_I && i < MAT_DIM_K; i++) {
+    A[i][i] = 1;
+
+    const size_t community = i / COMMUNITY_SIZE * COMMUNITY_SIZE;
+    for (int e = 0; e < INTRA_DEGREE / 2; e++) {
+      const size_t k = community + rand() % COMMUNITY_SIZE;
+      if (k < MAT_DIM_I && k < MAT_DIM_K)
+        A[i][k] = A[k][i] = 1;
+    }
+
+    if (rand() % 100 < INTER_PERCENT) {
+      const size_t k = rand() % MAT_DIM_K;
+      if (k < MAT_DIM_I)
+        A[i][k] = A[k][i] = 1;
+    }
+  }
+}
+
+// Skips the zeros of A, which are most of it
 void full_matmul(elem_t A[MAT_DIM_I][MAT_DIM_K], elem_t B[MAT_DIM_K][MAT_DIM_J], ACC_T D[MAT_DIM_I][MAT_DIM_J], full_t C_full[MAT_DIM_I][MAT_DIM_J]) {
-  for (size_t r = 0; r < MAT_DIM_I; r++)
-    for (size_t c = 0; c < MAT_DIM_J; c++) {
+  for (size_t r = 0; r < MAT_DIM_I; r++) {
+    for (size_t c = 0; c < MAT_DIM_J; c++)
       C_full[r][c] = D[r][c];
-      for (size_t k = 0; k < MAT_DIM_K; k++)
-        C_full[r][c] += A[r][k]*B[k][c];
-    }
+
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      if (A[r][k] != 0)
+        for (size_t c = 0; c < MAT_DIM_J; c++)
+          C_full[r][c] += A[r][k]*B[k][c];
+  }
 }
 
 void full_printMatrix(elem_t m[MAT_DIM_I][MAT_DIM_J]) {
@@ -100,18 +140,15 @@ int main() {
     static full_t gold_full[MAT_DIM_I][MAT_DIM_J];
     static elem_t gold[MAT_DIM_I][MAT_DIM_J];
 
+    // printf("Init A\n");
+    gcn_adjacency(full_A);
+
 #if CHECK_RESULT == 1
 #ifdef FAST
 #define RAND 1
 #else
 #define RAND rand()
 #endif
-    // printf("Init A\n");
-    for (size_t i = 0; i < MAT_DIM_I; ++i) {
-      for (size_t j = 0; j < MAT_DIM_K; ++j) {
-        full_A[i][j] = RAND % 2;
-      }
-    }
 
     // printf("Init B\n");
     for (size_t i = 0; i < MAT_DIM_K; ++i) {
@@ -129,24 +166,42 @@ int main() {
 
     printf("Starting slow CPU matmul\n");
     unsigned long cpu_start = read_cycles();
-#ifdef FAST
-    for (size_t i = 0; i < MAT_DIM_I; ++i) {
-      for (size_t j = 0; j < MAT_DIM_J; ++j) {
-        gold_full[i][j] = MAT_DIM_K + (NO_BIAS ? 0 : (RAND % 2));
-      }
-    }
-
-#else
     full_matmul(full_A, full_B, full_D, gold_full);
-#endif
     unsigned long cpu_end = read_cycles();
     printf("Cycles taken: %u\n", cpu_end-cpu_start);
     full_matscale(gold_full, gold, ACC_SCALE_IDENTITY);
 #endif
 
+#if BLOCK_SPARSE == 1
+    // The adjacency matrix doesn't change between layers, so this only needs
+    // to be computed once
+    static uint8_t A_occupancy[BLOCK_OCCUPANCY_BYTES(MAT_DIM_I, MAT_DIM_K)];
+    block_occupancy(MAT_DIM_I, MAT_DIM_K, (elem_t*)full_A, MAT_DIM_K, A_occupancy);
+
+    const size_t A_block_rows = BLOCK_OCCUPANCY_BLOCKS(MAT_DIM_I);
+    const size_t A_block_cols = BLOCK_OCCUPANCY_BLOCKS(MAT_DIM_K);
+    size_t A_nonempty = 0;
+    for (size_t r = 0; r < A_block_rows; r++)
+      for (size_t c = 0; c < A_block_cols; c++)
+        A_nonempty += block_occupancy_any(A_occupancy, A_block_cols, r, c, 1, 1);
+    printf("%u of the %u blocks of A are nonempty\n", (unsigned)A_nonempty,
+        (unsigned)(A_block_rows * A_block_cols));
+#endif
+
     printf("Starting gemmini matmul\n");
     unsigned long start = read_cycles();
 
+#if BLOCK_SPARSE == 1
+    tiled_matmul_block_sparse_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+            (elem_t*)full_A, (elem_t*)full_B, NO_BIAS ? NULL : &full_D[0][0], (elem_t*)full_C,
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            false, !FULL_BIAS_WIDTH,
+            A_occupancy, NULL,
+            WS);
+#else
     tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
             (elem_t*)full_A, (elem_t*)full_B, NO_BIAS ? NULL : &full_D[0][0], (elem_t*)full_C,
             MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
@@ -155,6 +210,7 @@ int main() {
             false, false,
             false, !FULL_BIAS_WIDTH,
             WS);
+#endif
 
     unsigned long end = read_cycles();
     printf("Cycles taken: %u\n", end-start);
@@ -0,0 +1,163 @@
+// See LICENSE for license details.
+
+// Runs a two-layer GCN with gcn_layer, which keeps X * W on-chip when it can,
+// and checks each layer against the CPU. A third layer, with as many input
+// features as Cora, is too big to be fused, and checks the fallback path. The
+// cycles of each fused layer are printed next to the cycles of running it as
+// a separate dense matmul and sparse matmul.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+#include "include/gemmini_nn.h"
+
+#define N_NODES 1000
+#define DENSITY_PERCENT 1
+
+#define N_LAYERS 3
+
+static const size_t in_dims[N_LAYERS] = {200, 40, 1433};
+static const size_t out_dims[N_LAYERS] = {40, 7, 16};
+static const bool with_bias[N_LAYERS] = {true, false, true};
+static const int acts[N_LAYERS] = {RELU, NO_ACTIVATION, RELU};
+
+#define MAX_IN_FEATURES 1433
+#define MAX_OUT_FEATURES 40
+#define MAX_NNZ (N_NODES * N_NODES * DENSITY_PERCENT * 2 / 100 + N_NODES)
+#define N_TILES (N_NODES / DIM + (N_NODES % DIM != 0))
+
+static elem_t X[N_NODES * MAX_IN_FEATURES] row_align(1);
+static elem_t W[MAX_IN_FEATURES * MAX_OUT_FEATURES] row_align(1);
+static acc_t bias[MAX_OUT_FEATURES] row_align_acc(1);
+static elem_t XW[N_NODES * MAX_OUT_FEATURES] row_align(1);
+static elem_t out[N_NODES * MAX_OUT_FEATURES] row_align(1);
+static elem_t gold_XW[N_NODES * MAX_OUT_FEATURES] row_align(1);
+static elem_t gold[N_NODES * MAX_OUT_FEATURES] row_align(1);
+
+static elem_t A_data[MAX_NNZ];
+static ind_t A_coo[MAX_NNZ][2];
+static ind_t A_tile_offsets[N_TILES * N_TILES + 1];
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    // A_hat is a random graph's adjacency matrix, with self-loops. Its
+    // nonzeros are generated in tile order, which is the order gcn_layer needs
+    size_t A_nnz = 0;
+    for (size_t i0 = 0; i0 < N_NODES; i0 += DIM)
+      for (size_t k0 = 0; k0 < N_NODES; k0 += DIM)
+        for (size_t i = i0; i < i0 + DIM && i < N_NODES; i++)
+          for (size_t k = k0; k < k0 + DIM && k < N_NODES; k++)
+            if (i == k || (A_nnz < MAX_NNZ && rand() % 100 < DENSITY_PERCENT)) {
+              A_data[A_nnz] = 1 + (rand() % 2);
+              A_coo[A_nnz][0] = i;
+              A_coo[A_nnz][1] = k;
+              A_nnz++;
+            }
+
+    spmm_coo_tile_offsets(N_NODES, N_NODES, (ind_t*)A_coo, A_nnz, A_tile_offsets);
+
+    printf("A_hat has %u nonzeros\n", (unsigned)A_nnz);
+
+    for (size_t l = 0; l < N_LAYERS; l++) {
+      const size_t F_in = in_dims[l], F_out = out_dims[l];
+
+      // Keep most features and weights at zero, so that the outputs stay
+      // small enough to be exact in every elem_t
+      for (size_t i = 0; i < N_NODES * F_in; i++)
+        X[i] = rand() % 8 == 0 ? (rand() % 5) - 2 : 0;
+      for (size_t i = 0; i < F_in * F_out; i++)
+        W[i] = rand() % 8 == 0 ? (rand() % 3) - 1 : 0;
+      for (size_t j = 0; j < F_out; j++)
+        bias[j] = (rand() % 5) - 2;
+
+      const acc_t * D = with_bias[l] ? bias : NULL;
+
+      char layer_name[16];
+      sprintf(layer_name, "gcn_%u", (unsigned)l);
+
+      const struct GcnCycles cycles = gcn_layer(N_NODES, F_in, F_out,
+          A_data, (ind_t*)A_coo, A_nnz, A_tile_offsets,
+          (elem_t (*)[F_in])X, (elem_t (*)[F_out])W, D, XW,
+          (elem_t (*)[F_out])out, acts[l], 0,
+          WS, layer_name);
+
+      printf("%s: %u x %u -> %u, %s\n", layer_name, (unsigned)N_NODES,
+          (unsigned)F_in, (unsigned)F_out, cycles.fused ? "fused" : "not fused");
+      printf("  transform cycles: %llu\n", cycles.transform);
+      printf("  aggregate cycles: %llu\n", cycles.aggregate);
+
+      tiled_matmul_auto(N_NODES, F_out, F_in,
+          X, W, NULL, gold_XW,
+          F_in, F_out, F_out, F_out,
+          MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+          NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+          false, false,
+          false, false,
+          CPU);
+
+      tiled_spmm_auto(N_NODES, F_out, N_NODES,
+          A_data, (ind_t*)A_coo, A_nnz, A_tile_offsets,
+          gold_XW, D, gold,
+          F_out, 0, F_out,
+          MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+          acts[l], ACC_SCALE_IDENTITY, 0, true,
+          false, false,
+          CPU);
+
+      elem_t (* const out_mat)[F_out] = (elem_t (*)[F_out])out;
+      elem_t (* const gold_mat)[F_out] = (elem_t (*)[F_out])gold;
+      if (!MAT_IS_EQUAL(N_NODES, F_out, out_mat, gold_mat)) {
+        printf("%s: output doesn't match the CPU's\n", layer_name);
+        exit(1);
+      }
+
+      if (l < 2 && !cycles.fused) {
+        printf("%s should have been fused\n", layer_name);
+        exit(1);
+      } else if (l == 2 && cycles.fused) {
+        printf("%s should be too big to be fused\n", layer_name);
+        exit(1);
+      }
+
+      if (cycles.fused) {
+        uint64_t start = read_cycles();
+
+        tiled_matmul_auto(N_NODES, F_out, F_in,
+            X, W, NULL, XW,
+            F_in, F_out, F_out, F_out,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            false, false,
+            WS);
+
+        tiled_spmm_auto(N_NODES, F_out, N_NODES,
+            A_data, (ind_t*)A_coo, A_nnz, A_tile_offsets,
+            XW, D, out,
+            F_out, 0, F_out,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            acts[l], ACC_SCALE_IDENTITY, 0, true,
+            false, false,
+            WS);
+
+        uint64_t end = read_cycles();
+        printf("  unfused cycles: %llu\n", end - start);
+      }
+    }
+
+    exit(0);
+}
@@ -0,0 +1,167 @@
+// See LICENSE for license details.
+
+// Builds a graph whose edges are local in some hidden node order, and then
+// shuffles its nodes, like a real graph's arbitrary node IDs would. Reordering
+// the nodes with RCM, or by degree, should cluster the adjacency matrix's
+// nonzeros into fewer DIM x DIM blocks. Each order's GCN layer output is
+// un-permuted and checked against the original order's, and the block
+// occupancy and cycles of each are printed.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+#include "include/gemmini_nn.h"
+#include "include/sparse_util.h"
+
+#define N_NODES 1000
+#define IN_FEATURES 64
+#define OUT_FEATURES 16
+
+// Each node is connected to the nodes within this distance of it in the
+// hidden order, with a probability of one in EDGE_ODDS
+#define RADIUS 24
+#define EDGE_ODDS 4
+
+#define MAX_NNZ (N_NODES * (2*RADIUS + 1))
+
+static elem_t X[N_NODES][IN_FEATURES] row_align(1);
+static elem_t X_perm[N_NODES][IN_FEATURES] row_align(1);
+static elem_t W[IN_FEATURES][OUT_FEATURES] row_align(1);
+static acc_t bias[OUT_FEATURES] row_align_acc(1);
+static elem_t out[N_NODES][OUT_FEATURES] row_align(1);
+static elem_t out_perm[N_NODES][OUT_FEATURES] row_align(1);
+static elem_t gold[N_NODES][OUT_FEATURES] row_align(1);
+
+static ind_t hidden[N_NODES];
+static ind_t perm[N_NODES];
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    // hidden[h] is the node ID of the h-th node in the hidden order
+    for (size_t i = 0; i < N_NODES; i++)
+      hidden[i] = i;
+    for (size_t i = N_NODES; i > 1; i--) {
+      const size_t j = rand() % i;
+      const ind_t tmp = hidden[i-1];
+      hidden[i-1] = hidden[j];
+      hidden[j] = tmp;
+    }
+
+    struct sparse_coo_t A;
+    A.rows = A.cols = N_NODES;
+    A.nnz = 0;
+    A.data = (elem_t *)sparse_alloc(MAX_NNZ * sizeof(elem_t));
+    A.coo = (ind_t *)sparse_alloc(2 * MAX_NNZ * sizeof(ind_t));
+
+    for (size_t h = 0; h < N_NODES; h++) {
+      // Self-loop
+      A.data[A.nnz] = 2;
+      A.coo[2*A.nnz] = A.coo[2*A.nnz+1] = hidden[h];
+      A.nnz++;
+
+      for (size_t d = 1; d <= RADIUS && h + d < N_NODES; d++) {
+        if (rand() % EDGE_ODDS != 0)
+          continue;
+
+        const ind_t a = hidden[h], b = hidden[h + d];
+        A.data[A.nnz] = 1;
+        A.coo[2*A.nnz] = a;
+        A.coo[2*A.nnz+1] = b;
+        A.nnz++;
+        A.data[A.nnz] = 1;
+        A.coo[2*A.nnz] = b;
+        A.coo[2*A.nnz+1] = a;
+        A.nnz++;
+      }
+    }
+
+    sparse_coo_sort(&A, false);
+
+    for (size_t i = 0; i < N_NODES; i++)
+      for (size_t j = 0; j < IN_FEATURES; j++)
+        X[i][j] = (rand() % 5) - 2;
+    for (size_t i = 0; i < IN_FEATURES; i++)
+      for (size_t j = 0; j < OUT_FEATURES; j++)
+        W[i][j] = rand() % 4 == 0 ? (rand() % 3) - 1 : 0;
+    for (size_t j = 0; j < OUT_FEATURES; j++)
+      bias[j] = (rand() % 5) - 2;
+
+    sparse_print_block_stats("original", sparse_coo_block_stats(&A));
+
+    // gcn_layer needs A in tile order, but the reorderings below need it in
+    // row-major order, so it is only tile-ordered for this layer
+    sparse_coo_sort(&A, true);
+    ind_t * A_offsets = sparse_coo_tile_offsets(&A);
+
+    struct GcnCycles cycles = gcn_layer(N_NODES, IN_FEATURES, OUT_FEATURES,
+        A.data, A.coo, A.nnz, A_offsets, X, W, bias, NULL, gold,
+        RELU, 0, WS, "original");
+    printf("original: %llu cycles\n", cycles.transform + cycles.aggregate);
+
+    free(A_offsets);
+    sparse_coo_sort(&A, false);
+
+    for (int use_rcm = 1; use_rcm >= 0; use_rcm--) {
+      const char * const name = use_rcm ? "rcm" : "degree";
+
+      struct sparse_coo_t A_perm;
+      A_perm.rows = A_perm.cols = N_NODES;
+      A_perm.nnz = A.nnz;
+      A_perm.data = (elem_t *)sparse_alloc(A.nnz * sizeof(elem_t));
+      A_perm.coo = (ind_t *)sparse_alloc(2 * A.nnz * sizeof(ind_t));
+      memcpy(A_perm.data, A.data, A.nnz * sizeof(elem_t));
+      memcpy(A_perm.coo, A.coo, 2 * A.nnz * sizeof(ind_t));
+
+      if (use_rcm)
+        sparse_rcm_permutation(&A, perm);
+      else
+        sparse_degree_permutation(&A, perm);
+
+      sparse_coo_permute(&A_perm, perm);
+      sparse_coo_sort(&A_perm, true);
+      ind_t * const A_perm_offsets = sparse_coo_tile_offsets(&A_perm);
+      sparse_permute_rows(N_NODES, IN_FEATURES, &X[0][0], &X_perm[0][0], IN_FEATURES, perm);
+
+      const struct sparse_block_stats_t stats = sparse_coo_block_stats(&A_perm);
+      sparse_print_block_stats(name, stats);
+
+      cycles = gcn_layer(N_NODES, IN_FEATURES, OUT_FEATURES,
+          A_perm.data, A_perm.coo, A_perm.nnz, A_perm_offsets,
+          X_perm, W, bias, NULL, out_perm,
+          RELU, 0, WS, (char *)name);
+      printf("%s: %llu cycles\n", name, cycles.transform + cycles.aggregate);
+
+      sparse_unpermute_rows(N_NODES, OUT_FEATURES, &out_perm[0][0], &out[0][0], OUT_FEATURES, perm);
+
+      if (!MAT_IS_EQUAL(N_NODES, OUT_FEATURES, out, gold)) {
+        printf("%s: output doesn't match the original order's\n", name);
+        exit(1);
+      }
+
+      if (use_rcm && stats.blocks * 2 > sparse_coo_block_stats(&A).blocks) {
+        printf("rcm: expected at least half of the blocks to become empty\n");
+        exit(1);
+      }
+
+      free(A_perm_offsets);
+      sparse_free_coo(&A_perm);
+    }
+
+    sparse_free_coo(&A);
+
+    exit(0);
+}
@@ -0,0 +1,133 @@
+// See LICENSE for license details.
+
+// Checks the elem_t bit helpers, and that matmuls whose sums don't fit in an
+// elem_t are accumulated at acc_t precision, and only rounded to an elem_t at
+// the end, the same way on Gemmini and on the CPU. This is meant for the
+// 16-bit float elem_ts (see GEMMINI_BF16 and GEMMINI_FP16), but works for any
+// float elem_t
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define MAT_DIM_I 64
+#define MAT_DIM_K 96
+#define MAT_DIM_J 80
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+#ifndef ELEM_T_IS_FLOAT
+    printf("This test needs a float elem_t\n");
+    exit(0);
+#else
+    gemmini_flush(0);
+
+    printf("elem_t is %u bytes, with %u exponent and %u significand bits\n",
+        sizeof(elem_t), ELEM_T_EXP_BITS, ELEM_T_SIG_BITS);
+
+    if (sizeof(elem_t) * 8 != ELEM_T_EXP_BITS + ELEM_T_SIG_BITS ||
+        MAX_BLOCK_LEN != MAX_BYTES / (DIM * sizeof(elem_t))) {
+      printf("The elem_t parameters are inconsistent\n");
+      exit(1);
+    }
+
+    const elem_t inf = elem_t_max * 2;
+    const elem_t nan = inf - inf;
+
+    if (elem_t_isnan(inf) || elem_t_isnan(-inf) || elem_t_isnan(elem_t_max) ||
+        elem_t_isnan(0) || !elem_t_isnan(nan)) {
+      printf("elem_t_isnan is wrong\n");
+      exit(1);
+    }
+
+    const elem_t one = 1;
+    const elem_t_bits one_bits = ((elem_t_bits)1 << (ELEM_T_EXP_BITS - 1)) - 1;
+    if (elem_t_to_elem_t_bits(one) != one_bits << (ELEM_T_SIG_BITS - 1) ||
+        elem_t_bits_to_elem_t(elem_t_to_elem_t_bits(elem_t_max)) != elem_t_max) {
+      printf("The elem_t bit conversions are wrong\n");
+      exit(1);
+    }
+
+    // Every element of A and B is 1 + 2^-k for some k which an elem_t can
+    // still represent, so their products, and their sums, need more bits of
+    // significand than an elem_t has
+    static elem_t A[MAT_DIM_I][MAT_DIM_K] row_align(1);
+    static elem_t B[MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static elem_t C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t gold[MAT_DIM_I][MAT_DIM_J];
+    static float gold_abs[MAT_DIM_I][MAT_DIM_J];
+
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t k = 0; k < MAT_DIM_K; k++)
+        A[i][k] = (1 + ldexp(1, -(1 + rand() % (ELEM_T_SIG_BITS - 1)))) * (rand() % 2 ? 1 : -1);
+
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        B[k][j] = 1 + ldexp(1, -(1 + rand() % (ELEM_T_SIG_BITS - 1)));
+
+    // Products are exact in an acc_t, and the sums are rounded in order
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t j = 0; j < MAT_DIM_J; j++) {
+        acc_t sum = 0;
+        gold_abs[i][j] = 0;
+        for (size_t k = 0; k < MAT_DIM_K; k++) {
+          sum += (acc_t)A[i][k] * (acc_t)B[k][j];
+          gold_abs[i][j] += fabsf((acc_t)A[i][k] * (acc_t)B[k][j]);
+        }
+        gold[i][j] = sum;
+      }
+
+    const enum tiled_matmul_type_t types[] = {CPU, WS, OS};
+    const char * type_names[] = {"CPU", "WS", "OS"};
+
+    for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+      printf("%s matmul\n", type_names[t]);
+
+      uint64_t start = read_cycles();
+
+      tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+          (elem_t*)A, (elem_t*)B, NULL, (elem_t*)C,
+          MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+          MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+          NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+          false, false,
+          false, false,
+          types[t]);
+
+      uint64_t end = read_cycles();
+      printf("Cycles taken: %llu\n", end-start);
+
+      // Gemmini sums up each DIM x DIM block of its matmuls before it adds
+      // it to the accumulator, so only the CPU is compared exactly. Gemmini's
+      // sums are rounded differently, by up to an acc_t ulp of the partial
+      // sum for each add, which can then round to a neighbouring elem_t
+      for (size_t i = 0; i < MAT_DIM_I; i++)
+        for (size_t j = 0; j < MAT_DIM_J; j++) {
+          const float err = fabsf((float)C[i][j] - (float)gold[i][j]);
+          const float tolerance = ldexpf(fabsf((float)gold[i][j]), 1 - ELEM_T_SIG_BITS) +
+            MAT_DIM_K * ldexpf(gold_abs[i][j], 1 - ACC_T_SIG_BITS);
+          if (types[t] == CPU ? err != 0 : err > tolerance) {
+            printf("C[%u][%u] is %f rather than %f\n", i, j,
+                (float)C[i][j], (float)gold[i][j]);
+            exit(1);
+          }
+        }
+    }
+
+    printf("Correct\n");
+    exit(0);
+#endif
+}
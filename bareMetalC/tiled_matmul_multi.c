@@ -0,0 +1,111 @@
+// See LICENSE for license details.
+
+// Splits a matmul whose dimensions don't divide evenly into tiles between
+// several harts, each with its own Gemmini, and checks that every way of
+// partitioning it gives the same result as running it on one Gemmini. Run it
+// on spike with -p4, or build it with -DGEMMINI_HOST_EMU to run each hart as a
+// pthread against its own emulated Gemmini.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+
+#define GEMMINI_CPU_HARTS 4
+
+#include "include/gemmini_testutils.h"
+
+#define MAT_DIM_I 300
+#define MAT_DIM_K 200
+#define MAT_DIM_J 250
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t A[MAT_DIM_I][MAT_DIM_K] row_align(1);
+    static elem_t B[MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static acc_t D[MAT_DIM_I][MAT_DIM_J] row_align_acc(1);
+    static elem_t C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t gold[MAT_DIM_I][MAT_DIM_J] row_align(1);
+
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t k = 0; k < MAT_DIM_K; k++)
+        A[i][k] = (rand() % 3) - 1;
+
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        B[k][j] = (rand() % 3) - 1;
+
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        D[i][j] = (rand() % 5) - 2;
+
+    for (int no_bias = 0; no_bias <= 1; no_bias++) {
+      printf("no_bias: %d\n", no_bias);
+
+      printf("Starting single-hart matmul\n");
+      uint64_t start = read_cycles();
+
+      tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+              (elem_t*)A, (elem_t*)B, no_bias ? NULL : &D[0][0], (elem_t*)gold,
+              MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              RELU, ACC_SCALE_IDENTITY, 0, false,
+              false, false,
+              false, false,
+              WS);
+
+      uint64_t end = read_cycles();
+      printf("Cycles taken: %llu\n", end-start);
+
+      for (int partition = STATIC_PARTITION; partition <= WORK_STEALING; partition++) {
+        printf("Starting %s multi-hart matmul\n",
+            partition == STATIC_PARTITION ? "statically partitioned" : "work-stealing");
+
+        for (size_t i = 0; i < MAT_DIM_I; i++)
+          for (size_t j = 0; j < MAT_DIM_J; j++)
+            C[i][j] = -1;
+
+        struct tiled_matmul_multi_stats_t stats;
+
+        tiled_matmul_multi(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+                (elem_t*)A, (elem_t*)B, no_bias ? NULL : &D[0][0], (elem_t*)C,
+                MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+                MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+                RELU, ACC_SCALE_IDENTITY, 0, false,
+                false, false,
+                false, false,
+                WS, partition, &stats);
+
+        // The harts run side by side, so the matmul takes as long as the
+        // slowest of them
+        uint64_t slowest = 0;
+        for (size_t h = 0; h < stats.harts; h++) {
+          printf("  Hart %u: %u blocks, %llu cycles\n", h, stats.blocks[h], stats.cycles[h]);
+          if (stats.cycles[h] > slowest)
+            slowest = stats.cycles[h];
+        }
+        printf("Cycles taken: %llu\n", slowest);
+
+        for (size_t i = 0; i < MAT_DIM_I; i++)
+          for (size_t j = 0; j < MAT_DIM_J; j++)
+            if (C[i][j] != gold[i][j]) {
+              printf("C[%u][%u] is different from the single-hart matmul's\n", i, j);
+              exit(1);
+            }
+      }
+    }
+
+    exit(0);
+}
@@ -0,0 +1,155 @@
+// See LICENSE for license details.
+
+// Packs B into the order in which tiled_matmul_auto's tiles use it, and
+// checks matmuls with the packed B against the CPU, including one with fewer
+// rows of A than B was packed for.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define MAT_DIM_I 200
+#define MAT_DIM_K 300
+#define MAT_DIM_J 250
+
+#define SMALL_DIM_I 30
+
+// The tiles along the edges of a packed B are padded out to whole tiles, so
+// leave some room for that. main() checks that it's enough
+#define PACKED_ELEMS ((MAT_DIM_K + 2*DIM) * (MAT_DIM_J + 2*DIM))
+
+static void randomize(size_t len, elem_t * A, acc_t * D) {
+  for (size_t i = 0; i < len; i++) {
+    if (A != NULL)
+      A[i] = (rand() % 3) - 1;
+    if (D != NULL)
+      D[i] = (rand() % 5) - 2;
+  }
+}
+
+static void full_printMatrix(size_t dim_I, elem_t m[MAT_DIM_I][MAT_DIM_J]) {
+  for (size_t i = 0; i < dim_I; ++i) {
+    for (size_t j = 0; j < MAT_DIM_J; ++j)
+      printf("%d ", (int)m[i][j]);
+    printf("\n");
+  }
+}
+
+static void check(size_t dim_I, elem_t C[MAT_DIM_I][MAT_DIM_J], elem_t gold[MAT_DIM_I][MAT_DIM_J]) {
+  if (!MAT_IS_EQUAL(dim_I, MAT_DIM_J, C, gold)) {
+    printf("C:\n");
+    full_printMatrix(dim_I, C);
+    printf("Gold:\n");
+    full_printMatrix(dim_I, gold);
+    exit(1);
+  }
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t A[MAT_DIM_I][MAT_DIM_K] row_align(1);
+    static elem_t B[MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static acc_t D[MAT_DIM_J] row_align_acc(1);
+    static elem_t C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t gold[MAT_DIM_I][MAT_DIM_J];
+    static elem_t packed[PACKED_ELEMS] row_align(1);
+
+    randomize(MAT_DIM_I * MAT_DIM_K, &A[0][0], NULL);
+    randomize(MAT_DIM_K * MAT_DIM_J, &B[0][0], NULL);
+    randomize(MAT_DIM_J, NULL, D);
+
+    tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+            (elem_t*)A, (elem_t*)B, D, (elem_t*)gold,
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            RELU, ACC_SCALE_IDENTITY, 0, true,
+            false, false,
+            false, false,
+            CPU);
+
+    const size_t packed_bytes = tiled_matmul_pack_B(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        (elem_t*)B, MAT_DIM_J, NULL, WS, NULL);
+
+    if (packed_bytes > sizeof(packed)) {
+      printf("Packed B needs %u bytes\n", packed_bytes);
+      exit(1);
+    }
+
+    struct tiled_matmul_packed_B_t packed_B;
+    tiled_matmul_pack_B(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        (elem_t*)B, MAT_DIM_J, packed, WS, &packed_B);
+
+    printf("Packed B into %u bytes, with %ux%ux%u tiles\n", packed_bytes,
+        packed_B.tile_I, packed_B.tile_J, packed_B.tile_K);
+
+    printf("Unpacked matmul\n");
+    uint64_t start = read_cycles();
+
+    tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+            (elem_t*)A, (elem_t*)B, D, (elem_t*)C,
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            RELU, ACC_SCALE_IDENTITY, 0, true,
+            false, false,
+            false, false,
+            WS);
+
+    uint64_t end = read_cycles();
+    printf("Cycles taken: %llu\n", end-start);
+
+    check(MAT_DIM_I, C, gold);
+
+    const enum tiled_matmul_type_t types[] = {WS, OS, CPU};
+    const char * type_names[] = {"WS", "OS", "CPU"};
+
+    for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+      printf("Packed %s matmul\n", type_names[t]);
+
+      for (size_t i = 0; i < MAT_DIM_I; i++)
+        for (size_t j = 0; j < MAT_DIM_J; j++)
+          C[i][j] = 0;
+
+      start = read_cycles();
+
+      tiled_matmul_packed_auto(MAT_DIM_I,
+              (elem_t*)A, &packed_B, D, (elem_t*)C,
+              MAT_DIM_K, MAT_DIM_J, MAT_DIM_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              RELU, ACC_SCALE_IDENTITY, 0, true,
+              false, false,
+              types[t]);
+
+      end = read_cycles();
+      printf("Cycles taken: %llu\n", end-start);
+
+      check(MAT_DIM_I, C, gold);
+    }
+
+    printf("Packed matmul with %u rows\n", SMALL_DIM_I);
+
+    tiled_matmul_packed_auto(SMALL_DIM_I,
+            (elem_t*)A, &packed_B, D, (elem_t*)C,
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            RELU, ACC_SCALE_IDENTITY, 0, true,
+            false, false,
+            WS);
+
+    check(SMALL_DIM_I, C, gold);
+
+    exit(0);
+}
@@ -0,0 +1,172 @@
+// See LICENSE for license details.
+
+// Calibrates a float fully-connected layer for int8 inference, with a scale
+// per output channel, and checks that Gemmini's requantized outputs match the
+// CPU's, and that they're close to the float layer's outputs
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+#include "include/quant_util.h"
+
+#define MAT_DIM_I 60
+#define MAT_DIM_K 200
+#define MAT_DIM_J 300
+
+#define N_SAMPLES 4
+
+// Small enough that C is split into chunks both ways
+#define REQUANT_ELEMS (32 * 128)
+
+static float rand_float(float range) {
+  return ((rand() % 201) - 100) * range / 100;
+}
+
+static void full_printMatrix(elem_t m[MAT_DIM_I][MAT_DIM_J]) {
+  for (size_t i = 0; i < MAT_DIM_I; ++i) {
+    for (size_t j = 0; j < MAT_DIM_J; ++j)
+      printf("%d ", (int)m[i][j]);
+    printf("\n");
+  }
+}
+
+static void check(elem_t C[MAT_DIM_I][MAT_DIM_J], elem_t gold[MAT_DIM_I][MAT_DIM_J]) {
+  if (!MAT_IS_EQUAL(MAT_DIM_I, MAT_DIM_J, C, gold)) {
+    printf("C:\n");
+    full_printMatrix(C);
+    printf("Gold:\n");
+    full_printMatrix(gold);
+    exit(1);
+  }
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static float samples[N_SAMPLES][MAT_DIM_I][MAT_DIM_K];
+    static float W[MAT_DIM_K][MAT_DIM_J];
+    static float bias[MAT_DIM_J];
+
+    for (size_t s = 0; s < N_SAMPLES; s++)
+      for (size_t i = 0; i < MAT_DIM_I; i++)
+        for (size_t k = 0; k < MAT_DIM_K; k++)
+          samples[s][i][k] = rand_float(2);
+
+    // Give each output channel weights of a different magnitude, so that a
+    // single scale wouldn't fit them all
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        W[k][j] = rand_float(0.01 * (1 + j % 13));
+
+    for (size_t j = 0; j < MAT_DIM_J; j++)
+      bias[j] = rand_float(1);
+
+    static elem_t W_q[MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static acc_t bias_q[MAT_DIM_J] row_align_acc(1);
+    static float w_scales[MAT_DIM_J];
+    static acc_scale_t scales[MAT_DIM_J];
+    float in_scale, out_scale;
+
+    quant_calibrate_fc(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        N_SAMPLES, &samples[0][0][0], &W[0][0], bias,
+        &W_q[0][0], bias_q, w_scales, scales,
+        false, &in_scale, &out_scale, true);
+
+    printf("Input scale: %f, output scale: %f\n", in_scale, out_scale);
+
+    // Run the layer on the last sample
+    static elem_t A_q[MAT_DIM_I][MAT_DIM_K] row_align(1);
+    quant_tensor(MAT_DIM_I * MAT_DIM_K, &samples[N_SAMPLES-1][0][0], in_scale, &A_q[0][0]);
+
+    static elem_t C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t gold[MAT_DIM_I][MAT_DIM_J];
+    static acc_t requant[REQUANT_ELEMS] row_align_acc(1);
+
+    tiled_matmul_auto_per_channel(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        (elem_t*)A_q, (elem_t*)W_q, bias_q, (elem_t*)gold,
+        MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+        RELU, scales, 0, true,
+        NULL, 0,
+        CPU);
+
+    const enum tiled_matmul_type_t types[] = {WS, OS};
+    const char * type_names[] = {"WS", "OS"};
+
+    for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+      printf("Per-channel %s matmul\n", type_names[t]);
+
+      uint64_t start = read_cycles();
+
+      tiled_matmul_auto_per_channel(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+          (elem_t*)A_q, (elem_t*)W_q, bias_q, (elem_t*)C,
+          MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+          RELU, scales, 0, true,
+          requant, REQUANT_ELEMS,
+          types[t]);
+
+      uint64_t end = read_cycles();
+      printf("Cycles taken: %llu\n", end-start);
+
+      check(C, gold);
+    }
+
+    // The quantized layer should be within a few output steps of the float one
+    float max_err = 0;
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t j = 0; j < MAT_DIM_J; j++) {
+        float ref = bias[j];
+        for (size_t k = 0; k < MAT_DIM_K; k++)
+          ref += samples[N_SAMPLES-1][i][k] * W[k][j];
+        ref = ref < 0 ? 0 : ref;
+
+        float err = dequant_value(C[i][j], out_scale) - ref;
+        err = err < 0 ? -err : err;
+        if (err > max_err)
+          max_err = err;
+      }
+
+    printf("Largest error: %f output steps\n", max_err / out_scale);
+
+    if (max_err > 4 * out_scale) {
+      printf("Quantized outputs are too far from the float outputs\n");
+      exit(1);
+    }
+
+    // With the same scale for every channel, the mvout scaler is used instead
+    for (size_t j = 0; j < MAT_DIM_J; j++)
+      scales[j] = scales[0];
+
+    tiled_matmul_auto_per_channel(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        (elem_t*)A_q, (elem_t*)W_q, bias_q, (elem_t*)gold,
+        MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+        RELU, scales, 0, true,
+        NULL, 0,
+        CPU);
+
+    printf("Per-tensor WS matmul\n");
+
+    tiled_matmul_auto_per_channel(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        (elem_t*)A_q, (elem_t*)W_q, bias_q, (elem_t*)C,
+        MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+        RELU, scales, 0, true,
+        NULL, 0,
+        WS);
+
+    check(C, gold);
+
+    printf("Correct\n");
+    exit(0);
+}
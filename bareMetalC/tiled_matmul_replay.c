@@ -0,0 +1,131 @@
+// See LICENSE for license details.
+
+// Records the instructions which tiled_matmul_auto issues into a command
+// buffer, and then replays it on the buffers it was recorded with, and on a
+// different set of buffers.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+
+#define GEMMINI_COMMAND_BUFFERS
+
+#include "include/gemmini_testutils.h"
+
+#define MAT_DIM_I 120
+#define MAT_DIM_K 100
+#define MAT_DIM_J 90
+
+#define MAX_COMMANDS 4096
+
+enum {SLOT_A, SLOT_B, SLOT_D, SLOT_C, N_SLOTS};
+
+static void randomize(size_t rows, size_t cols, elem_t * A, acc_t * D) {
+  for (size_t i = 0; i < rows * cols; i++) {
+    if (A != NULL)
+      A[i] = (rand() % 3) - 1;
+    if (D != NULL)
+      D[i] = (rand() % 5) - 2;
+  }
+}
+
+static void full_printMatrix(elem_t m[MAT_DIM_I][MAT_DIM_J]) {
+  for (size_t i = 0; i < MAT_DIM_I; ++i) {
+    for (size_t j = 0; j < MAT_DIM_J; ++j)
+      printf("%d ", (int)m[i][j]);
+    printf("\n");
+  }
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t A[2][MAT_DIM_I][MAT_DIM_K] row_align(1);
+    static elem_t B[2][MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static acc_t D[2][MAT_DIM_I][MAT_DIM_J] row_align_acc(1);
+    static elem_t C[2][MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t gold[2][MAT_DIM_I][MAT_DIM_J];
+
+    for (int set = 0; set < 2; set++) {
+      randomize(MAT_DIM_I, MAT_DIM_K, &A[set][0][0], NULL);
+      randomize(MAT_DIM_K, MAT_DIM_J, &B[set][0][0], NULL);
+      randomize(MAT_DIM_I, MAT_DIM_J, NULL, &D[set][0][0]);
+
+      tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+              (elem_t*)A[set], (elem_t*)B[set], D[set], (elem_t*)gold[set],
+              MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              RELU, ACC_SCALE_IDENTITY, 0, false,
+              false, false,
+              false, false,
+              CPU);
+    }
+
+    static struct gemmini_command_t commands[MAX_COMMANDS];
+    struct gemmini_command_buffer_t cb;
+    gemmini_command_buffer_init(&cb, commands, MAX_COMMANDS);
+
+    const void * bases[2][N_SLOTS] = {
+      {A[0], B[0], D[0], C[0]},
+      {A[1], B[1], D[1], C[1]},
+    };
+    const size_t bytes[N_SLOTS] = {sizeof(A[0]), sizeof(B[0]), sizeof(D[0]), sizeof(C[0])};
+
+    printf("Recording matmul\n");
+    gemmini_record_begin(&cb, N_SLOTS, bases[0], bytes);
+
+    tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+            (elem_t*)A[0], (elem_t*)B[0], D[0], (elem_t*)C[0],
+            MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            RELU, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            false, false,
+            WS);
+
+    if (!gemmini_record_end()) {
+      printf("Command buffer overflowed\n");
+      exit(1);
+    }
+
+    printf("Recorded %u commands (%u bytes)\n", cb.len, cb.len * sizeof(struct gemmini_command_t));
+
+    // Recording shouldn't have issued anything
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        if (C[0][i][j] != 0) {
+          printf("C was written to while recording\n");
+          exit(1);
+        }
+
+    for (int set = 0; set < 2; set++) {
+      printf("Replaying on buffer set %d\n", set);
+
+      uint64_t start = read_cycles();
+      gemmini_replay(&cb, bases[set]);
+      uint64_t end = read_cycles();
+      printf("Cycles taken: %llu\n", end-start);
+
+      if (!MAT_IS_EQUAL(MAT_DIM_I, MAT_DIM_J, C[set], gold[set])) {
+        printf("C:\n");
+        full_printMatrix(C[set]);
+        printf("Gold:\n");
+        full_printMatrix(gold[set]);
+        exit(1);
+      }
+    }
+
+    exit(0);
+}
@@ -0,0 +1,117 @@
+// See LICENSE for license details.
+
+// Runs a sampled dense-dense matmul, like the one which computes the
+// attention scores of a graph attention layer, and checks it against the CPU.
+// Its cycles are printed next to those of computing the full dense matmul.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define MAT_DIM_I 300
+#define MAT_DIM_K 70
+#define MAT_DIM_J 500
+
+#define MAX_NNZ (MAT_DIM_I * MAT_DIM_J / 10)
+
+#define I_TILES (MAT_DIM_I / DIM + (MAT_DIM_I % DIM != 0))
+#define J_TILES (MAT_DIM_J / DIM + (MAT_DIM_J % DIM != 0))
+
+static elem_t A[MAT_DIM_I][MAT_DIM_K] row_align(1);
+static elem_t B[MAT_DIM_K][MAT_DIM_J] row_align(1);
+static elem_t dense_C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+
+static ind_t mask[MAX_NNZ][2];
+static ind_t mask_tile_offsets[I_TILES * J_TILES + 1];
+static elem_t out_values[MAX_NNZ];
+static elem_t gold[MAX_NNZ];
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t k = 0; k < MAT_DIM_K; k++)
+        A[i][k] = (rand() % 5) - 2;
+
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        B[k][j] = (rand() % 5) - 2;
+
+    // Leave some block rows of the mask empty, and put the rest of it around
+    // the diagonal, like a reordered graph's adjacency matrix. The nonzeros
+    // are generated in tile order, which is the order tiled_sddmm needs
+    size_t nnz = 0;
+    for (size_t i0 = 0; i0 < MAT_DIM_I; i0 += DIM)
+      for (size_t j0 = 0; j0 < MAT_DIM_J; j0 += DIM)
+        for (size_t i = i0; i < i0 + DIM && i < MAT_DIM_I; i++)
+          for (size_t j = j0; j < j0 + DIM && j < MAT_DIM_J; j++) {
+            const bool near_diagonal = j + 40 > i && j < i + 40;
+            if ((i / DIM) % 5 != 2 && near_diagonal && nnz < MAX_NNZ &&
+                rand() % 100 < 30) {
+              mask[nnz][0] = i;
+              mask[nnz][1] = j;
+              nnz++;
+            }
+          }
+
+    spmm_coo_tile_offsets(MAT_DIM_I, MAT_DIM_J, (ind_t*)mask, nnz, mask_tile_offsets);
+
+    printf("Mask has %u nonzeros\n", (unsigned)nnz);
+
+    const acc_scale_t scale = ACC_SCALE_IDENTITY;
+
+    printf("Starting CPU sddmm\n");
+    uint64_t start = read_cycles();
+    tiled_sddmm_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        (elem_t*)A, (elem_t*)B, (ind_t*)mask, nnz, mask_tile_offsets,
+        gold,
+        MAT_DIM_K, MAT_DIM_J,
+        NO_ACTIVATION, scale, CPU);
+    uint64_t end = read_cycles();
+    printf("Cycles taken: %llu\n", end-start);
+
+    printf("Starting gemmini sddmm\n");
+    start = read_cycles();
+    tiled_sddmm_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        (elem_t*)A, (elem_t*)B, (ind_t*)mask, nnz, mask_tile_offsets,
+        out_values,
+        MAT_DIM_K, MAT_DIM_J,
+        NO_ACTIVATION, scale, WS);
+    end = read_cycles();
+    printf("Cycles taken: %llu\n", end-start);
+
+    printf("Starting gemmini dense matmul\n");
+    start = read_cycles();
+    tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+        (elem_t*)A, (elem_t*)B, NULL, (elem_t*)dense_C,
+        MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+        MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+        NO_ACTIVATION, scale, 0, false,
+        false, false,
+        false, false,
+        WS);
+    end = read_cycles();
+    printf("Cycles taken: %llu\n", end-start);
+
+    for (size_t n = 0; n < nnz; n++) {
+      if (out_values[n] != gold[n] || out_values[n] != dense_C[mask[n][0]][mask[n][1]]) {
+        printf("Value %u, at (%u, %u), is wrong\n", (unsigned)n, (unsigned)mask[n][0], (unsigned)mask[n][1]);
+        exit(1);
+      }
+    }
+
+    exit(0);
+}
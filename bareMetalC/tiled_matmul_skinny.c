@@ -0,0 +1,89 @@
+// See LICENSE for license details.
+
+// Runs tiled_matmul_auto on tall, skinny matmuls, like the ones in GCN layers,
+// where the choice of tiling factors matters most for DRAM traffic, and checks
+// the results against the CPU. The chosen schedules are printed.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+
+#define GEMMINI_PRINT_TILING
+
+#include "include/gemmini_testutils.h"
+
+// The largest number of elements in any of the matrices below
+#define MAX_ELEMS (1000 * 300)
+
+// {dim_I, dim_J, dim_K}
+static const size_t shapes[][3] = {
+  {1000, 6, 300},
+  {1000, 16, 300},
+  {1000, 300, 6},
+  {64, 64, 300},
+  {1000, 64, 20},
+};
+
+#define N_SHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+static elem_t A[MAX_ELEMS] row_align(1);
+static elem_t B[MAX_ELEMS] row_align(1);
+static elem_t C[MAX_ELEMS] row_align(1);
+static elem_t gold[MAX_ELEMS] row_align(1);
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    for (size_t i = 0; i < MAX_ELEMS; i++) {
+      A[i] = (rand() % 3) - 1;
+      B[i] = (rand() % 3) - 1;
+    }
+
+    for (size_t s = 0; s < N_SHAPES; s++) {
+      const size_t dim_I = shapes[s][0], dim_J = shapes[s][1], dim_K = shapes[s][2];
+
+      tiled_matmul_auto(dim_I, dim_J, dim_K,
+              A, B, NULL, gold,
+              dim_K, dim_J, dim_J, dim_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+              false, false,
+              false, false,
+              CPU);
+
+      uint64_t start = read_cycles();
+
+      tiled_matmul_auto(dim_I, dim_J, dim_K,
+              A, B, NULL, C,
+              dim_K, dim_J, dim_J, dim_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+              false, false,
+              false, false,
+              WS);
+
+      uint64_t end = read_cycles();
+      printf("Cycles taken: %llu\n", end-start);
+
+      for (size_t i = 0; i < dim_I * dim_J; i++)
+        if (C[i] != gold[i]) {
+          printf("Gemmini's output is different from the CPU's for %llux%llux%llu\n",
+              (unsigned long long)dim_I, (unsigned long long)dim_J, (unsigned long long)dim_K);
+          exit(1);
+        }
+    }
+
+    exit(0);
+}
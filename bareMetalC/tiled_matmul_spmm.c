@@ -0,0 +1,177 @@
+// See LICENSE for license details.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define CHECK_RESULT 1
+
+#define DENSITY_PERCENT 1
+
+// A is a graph adjacency matrix, and B is a feature matrix, like in the GCN
+// benchmarks
+#define MAT_DIM_I 1000
+#define MAT_DIM_K 1000
+#define MAT_DIM_J 64
+
+#define MAX_NNZ (MAT_DIM_I * MAT_DIM_K * DENSITY_PERCENT * 2 / 100)
+
+#define I_TILES (MAT_DIM_I / DIM + (MAT_DIM_I % DIM != 0))
+#define K_TILES (MAT_DIM_K / DIM + (MAT_DIM_K % DIM != 0))
+
+void full_printMatrix(elem_t m[MAT_DIM_I][MAT_DIM_J]) {
+  for (size_t i = 0; i < MAT_DIM_I; ++i) {
+    for (size_t j = 0; j < MAT_DIM_J; ++j)
+#ifndef ELEM_T_IS_FLOAT
+      printf("%d ", m[i][j]);
+#else
+      printf("%x ", elem_t_to_elem_t_bits(m[i][j]));
+#endif
+    printf("\n");
+  }
+}
+
+int full_is_equal(elem_t x[MAT_DIM_I][MAT_DIM_J], elem_t y[MAT_DIM_I][MAT_DIM_J]) {
+  for (size_t i = 0; i < MAT_DIM_I; ++i)
+    for (size_t j = 0; j < MAT_DIM_J; ++j)
+      if (x[i][j] != y[i][j])
+        return 0;
+  return 1;
+}
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t full_A[MAT_DIM_I][MAT_DIM_K] row_align(1);
+    static elem_t full_B[MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static elem_t full_C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t dense_C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static acc_t full_D[MAT_DIM_I][MAT_DIM_J] row_align_acc(1);
+    static elem_t gold[MAT_DIM_I][MAT_DIM_J];
+
+    static elem_t A_data[MAX_NNZ];
+    static ind_t A_coo[MAX_NNZ][2];
+    static ind_t A_tile_offsets[I_TILES * K_TILES + 1];
+    size_t A_nnz = 0;
+
+    // printf("Init A\n");
+    for (size_t i = 0; i < MAT_DIM_I; ++i) {
+      for (size_t k = 0; k < MAT_DIM_K; ++k) {
+        full_A[i][k] = 0;
+        if (A_nnz < MAX_NNZ && (rand() % 100) < DENSITY_PERCENT) {
+          full_A[i][k] = 1 + (rand() % 2);
+          A_nnz++;
+        }
+      }
+    }
+
+    // The tiled kernels need A's nonzeros in tile order
+    A_nnz = 0;
+    for (size_t i0 = 0; i0 < MAT_DIM_I; i0 += DIM)
+      for (size_t k0 = 0; k0 < MAT_DIM_K; k0 += DIM)
+        for (size_t i = i0; i < i0 + DIM && i < MAT_DIM_I; ++i)
+          for (size_t k = k0; k < k0 + DIM && k < MAT_DIM_K; ++k)
+            if (full_A[i][k] != 0) {
+              A_data[A_nnz] = full_A[i][k];
+              A_coo[A_nnz][0] = i;
+              A_coo[A_nnz][1] = k;
+              A_nnz++;
+            }
+
+    spmm_coo_tile_offsets(MAT_DIM_I, MAT_DIM_K, (ind_t*)A_coo, A_nnz, A_tile_offsets);
+
+    // printf("Init B\n");
+    for (size_t k = 0; k < MAT_DIM_K; ++k) {
+      for (size_t j = 0; j < MAT_DIM_J; ++j) {
+        full_B[k][j] = (rand() % 5) - 2;
+      }
+    }
+
+    // printf("Init D\n");
+    for (size_t i = 0; i < MAT_DIM_I; ++i) {
+      for (size_t j = 0; j < MAT_DIM_J; ++j) {
+        full_D[i][j] = (rand() % 5) - 2;
+      }
+    }
+
+    printf("A has %u nonzeros\n", (unsigned)A_nnz);
+
+    // Without a bias, and then with one
+    for (int no_bias = 1; no_bias >= 0; no_bias--) {
+      printf("no_bias: %d\n", no_bias);
+
+#if CHECK_RESULT == 1
+      printf("Starting CPU spmm\n");
+      unsigned long cpu_start = read_cycles();
+      tiled_spmm_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+              A_data, (ind_t*)A_coo, A_nnz, A_tile_offsets,
+              (elem_t*)full_B, no_bias ? NULL : &full_D[0][0], (elem_t*)gold,
+              MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+              false, false,
+              CPU);
+      unsigned long cpu_end = read_cycles();
+      printf("Cycles taken: %u\n", cpu_end-cpu_start);
+#endif
+
+      printf("Starting gemmini dense matmul\n");
+      unsigned long dense_start = read_cycles();
+
+      tiled_matmul_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+              (elem_t*)full_A, (elem_t*)full_B, no_bias ? NULL : &full_D[0][0], (elem_t*)dense_C,
+              MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+              false, false,
+              false, false,
+              WS);
+
+      unsigned long dense_end = read_cycles();
+      printf("Cycles taken: %u\n", dense_end-dense_start);
+
+      printf("Starting gemmini sparse matmul\n");
+      unsigned long start = read_cycles();
+
+      tiled_spmm_auto(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+              A_data, (ind_t*)A_coo, A_nnz, A_tile_offsets,
+              (elem_t*)full_B, no_bias ? NULL : &full_D[0][0], (elem_t*)full_C,
+              MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+              false, false,
+              WS);
+
+      unsigned long end = read_cycles();
+      printf("Cycles taken: %u\n", end-start);
+
+#if CHECK_RESULT == 1
+      if (!full_is_equal(full_C, gold) || !full_is_equal(dense_C, gold)) {
+        printf("C:\n");
+        full_printMatrix(full_C);
+        printf("Dense C:\n");
+        full_printMatrix(dense_C);
+        printf("Gold:\n");
+        full_printMatrix(gold);
+        printf("\n");
+
+        exit(1);
+      }
+#endif
+    }
+
+  exit(0);
+}
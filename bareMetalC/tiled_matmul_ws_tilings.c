@@ -0,0 +1,125 @@
+// See LICENSE for license details.
+
+// Times tiled_matmul with a few hand-picked tiling factors, and with the ones
+// tiled_matmul_auto picks, so that they can be ranked against each other.
+// Build it with -DGEMMINI_HOST_EMU to rank them with the host emulator's
+// timing model instead of on hardware.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef BAREMETAL
+#include <sys/mman.h>
+#endif
+#include "include/gemmini_testutils.h"
+
+#define MAT_DIM_I 256
+#define MAT_DIM_K 256
+#define MAT_DIM_J 256
+
+// Tiling factors, in units of DIM. The first one, {0, 0, 0}, stands for
+// whatever tiled_matmul_auto picks
+static const size_t tilings[][3] = {
+  {0, 0, 0},
+  {1, 1, 1},
+  {2, 2, 2},
+  {4, 4, 4},
+  {8, 4, 4},
+  {4, 8, 8},
+  {8, 4, 8},
+  {4, 4, 16},
+  {2, 16, 4},
+  {16, 2, 4},
+};
+
+#define N_TILINGS (sizeof(tilings) / sizeof(tilings[0]))
+
+int main() {
+#ifndef BAREMETAL
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      perror("mlockall failed");
+      exit(1);
+    }
+#endif
+
+    gemmini_flush(0);
+
+    static elem_t full_A[MAT_DIM_I][MAT_DIM_K] row_align(1);
+    static elem_t full_B[MAT_DIM_K][MAT_DIM_J] row_align(1);
+    static elem_t full_C[MAT_DIM_I][MAT_DIM_J] row_align(1);
+    static elem_t gold[MAT_DIM_I][MAT_DIM_J] row_align(1);
+
+    for (size_t i = 0; i < MAT_DIM_I; i++)
+      for (size_t k = 0; k < MAT_DIM_K; k++)
+        full_A[i][k] = (rand() % 3) - 1;
+
+    for (size_t k = 0; k < MAT_DIM_K; k++)
+      for (size_t j = 0; j < MAT_DIM_J; j++)
+        full_B[k][j] = (rand() % 3) - 1;
+
+    const size_t total_macs = (size_t)MAT_DIM_I * MAT_DIM_J * MAT_DIM_K;
+    const size_t ideal_cycles = total_macs / (DIM * DIM);
+
+    size_t best_I = 0, best_J = 0, best_K = 0;
+    uint64_t best_cycles = 0;
+
+    for (size_t t = 0; t < N_TILINGS; t++) {
+      size_t tile_I = tilings[t][0], tile_J = tilings[t][1], tile_K = tilings[t][2];
+      if (t == 0) {
+        tiled_matmul_auto_tiling_factors(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K, true,
+            &tile_I, &tile_J, &tile_K);
+      }
+
+      printf("tile_I: %u, tile_J: %u, tile_K: %u%s\n", tile_I, tile_J, tile_K,
+          t == 0 ? " (auto)" : "");
+
+      uint64_t start = read_cycles();
+
+      tiled_matmul(MAT_DIM_I, MAT_DIM_J, MAT_DIM_K,
+              (elem_t*)full_A, (elem_t*)full_B, NULL, (elem_t*)full_C,
+              MAT_DIM_K, MAT_DIM_J, MAT_DIM_J, MAT_DIM_J,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+              tile_I, tile_J, tile_K,
+              false, false,
+              false, false,
+              WS);
+
+      uint64_t end = read_cycles();
+      printf("Cycles taken: %u\n", end-start);
+
+      const int utilization = 100 * ideal_cycles / (end-start);
+      printf("Utilization: %d%%\n", utilization);
+
+      if (t == 0) {
+        for (size_t i = 0; i < MAT_DIM_I; i++)
+          for (size_t j = 0; j < MAT_DIM_J; j++)
+            gold[i][j] = full_C[i][j];
+      } else {
+        for (size_t i = 0; i < MAT_DIM_I; i++)
+          for (size_t j = 0; j < MAT_DIM_J; j++)
+            if (full_C[i][j] != gold[i][j]) {
+              printf("Output of this tiling does not match the output of tiled_matmul_auto\n");
+              exit(1);
+            }
+      }
+
+      if (t == 0 || end - start < best_cycles) {
+        best_I = tile_I;
+        best_J = tile_J;
+        best_K = tile_K;
+        best_cycles = end - start;
+      }
+    }
+
+    printf("\nFastest tiling: tile_I: %u, tile_J: %u, tile_K: %u (%llu cycles)\n",
+        best_I, best_J, best_K, best_cycles);
+
+#ifdef GEMMINI_HOST_EMU
+    gemmini_emu_print_stats();
+#endif
+
+    exit(0);
+}
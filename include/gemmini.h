@@ -16,8 +16,28 @@
 
 #define GEMMINI_ASSERTIONS
 
+// GEMMINI_RVV opts the CPU fallback kernels (matmul_cpu, and so conv_cpu,
+// resadd_cpu, and pool and conv_dw in gemmini_nn.h) in to RISC-V vector
+// intrinsics, vectorizing across the J or channel dimension. They multiply and
+// add separately, in the same order as the scalar kernels, so the results are
+// bit-identical to them as long as the compiler doesn't contract the scalar
+// ones into FMAs either. The Makefile's GEMMINI_RVV=1 passes -ffp-contract=off
+// for that. Only the kernels which read float32 elem_ts are vectorized when
+// elem_ts are 16 bits wide
+#ifdef GEMMINI_RVV
+#if !defined(__riscv_vector) || !defined(ELEM_T_IS_FLOAT) || ACC_T_EXP_BITS + ACC_T_SIG_BITS != 32
+#error "GEMMINI_RVV needs the V extension, and float elem_ts and acc_ts"
+#endif
+#include <riscv_vector.h>
+#if ELEM_T_EXP_BITS + ELEM_T_SIG_BITS == 32
+#define GEMMINI_RVV_ELEMS
+#endif
+#endif
+
 // Accelerator interface
+#ifndef GEMMINI_HOST_EMU
 #include "rocc-software/src/xcustom.h"
+#endif
 
 #define k_CONFIG 0
 #define k_MVIN2 1
@@ -39,6 +59,9 @@
 
 #define k_MVIN_SP_CONFIG 18
 #define k_MVIN_SP_COO 19
+#define k_MVIN_SP_CONFIG_PTR 20
+#define k_MVIN_SP_CSR 21
+#define k_MVIN_SP_BCSR 22
 
 //============================================================================
 // gemmini-cisc opcodes
@@ -112,7 +135,8 @@ acc_t_bits acc_t_to_acc_t_bits(acc_t x) {
 bool elem_t_isnan(elem_t x) {
     elem_t_bits bits = elem_t_to_elem_t_bits(x);
     uint64_t exp = (bits >> (ELEM_T_SIG_BITS-1)) & (((uint64_t)1 << ELEM_T_EXP_BITS) - 1);
-    uint64_t sig = bits & (((uint64_t)1 << ELEM_T_SIG_BITS) - 1);
+    // The significand's leading one isn't stored
+    uint64_t sig = bits & (((uint64_t)1 << (ELEM_T_SIG_BITS-1)) - 1);
     bool is_nan_or_inf = exp == (((uint64_t)1 << ELEM_T_EXP_BITS) - 1);
     bool is_not_inf = sig != 0;
     return is_nan_or_inf && is_not_inf;
@@ -121,7 +145,7 @@ bool elem_t_isnan(elem_t x) {
 bool acc_t_isnan(acc_t x) {
     acc_t_bits bits = acc_t_to_acc_t_bits(x);
     uint64_t exp = (bits >> (ACC_T_SIG_BITS-1)) & (((uint64_t)1 << ACC_T_EXP_BITS) - 1);
-    uint64_t sig = bits & (((uint64_t)1 << ACC_T_SIG_BITS) - 1);
+    uint64_t sig = bits & (((uint64_t)1 << (ACC_T_SIG_BITS-1)) - 1);
     bool is_nan_or_inf = exp == (((uint64_t)1 << ACC_T_EXP_BITS) - 1);
     bool is_not_inf = sig != 0;
     return is_nan_or_inf && is_not_inf;
@@ -192,13 +216,159 @@ acc_scale_t_bits acc_scale_t_to_acc_scale_t_bits(acc_scale_t x) {
     return un.b;
 }
 
-#define ROCC_INSTRUCTION_RS1_RS2(x, rs1, rs2, funct) \
+#ifdef GEMMINI_HOST_EMU
+#include "include/gemmini_host_emu.h"
+
+#define GEMMINI_ROCC_ISSUE(x, rs1, rs2, funct) \
+  { gemmini_emu_rocc(funct, (uint64_t)(rs1), (uint64_t)(rs2)); }
+#else
+#define GEMMINI_ROCC_ISSUE(x, rs1, rs2, funct) \
   ROCC_INSTRUCTION_0_R_R(x, rs1, rs2, funct)
+#endif
+
+//============================================================================
+// Command buffers
+//
+// With GEMMINI_COMMAND_BUFFERS defined, the instructions which a call like
+// tiled_matmul_auto or tiled_conv_auto would issue can be recorded into a
+// command buffer instead, and then replayed as often as needed without
+// redoing any of the tiling arithmetic. Every DRAM address which an
+// instruction carries, and which falls within one of the buffers passed to
+// gemmini_record_begin, is recorded as an offset into that slot, so that the
+// command buffer can be replayed on different buffers of the same shape.
+//
+// Only Gemmini's instructions and fences are recorded, so calls which do any
+// of their work on the CPU, like CPU matmuls, or the software sparse mvins,
+// can't be replayed. The gemmini-cisc opcodes share their funct values with
+// the LOOP_WS ones, so they can't be recorded either.
+//============================================================================
+
+#ifdef GEMMINI_COMMAND_BUFFERS
+#ifndef GEMMINI_MAX_SLOTS
+#define GEMMINI_MAX_SLOTS 8
+#endif
+
+// A funct value which no instruction uses, for recording fences
+#define GEMMINI_FENCE_FUNCT 127
+
+struct gemmini_command_t {
+  uint64_t rs1, rs2;
+  uint8_t funct;
+
+  // Which slot rs1 and rs2 are offsets into, or -1 if they are recorded as is
+  int8_t rs1_slot, rs2_slot;
+};
+
+struct gemmini_command_buffer_t {
+  struct gemmini_command_t * commands;
+  size_t len, capacity;
+  bool overflowed;
+
+  size_t n_slots;
+  uintptr_t slot_start[GEMMINI_MAX_SLOTS];
+  uintptr_t slot_end[GEMMINI_MAX_SLOTS];
+};
+
+// The command buffer which is being recorded into, if any
+static struct gemmini_command_buffer_t * gemmini_recording = NULL;
+
+// Which of an instruction's operands are DRAM addresses: bit 0 for rs1, and
+// bit 1 for rs2
+static int gemmini_dram_operands(int funct) {
+  switch (funct) {
+    case k_MVIN:
+    case k_MVIN2:
+    case k_MVIN3:
+    case k_MVOUT:
+    case k_MVIN_SP_CONFIG_PTR:
+      return 1;
+    case k_LOOP_WS_CONFIG_ADDRS_AB:
+    case k_LOOP_WS_CONFIG_ADDRS_DC:
+    case k_MVIN_SP_CONFIG:
+      return 3;
+    default:
+      return 0;
+  }
+}
+
+static int8_t gemmini_find_slot(const struct gemmini_command_buffer_t * cb,
+        uint64_t addr) {
+  for (size_t s = 0; s < cb->n_slots; s++)
+    if (addr >= cb->slot_start[s] && addr < cb->slot_end[s])
+      return s;
+  return -1;
+}
+
+static void gemmini_record(int funct, uint64_t rs1, uint64_t rs2) {
+  struct gemmini_command_buffer_t * cb = gemmini_recording;
+
+  if (cb->len >= cb->capacity) {
+    cb->overflowed = true;
+    return;
+  }
+
+  struct gemmini_command_t * c = &cb->commands[cb->len++];
+  const int dram_operands = gemmini_dram_operands(funct);
+
+  c->funct = funct;
+  c->rs1_slot = dram_operands & 1 ? gemmini_find_slot(cb, rs1) : -1;
+  c->rs2_slot = dram_operands & 2 ? gemmini_find_slot(cb, rs2) : -1;
+  c->rs1 = c->rs1_slot >= 0 ? rs1 - cb->slot_start[c->rs1_slot] : rs1;
+  c->rs2 = c->rs2_slot >= 0 ? rs2 - cb->slot_start[c->rs2_slot] : rs2;
+}
+
+#define ROCC_INSTRUCTION_RS1_RS2(x, rs1, rs2, funct) \
+  { \
+    if (gemmini_recording != NULL) \
+      gemmini_record(funct, (uint64_t)(rs1), (uint64_t)(rs2)); \
+    else \
+      GEMMINI_ROCC_ISSUE(x, rs1, rs2, funct) \
+  }
+#else
+#define ROCC_INSTRUCTION_RS1_RS2(x, rs1, rs2, funct) \
+  GEMMINI_ROCC_ISSUE(x, rs1, rs2, funct)
+#endif
 
 #define gemmini_extended_mvin_sparse_coo(dram_addr_dat, dram_addr_ind, array_dim, spad_addr, start_col, cols, start_row, rows) \
   ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, dram_addr_dat, dram_addr_ind, k_MVIN_SP_CONFIG) \
   ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, ((uint64_t)(rows) << (ADDR_LEN + 16)) | ((uint64_t)(cols) << ADDR_LEN) | (spad_addr), ((uint64_t) (array_dim) << (32)) | ((uint64_t)(start_row) << (16)) | (uint64_t)(start_col), k_MVIN_SP_COO)
 
+// CSR matrices are described by their values, the column of each value, and
+// tile pointers, which are row pointers that are also split at every DIM
+// columns (see spmm_csr_tile_ptr). With tile_cols tile columns, the values of
+// row r in the tile column which starts at start_col are the ones from
+// tile_ptr[r*tile_cols + start_col/DIM] up to the next tile pointer, so each
+// row of a tile is found in O(1), and only the tile's own nonzeros are read.
+// start_col must be a multiple of DIM.
+//
+// Blocked-CSR matrices are CSR matrices of DIM x DIM blocks. dram_addr_dat
+// holds each stored block as DIM*DIM values in row-major order, and block_row
+// and block_col are in units of blocks. Their tile pointers are split at
+// every block column, so a block is stored if and only if its tile pointer is
+// less than the next one, and it's then found in O(1) too. Blocks which
+// aren't stored are moved in as zeros.
+//
+// These are expanded into regular mvins on the CPU, unless
+// GEMMINI_HW_SPARSE_MVIN is defined, for Gemmini configurations which
+// implement the CSR and blocked-CSR mvins themselves
+#ifdef GEMMINI_HW_SPARSE_MVIN
+#define gemmini_extended_mvin_sparse_csr(dram_addr_dat, dram_addr_ind, dram_addr_tile_ptr, tile_cols, spad_addr, start_col, cols, start_row, rows) \
+  ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, dram_addr_dat, dram_addr_ind, k_MVIN_SP_CONFIG) \
+  ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, dram_addr_tile_ptr, tile_cols, k_MVIN_SP_CONFIG_PTR) \
+  ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, ((uint64_t)(rows) << (ADDR_LEN + 16)) | ((uint64_t)(cols) << ADDR_LEN) | (spad_addr), ((uint64_t)(start_row) << (16)) | (uint64_t)(start_col), k_MVIN_SP_CSR)
+
+#define gemmini_extended_mvin_sparse_bcsr(dram_addr_dat, dram_addr_tile_ptr, tile_cols, spad_addr, block_col, cols, block_row, rows) \
+  ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, dram_addr_dat, 0, k_MVIN_SP_CONFIG) \
+  ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, dram_addr_tile_ptr, tile_cols, k_MVIN_SP_CONFIG_PTR) \
+  ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, ((uint64_t)(rows) << (ADDR_LEN + 16)) | ((uint64_t)(cols) << ADDR_LEN) | (spad_addr), ((uint64_t)(block_row) << (16)) | (uint64_t)(block_col), k_MVIN_SP_BCSR)
+#else
+#define gemmini_extended_mvin_sparse_csr(dram_addr_dat, dram_addr_ind, dram_addr_tile_ptr, tile_cols, spad_addr, start_col, cols, start_row, rows) \
+  mvin_sparse_csr_sw(dram_addr_dat, dram_addr_ind, dram_addr_tile_ptr, tile_cols, spad_addr, start_col, cols, start_row, rows);
+
+#define gemmini_extended_mvin_sparse_bcsr(dram_addr_dat, dram_addr_tile_ptr, tile_cols, spad_addr, block_col, cols, block_row, rows) \
+  mvin_sparse_bcsr_sw(dram_addr_dat, dram_addr_tile_ptr, tile_cols, spad_addr, block_col, cols, block_row, rows);
+#endif
+
 #define gemmini_extended_mvin(dram_addr, spad_addr, cols, rows) \
   ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, dram_addr, ((uint64_t)(rows) << (ADDR_LEN + 16)) | ((uint64_t)(cols) << ADDR_LEN) | (spad_addr), k_MVIN)
 
@@ -294,7 +464,99 @@ acc_scale_t_bits acc_scale_t_to_acc_scale_t_bits(acc_scale_t x) {
   ROCC_INSTRUCTION_RS1_RS2(XCUSTOM_ACC, skip, 0, k_FLUSH)
 
 // fence
-#define gemmini_fence() asm volatile("fence")
+#ifdef GEMMINI_HOST_EMU
+#define GEMMINI_FENCE() gemmini_emu_fence()
+#else
+#define GEMMINI_FENCE() asm volatile("fence")
+#endif
+
+#ifdef GEMMINI_COMMAND_BUFFERS
+#define gemmini_fence() \
+  do { \
+    if (gemmini_recording != NULL) \
+      gemmini_record(GEMMINI_FENCE_FUNCT, 0, 0); \
+    else \
+      GEMMINI_FENCE(); \
+  } while (0)
+#else
+#define gemmini_fence() GEMMINI_FENCE()
+#endif
+
+#ifdef GEMMINI_COMMAND_BUFFERS
+// Sets up an empty command buffer, which can hold up to capacity commands
+static void gemmini_command_buffer_init(struct gemmini_command_buffer_t * cb,
+        struct gemmini_command_t * commands, size_t capacity) {
+  cb->commands = commands;
+  cb->len = 0;
+  cb->capacity = capacity;
+  cb->overflowed = false;
+  cb->n_slots = 0;
+}
+
+// Starts recording instructions into cb, instead of issuing them. bases and
+// bytes describe the DRAM buffers which gemmini_replay can later replace
+static void gemmini_record_begin(struct gemmini_command_buffer_t * cb,
+        size_t n_slots, const void * const bases[], const size_t bytes[]) {
+#ifdef GEMMINI_ASSERTIONS
+  if (n_slots > GEMMINI_MAX_SLOTS) {
+    printf("Too many slots in command buffer (more than GEMMINI_MAX_SLOTS)\n");
+    exit(1);
+  }
+#endif
+
+  cb->len = 0;
+  cb->overflowed = false;
+  cb->n_slots = n_slots;
+
+  for (size_t s = 0; s < n_slots; s++) {
+    cb->slot_start[s] = (uintptr_t)bases[s];
+    cb->slot_end[s] = (uintptr_t)bases[s] + bytes[s];
+  }
+
+  gemmini_recording = cb;
+}
+
+// Stops recording. Returns false if cb ran out of space, in which case it
+// can't be replayed
+static bool gemmini_record_end() {
+  const bool ok = !gemmini_recording->overflowed;
+  gemmini_recording = NULL;
+  return ok;
+}
+
+// Every funct value needs its own case, because it's encoded in the
+// instruction itself
+#define GEMMINI_REPLAY_CASE(funct) \
+  case funct: GEMMINI_ROCC_ISSUE(XCUSTOM_ACC, rs1, rs2, funct) break;
+
+// Issues every instruction in cb, with the DRAM addresses in each slot
+// relocated to the matching buffer in bases
+static void gemmini_replay(const struct gemmini_command_buffer_t * cb,
+        const void * const bases[]) {
+
+  const struct gemmini_command_t * c = cb->commands;
+  const struct gemmini_command_t * const end = c + cb->len;
+
+  for (; c < end; c++) {
+    const uint64_t rs1 = c->rs1_slot >= 0 ? (uintptr_t)bases[c->rs1_slot] + c->rs1 : c->rs1;
+    const uint64_t rs2 = c->rs2_slot >= 0 ? (uintptr_t)bases[c->rs2_slot] + c->rs2 : c->rs2;
+
+    switch (c->funct) {
+      GEMMINI_REPLAY_CASE(0) GEMMINI_REPLAY_CASE(1) GEMMINI_REPLAY_CASE(2)
+      GEMMINI_REPLAY_CASE(3) GEMMINI_REPLAY_CASE(4) GEMMINI_REPLAY_CASE(5)
+      GEMMINI_REPLAY_CASE(6) GEMMINI_REPLAY_CASE(7) GEMMINI_REPLAY_CASE(8)
+      GEMMINI_REPLAY_CASE(9) GEMMINI_REPLAY_CASE(10) GEMMINI_REPLAY_CASE(11)
+      GEMMINI_REPLAY_CASE(12) GEMMINI_REPLAY_CASE(13) GEMMINI_REPLAY_CASE(14)
+      GEMMINI_REPLAY_CASE(15) GEMMINI_REPLAY_CASE(16) GEMMINI_REPLAY_CASE(17)
+      GEMMINI_REPLAY_CASE(18) GEMMINI_REPLAY_CASE(19) GEMMINI_REPLAY_CASE(20)
+      GEMMINI_REPLAY_CASE(21) GEMMINI_REPLAY_CASE(22)
+      case GEMMINI_FENCE_FUNCT: GEMMINI_FENCE(); break;
+    }
+  }
+}
+
+#undef GEMMINI_REPLAY_CASE
+#endif
 
 //============================================================================
 // gemmini-cisc opcodes
@@ -587,6 +849,114 @@ static void sp_tiled_matmul_ws(const elem_t * A, const elem_t * B,
     full_C, low_D, !no_bias || D == NULL);
 }
 
+// Block-occupancy bitmaps record which DIM x DIM blocks of a matrix have any
+// nonzero elements in them. Bit (r * block_cols + c) is set if the block at
+// block-row r and block-column c is occupied. They can be computed once for a
+// matrix, and then passed to every tiled_matmul_block_sparse call which uses
+// that matrix
+#define BLOCK_OCCUPANCY_BLOCKS(dim) ((dim) / DIM + ((dim) % DIM != 0))
+#define BLOCK_OCCUPANCY_BYTES(rows, cols) \
+  ((BLOCK_OCCUPANCY_BLOCKS(rows) * BLOCK_OCCUPANCY_BLOCKS(cols) + 7) / 8)
+
+static void block_occupancy(size_t rows, size_t cols,
+        const elem_t * M, size_t stride, uint8_t * bitmap) {
+
+  const size_t block_rows = BLOCK_OCCUPANCY_BLOCKS(rows);
+  const size_t block_cols = BLOCK_OCCUPANCY_BLOCKS(cols);
+
+  for (size_t b = 0; b < (block_rows * block_cols + 7) / 8; b++)
+    bitmap[b] = 0;
+
+  for (size_t r = 0; r < rows; r++)
+    for (size_t c = 0; c < cols; c++)
+      if (M[r * stride + c] != 0) {
+        const size_t bit = (r / DIM) * block_cols + c / DIM;
+        bitmap[bit / 8] |= 1 << (bit % 8);
+      }
+}
+
+// Returns true if any block in the block_r x block_c region starting at block
+// (r, c) is occupied
+static bool block_occupancy_any(const uint8_t * bitmap, size_t block_cols,
+        size_t r, size_t c, size_t block_r, size_t block_c) {
+
+  for (size_t br = r; br < r + block_r; br++)
+    for (size_t bc = c; bc < c + block_c; bc++) {
+      const size_t bit = br * block_cols + bc;
+      if (bitmap[bit / 8] & (1 << (bit % 8)))
+        return true;
+    }
+
+  return false;
+}
+
+// Writes the bias (or zeros, if there is no bias) to a tile of C which
+// receives no contributions from A * B. The bias goes through the accumulator
+// so that it is scaled and activated the same way as any other output
+static void sp_tiled_matmul_bias_only(const void * D, void * C,
+        size_t I, size_t J, size_t pad_I, size_t pad_J,
+        size_t D_row_stride, size_t C_row_stride,
+        bool full_C, bool low_D,
+        bool no_bias, bool repeating_bias,
+        scale_acc_t D_scale_factor) {
+
+  static acc_t zeros[DIM] = {0};
+
+  const uint32_t D_sp_addr_start = 1 << (ADDR_LEN-1);
+  const uint32_t C_sp_addr_start = (1 << (ADDR_LEN-1)) | (full_C << (ADDR_LEN-3));
+
+  const size_t sizeof_D = low_D ? sizeof(elem_t) : sizeof(acc_t);
+  const size_t sizeof_C = full_C ? sizeof(acc_t) : sizeof(elem_t);
+
+  if (no_bias) {
+    gemmini_extended3_config_ld(0, MVIN_SCALE_IDENTITY, false, 2);
+  }
+
+  for (size_t i = 0; i < I; i++) {
+    for (size_t j = 0; j < J; j++) {
+      const size_t bias_row = repeating_bias ? 0 : i;
+      const void * const D_dram_addr = no_bias ? (void *)zeros :
+        (int8_t *)D + (bias_row * D_row_stride + j)*DIM*sizeof_D;
+      void * const C_dram_addr = (int8_t*)C + (i*C_row_stride + j)*DIM*sizeof_C;
+
+      const size_t cols = DIM - (j == J - 1 ? pad_J : 0);
+      const size_t rows = DIM - (i == I - 1 ? pad_I : 0);
+
+      gemmini_extended_mvin3(D_dram_addr, D_sp_addr_start + (i*J + j)*DIM, cols, rows);
+      gemmini_extended_mvout(C_dram_addr, C_sp_addr_start + (i*J + j)*DIM, cols, rows);
+    }
+  }
+
+  if (no_bias) {
+    gemmini_extended3_config_ld(repeating_bias ? 0 : (D_row_stride * sizeof_D), D_scale_factor, low_D, 2);
+  }
+}
+
+// Matmuls which tiled_matmul_auto_async has issued, and which may not have
+// finished yet (see "Asynchronous matmuls" below)
+typedef uint64_t gemmini_handle_t;
+
+#ifndef GEMMINI_MAX_IN_FLIGHT
+#define GEMMINI_MAX_IN_FLIGHT 8
+#endif
+
+// A range of DRAM addresses which an unfinished matmul reads or writes
+struct gemmini_in_flight_buffer_t {
+  gemmini_handle_t handle;
+  uintptr_t start, end;
+  bool written;
+};
+
+// Each matmul has four buffers: A, B, D, and C
+static struct gemmini_in_flight_buffer_t gemmini_in_flight[4 * GEMMINI_MAX_IN_FLIGHT];
+static size_t gemmini_in_flight_n = 0;
+static gemmini_handle_t gemmini_last_issued = 0;
+static gemmini_handle_t gemmini_last_finished = 0;
+
+// While this is set, tiled_matmul_outer returns without waiting for Gemmini to
+// finish, and leaves the fence to gemmini_wait (see tiled_matmul_auto_async)
+static bool tiled_matmul_defer_fence = false;
+
 static void tiled_matmul_outer(size_t dim_I, size_t dim_J, size_t dim_K,
         const elem_t* A, const elem_t* B,
         const void * D, void * C,
@@ -596,7 +966,8 @@ static void tiled_matmul_outer(size_t dim_I, size_t dim_J, size_t dim_K,
         int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
         bool a_transpose, bool b_transpose,
         bool full_C, bool low_D,
-        int dataflow) {
+        const uint8_t * A_occupancy, const uint8_t * B_occupancy,
+        bool B_packed, int dataflow) {
 
   const size_t dim_I_padded = (dim_I / DIM + (dim_I % DIM != 0)) * DIM;
   const size_t dim_J_padded = (dim_J / DIM + (dim_J % DIM != 0)) * DIM;
@@ -647,36 +1018,84 @@ static void tiled_matmul_outer(size_t dim_I, size_t dim_J, size_t dim_K,
     inner = &sp_tiled_matmul_ws;
   }
 
+  const size_t A_block_cols = a_transpose ? dim_I_padded / DIM : dim_K_padded / DIM;
+  const size_t B_block_cols = b_transpose ? dim_K_padded / DIM : dim_J_padded / DIM;
+
   for (size_t i0 = 0; i0 < I0; i0++)
-    for (size_t j0 = 0; j0 < J0; j0++)
+    for (size_t j0 = 0; j0 < J0; j0++) {
+
+      const size_t I = i0 < I0-1 ? tile_I : last_I;
+      const size_t J = j0 < J0-1 ? tile_J : last_J;
+
+      // Find the k-slices which actually contribute to this tile of C, so we
+      // can skip the ones where the A tile or the B tile is entirely zero
+      bool k0_occupied[K0];
+      size_t first_k0 = K0, last_k0 = K0;
+
       for (size_t k0 = 0; k0 < K0; k0++) {
+        const size_t K = k0 < K0-1 ? tile_K : last_K;
 
-        const void * pre;
-        if (k0 != 0) {
-          pre = NULL;
-        } else {
-          size_t bias_row = repeating_bias ? 0 : i0*tile_I*DIM;
-          // pre = &(((acc_t*)D)[bias_row * stride_D + j0 * tile_J * DIM]);
-          pre = (int8_t*)D + (bias_row * stride_D + j0 * tile_J * DIM)*sizeof_D;
+        bool occupied = true;
+
+        if (A_occupancy != NULL) {
+          occupied = occupied && (a_transpose ?
+            block_occupancy_any(A_occupancy, A_block_cols, k0*tile_K, i0*tile_I, K, I) :
+            block_occupancy_any(A_occupancy, A_block_cols, i0*tile_I, k0*tile_K, I, K));
         }
 
-        void * out = k0 == K0-1 ? (int8_t*)C + (i0*tile_I*DIM*stride_C + j0*tile_J*DIM)*sizeof_C : NULL;
+        if (B_occupancy != NULL) {
+          occupied = occupied && (b_transpose ?
+            block_occupancy_any(B_occupancy, B_block_cols, j0*tile_J, k0*tile_K, J, K) :
+            block_occupancy_any(B_occupancy, B_block_cols, k0*tile_K, j0*tile_J, K, J));
+        }
 
-        const size_t I = i0 < I0-1 ? tile_I : last_I;
-        const size_t J = j0 < J0-1 ? tile_J : last_J;
-        const size_t K = k0 < K0-1 ? tile_K : last_K;
+        k0_occupied[k0] = occupied;
 
-        const size_t pad_I = i0 == I0-1 ? padding_I : 0;
-        const size_t pad_J = j0 == J0-1 ? padding_J : 0;
+        if (occupied) {
+          if (first_k0 == K0)
+            first_k0 = k0;
+          last_k0 = k0;
+        }
+      }
+
+      const size_t pad_I = i0 == I0-1 ? padding_I : 0;
+      const size_t pad_J = j0 == J0-1 ? padding_J : 0;
+
+      const size_t bias_row = repeating_bias ? 0 : i0*tile_I*DIM;
+      const void * bias = (int8_t*)D + (bias_row * stride_D + j0 * tile_J * DIM)*sizeof_D;
+
+      void * out = (int8_t*)C + (i0*tile_I*DIM*stride_C + j0*tile_J*DIM)*sizeof_C;
+
+      if (first_k0 == K0) {
+        if (C != NULL) {
+          sp_tiled_matmul_bias_only(bias, out,
+              I, J, pad_I, pad_J,
+              stride_D, stride_C,
+              full_C, low_D,
+              no_bias, repeating_bias,
+              D_scale_factor);
+        }
+        continue;
+      }
+
+      for (size_t k0 = first_k0; k0 <= last_k0; k0++) {
+        if (!k0_occupied[k0])
+          continue;
+
+        const void * pre = k0 == first_k0 ? bias : NULL;
+
+        const size_t K = k0 < K0-1 ? tile_K : last_K;
         const size_t pad_K = k0 == K0-1 ? padding_K : 0;
 
         const elem_t * a = a_transpose ? (A + k0*tile_K*DIM*stride_A + i0*tile_I*DIM)
           : (A + i0*tile_I*DIM*stride_A + k0*tile_K*DIM);
 
-        const elem_t * b = b_transpose ? (B + j0*tile_J*DIM*stride_B + k0*tile_K*DIM)
+        // Packed B matrices store each tile contiguously. See tiled_matmul_pack_B
+        const elem_t * b = B_packed ? (B + (k0*J0 + j0)*tile_K*tile_J*DIM*DIM)
+          : b_transpose ? (B + j0*tile_J*DIM*stride_B + k0*tile_K*DIM)
           : (B + k0*tile_K*DIM*stride_B + j0*tile_J*DIM);
 
-        (*inner)(a, b, pre, out,
+        (*inner)(a, b, pre, k0 == last_k0 && C != NULL ? out : NULL,
             A_scale_factor, B_scale_factor, D_scale_factor,
             I, J, K,
             pad_I, pad_J, pad_K,
@@ -685,8 +1104,18 @@ static void tiled_matmul_outer(size_t dim_I, size_t dim_J, size_t dim_K,
             full_C, low_D,
             no_bias, repeating_bias);
       }
+    }
 
-  gemmini_fence();
+  if (!tiled_matmul_defer_fence) {
+    gemmini_fence();
+
+    // The harts of tiled_matmul_multi run this at the same time, but it waits
+    // for every asynchronous matmul first, so none of them write to these
+    if (gemmini_last_finished != gemmini_last_issued) {
+      gemmini_last_finished = gemmini_last_issued;
+      gemmini_in_flight_n = 0;
+    }
+  }
 }
 
 static elem_t scale_and_sat(acc_t x, int act, acc_scale_t scale, size_t relu6_shift) {
@@ -706,145 +1135,443 @@ static elem_t scale_and_sat(acc_t x, int act, acc_scale_t scale, size_t relu6_sh
   return x;
 }
 
+#ifdef GEMMINI_RVV
+// Clips x to [lo, hi] like the scalar ternaries do. vfmin and vfmax would
+// turn a -0 into a +0 at a bound of 0, so this merges on compares instead
+static vfloat32m4_t clip_rvv(vfloat32m4_t x, float lo, float hi, size_t vl) {
+  const vbool8_t below = __riscv_vmflt_vf_f32m4_b8(x, lo, vl);
+  const vbool8_t above = __riscv_vmfgt_vf_f32m4_b8(x, hi, vl);
+  x = __riscv_vfmerge_vfm_f32m4(x, lo, below, vl);
+  return __riscv_vfmerge_vfm_f32m4(x, hi, above, vl);
+}
+#endif
+
 #ifdef HAS_MVIN_SCALE
 #define GEMMINI_SCALE(x, scale) MVIN_SCALE((x), (scale))
 #else
 #define GEMMINI_SCALE(x, scale) (x)
 #endif
 
-static void matmul_cpu(size_t DIM_I, size_t DIM_J, size_t DIM_K,
-        const elem_t* A, const elem_t* B, const acc_t * D,
-        elem_t* C,
-        size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
-        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
-        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias) {
+#ifdef HAS_MVIN_ACC_SCALE
+#define GEMMINI_ACC_SCALE(x, scale) MVIN_SCALE_ACC((x), (scale))
+#else
+#define GEMMINI_ACC_SCALE(x, scale) (x)
+#endif
 
-  const int no_bias = D == NULL;
-  if (DIM_I % 4 == 0 && DIM_J % 4 == 0) {
-    for (size_t i = 0; i < DIM_I; i += 4) {
-      for (size_t j = 0; j < DIM_J; j += 4) {
+// matmul_cpu is blocked so that a MATMUL_CPU_BLOCK_I x MATMUL_CPU_BLOCK_K
+// panel of A and a MATMUL_CPU_BLOCK_K x MATMUL_CPU_BLOCK_J panel of B fit in
+// the L1 and L2 caches respectively. The panels are packed into contiguous
+// buffers, in the order that the 4x4 inner kernel reads them.
+//
+// Every element of C is still accumulated in the same order (the bias first,
+// then k = 0, 1, 2, ...) as a naive triple loop would, so the results are
+// bit-identical to it, even with floats.
+//
+// The panels are static, and every hart has its own. Unless GEMMINI_CPU_HARTS
+// is defined (see below), the B panels are kept narrow, so that programs
+// which never use the CPU for big matmuls don't pay for the memory.
+#ifndef MATMUL_CPU_BLOCK_I
+#define MATMUL_CPU_BLOCK_I 32
+#endif
 
-        acc_t result[4][4]; // = {{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}};
+#ifndef MATMUL_CPU_BLOCK_J
+#ifdef GEMMINI_CPU_HARTS
+#define MATMUL_CPU_BLOCK_J 128
+#else
+#define MATMUL_CPU_BLOCK_J 32
+#endif
+#endif
 
-        for (size_t ii = 0; ii < 4; ii++)
-          for (size_t jj = 0; jj < 4; jj++) {
-            const size_t bias_row = repeating_bias ? 0 : i + ii;
-            result[ii][jj] = no_bias ? 0 :
-              GEMMINI_SCALE(*(D + bias_row*stride_D + j + jj), D_scale_factor);
-          }
+#ifndef MATMUL_CPU_BLOCK_K
+#define MATMUL_CPU_BLOCK_K 128
+#endif
 
-        for (size_t k = 0; k < DIM_K; k++) {
-          result[0][0] +=
-                GEMMINI_SCALE(*(A + i*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j), B_scale_factor);
-          result[0][1] +=
-                GEMMINI_SCALE(*(A + i*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+1), B_scale_factor);
-          result[0][2] +=
-                GEMMINI_SCALE(*(A + i*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+2), B_scale_factor);
-          result[0][3] +=
-                GEMMINI_SCALE(*(A + i*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+3), B_scale_factor);
-          result[1][0] +=
-                GEMMINI_SCALE(*(A + (i+1)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j), B_scale_factor);
-          result[1][1] +=
-                GEMMINI_SCALE(*(A + (i+1)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+1), B_scale_factor);
-          result[1][2] +=
-                GEMMINI_SCALE(*(A + (i+1)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+2), B_scale_factor);
-          result[1][3] +=
-                GEMMINI_SCALE(*(A + (i+1)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+3), B_scale_factor);
-          result[2][0] +=
-                GEMMINI_SCALE(*(A + (i+2)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j), B_scale_factor);
-          result[2][1] +=
-                GEMMINI_SCALE(*(A + (i+2)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+1), B_scale_factor);
-          result[2][2] +=
-                GEMMINI_SCALE(*(A + (i+2)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+2), B_scale_factor);
-          result[2][3] +=
-                GEMMINI_SCALE(*(A + (i+2)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+3), B_scale_factor);
-          result[3][0] +=
-                GEMMINI_SCALE(*(A + (i+3)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j), B_scale_factor);
-          result[3][1] +=
-                GEMMINI_SCALE(*(A + (i+3)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+1), B_scale_factor);
-          result[3][2] +=
-                GEMMINI_SCALE(*(A + (i+3)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+2), B_scale_factor);
-          result[3][3] +=
-                GEMMINI_SCALE(*(A + (i+3)*stride_A + k), A_scale_factor) *
-                GEMMINI_SCALE(*(B + k*stride_B + j+3), B_scale_factor);
-        }
+// The blocks of C are split between the MATMUL_CPU_THREADS harts of the pool
+// which gemmini_run_on_harts, below, runs jobs on. Define GEMMINI_CPU_HARTS
+// to the number of harts to use to opt in to a pool of more than one
+#ifndef MATMUL_CPU_THREADS
+#ifdef GEMMINI_CPU_HARTS
+#define MATMUL_CPU_THREADS GEMMINI_CPU_HARTS
+#else
+#define MATMUL_CPU_THREADS 1
+#endif
+#endif
+
+// Scaled inputs are rounded to an elem_t by MVIN_SCALE, like they are on
+// Gemmini, and then multiplied as acc_ts, so that 16-bit float elem_ts are
+// multiplied exactly, like in the mesh
+#ifdef ELEM_T_IS_FLOAT
+typedef acc_t matmul_cpu_scaled_t;
+#else
+typedef elem_t matmul_cpu_scaled_t;
+#endif
+
+// The A matrix of a conv's matmul is the im2col of its input, where each row
+// is an output pixel, starting from first_pixel, and each column is a
+// (krow, kcol, kch) of the kernel. conv_cpu never stores it though: its rows
+// are gathered straight from the input as they're packed
+struct matmul_cpu_im2col_t {
+  const elem_t * input;
+  int in_dim, in_channels, out_dim;
+  int stride, padding, kernel_dim;
+  size_t first_pixel;
+};
+
+struct matmul_cpu_args_t {
+  size_t DIM_I, DIM_J, DIM_K;
+  const elem_t * A;
+  const elem_t * B;
+  const acc_t * D;
+  elem_t * C;
+  size_t stride_A, stride_B, stride_D, stride_C;
+  scale_t A_scale_factor, B_scale_factor;
+  scale_acc_t D_scale_factor;
+  int act;
+  acc_scale_t scale;
+  size_t relu6_shift;
+  bool repeating_bias;
+
+  // If im2col is set, it describes A, which is NULL
+  const struct matmul_cpu_im2col_t * im2col;
+
+  // If residual is set, MVIN_SCALE(residual, res_scale) is added to the bias
+  const elem_t * residual;
+  size_t stride_residual;
+  scale_t res_scale;
+};
+
+// Packs rows x depth of A into 4-row micro-panels, padding the last one with
+// zeros
+static void matmul_cpu_pack_A(const struct matmul_cpu_args_t * args,
+        size_t i0, size_t rows, size_t k0, size_t depth,
+        matmul_cpu_scaled_t * packed) {
+
+  for (size_t i = 0; i < rows; i += 4)
+    for (size_t k = 0; k < depth; k++)
+      for (size_t ii = 0; ii < 4; ii++)
+        *packed++ = i + ii >= rows ? 0 :
+          GEMMINI_SCALE(*(args->A + (i0 + i + ii)*args->stride_A + k0 + k), args->A_scale_factor);
+}
 
-        *(C + i*stride_C + j) =
-             scale_and_sat(result[0][0], act, scale, relu6_shift);
-        *(C + i*stride_C + j+1) =
-             scale_and_sat(result[0][1], act, scale, relu6_shift);
-        *(C + i*stride_C + j+2) =
-             scale_and_sat(result[0][2], act, scale, relu6_shift);
-        *(C + i*stride_C + j+3) =
-             scale_and_sat(result[0][3], act, scale, relu6_shift);
-        *(C + (i+1)*stride_C + j) =
-             scale_and_sat(result[1][0], act, scale, relu6_shift);
-        *(C + (i+1)*stride_C + j+1) =
-             scale_and_sat(result[1][1], act, scale, relu6_shift);
-        *(C + (i+1)*stride_C + j+2) =
-             scale_and_sat(result[1][2], act, scale, relu6_shift);
-        *(C + (i+1)*stride_C + j+3) =
-             scale_and_sat(result[1][3], act, scale, relu6_shift);
-        *(C + (i+2)*stride_C + j) =
-             scale_and_sat(result[2][0], act, scale, relu6_shift);
-        *(C + (i+2)*stride_C + j+1) =
-             scale_and_sat(result[2][1], act, scale, relu6_shift);
-        *(C + (i+2)*stride_C + j+2) =
-             scale_and_sat(result[2][2], act, scale, relu6_shift);
-        *(C + (i+2)*stride_C + j+3) =
-             scale_and_sat(result[2][3], act, scale, relu6_shift);
-        *(C + (i+3)*stride_C + j) =
-             scale_and_sat(result[3][0], act, scale, relu6_shift);
-        *(C + (i+3)*stride_C + j+1) =
-             scale_and_sat(result[3][1], act, scale, relu6_shift);
-        *(C + (i+3)*stride_C + j+2) =
-             scale_and_sat(result[3][2], act, scale, relu6_shift);
-        *(C + (i+3)*stride_C + j+3) =
-             scale_and_sat(result[3][3], act, scale, relu6_shift);
+// Packs rows x depth of an implicit im2col, like matmul_cpu_pack_A. Each row
+// is made of runs of in_channels consecutive input values, which are either
+// all in the padding, or all copied from one input pixel
+static void matmul_cpu_pack_A_im2col(const struct matmul_cpu_args_t * args,
+        size_t i0, size_t rows, size_t k0, size_t depth,
+        matmul_cpu_scaled_t * packed) {
+
+  const struct matmul_cpu_im2col_t * im2col = args->im2col;
+  const size_t in_channels = im2col->in_channels;
+  const size_t out_dim = im2col->out_dim;
+
+  for (size_t i = 0; i < rows; i++) {
+    matmul_cpu_scaled_t * row = packed + (i / 4) * 4 * depth + i % 4;
+
+    const size_t pixel = im2col->first_pixel + i0 + i;
+    const size_t b = pixel / (out_dim * out_dim);
+    const int orow = (pixel / out_dim) % out_dim;
+    const int ocol = pixel % out_dim;
+
+    for (size_t k = k0; k < k0 + depth;) {
+      const int krow = k / (im2col->kernel_dim * in_channels);
+      const int kcol = (k / in_channels) % im2col->kernel_dim;
+      const size_t kch = k % in_channels;
+      const size_t run = in_channels - kch < k0 + depth - k ?
+        in_channels - kch : k0 + depth - k;
+
+      const int irow = orow * im2col->stride + krow - im2col->padding;
+      const int icol = ocol * im2col->stride + kcol - im2col->padding;
+
+      if (irow < 0 || irow >= im2col->in_dim || icol < 0 || icol >= im2col->in_dim) {
+        for (size_t r = 0; r < run; r++)
+          row[(k - k0 + r) * 4] = 0;
+      } else {
+        const elem_t * ipixel = im2col->input +
+          ((b * im2col->in_dim + irow) * im2col->in_dim + icol) * in_channels + kch;
+        for (size_t r = 0; r < run; r++)
+          row[(k - k0 + r) * 4] = ipixel[r];
       }
+
+      k += run;
     }
-  } else {
-    for (size_t i = 0; i < DIM_I; i++) {
-      for (size_t j = 0; j < DIM_J; j++) {
+  }
 
-        const size_t bias_row = repeating_bias ? 0 : i;
+  // Pad the last micro-panel with zeros
+  for (size_t i = rows; i % 4 != 0; i++)
+    for (size_t k = 0; k < depth; k++)
+      packed[(i / 4) * 4 * depth + k * 4 + i % 4] = 0;
+}
+
+// Packs depth x cols of B into 4-column micro-panels, padding the last one
+// with zeros. The vector kernel reads whole rows of B instead, so with RVV, B
+// is packed row-major
+static void matmul_cpu_pack_B(const struct matmul_cpu_args_t * args,
+        size_t k0, size_t depth, size_t j0, size_t cols,
+        matmul_cpu_scaled_t * packed) {
+
+#ifdef GEMMINI_RVV
+  for (size_t k = 0; k < depth; k++)
+    for (size_t j = 0; j < cols; j++)
+      *packed++ = GEMMINI_SCALE(*(args->B + (k0 + k)*args->stride_B + j0 + j), args->B_scale_factor);
+  return;
+#endif
 
-        acc_t result = no_bias ? 0 : GEMMINI_SCALE(*(D + bias_row * stride_D + j), D_scale_factor);
+  for (size_t j = 0; j < cols; j += 4)
+    for (size_t k = 0; k < depth; k++)
+      for (size_t jj = 0; jj < 4; jj++)
+        *packed++ = j + jj >= cols ? 0 :
+          GEMMINI_SCALE(*(args->B + (k0 + k)*args->stride_B + j0 + j + jj), args->B_scale_factor);
+}
+
+// Computes every MATMUL_CPU_BLOCK_I x MATMUL_CPU_BLOCK_J block of C whose index
+// is tid modulo nthreads
+static void matmul_cpu_thread(size_t tid, size_t nthreads,
+        const struct matmul_cpu_args_t * args) {
+
+  // Round the block sizes up to a multiple of the 4x4 kernel
+  static matmul_cpu_scaled_t packed_A[MATMUL_CPU_THREADS][(MATMUL_CPU_BLOCK_I + 3) / 4 * 4 * MATMUL_CPU_BLOCK_K];
+  static matmul_cpu_scaled_t packed_B[MATMUL_CPU_THREADS][(MATMUL_CPU_BLOCK_J + 3) / 4 * 4 * MATMUL_CPU_BLOCK_K];
+  static acc_t result[MATMUL_CPU_THREADS][MATMUL_CPU_BLOCK_I][MATMUL_CPU_BLOCK_J];
+
+  matmul_cpu_scaled_t * const A_panel = packed_A[tid];
+  matmul_cpu_scaled_t * const B_panel = packed_B[tid];
+  acc_t (* const res)[MATMUL_CPU_BLOCK_J] = result[tid];
+
+  const size_t I0 = args->DIM_I / MATMUL_CPU_BLOCK_I + (args->DIM_I % MATMUL_CPU_BLOCK_I != 0);
+  const size_t J0 = args->DIM_J / MATMUL_CPU_BLOCK_J + (args->DIM_J % MATMUL_CPU_BLOCK_J != 0);
+
+  for (size_t block = tid; block < I0 * J0; block += nthreads) {
+    const size_t i0 = (block / J0) * MATMUL_CPU_BLOCK_I;
+    const size_t j0 = (block % J0) * MATMUL_CPU_BLOCK_J;
+    const size_t rows = args->DIM_I - i0 > MATMUL_CPU_BLOCK_I ? MATMUL_CPU_BLOCK_I : args->DIM_I - i0;
+    const size_t cols = args->DIM_J - j0 > MATMUL_CPU_BLOCK_J ? MATMUL_CPU_BLOCK_J : args->DIM_J - j0;
+
+    for (size_t i = 0; i < rows; i++)
+      for (size_t j = 0; j < cols; j++) {
+        const size_t bias_row = args->repeating_bias ? 0 : i0 + i;
+        res[i][j] = args->D == NULL ? 0 :
+          GEMMINI_ACC_SCALE(*(args->D + bias_row*args->stride_D + j0 + j), args->D_scale_factor);
+        if (args->residual != NULL)
+          res[i][j] += MVIN_SCALE(*(args->residual + (i0 + i)*args->stride_residual + j0 + j), args->res_scale);
+      }
+
+    for (size_t k0 = 0; k0 < args->DIM_K; k0 += MATMUL_CPU_BLOCK_K) {
+      const size_t depth = args->DIM_K - k0 > MATMUL_CPU_BLOCK_K ? MATMUL_CPU_BLOCK_K : args->DIM_K - k0;
+
+      if (args->im2col != NULL)
+        matmul_cpu_pack_A_im2col(args, i0, rows, k0, depth, A_panel);
+      else
+        matmul_cpu_pack_A(args, i0, rows, k0, depth, A_panel);
+      matmul_cpu_pack_B(args, k0, depth, j0, cols, B_panel);
+
+#ifdef GEMMINI_RVV
+      // Each row of the block is accumulated vl columns at a time, still
+      // going through k in order
+      for (size_t i = 0; i < rows; i++) {
+        const matmul_cpu_scaled_t * a = A_panel + (i / 4) * 4 * depth + i % 4;
+
+        for (size_t j = 0; j < cols;) {
+          const size_t vl = __riscv_vsetvl_e32m4(cols - j);
+
+          vfloat32m4_t r = __riscv_vle32_v_f32m4(&res[i][j], vl);
+          for (size_t k = 0; k < depth; k++) {
+            const vfloat32m4_t b = __riscv_vle32_v_f32m4(B_panel + k * cols + j, vl);
+            r = __riscv_vfadd_vv_f32m4(r, __riscv_vfmul_vf_f32m4(b, a[k * 4], vl), vl);
+          }
+          __riscv_vse32_v_f32m4(&res[i][j], r, vl);
 
-        for (size_t k = 0; k < DIM_K; k++) {
-          //acc_t past_opixel = result;
-          result += GEMMINI_SCALE(*(A + i*stride_A + k), A_scale_factor) * GEMMINI_SCALE(*((elem_t*)B + k*stride_B + j), B_scale_factor);
+          j += vl;
         }
+      }
+      continue;
+#endif
+
+      for (size_t i = 0; i < rows; i += 4) {
+        for (size_t j = 0; j < cols; j += 4) {
+          const size_t kernel_rows = rows - i > 4 ? 4 : rows - i;
+          const size_t kernel_cols = cols - j > 4 ? 4 : cols - j;
+
+          const matmul_cpu_scaled_t * a = A_panel + i * depth;
+          const matmul_cpu_scaled_t * b = B_panel + j * depth;
+
+          acc_t r[4][4] = {{0}};
+          for (size_t ii = 0; ii < kernel_rows; ii++)
+            for (size_t jj = 0; jj < kernel_cols; jj++)
+              r[ii][jj] = res[i + ii][j + jj];
+
+          for (size_t k = 0; k < depth; k++, a += 4, b += 4) {
+            r[0][0] += a[0] * b[0];
+            r[0][1] += a[0] * b[1];
+            r[0][2] += a[0] * b[2];
+            r[0][3] += a[0] * b[3];
+            r[1][0] += a[1] * b[0];
+            r[1][1] += a[1] * b[1];
+            r[1][2] += a[1] * b[2];
+            r[1][3] += a[1] * b[3];
+            r[2][0] += a[2] * b[0];
+            r[2][1] += a[2] * b[1];
+            r[2][2] += a[2] * b[2];
+            r[2][3] += a[2] * b[3];
+            r[3][0] += a[3] * b[0];
+            r[3][1] += a[3] * b[1];
+            r[3][2] += a[3] * b[2];
+            r[3][3] += a[3] * b[3];
+          }
 
-        *(C + i*stride_C + j) = scale_and_sat(result, act, scale, relu6_shift);
+          for (size_t ii = 0; ii < kernel_rows; ii++)
+            for (size_t jj = 0; jj < kernel_cols; jj++)
+              res[i + ii][j + jj] = r[ii][jj];
+        }
       }
     }
+
+    for (size_t i = 0; i < rows; i++)
+      for (size_t j = 0; j < cols; j++)
+        *(args->C + (i0 + i)*args->stride_C + j0 + j) =
+          scale_and_sat(res[i][j], args->act, args->scale, args->relu6_shift);
+  }
+}
+
+// Runs job(tid, nthreads, args) on every hart in the pool, and returns once
+// they have all finished, which makes the return a barrier between them. The
+// pool has MATMUL_CPU_THREADS harts. Against the host emulator, these are
+// pthreads, each of which drives its own copy of the emulated Gemmini. On
+// Linux, the pool is only the calling thread, since other threads could issue
+// their Gemmini instructions from any core, and move between cores in the
+// middle of a tile. On bare-metal, with GEMMINI_CPU_HARTS defined, these are
+// the harts which the riscv-tests runtime starts up, up to however many it
+// actually has. That replaces riscv-tests' thread_entry, so programs which
+// have their own can't define GEMMINI_CPU_HARTS. Without it, bare-metal
+// programs only use hart 0
+typedef void (*gemmini_hart_job_t)(size_t tid, size_t nthreads, const void * args);
+
+#if MATMUL_CPU_THREADS > 1 && defined(GEMMINI_CPU_HARTS) && defined(BAREMETAL) && !defined(GEMMINI_HOST_EMU)
+// Every hart besides hart 0 waits here for hart 0 to hand it some work
+static volatile size_t gemmini_harts = 1;
+static volatile unsigned gemmini_hart_job_id = 0;
+static volatile unsigned gemmini_hart_jobs_done = 0;
+static gemmini_hart_job_t gemmini_hart_job;
+static const void * gemmini_hart_job_args;
+
+void thread_entry(int cid, int nc) {
+  const int harts = nc < MATMUL_CPU_THREADS ? nc : MATMUL_CPU_THREADS;
+
+  if (cid == 0) {
+    gemmini_harts = harts;
+    return;
+  } else if (cid >= harts) {
+    while (true);
+  }
+
+  unsigned job_id = 0;
+  while (true) {
+    while (gemmini_hart_job_id == job_id);
+    job_id = gemmini_hart_job_id;
+    __sync_synchronize();
+
+    gemmini_hart_job(cid, harts, gemmini_hart_job_args);
+
+    __sync_fetch_and_add(&gemmini_hart_jobs_done, 1);
+  }
+}
+
+static size_t gemmini_hart_count() {
+  return gemmini_harts;
+}
+
+static void gemmini_run_on_harts(gemmini_hart_job_t job, const void * args) {
+  const size_t harts = gemmini_harts;
+  const unsigned workers = harts - 1;
+
+  gemmini_hart_job = job;
+  gemmini_hart_job_args = args;
+  gemmini_hart_jobs_done = 0;
+  __sync_synchronize();
+  gemmini_hart_job_id++;
+
+  job(0, harts, args);
+
+  while (gemmini_hart_jobs_done < workers);
+  __sync_synchronize();
+}
+#elif MATMUL_CPU_THREADS > 1 && defined(GEMMINI_HOST_EMU)
+#include <pthread.h>
+
+struct gemmini_hart_pthread_args_t {
+  size_t tid;
+  gemmini_hart_job_t job;
+  const void * args;
+};
+
+static void * gemmini_hart_pthread(void * arg) {
+  const struct gemmini_hart_pthread_args_t * a = (const struct gemmini_hart_pthread_args_t *)arg;
+  a->job(a->tid, MATMUL_CPU_THREADS, a->args);
+  return NULL;
+}
+
+static size_t gemmini_hart_count() {
+  return MATMUL_CPU_THREADS;
+}
+
+static void gemmini_run_on_harts(gemmini_hart_job_t job, const void * args) {
+  pthread_t threads[MATMUL_CPU_THREADS];
+  struct gemmini_hart_pthread_args_t thread_args[MATMUL_CPU_THREADS];
+
+  for (size_t t = 1; t < MATMUL_CPU_THREADS; t++) {
+    thread_args[t].tid = t;
+    thread_args[t].job = job;
+    thread_args[t].args = args;
+    pthread_create(&threads[t], NULL, gemmini_hart_pthread, &thread_args[t]);
   }
+
+  job(0, MATMUL_CPU_THREADS, args);
+
+  for (size_t t = 1; t < MATMUL_CPU_THREADS; t++)
+    pthread_join(threads[t], NULL);
+}
+#else
+static size_t gemmini_hart_count() {
+  return 1;
+}
+
+static void gemmini_run_on_harts(gemmini_hart_job_t job, const void * args) {
+  job(0, 1, args);
+}
+#endif
+
+static void matmul_cpu_job(size_t tid, size_t nthreads, const void * args) {
+  matmul_cpu_thread(tid, nthreads, (const struct matmul_cpu_args_t *)args);
+}
+
+static void matmul_cpu(size_t DIM_I, size_t DIM_J, size_t DIM_K,
+        const elem_t* A, const elem_t* B, const acc_t * D,
+        elem_t* C,
+        size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias) {
+
+  const struct matmul_cpu_args_t args = {
+    DIM_I, DIM_J, DIM_K,
+    A, B, D, C,
+    stride_A, stride_B, stride_D, stride_C,
+    A_scale_factor, B_scale_factor, D_scale_factor,
+    act, scale, relu6_shift, repeating_bias,
+  };
+
+  gemmini_run_on_harts(matmul_cpu_job, &args);
 }
 
 #undef GEMMINI_SCALE
+#undef GEMMINI_ACC_SCALE
 
 // General matmul which can be run with different dataflows, or on the CPU
 enum tiled_matmul_type_t {OS, WS, CPU}; // TODO rename this so it's name also applies to convs
 
 // This function runs a tiled matrix multiplication, with hardcoded tiling
-// factors
-void tiled_matmul(size_t dim_I, size_t dim_J, size_t dim_K,
+// factors. A_occupancy and B_occupancy are optional block-occupancy bitmaps
+// (see block_occupancy) of A and B. If they are provided, then tiles of A or B
+// which are entirely zero are skipped
+void tiled_matmul_block_sparse(size_t dim_I, size_t dim_J, size_t dim_K,
         const elem_t* A, const elem_t* B,
         const void * D, void* C,
         size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
@@ -853,6 +1580,7 @@ void tiled_matmul(size_t dim_I, size_t dim_J, size_t dim_K,
         size_t tile_I, size_t tile_J, size_t tile_K,
         bool transpose_A, bool transpose_B,
         bool full_C, bool low_D,
+        const uint8_t * A_occupancy, const uint8_t * B_occupancy,
         enum tiled_matmul_type_t tiled_matmul_type) {
 
 #ifdef GEMMINI_ASSERTIONS
@@ -937,7 +1665,8 @@ void tiled_matmul(size_t dim_I, size_t dim_J, size_t dim_K,
         act, scale, relu6_shift, repeating_bias,
         transpose_A, transpose_B,
         full_C, low_D,
-        (int)tiled_matmul_type);
+        A_occupancy, B_occupancy,
+        false, (int)tiled_matmul_type);
   } else /*if (tiled_matmul_type == CPU)*/ {
     matmul_cpu(dim_I, dim_J, dim_K,
             A, B, D, (elem_t*)C,
@@ -947,88 +1676,355 @@ void tiled_matmul(size_t dim_I, size_t dim_J, size_t dim_K,
   }
 }
 
-static size_t tiled_matmul_total_spad_rows(size_t I, size_t J, size_t K) {
-  return (I * K + K * J) * DIM;
-}
-
-static size_t tiled_matmul_total_acc_rows(size_t I, size_t J) {
-  return (I * J) * DIM;
-}
-
-// This function runs a tiled matrix multiplication, with automatically
-// calculated tiling factors
-void tiled_matmul_auto(size_t dim_I, size_t dim_J, size_t dim_K,
+// This function runs a tiled matrix multiplication, with hardcoded tiling
+// factors
+void tiled_matmul(size_t dim_I, size_t dim_J, size_t dim_K,
         const elem_t* A, const elem_t* B,
-        const void * D, void * C,
+        const void * D, void* C,
         size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
         scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
         int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        size_t tile_I, size_t tile_J, size_t tile_K,
         bool transpose_A, bool transpose_B,
         bool full_C, bool low_D,
         enum tiled_matmul_type_t tiled_matmul_type) {
 
-#define partition_rows (BANK_NUM * BANK_ROWS / 2)
-#define mats_in_partition (partition_rows / DIM)
-#define mats_in_acc (ACC_ROWS / DIM)
-#define max_tile_i_j ((size_t)sqrt(mats_in_acc))
-#define max_tile_k (mats_in_partition / max_tile_i_j)
-
-    // "db_" means "double-buffered"
-#define db_partition_rows ((BANK_NUM * BANK_ROWS / 2) / 2)
-#define db_mats_in_partition (db_partition_rows / DIM)
-#define db_mats_in_acc ((ACC_ROWS / 2) / DIM)
-#define db_max_tile_i_j ((size_t)sqrt(db_mats_in_acc))
-#define db_max_tile_k (db_mats_in_partition / db_max_tile_i_j)
+  tiled_matmul_block_sparse(dim_I, dim_J, dim_K,
+      A, B, D, C,
+      stride_A, stride_B, stride_D, stride_C,
+      A_scale_factor, B_scale_factor, D_scale_factor,
+      act, scale, relu6_shift, repeating_bias,
+      tile_I, tile_J, tile_K,
+      transpose_A, transpose_B,
+      full_C, low_D,
+      NULL, NULL,
+      tiled_matmul_type);
+}
 
-    const size_t dim_I_padded = (dim_I / DIM + (dim_I % DIM != 0)) * DIM;
-    const size_t dim_J_padded = (dim_J / DIM + (dim_J % DIM != 0)) * DIM;
-    const size_t dim_K_padded = (dim_K / DIM + (dim_K % DIM != 0)) * DIM;
+static size_t tiled_matmul_total_spad_rows(size_t I, size_t J, size_t K) {
+  return (I * K + K * J) * DIM;
+}
 
-    const bool double_buffered = tiled_matmul_type == WS;
+static size_t tiled_matmul_total_acc_rows(size_t I, size_t J) {
+  return (I * J) * DIM;
+}
+
+// The cost of one call to loop_ws, in bytes of DRAM traffic, which
+// tiled_matmul_auto_tiling_factors trades off against the traffic itself.
+// Every call has to configure loop_ws, fill up the mesh, and wait for its
+// first loads to come back before it can start computing
+#ifndef GEMMINI_LOOP_WS_COST
+#define GEMMINI_LOOP_WS_COST (8 * DIM * MAX_BYTES)
+#endif
+
+// Estimates how many bytes tiled_matmul_outer moves between DRAM and Gemmini
+// for a dim_I x dim_J x dim_K matmul with the given tiling factors, and how
+// many times it calls loop_ws. A tile of A is moved in once for every tile of
+// C in its row, and a tile of B once for every tile of C in its column. The
+// bias is left out, since it's moved in once regardless of the tiling
+static void tiled_matmul_schedule_cost(size_t dim_I, size_t dim_J, size_t dim_K,
+        size_t tile_I, size_t tile_J, size_t tile_K,
+        size_t * bytes_out, size_t * calls_out) {
+
+    const size_t dim_I_blocks = dim_I / DIM + (dim_I % DIM != 0);
+    const size_t dim_J_blocks = dim_J / DIM + (dim_J % DIM != 0);
+    const size_t dim_K_blocks = dim_K / DIM + (dim_K % DIM != 0);
+
+    const size_t I0 = dim_I_blocks / tile_I + (dim_I_blocks % tile_I != 0);
+    const size_t J0 = dim_J_blocks / tile_J + (dim_J_blocks % tile_J != 0);
+    const size_t K0 = dim_K_blocks / tile_K + (dim_K_blocks % tile_K != 0);
+
+    *bytes_out = (dim_I * dim_K * J0 + dim_K * dim_J * I0 + dim_I * dim_J) * sizeof(elem_t);
+    *calls_out = I0 * J0 * K0;
+}
+
+// Prints the schedule which tiled_matmul will follow with the given tiling
+// factors, along with the cost which tiled_matmul_auto_tiling_factors
+// assigns to it
+static void tiled_matmul_print_schedule(size_t dim_I, size_t dim_J, size_t dim_K,
+        size_t tile_I, size_t tile_J, size_t tile_K) {
+
+    size_t bytes, calls;
+    tiled_matmul_schedule_cost(dim_I, dim_J, dim_K, tile_I, tile_J, tile_K,
+        &bytes, &calls);
+
+    printf("matmul %llux%llux%llu: tile_I: %llu, tile_J: %llu, tile_K: %llu, "
+        "spad rows: %llu, acc rows: %llu, loop_ws calls: %llu, bytes moved: %llu, cost: %llu\n",
+        (unsigned long long)dim_I, (unsigned long long)dim_J, (unsigned long long)dim_K,
+        (unsigned long long)tile_I, (unsigned long long)tile_J, (unsigned long long)tile_K,
+        (unsigned long long)tiled_matmul_total_spad_rows(tile_I, tile_J, tile_K),
+        (unsigned long long)tiled_matmul_total_acc_rows(tile_I, tile_J),
+        (unsigned long long)calls, (unsigned long long)bytes,
+        (unsigned long long)(bytes + calls * GEMMINI_LOOP_WS_COST));
+}
+
+// Finds the max_candidates tiling factors (in units of DIM x DIM blocks) for a
+// dim_I x dim_J x dim_K matmul which fit in the scratchpad and accumulator,
+// and which have the lowest estimated cost. The cost is the number of bytes
+// moved between DRAM and Gemmini, plus GEMMINI_LOOP_WS_COST for every call to
+// loop_ws. The candidates are sorted from cheapest to most expensive, and the
+// number which were found is returned
+static size_t tiled_matmul_tiling_candidates(size_t dim_I, size_t dim_J, size_t dim_K,
+        bool double_buffered, size_t candidates[][3], size_t max_candidates) {
+
+    const size_t dim_I_blocks = dim_I / DIM + (dim_I % DIM != 0);
+    const size_t dim_J_blocks = dim_J / DIM + (dim_J % DIM != 0);
+    const size_t dim_K_blocks = dim_K / DIM + (dim_K % DIM != 0);
 
     const size_t max_spad_rows = double_buffered ? BANK_NUM * BANK_ROWS / 2 :
       BANK_NUM * BANK_ROWS;
     const size_t max_acc_rows = double_buffered ? ACC_ROWS / 2 : ACC_ROWS;
 
-    size_t tile_I, tile_J, tile_K;
+    size_t costs[max_candidates];
+    size_t n = 0;
+
+    // The number of bytes moved only depends on tile_I and tile_J, so for each
+    // of those, tile_K is made as large as the scratchpad allows, to make as
+    // few calls to loop_ws as possible. Within each dimension, smaller tiles
+    // are tried first, so that ties go to the tiling with the fewest padded
+    // rows and columns in its last tile
+    for (size_t tile_I = 1; tile_I <= dim_I_blocks && tile_I <= 65535 &&
+        tiled_matmul_total_acc_rows(tile_I, 1) <= max_acc_rows; tile_I++) {
+
+      for (size_t tile_J = 1; tile_J <= dim_J_blocks && tile_J <= 65535 &&
+          tiled_matmul_total_acc_rows(tile_I, tile_J) <= max_acc_rows; tile_J++) {
+
+        size_t tile_K = max_spad_rows / ((tile_I + tile_J) * DIM);
+        if (tile_K > dim_K_blocks)
+          tile_K = dim_K_blocks;
+        if (tile_K > 65535)
+          tile_K = 65535;
+        if (tile_K == 0)
+          break;
+
+        // Spread dim_K as evenly as possible over the k-slices it needs
+        const size_t K0 = dim_K_blocks / tile_K + (dim_K_blocks % tile_K != 0);
+        tile_K = dim_K_blocks / K0 + (dim_K_blocks % K0 != 0);
+
+        size_t bytes, calls;
+        tiled_matmul_schedule_cost(dim_I, dim_J, dim_K, tile_I, tile_J, tile_K,
+            &bytes, &calls);
+
+        const size_t cost = bytes + calls * GEMMINI_LOOP_WS_COST;
+
+        // Insert this tiling into the sorted list of candidates
+        size_t pos = n;
+        while (pos > 0 && cost < costs[pos-1])
+          pos--;
+
+        if (pos >= max_candidates)
+          continue;
+
+        if (n < max_candidates)
+          n++;
+
+        for (size_t c = n-1; c > pos; c--) {
+          costs[c] = costs[c-1];
+          candidates[c][0] = candidates[c-1][0];
+          candidates[c][1] = candidates[c-1][1];
+          candidates[c][2] = candidates[c-1][2];
+        }
 
-    if (double_buffered) {
-       tile_I = dim_I_padded/DIM < db_max_tile_i_j ? dim_I_padded/DIM : db_max_tile_i_j;
-       tile_J = dim_J_padded/DIM < db_max_tile_i_j ? dim_J_padded/DIM : db_max_tile_i_j;
-       tile_K = dim_K_padded/DIM < db_max_tile_k ? dim_K_padded/DIM : db_max_tile_k;
-    } else {
-       tile_I = dim_I_padded/DIM < max_tile_i_j ? dim_I_padded/DIM : max_tile_i_j;
-       tile_J = dim_J_padded/DIM < max_tile_i_j ? dim_J_padded/DIM : max_tile_i_j;
-       tile_K = dim_K_padded/DIM < max_tile_k ? dim_K_padded/DIM : max_tile_k;
+        costs[pos] = cost;
+        candidates[pos][0] = tile_I;
+        candidates[pos][1] = tile_J;
+        candidates[pos][2] = tile_K;
+      }
     }
 
-    // Fill scratchpad as much as possible
-    while (true) {
-      bool increased = false;
+    return n;
+}
 
-      if (tiled_matmul_total_spad_rows(tile_I, tile_J+1, tile_K) <= max_spad_rows &&
-          tiled_matmul_total_acc_rows(tile_I, tile_J+1) <= max_acc_rows &&
-          (tile_J+1) * DIM <= dim_J_padded) {
-        tile_J++;
-        increased = true;
-      }
+// Picks the cheapest tiling factors for a dim_I x dim_J x dim_K matmul,
+// according to tiled_matmul_tiling_candidates. Define GEMMINI_PRINT_TILING to
+// print the schedule that was chosen
+static void tiled_matmul_auto_tiling_factors(size_t dim_I, size_t dim_J, size_t dim_K,
+        bool double_buffered,
+        size_t * tile_I_out, size_t * tile_J_out, size_t * tile_K_out) {
 
-      if (tiled_matmul_total_spad_rows(tile_I+1, tile_J, tile_K) <= max_spad_rows &&
-          tiled_matmul_total_acc_rows(tile_I+1, tile_J) <= max_acc_rows &&
-          (tile_I+1) * DIM <= dim_I_padded) {
-        tile_I++;
-        increased = true;
-      }
+    size_t best[1][3] = {{1, 1, 1}};
+    tiled_matmul_tiling_candidates(dim_I, dim_J, dim_K, double_buffered, best, 1);
+
+#ifdef GEMMINI_PRINT_TILING
+    tiled_matmul_print_schedule(dim_I, dim_J, dim_K, best[0][0], best[0][1], best[0][2]);
+#endif
+
+    *tile_I_out = best[0][0];
+    *tile_J_out = best[0][1];
+    *tile_K_out = best[0][2];
+}
+
+//============================================================================
+// Autotuning
+//
+// Build with GEMMINI_AUTOTUNE to make tiled_matmul_auto time the
+// GEMMINI_AUTOTUNE_CANDIDATES cheapest tilings of every new matmul it runs
+// with read_cycles, and remember the fastest one. tiled_conv_auto and
+// tiled_conv_auto_largeC do the same with their own tilings, and a few smaller
+// variants of them. While autotuning, each layer runs once per candidate, so
+// its output must not overlap its inputs.
+//
+// gemmini_autotune_dump prints what was found as a header. Build with
+// -DGEMMINI_TUNED_TILINGS='"tuned_tilings.h"' to have every layer in that
+// header run its fastest tiling straight away, without searching.
+//============================================================================
+
+struct tiled_matmul_tuning_t {
+  size_t dim_I, dim_J, dim_K;
+  enum tiled_matmul_type_t dataflow;
+  bool transpose_A, transpose_B, no_bias;
+
+  size_t tile_I, tile_J, tile_K;
+};
+
+struct tiled_conv_tuning_t {
+  int batch_size, in_dim, in_channels, out_channels, out_dim;
+  int stride, padding, kernel_dim;
+  int pool_size, pool_stride, pool_padding;
+  bool no_bias;
+
+  int batches, porows, pocols, pochs, kchs, weight_bank;
+};
+
+// The generated header defines tiled_matmul_tuned and tiled_conv_tuned, each
+// ending with an entry whose batch_size or dim_I is 0
+#ifdef GEMMINI_TUNED_TILINGS
+#include GEMMINI_TUNED_TILINGS
+#endif
+
+#ifdef GEMMINI_AUTOTUNE
+#ifndef GEMMINI_AUTOTUNE_CANDIDATES
+#define GEMMINI_AUTOTUNE_CANDIDATES 8
+#endif
+
+#ifndef GEMMINI_AUTOTUNE_MAX_ENTRIES
+#define GEMMINI_AUTOTUNE_MAX_ENTRIES 128
+#endif
+
+static struct tiled_matmul_tuning_t tiled_matmul_autotuned[GEMMINI_AUTOTUNE_MAX_ENTRIES];
+static size_t tiled_matmul_autotuned_n = 0;
+
+static struct tiled_conv_tuning_t tiled_conv_autotuned[GEMMINI_AUTOTUNE_MAX_ENTRIES];
+static size_t tiled_conv_autotuned_n = 0;
+#endif
+
+// Reads this hart's cycle counter, or the host emulator's estimate of it
+static uint64_t gemmini_read_cycles() {
+#ifdef GEMMINI_HOST_EMU
+  return gemmini_emu_read_cycles();
+#else
+  uint64_t cycles;
+  asm volatile ("rdcycle %0" : "=r" (cycles));
+  return cycles;
+#endif
+}
+
+static bool tiled_matmul_tuning_matches(const struct tiled_matmul_tuning_t * a,
+        const struct tiled_matmul_tuning_t * b) {
+  return a->dim_I == b->dim_I && a->dim_J == b->dim_J && a->dim_K == b->dim_K &&
+    a->dataflow == b->dataflow &&
+    a->transpose_A == b->transpose_A && a->transpose_B == b->transpose_B &&
+    a->no_bias == b->no_bias;
+}
+
+// Looks up the tuned tiling factors for the matmul described by "key", and
+// stores them in "key" if there are any
+static bool tiled_matmul_find_tuning(struct tiled_matmul_tuning_t * key) {
+  const struct tiled_matmul_tuning_t * found = NULL;
+
+#ifdef GEMMINI_TUNED_TILINGS
+  for (size_t i = 0; found == NULL && tiled_matmul_tuned[i].dim_I != 0; i++)
+    if (tiled_matmul_tuning_matches(&tiled_matmul_tuned[i], key))
+      found = &tiled_matmul_tuned[i];
+#endif
+
+#ifdef GEMMINI_AUTOTUNE
+  for (size_t i = 0; found == NULL && i < tiled_matmul_autotuned_n; i++)
+    if (tiled_matmul_tuning_matches(&tiled_matmul_autotuned[i], key))
+      found = &tiled_matmul_autotuned[i];
+#endif
+
+  if (found == NULL)
+    return false;
+
+  key->tile_I = found->tile_I;
+  key->tile_J = found->tile_J;
+  key->tile_K = found->tile_K;
+  return true;
+}
+
+// This function runs a tiled matrix multiplication, with automatically
+// calculated tiling factors
+void tiled_matmul_auto(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t* A, const elem_t* B,
+        const void * D, void * C,
+        size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        bool transpose_A, bool transpose_B,
+        bool full_C, bool low_D,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+    const bool double_buffered = tiled_matmul_type == WS;
+
+    struct tiled_matmul_tuning_t tuning = {dim_I, dim_J, dim_K,
+      tiled_matmul_type, transpose_A, transpose_B, D == NULL};
+
+    if (tiled_matmul_find_tuning(&tuning)) {
+      tiled_matmul(dim_I, dim_J, dim_K,
+          A, B, D, C,
+          stride_A, stride_B, stride_D, stride_C,
+          A_scale_factor, B_scale_factor, D_scale_factor,
+          act, scale, relu6_shift, repeating_bias,
+          tuning.tile_I, tuning.tile_J, tuning.tile_K,
+          transpose_A, transpose_B,
+          full_C, low_D,
+          tiled_matmul_type);
+      return;
+    }
+
+#ifdef GEMMINI_AUTOTUNE
+    if (tiled_matmul_type != CPU &&
+        tiled_matmul_autotuned_n < GEMMINI_AUTOTUNE_MAX_ENTRIES) {
+      size_t candidates[GEMMINI_AUTOTUNE_CANDIDATES][3];
+      const size_t n = tiled_matmul_tiling_candidates(dim_I, dim_J, dim_K,
+          double_buffered, candidates, GEMMINI_AUTOTUNE_CANDIDATES);
+
+      uint64_t best_cycles = 0;
+
+      for (size_t c = 0; c < n; c++) {
+        const uint64_t start = gemmini_read_cycles();
+
+        tiled_matmul(dim_I, dim_J, dim_K,
+            A, B, D, C,
+            stride_A, stride_B, stride_D, stride_C,
+            A_scale_factor, B_scale_factor, D_scale_factor,
+            act, scale, relu6_shift, repeating_bias,
+            candidates[c][0], candidates[c][1], candidates[c][2],
+            transpose_A, transpose_B,
+            full_C, low_D,
+            tiled_matmul_type);
+
+        // Time each candidate to completion, even from tiled_matmul_auto_async
+        gemmini_fence();
+        const uint64_t cycles = gemmini_read_cycles() - start;
 
-      if (tiled_matmul_total_spad_rows(tile_I, tile_J, tile_K+1) <= max_spad_rows &&
-          (tile_K+1) * DIM <= dim_K_padded) {
-        tile_K++;
-        increased = true;
+        if (c == 0 || cycles < best_cycles) {
+          tuning.tile_I = candidates[c][0];
+          tuning.tile_J = candidates[c][1];
+          tuning.tile_K = candidates[c][2];
+          best_cycles = cycles;
+        }
       }
 
-      if (!increased)
-        break;
+      tiled_matmul_autotuned[tiled_matmul_autotuned_n++] = tuning;
+      return;
     }
+#endif
+
+    size_t tile_I, tile_J, tile_K;
+    tiled_matmul_auto_tiling_factors(dim_I, dim_J, dim_K, double_buffered,
+        &tile_I, &tile_J, &tile_K);
 
     tiled_matmul(dim_I, dim_J, dim_K,
         A, B, D, C,
@@ -1039,28 +2035,1797 @@ void tiled_matmul_auto(size_t dim_I, size_t dim_J, size_t dim_K,
         transpose_A, transpose_B,
         full_C, low_D,
         tiled_matmul_type);
+}
+
+//============================================================================
+// Per-channel requantization
+//
+// Quantized weights are usually given a scale per output channel, so each
+// column j of C is scaled down by its own scales[j]. Gemmini's mvout scaler
+// only has one scale, so unless every column has the same scale, C is
+// computed in chunks which fit in a scratch buffer that the caller provides,
+// and each chunk is moved out at full precision and then scaled down on the
+// CPU.
+//============================================================================
+
+// This function runs a tiled matrix multiplication, with automatically
+// calculated tiling factors, which scales column j of C by scales[j]. Unless
+// every column has the same scale, or this runs on the CPU, scratch has to
+// hold at least DIM*DIM elements, and should be aligned like row_align_acc(1).
+// The more it holds, the fewer chunks C is split into
+void tiled_matmul_auto_per_channel(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t* A, const elem_t* B,
+        const acc_t * D, elem_t * C,
+        size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
+        int act, const acc_scale_t * scales, size_t relu6_shift, bool repeating_bias,
+        acc_t * scratch, size_t scratch_elems,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+  bool same_scale = true;
+  for (size_t j = 1; j < dim_J; j++)
+    if (scales[j] != scales[0])
+      same_scale = false;
+
+  if (same_scale) {
+    tiled_matmul_auto(dim_I, dim_J, dim_K,
+        A, B, D, C,
+        stride_A, stride_B, stride_D, stride_C,
+        MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+        act, scales[0], relu6_shift, repeating_bias,
+        false, false,
+        false, false,
+        tiled_matmul_type);
+    return;
+  }
+
+  if (tiled_matmul_type == CPU) {
+    for (size_t i = 0; i < dim_I; i++)
+      for (size_t j = 0; j < dim_J; j++) {
+        acc_t sum = D == NULL ? 0 : D[(repeating_bias ? 0 : i*stride_D) + j];
+        for (size_t k = 0; k < dim_K; k++)
+          sum += (acc_t)A[i*stride_A + k] * B[k*stride_B + j];
+        C[i*stride_C + j] = scale_and_sat(sum, act, scales[j], relu6_shift);
+      }
+    return;
+  }
+
+#ifdef GEMMINI_ASSERTIONS
+  if (scratch == NULL || scratch_elems < DIM*DIM) {
+    printf("Per-channel scales need a scratch buffer of at least DIM*DIM elements\n");
+    exit(1);
+  }
+#endif
 
-#undef partition_rows
-#undef mats_in_partition
-#undef mats_in_acc
-#undef max_tile_i_j
-#undef max_tile_k
+  // Chunks are whole DIM x DIM blocks, and as wide as the buffer allows
+  const size_t max_cols = scratch_elems / DIM / DIM * DIM;
+  const size_t chunk_cols = dim_J < max_cols ? dim_J : max_cols;
+  const size_t chunk_cols_padded = (chunk_cols + DIM - 1) / DIM * DIM;
+  const size_t chunk_rows = scratch_elems / chunk_cols_padded / DIM * DIM;
+
+  for (size_t i0 = 0; i0 < dim_I; i0 += chunk_rows) {
+    const size_t rows = dim_I - i0 < chunk_rows ? dim_I - i0 : chunk_rows;
+
+    for (size_t j0 = 0; j0 < dim_J; j0 += chunk_cols) {
+      const size_t cols = dim_J - j0 < chunk_cols ? dim_J - j0 : chunk_cols;
+      const acc_t * chunk_D = D == NULL ? NULL :
+        D + (repeating_bias ? 0 : i0*stride_D) + j0;
+
+      tiled_matmul_auto(rows, cols, dim_K,
+          A + i0*stride_A, B + j0, chunk_D, scratch,
+          stride_A, stride_B, stride_D, chunk_cols_padded,
+          MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+          NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, repeating_bias,
+          false, false,
+          true, false,
+          tiled_matmul_type);
+
+      gemmini_fence();
+
+      for (size_t i = 0; i < rows; i++)
+        for (size_t j = 0; j < cols; j++)
+          C[(i0 + i)*stride_C + j0 + j] = scale_and_sat(
+              scratch[i*chunk_cols_padded + j],
+              act, scales[j0 + j], relu6_shift);
+    }
+  }
 }
 
-static void tiled_matmul_auto_cisc(
-  size_t M, size_t N, size_t K,
-  const elem_t* A, const elem_t* B, const acc_t * D, elem_t* C,
-  int act, size_t shift, size_t relu6_shift, bool repeating_bias)
-{
-  gemmini_config_reset();
-  gemmini_config_cisc_ex(act, 0, shift, relu6_shift);
-  gemmini_config_addr_ab((uintptr_t)A, (uintptr_t)B);
-  gemmini_config_addr_cd((uintptr_t)C, (uintptr_t)D);
-  gemmini_config_size0(M, N);
-  gemmini_config_size1(K);
-  gemmini_config_repeating_bias(repeating_bias);
-  gemmini_compute_cisc();
+//============================================================================
+// Weight pre-packing
+//
+// tiled_matmul moves each tile of B in row by row, with a stride of the whole
+// of B's width, so every row of a tile is a separate DMA burst. Weights never
+// change between inferences though, so they can be packed once, when a model
+// is loaded, into the order in which the tiles are used. tiled_matmul_pack_B
+// picks the tiling factors that tiled_matmul_auto would pick for a matmul,
+// and then stores each tile_K*DIM x tile_J*DIM tile of B contiguously, in
+// (k0, j0) order, with the tiles along the edges padded with zeros. Each tile
+// then has a row stride of its own width, so the mvins of a tile which is no
+// wider than MAX_BLOCK_LEN blocks read one contiguous region.
+//============================================================================
+
+struct tiled_matmul_packed_B_t {
+  const elem_t * packed;
+  size_t dim_J, dim_K;
+  size_t tile_I, tile_J, tile_K;
+
+  // The unpacked B, which the CPU uses instead
+  const elem_t * B;
+  size_t stride_B;
+};
+
+// Packs the dim_K x dim_J matrix B, for dim_I x dim_J x dim_K matmuls of the
+// given type, into packed, and describes the result in packed_B. B must stay
+// valid if it's also used on the CPU. Returns the number of bytes of packed
+// which are needed. Pass a NULL packed to find out how large it should be
+static size_t tiled_matmul_pack_B(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t * B, size_t stride_B, elem_t * packed,
+        enum tiled_matmul_type_t tiled_matmul_type,
+        struct tiled_matmul_packed_B_t * packed_B) {
+
+  size_t tile_I, tile_J, tile_K;
+  tiled_matmul_auto_tiling_factors(dim_I, dim_J, dim_K, tiled_matmul_type == WS,
+      &tile_I, &tile_J, &tile_K);
+
+  const size_t dim_J_padded = (dim_J / DIM + (dim_J % DIM != 0)) * DIM;
+  const size_t dim_K_padded = (dim_K / DIM + (dim_K % DIM != 0)) * DIM;
+
+  const size_t tile_cols = tile_J*DIM;
+  const size_t tile_rows = tile_K*DIM;
+  const size_t J0 = dim_J_padded / tile_cols + (dim_J_padded % tile_cols != 0);
+  const size_t K0 = dim_K_padded / tile_rows + (dim_K_padded % tile_rows != 0);
+
+  const size_t bytes = K0 * J0 * tile_rows * tile_cols * sizeof(elem_t);
+
+  if (packed == NULL)
+    return bytes;
+
+  for (size_t k0 = 0; k0 < K0; k0++)
+    for (size_t j0 = 0; j0 < J0; j0++) {
+      elem_t * tile = packed + (k0*J0 + j0) * tile_rows * tile_cols;
+
+      for (size_t k = 0; k < tile_rows; k++)
+        for (size_t j = 0; j < tile_cols; j++) {
+          const size_t row = k0*tile_rows + k;
+          const size_t col = j0*tile_cols + j;
+
+          tile[k*tile_cols + j] = row < dim_K && col < dim_J ?
+            B[row*stride_B + col] : 0;
+        }
+    }
+
+  packed_B->packed = packed;
+  packed_B->dim_J = dim_J;
+  packed_B->dim_K = dim_K;
+  packed_B->tile_I = tile_I;
+  packed_B->tile_J = tile_J;
+  packed_B->tile_K = tile_K;
+  packed_B->B = B;
+  packed_B->stride_B = stride_B;
+
+  return bytes;
+}
+
+// Runs tiled_matmul_auto with a B which was packed by tiled_matmul_pack_B.
+// dim_I may differ from the dim_I that B was packed for, but the tiling
+// factors were picked for that one
+void tiled_matmul_packed_auto(size_t dim_I,
+        const elem_t* A, const struct tiled_matmul_packed_B_t * B,
+        const void * D, void * C,
+        size_t stride_A, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        bool full_C, bool low_D,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+  if (tiled_matmul_type == CPU) {
+    tiled_matmul(dim_I, B->dim_J, B->dim_K,
+        A, B->B, D, C,
+        stride_A, B->stride_B, stride_D, stride_C,
+        A_scale_factor, B_scale_factor, D_scale_factor,
+        act, scale, relu6_shift, repeating_bias,
+        1, 1, 1,
+        false, false,
+        full_C, low_D,
+        tiled_matmul_type);
+    return;
+  }
+
+  const size_t I_blocks = dim_I / DIM + (dim_I % DIM != 0);
+  const size_t tile_I = B->tile_I < I_blocks ? B->tile_I : I_blocks;
+
+  tiled_matmul_outer(dim_I, B->dim_J, B->dim_K,
+      A, B->packed, D, C,
+      stride_A, B->tile_J*DIM, stride_D, stride_C,
+      A_scale_factor, B_scale_factor, D_scale_factor,
+      tile_I, B->tile_J, B->tile_K,
+      act, scale, relu6_shift, repeating_bias,
+      false, false,
+      full_C, low_D,
+      NULL, NULL,
+      true, (int)tiled_matmul_type);
+}
+
+// This function runs a tiled matrix multiplication, with automatically
+// calculated tiling factors, skipping tiles of A or B which are entirely zero
+// according to their block-occupancy bitmaps. Either bitmap may be NULL
+void tiled_matmul_block_sparse_auto(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t* A, const elem_t* B,
+        const void * D, void * C,
+        size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        bool transpose_A, bool transpose_B,
+        bool full_C, bool low_D,
+        const uint8_t * A_occupancy, const uint8_t * B_occupancy,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+    const bool double_buffered = tiled_matmul_type == WS;
+
+    size_t tile_I, tile_J, tile_K;
+    tiled_matmul_auto_tiling_factors(dim_I, dim_J, dim_K, double_buffered,
+        &tile_I, &tile_J, &tile_K);
+
+    tiled_matmul_block_sparse(dim_I, dim_J, dim_K,
+        A, B, D, C,
+        stride_A, stride_B, stride_D, stride_C,
+        A_scale_factor, B_scale_factor, D_scale_factor,
+        act, scale, relu6_shift, repeating_bias,
+        tile_I, tile_J, tile_K,
+        transpose_A, transpose_B,
+        full_C, low_D,
+        A_occupancy, B_occupancy,
+        tiled_matmul_type);
+}
+
+//============================================================================
+// Asynchronous matmuls
+//
+// tiled_matmul_auto_async issues a matmul to Gemmini, and returns a handle to
+// it without waiting for it to finish, so that the CPU can get on with
+// something else, like the im2col for the next layer, in the meantime. Gemmini
+// can only be waited on with a fence, which waits for everything it has been
+// given, so gemmini_wait(handle) also finishes every matmul issued before
+// that one, and handles are numbered in the order they were issued. For the
+// same reason, an ordinary tiled_matmul finishes every async matmul as well.
+//
+// Until a matmul finishes, Gemmini may still be reading its A, B, and D, and
+// writing its C. The DRAM buffers of every unfinished matmul are kept track
+// of, and gemmini_wait_for_buffer waits for whichever ones touch a buffer
+// which the CPU is about to use. tiled_matmul_auto_async uses it too, so that
+// a matmul which reads the output of an earlier one waits for it first.
+//
+// The instructions of a matmul are still issued by the CPU, which stalls
+// whenever Gemmini's queues are full, so the work which can be overlapped is
+// what's left in the queues once the last instruction has been issued.
+//============================================================================
+
+// Returns true if the matmul with this handle has finished
+static bool gemmini_is_done(gemmini_handle_t handle) {
+  return handle <= gemmini_last_finished;
+}
+
+// Waits for the matmul with this handle, and every one issued before it, to
+// finish
+static void gemmini_wait(gemmini_handle_t handle) {
+  if (gemmini_is_done(handle))
+    return;
+
   gemmini_fence();
+  gemmini_last_finished = gemmini_last_issued;
+  gemmini_in_flight_n = 0;
+}
+
+// Returns the handle of the last unfinished matmul which writes to any of the
+// bytes of this buffer or, if the CPU is going to write to it, which reads
+// them. If there aren't any, the handle which is returned is already done
+static gemmini_handle_t gemmini_buffer_handle(const void * buf, size_t bytes,
+        bool writing) {
+
+  const uintptr_t start = (uintptr_t)buf;
+  const uintptr_t end = start + bytes;
+
+  gemmini_handle_t handle = gemmini_last_finished;
+
+  for (size_t b = 0; b < gemmini_in_flight_n; b++) {
+    const struct gemmini_in_flight_buffer_t * f = &gemmini_in_flight[b];
+    if ((f->written || writing) && f->start < end && start < f->end &&
+        f->handle > handle)
+      handle = f->handle;
+  }
+
+  return handle;
+}
+
+// Waits until the CPU can safely read, or write, this buffer
+static void gemmini_wait_for_buffer(const void * buf, size_t bytes, bool writing) {
+  gemmini_wait(gemmini_buffer_handle(buf, bytes, writing));
+}
+
+static void gemmini_track_buffer(gemmini_handle_t handle,
+        const void * buf, size_t rows, size_t cols, size_t stride,
+        size_t elem_size, bool written) {
+
+  if (buf == NULL || rows == 0)
+    return;
+
+  struct gemmini_in_flight_buffer_t * f = &gemmini_in_flight[gemmini_in_flight_n++];
+  f->handle = handle;
+  f->start = (uintptr_t)buf;
+  f->end = f->start + ((rows - 1) * stride + cols) * elem_size;
+  f->written = written;
+}
+
+// This function runs a tiled matrix multiplication, with automatically
+// calculated tiling factors, but returns without waiting for it to finish.
+// Pass the handle it returns to gemmini_wait before reading C, or before
+// overwriting A, B, or D
+gemmini_handle_t tiled_matmul_auto_async(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t* A, const elem_t* B,
+        const void * D, void * C,
+        size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        bool transpose_A, bool transpose_B,
+        bool full_C, bool low_D,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+    const size_t A_rows = transpose_A ? dim_K : dim_I;
+    const size_t A_cols = transpose_A ? dim_I : dim_K;
+    const size_t B_rows = transpose_B ? dim_J : dim_K;
+    const size_t B_cols = transpose_B ? dim_K : dim_J;
+    const size_t D_rows = repeating_bias ? 1 : dim_I;
+    const size_t sizeof_D = low_D ? sizeof(elem_t) : sizeof(acc_t);
+    const size_t sizeof_C = full_C ? sizeof(acc_t) : sizeof(elem_t);
+
+    // Wait for earlier matmuls which write this one's inputs, or which read
+    // or write its output
+    gemmini_wait_for_buffer(A, ((A_rows - 1) * stride_A + A_cols) * sizeof(elem_t), false);
+    gemmini_wait_for_buffer(B, ((B_rows - 1) * stride_B + B_cols) * sizeof(elem_t), false);
+    if (D != NULL)
+      gemmini_wait_for_buffer(D, ((D_rows - 1) * stride_D + dim_J) * sizeof_D, false);
+    gemmini_wait_for_buffer(C, ((dim_I - 1) * stride_C + dim_J) * sizeof_C, true);
+
+    if (gemmini_in_flight_n + 4 > 4 * GEMMINI_MAX_IN_FLIGHT)
+      gemmini_wait(gemmini_last_issued);
+
+    // The CPU computes the matmul itself, so it's already finished by the
+    // time it returns
+    if (tiled_matmul_type == CPU) {
+      tiled_matmul_auto(dim_I, dim_J, dim_K,
+          A, B, D, C,
+          stride_A, stride_B, stride_D, stride_C,
+          A_scale_factor, B_scale_factor, D_scale_factor,
+          act, scale, relu6_shift, repeating_bias,
+          transpose_A, transpose_B,
+          full_C, low_D,
+          tiled_matmul_type);
+      return gemmini_last_finished;
+    }
+
+    const gemmini_handle_t handle = ++gemmini_last_issued;
+
+    tiled_matmul_defer_fence = true;
+
+    tiled_matmul_auto(dim_I, dim_J, dim_K,
+        A, B, D, C,
+        stride_A, stride_B, stride_D, stride_C,
+        A_scale_factor, B_scale_factor, D_scale_factor,
+        act, scale, relu6_shift, repeating_bias,
+        transpose_A, transpose_B,
+        full_C, low_D,
+        tiled_matmul_type);
+
+    tiled_matmul_defer_fence = false;
+
+    gemmini_track_buffer(handle, A, A_rows, A_cols, stride_A, sizeof(elem_t), false);
+    gemmini_track_buffer(handle, B, B_rows, B_cols, stride_B, sizeof(elem_t), false);
+    gemmini_track_buffer(handle, D, D_rows, dim_J, stride_D, sizeof_D, false);
+    gemmini_track_buffer(handle, C, dim_I, dim_J, stride_C, sizeof_C, true);
+
+    return handle;
+}
+
+//============================================================================
+// Multi-accelerator matmuls
+//
+// tiled_matmul_multi splits the blocks of C between the harts of the pool that
+// gemmini_run_on_harts runs jobs on, and each hart computes its blocks on the
+// Gemmini attached to it. Every block is tile_I x tile_J tiles large, and is
+// computed with its own call to tiled_matmul.
+//
+// With STATIC_PARTITION, hart h computes every block whose index is h modulo
+// the number of harts. The blocks along the bottom and right edges of C can be
+// much smaller than the others though, so with WORK_STEALING, each hart
+// starts off with a contiguous range of blocks, and once it has claimed all of
+// its own, it claims the ones that are left in the other harts' ranges.
+//============================================================================
+
+enum tiled_matmul_partition_t {STATIC_PARTITION, WORK_STEALING};
+
+// How many blocks each hart computed, and how many cycles it spent on them
+struct tiled_matmul_multi_stats_t {
+  size_t harts;
+  size_t blocks[MATMUL_CPU_THREADS];
+  uint64_t cycles[MATMUL_CPU_THREADS];
+};
+
+struct tiled_matmul_multi_args_t {
+  size_t dim_I, dim_J, dim_K;
+  const elem_t * A;
+  const elem_t * B;
+  const void * D;
+  void * C;
+  size_t stride_A, stride_B, stride_D, stride_C;
+  scale_t A_scale_factor, B_scale_factor;
+  scale_acc_t D_scale_factor;
+  int act;
+  acc_scale_t scale;
+  size_t relu6_shift;
+  bool repeating_bias;
+  bool transpose_A, transpose_B;
+  bool full_C, low_D;
+  enum tiled_matmul_type_t tiled_matmul_type;
+  enum tiled_matmul_partition_t partition;
+
+  // Tiling factors, and the number of blocks along each dimension of C
+  size_t tile_I, tile_J, tile_K;
+  size_t I0, J0;
+
+  // With WORK_STEALING, the next unclaimed block in each hart's range, and
+  // the end of that range
+  volatile size_t next[MATMUL_CPU_THREADS];
+  size_t end[MATMUL_CPU_THREADS];
+
+  struct tiled_matmul_multi_stats_t stats;
+};
+
+static void tiled_matmul_multi_block(const struct tiled_matmul_multi_args_t * args,
+        size_t block) {
+
+  const size_t i0 = (block / args->J0) * args->tile_I * DIM;
+  const size_t j0 = (block % args->J0) * args->tile_J * DIM;
+  const size_t rows = args->dim_I - i0 > args->tile_I * DIM ? args->tile_I * DIM : args->dim_I - i0;
+  const size_t cols = args->dim_J - j0 > args->tile_J * DIM ? args->tile_J * DIM : args->dim_J - j0;
+
+  const elem_t * A = args->transpose_A ? args->A + i0 : args->A + i0 * args->stride_A;
+  const elem_t * B = args->transpose_B ? args->B + j0 * args->stride_B : args->B + j0;
+
+  const void * D = NULL;
+  if (args->D != NULL) {
+    const size_t sizeof_D = args->low_D ? sizeof(elem_t) : sizeof(acc_t);
+    const size_t bias_row = args->repeating_bias ? 0 : i0;
+    D = (const int8_t *)args->D + (bias_row * args->stride_D + j0) * sizeof_D;
+  }
+
+  const size_t sizeof_C = args->full_C ? sizeof(acc_t) : sizeof(elem_t);
+  void * C = (int8_t *)args->C + (i0 * args->stride_C + j0) * sizeof_C;
+
+  // The blocks along the edges of C may need smaller tiles
+  const size_t row_blocks = rows / DIM + (rows % DIM != 0);
+  const size_t col_blocks = cols / DIM + (cols % DIM != 0);
+
+  tiled_matmul(rows, cols, args->dim_K,
+      A, B, D, C,
+      args->stride_A, args->stride_B, args->stride_D, args->stride_C,
+      args->A_scale_factor, args->B_scale_factor, args->D_scale_factor,
+      args->act, args->scale, args->relu6_shift, args->repeating_bias,
+      row_blocks < args->tile_I ? row_blocks : args->tile_I,
+      col_blocks < args->tile_J ? col_blocks : args->tile_J,
+      args->tile_K,
+      args->transpose_A, args->transpose_B,
+      args->full_C, args->low_D,
+      args->tiled_matmul_type);
+}
+
+static void tiled_matmul_multi_job(size_t tid, size_t nthreads, const void * job) {
+  struct tiled_matmul_multi_args_t * args = (struct tiled_matmul_multi_args_t *)job;
+
+  const uint64_t start = gemmini_read_cycles();
+  size_t blocks = 0;
+
+  if (args->partition == STATIC_PARTITION) {
+    for (size_t block = tid; block < args->I0 * args->J0; block += nthreads) {
+      tiled_matmul_multi_block(args, block);
+      blocks++;
+    }
+  } else {
+    for (size_t t = 0; t < nthreads; t++) {
+      const size_t victim = (tid + t) % nthreads;
+
+      while (true) {
+        const size_t block = __sync_fetch_and_add(&args->next[victim], 1);
+        if (block >= args->end[victim])
+          break;
+
+        tiled_matmul_multi_block(args, block);
+        blocks++;
+      }
+    }
+  }
+
+  args->stats.blocks[tid] = blocks;
+  args->stats.cycles[tid] = gemmini_read_cycles() - start;
+}
+
+// This function runs a tiled matrix multiplication on every Gemmini in the
+// system, with automatically calculated tiling factors. If stats is not NULL,
+// it is filled in with how the work was split up
+void tiled_matmul_multi(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t* A, const elem_t* B,
+        const void * D, void * C,
+        size_t stride_A, size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        bool transpose_A, bool transpose_B,
+        bool full_C, bool low_D,
+        enum tiled_matmul_type_t tiled_matmul_type,
+        enum tiled_matmul_partition_t partition,
+        struct tiled_matmul_multi_stats_t * stats) {
+
+    const size_t harts = gemmini_hart_count();
+
+    // matmul_cpu already splits its work up between the harts
+    if (tiled_matmul_type == CPU || harts == 1) {
+      const uint64_t start = gemmini_read_cycles();
+
+      tiled_matmul_auto(dim_I, dim_J, dim_K,
+          A, B, D, C,
+          stride_A, stride_B, stride_D, stride_C,
+          A_scale_factor, B_scale_factor, D_scale_factor,
+          act, scale, relu6_shift, repeating_bias,
+          transpose_A, transpose_B,
+          full_C, low_D,
+          tiled_matmul_type);
+
+      if (stats != NULL) {
+        stats->harts = 1;
+        stats->blocks[0] = 1;
+        stats->cycles[0] = gemmini_read_cycles() - start;
+      }
+      return;
+    }
+
+    // The harts share hart 0's Gemmini state for asynchronous matmuls, so
+    // wait for those first
+    gemmini_wait(gemmini_last_issued);
+
+    struct tiled_matmul_multi_args_t args = {
+      dim_I, dim_J, dim_K,
+      A, B, D, C,
+      stride_A, stride_B, stride_D, stride_C,
+      A_scale_factor, B_scale_factor, D_scale_factor,
+      act, scale, relu6_shift, repeating_bias,
+      transpose_A, transpose_B,
+      full_C, low_D,
+      tiled_matmul_type, partition,
+    };
+
+    tiled_matmul_auto_tiling_factors(dim_I, dim_J, dim_K, tiled_matmul_type == WS,
+        &args.tile_I, &args.tile_J, &args.tile_K);
+
+    // Shrink the blocks until there are at least two for every hart, so that
+    // there is something left over for the harts which finish early to steal
+    const size_t dim_I_blocks = dim_I / DIM + (dim_I % DIM != 0);
+    const size_t dim_J_blocks = dim_J / DIM + (dim_J % DIM != 0);
+
+    while (true) {
+      args.I0 = dim_I_blocks / args.tile_I + (dim_I_blocks % args.tile_I != 0);
+      args.J0 = dim_J_blocks / args.tile_J + (dim_J_blocks % args.tile_J != 0);
+
+      if (args.I0 * args.J0 >= 2 * harts || (args.tile_I == 1 && args.tile_J == 1))
+        break;
+
+      if (args.tile_I >= args.tile_J)
+        args.tile_I = (args.tile_I + 1) / 2;
+      else
+        args.tile_J = (args.tile_J + 1) / 2;
+    }
+
+    const size_t total_blocks = args.I0 * args.J0;
+    for (size_t h = 0; h < harts; h++) {
+      args.next[h] = total_blocks * h / harts;
+      args.end[h] = total_blocks * (h + 1) / harts;
+    }
+
+    args.stats.harts = harts;
+    __sync_synchronize();
+
+    gemmini_run_on_harts(tiled_matmul_multi_job, &args);
+
+    if (stats != NULL)
+      *stats = args.stats;
+}
+
+//============================================================================
+// Chained matmuls
+//
+// A chain is a sequence of matmuls, like the fully-connected layers of an
+// MLP, where the output of each one is the A matrix of the next. Layer l
+// multiplies a dim_I x dims[l] matrix with the dims[l] x dims[l+1] matrix
+// B[l], adds the optional bias row D[l] to every row, and writes a dim_I x
+// dims[l+1] matrix to C[l]. All matrices are stored contiguously.
+//
+// Wherever the next layer fits in the scratchpad alongside it, a layer's
+// output is computed straight into the scratchpad with the OS dataflow, and
+// the next layer reads it from there. Its C[l] is then left untouched. It is
+// only moved out to DRAM when the chain can't continue on-chip, and after the
+// last layer.
+//============================================================================
+
+// Scratchpad rows used by the weights and biases of one layer of a chain:
+// two DIM-column panels of B and two blocks of bias, so that the next panel
+// can be moved in while the current one is being used
+static size_t tiled_matmul_chain_weight_rows(size_t K) {
+  return (2 * K + 2) * DIM;
+}
+
+// Checks whether a layer of a chain, with the given dimensions in units of DIM
+// x DIM blocks, fits in the scratchpad with its A matrix at A_sp_addr. If it
+// does, its output's scratchpad address is returned in C_sp_addr
+static bool tiled_matmul_chain_fits(size_t I, size_t J, size_t K,
+        size_t A_sp_addr, size_t * C_sp_addr) {
+
+  const size_t weight_sp_addr = BANK_NUM * BANK_ROWS - tiled_matmul_chain_weight_rows(K);
+  const size_t A_rows = I * K * DIM;
+  const size_t C_rows = I * J * DIM;
+
+  if (tiled_matmul_chain_weight_rows(K) > BANK_NUM * BANK_ROWS ||
+      A_sp_addr + A_rows > weight_sp_addr)
+    return false;
+
+  // Put C below A if there's room for it there, and above it otherwise
+  *C_sp_addr = A_sp_addr >= C_rows ? 0 : A_sp_addr + A_rows;
+
+  return *C_sp_addr + C_rows <= weight_sp_addr;
+}
+
+// Runs one layer of a chain with the OS dataflow, writing its output into the
+// scratchpad at C_sp_addr_start. If A is NULL, then the A matrix is already in
+// the scratchpad at A_sp_addr_start. Otherwise, it is moved in from A. If C
+// isn't NULL, then the output is also moved out to C
+static void sp_tiled_matmul_chain_layer(const elem_t * A, const elem_t * B,
+        const acc_t * D, elem_t * C,
+        size_t dim_I, size_t dim_J, size_t dim_K,
+        uint32_t A_sp_addr_start, uint32_t C_sp_addr_start,
+        int act, size_t relu6_shift) {
+
+  const size_t I = dim_I / DIM + (dim_I % DIM != 0);
+  const size_t J = dim_J / DIM + (dim_J % DIM != 0);
+  const size_t K = dim_K / DIM + (dim_K % DIM != 0);
+
+  const size_t pad_I = I * DIM - dim_I;
+  const size_t pad_J = J * DIM - dim_J;
+  const size_t pad_K = K * DIM - dim_K;
+
+  const uint32_t B_sp_addr_start = BANK_NUM * BANK_ROWS - tiled_matmul_chain_weight_rows(K);
+  const uint32_t D_sp_addr_start = B_sp_addr_start + 2 * K * DIM;
+
+  const int A_blocks = K <= MAX_BLOCK_LEN ? K : MAX_BLOCK_LEN;
+
+  gemmini_extended_config_ex(OUTPUT_STATIONARY, act, 0, ACC_SCALE_IDENTITY, relu6_shift, 1, false, false);
+  gemmini_extended3_config_ld(dim_J * sizeof(elem_t), MVIN_SCALE_IDENTITY, false, 1);
+  gemmini_extended3_config_ld(0, MVIN_SCALE_IDENTITY, false, 2); // The bias row is repeated
+  gemmini_config_st(dim_J * sizeof(elem_t));
+
+  // Move-in A
+  if (A != NULL) {
+    gemmini_extended3_config_ld(dim_K * sizeof(elem_t), MVIN_SCALE_IDENTITY, false, 0);
+
+    for (size_t i = 0; i < I; i++) {
+      for (size_t k = 0; k < K; k += A_blocks) {
+        const elem_t * const A_dram_addr = A + (i*dim_K + k)*DIM;
+        const uint32_t A_sp_addr = A_sp_addr_start + (i*K + k)*DIM;
+        const size_t blocks = k + A_blocks <= K ? A_blocks : K-k;
+        const size_t cols = blocks * DIM - (k + blocks >= K ? pad_K : 0);
+        const size_t rows = DIM - (i == I-1 ? pad_I : 0);
+        gemmini_extended_mvin(A_dram_addr, A_sp_addr, cols, rows);
+      }
+    }
+  }
+
+  for (size_t j = 0; j < J; j++) {
+    const uint32_t B_sp_addr = B_sp_addr_start + (j % 2) * K * DIM;
+    const uint32_t D_sp_addr = D_sp_addr_start + (j % 2) * DIM;
+
+    const size_t C_cols = DIM - (j == J-1 ? pad_J : 0);
+
+    // Move-in this column of B, and its bias
+    for (size_t k = 0; k < K; k++) {
+      const size_t rows = DIM - (k == K-1 ? pad_K : 0);
+      gemmini_extended_mvin2(B + (k*dim_J + j)*DIM, B_sp_addr + k*DIM, C_cols, rows);
+    }
+
+    if (D != NULL) {
+      gemmini_extended_mvin3(D + j*DIM, D_sp_addr, C_cols, DIM);
+    }
+
+    for (size_t i = 0; i < I; i++) {
+      const uint32_t C_sp_addr = C_sp_addr_start + (i*J + j)*DIM;
+      const size_t C_rows = DIM - (i == I-1 ? pad_I : 0);
+
+      for (size_t k = 0; k < K; k++) {
+        const uint32_t A_sp_addr = A_sp_addr_start + (i*K + k)*DIM;
+        const size_t A_cols = DIM - (k == K-1 ? pad_K : 0);
+
+        const uint32_t pre_sp_addr = k == 0 && D != NULL ? D_sp_addr : GARBAGE_ADDR;
+        const uint32_t out_sp_addr = k == K-1 ? C_sp_addr : GARBAGE_ADDR;
+
+        gemmini_extended_preload(pre_sp_addr, out_sp_addr, C_cols, C_rows, C_cols, C_rows);
+
+        if (k == 0) {
+          gemmini_extended_compute_preloaded(A_sp_addr, B_sp_addr + k*DIM, A_cols, C_rows, C_cols, A_cols);
+        } else {
+          gemmini_extended_compute_accumulated(A_sp_addr, B_sp_addr + k*DIM, A_cols, C_rows, C_cols, A_cols);
+        }
+      }
+
+      // Move-out C
+      if (C != NULL) {
+        gemmini_extended_mvout(C + (i*dim_J + j)*DIM, C_sp_addr, C_cols, C_rows);
+      }
+    }
+  }
+}
+
+// Layers can only be chained on-chip if nothing has to be applied to their
+// outputs on the way out of the accumulator. Their bias is preloaded from the
+// scratchpad, so it also has to fit in an elem_t
+static bool tiled_matmul_chain_can_chain(const acc_t * D, acc_scale_t scale) {
+  return scale == ACC_SCALE_IDENTITY && (D == NULL || sizeof(acc_t) == sizeof(elem_t));
+}
+
+// This function runs a chain of matmuls (see above). Layers which can't be
+// run on-chip, either because they don't fit or because of
+// tiled_matmul_chain_can_chain, are run with tiled_matmul_auto instead
+void tiled_matmul_chain(size_t n_layers, size_t dim_I, const size_t dims[],
+        const elem_t * A, const elem_t * const B[], const acc_t * const D[],
+        elem_t * const C[],
+        const int acts[], const acc_scale_t scales[], size_t relu6_shift,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+  const size_t I = dim_I / DIM + (dim_I % DIM != 0);
+
+  // Whether the current layer's A matrix is in the scratchpad, and where
+  bool on_chip = false;
+  size_t A_sp_addr = 0;
+
+  for (size_t l = 0; l < n_layers; l++) {
+    const size_t J = dims[l+1] / DIM + (dims[l+1] % DIM != 0);
+    const size_t K = dims[l] / DIM + (dims[l] % DIM != 0);
+    const elem_t * const A_dram = l == 0 ? A : C[l-1];
+
+    size_t C_sp_addr = 0;
+    const bool fits = tiled_matmul_type != CPU &&
+      tiled_matmul_chain_can_chain(D[l], scales[l]) &&
+      tiled_matmul_chain_fits(I, J, K, on_chip ? A_sp_addr : 0, &C_sp_addr);
+
+    if (!fits) {
+      // The previous layer only keeps its output on-chip if this one fits, so
+      // A is always in DRAM here
+      tiled_matmul_auto(dim_I, dims[l+1], dims[l],
+          A_dram, B[l], D[l], C[l],
+          dims[l], dims[l+1], dims[l+1], dims[l+1],
+          MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+          acts[l], scales[l], relu6_shift, D[l] != NULL,
+          false, false,
+          false, false,
+          tiled_matmul_type);
+
+      on_chip = false;
+      continue;
+    }
+
+    // Keep this layer's output on-chip if the next layer can carry on from it
+    size_t next_C_sp_addr;
+    const bool keep = l+1 < n_layers &&
+      tiled_matmul_chain_can_chain(D[l+1], scales[l+1]) &&
+      tiled_matmul_chain_fits(I, dims[l+2] / DIM + (dims[l+2] % DIM != 0), J,
+          C_sp_addr, &next_C_sp_addr);
+
+    sp_tiled_matmul_chain_layer(on_chip ? NULL : A_dram, B[l], D[l],
+        keep ? NULL : C[l],
+        dim_I, dims[l+1], dims[l],
+        on_chip ? A_sp_addr : 0, C_sp_addr,
+        acts[l], relu6_shift);
+
+    // Whatever reads C[l] next will read it from DRAM
+    if (!keep)
+      gemmini_fence();
+
+    on_chip = keep;
+    A_sp_addr = C_sp_addr;
+  }
+}
+
+static void tiled_matmul_auto_cisc(
+  size_t M, size_t N, size_t K,
+  const elem_t* A, const elem_t* B, const acc_t * D, elem_t* C,
+  int act, size_t shift, size_t relu6_shift, bool repeating_bias)
+{
+  gemmini_config_reset();
+  gemmini_config_cisc_ex(act, 0, shift, relu6_shift);
+  gemmini_config_addr_ab((uintptr_t)A, (uintptr_t)B);
+  gemmini_config_addr_cd((uintptr_t)C, (uintptr_t)D);
+  gemmini_config_size0(M, N);
+  gemmini_config_size1(K);
+  gemmini_config_repeating_bias(repeating_bias);
+  gemmini_compute_cisc();
+  gemmini_fence();
+}
+
+//============================================================================
+// Sparse-dense matmuls
+//
+// "A" is a sparse matrix in COO format: A_data[n] holds the value of the n-th
+// nonzero, and A_coo[2*n], A_coo[2*n+1] hold its row and column. The nonzeros
+// must be sorted in tile order, i.e. grouped by DIM x DIM tile, with the tiles
+// in row-major order, and the nonzeros in row-major order within each tile.
+// A_tile_offsets says where each tile's nonzeros are (see
+// spmm_coo_tile_offsets), so the tiled kernels find any tile of A in O(1),
+// and each sparse mvin only reads that tile's nonzeros. "B", "D", and "C" are
+// dense, like in tiled_matmul.
+//============================================================================
+
+// Fills A_tile_offsets, which must have room for one entry per DIM x DIM tile
+// of a tile-ordered COO matrix, plus one. Entry i*K + k, where K is the
+// number of tile columns, is the index of tile (i, k)'s first nonzero, and
+// the entry after it is one past its last nonzero
+static void spmm_coo_tile_offsets(size_t dim_I, size_t dim_K,
+        const ind_t * A_coo, size_t A_nnz, ind_t * A_tile_offsets) {
+  const size_t I = dim_I / DIM + (dim_I % DIM != 0);
+  const size_t K = dim_K / DIM + (dim_K % DIM != 0);
+
+  size_t n = 0;
+  for (size_t t = 0; t < I * K; t++) {
+    A_tile_offsets[t] = n;
+    while (n < A_nnz && (A_coo[2*n] / DIM) * K + A_coo[2*n+1] / DIM == t)
+      n++;
+  }
+  A_tile_offsets[I * K] = n;
+}
+
+// Returns whether a COO matrix's nonzeros are sorted in tile order
+static bool spmm_coo_is_tile_ordered(const ind_t * A_coo, size_t A_nnz) {
+  for (size_t n = 1; n < A_nnz; n++) {
+    const ind_t * const a = A_coo + 2*(n-1);
+    const ind_t * const b = A_coo + 2*n;
+
+    if (a[0] / DIM != b[0] / DIM) {
+      if (a[0] / DIM > b[0] / DIM)
+        return false;
+    } else if (a[1] / DIM != b[1] / DIM) {
+      if (a[1] / DIM > b[1] / DIM)
+        return false;
+    } else if (a[0] > b[0] || (a[0] == b[0] && a[1] >= b[1])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Converts a row-major sorted COO matrix with dim_I rows to CSR. The values
+// are in the same order in both formats, so A_data can be used as is.
+// row_ptr must have room for dim_I+1 entries
+static void spmm_coo_to_csr(size_t dim_I, const ind_t * A_coo, size_t A_nnz,
+        ind_t * col_idx, ind_t * row_ptr) {
+  size_t n = 0;
+  for (size_t i = 0; i < dim_I; i++) {
+    row_ptr[i] = n;
+    for (; n < A_nnz && A_coo[2*n] == i; n++)
+      col_idx[n] = A_coo[2*n+1];
+  }
+  row_ptr[dim_I] = n;
+}
+
+// Returns how many DIM x DIM blocks of a CSR matrix have any nonzeros in
+// them, which is how many blocks spmm_csr_to_bcsr will store
+static size_t spmm_csr_nnz_blocks(size_t dim_I, size_t dim_K,
+        const ind_t * col_idx, const ind_t * row_ptr) {
+  const size_t I = dim_I / DIM + (dim_I % DIM != 0);
+  const size_t K = dim_K / DIM + (dim_K % DIM != 0);
+
+  size_t last_row[K];
+  for (size_t k = 0; k < K; k++)
+    last_row[k] = I;
+
+  size_t blocks = 0;
+  for (size_t i = 0; i < I; i++)
+    for (size_t r = i*DIM; r < dim_I && r < (i+1)*DIM; r++)
+      for (size_t n = row_ptr[r]; n < row_ptr[r+1]; n++) {
+        const size_t k = col_idx[n] / DIM;
+        if (last_row[k] != i) {
+          last_row[k] = i;
+          blocks++;
+        }
+      }
+
+  return blocks;
+}
+
+// Converts a CSR matrix to blocked CSR. block_data must have room for
+// DIM*DIM values per block, block_col_idx for one index per block, and
+// block_row_ptr for one pointer per block row, plus one. The values which
+// pad out the edge blocks are zeros
+static void spmm_csr_to_bcsr(size_t dim_I, size_t dim_K,
+        const elem_t * data, const ind_t * col_idx, const ind_t * row_ptr,
+        elem_t * block_data, ind_t * block_col_idx, ind_t * block_row_ptr) {
+  const size_t I = dim_I / DIM + (dim_I % DIM != 0);
+  const size_t K = dim_K / DIM + (dim_K % DIM != 0);
+
+  bool nonempty[K];
+  size_t slot[K];
+  size_t blocks = 0;
+
+  for (size_t i = 0; i < I; i++) {
+    const size_t row_end = (i+1)*DIM < dim_I ? (i+1)*DIM : dim_I;
+
+    for (size_t k = 0; k < K; k++)
+      nonempty[k] = false;
+
+    for (size_t r = i*DIM; r < row_end; r++)
+      for (size_t n = row_ptr[r]; n < row_ptr[r+1]; n++)
+        nonempty[col_idx[n] / DIM] = true;
+
+    // Store the blocks in column order
+    block_row_ptr[i] = blocks;
+    for (size_t k = 0; k < K; k++) {
+      if (!nonempty[k])
+        continue;
+
+      slot[k] = blocks;
+      block_col_idx[blocks] = k;
+      for (size_t x = 0; x < DIM*DIM; x++)
+        block_data[blocks*DIM*DIM + x] = 0;
+      blocks++;
+    }
+
+    for (size_t r = i*DIM; r < row_end; r++)
+      for (size_t n = row_ptr[r]; n < row_ptr[r+1]; n++) {
+        const size_t k = col_idx[n] / DIM;
+        block_data[slot[k]*DIM*DIM + (r % DIM)*DIM + col_idx[n] % DIM] = data[n];
+      }
+  }
+
+  block_row_ptr[I] = blocks;
+}
+
+// Splits each row of a CSR matrix at every tile_width columns. tile_ptr must
+// have room for rows*tile_cols + 1 entries, where tile_cols is the number of
+// tile columns. Entry r*tile_cols + k is the index of the first value of row
+// r in tile column k, and the entry after it is one past the last one, which
+// is where row r+1 starts when k is the last tile column. For a CSR matrix,
+// tile_width is DIM. For a blocked-CSR matrix, whose rows are block rows and
+// whose columns are block columns, it's 1
+static void spmm_csr_tile_ptr(size_t rows, size_t tile_cols, size_t tile_width,
+        const ind_t * col_idx, const ind_t * row_ptr, ind_t * tile_ptr) {
+  for (size_t r = 0; r < rows; r++) {
+    size_t n = row_ptr[r];
+    for (size_t k = 0; k < tile_cols; k++) {
+      tile_ptr[r*tile_cols + k] = n;
+      while (n < row_ptr[r+1] && col_idx[n] < (k+1) * tile_width)
+        n++;
+    }
+  }
+
+  tile_ptr[rows * tile_cols] = row_ptr[rows];
+}
+
+#ifndef GEMMINI_HW_SPARSE_MVIN
+// Software versions of the CSR and blocked-CSR mvins. The tile is decompressed
+// into a buffer on the CPU, and then moved in one row at a time, so that the
+// mvin stride which the caller configured isn't disturbed. The buffer can't
+// be reused until the previous tile has been moved in, so this fences first
+static elem_t mvin_sparse_sw_buf[DIM][DIM] row_align(1);
+
+static void mvin_sparse_sw_rows(uint32_t spad_addr, size_t cols, size_t rows) {
+  for (size_t r = 0; r < rows; r++)
+    gemmini_extended_mvin(mvin_sparse_sw_buf[r], spad_addr + r, cols, 1);
+}
+
+static void mvin_sparse_csr_sw(const elem_t * data, const ind_t * col_idx,
+        const ind_t * tile_ptr, size_t tile_cols, uint32_t spad_addr,
+        size_t start_col, size_t cols, size_t start_row, size_t rows) {
+  gemmini_fence();
+
+  for (size_t r = 0; r < rows; r++) {
+    const size_t t = (start_row + r) * tile_cols + start_col / DIM;
+
+    for (size_t c = 0; c < cols; c++)
+      mvin_sparse_sw_buf[r][c] = 0;
+
+    for (size_t n = tile_ptr[t]; n < tile_ptr[t+1]; n++)
+      mvin_sparse_sw_buf[r][col_idx[n] - start_col] = data[n];
+  }
+
+  mvin_sparse_sw_rows(spad_addr, cols, rows);
+}
+
+static void mvin_sparse_bcsr_sw(const elem_t * block_data,
+        const ind_t * tile_ptr, size_t tile_cols, uint32_t spad_addr,
+        size_t block_col, size_t cols, size_t block_row, size_t rows) {
+  gemmini_fence();
+
+  const size_t t = block_row * tile_cols + block_col;
+  const elem_t * block = tile_ptr[t] < tile_ptr[t+1] ?
+    block_data + tile_ptr[t]*DIM*DIM : NULL;
+
+  for (size_t r = 0; r < rows; r++)
+    for (size_t c = 0; c < cols; c++)
+      mvin_sparse_sw_buf[r][c] = block == NULL ? 0 : block[r*DIM + c];
+
+  mvin_sparse_sw_rows(spad_addr, cols, rows);
+}
+#endif
+
+static void sp_tiled_spmm_ws(const elem_t * A_data, const ind_t * A_coo,
+        const ind_t * A_tile_offsets, size_t A_tile_cols,
+        const elem_t * B, const void * D, void * C,
+        size_t i_start, size_t k_start,
+        size_t I, size_t J, size_t K, size_t pad_I, size_t pad_J, size_t pad_K,
+        size_t B_row_stride, size_t D_row_stride, size_t C_row_stride,
+        bool full_C, bool low_D,
+        bool no_bias, bool repeating_bias) {
+
+  const uint32_t A_sp_addr_start = 0;
+  const uint32_t B_sp_addr_start = BANK_NUM * BANK_ROWS - K * J * DIM;
+  const uint32_t D_sp_addr_start = 1 << (ADDR_LEN-1);
+  const uint32_t C_sp_addr_start = (3 << (ADDR_LEN-2)) | (full_C << (ADDR_LEN-3));
+
+  const int B_blocks = J <= MAX_BLOCK_LEN ? J : MAX_BLOCK_LEN;
+  const int D_blocks = low_D ? (J <= MAX_BLOCK_LEN ? J : MAX_BLOCK_LEN) :
+    (J <= MAX_BLOCK_LEN_ACC ? J : MAX_BLOCK_LEN_ACC);
+
+  const size_t sizeof_D = low_D ? sizeof(elem_t) : sizeof(acc_t);
+  const size_t sizeof_C = full_C ? sizeof(acc_t) : sizeof(elem_t);
+
+  // The nonzeros of block (i, k) of A are A_tiles[i*A_tile_cols + k] up to
+  // the next offset. Blocks where those are equal are entirely zero
+  const ind_t * const A_tiles = A_tile_offsets + i_start * A_tile_cols + k_start;
+
+  bool k_nonempty[K];
+
+  for (size_t k = 0; k < K; k++) {
+    k_nonempty[k] = false;
+    for (size_t i = 0; i < I; i++)
+      k_nonempty[k] |= A_tiles[i*A_tile_cols + k] != A_tiles[i*A_tile_cols + k + 1];
+  }
+
+  // Move-in D. If there's no bias, then we move in zeros instead, because C
+  // blocks which get no contributions from A still need to be written out
+  if (D != NULL) {
+    static acc_t zeros[DIM] = {0};
+
+    for (size_t i = 0; i < I; i++) {
+      const size_t rows = DIM - (i == I-1 ? pad_I : 0);
+      for (size_t j = 0; j < J; j += (no_bias ? 1 : D_blocks)) {
+        const size_t bias_row = repeating_bias ? 0 : i;
+        const void * const D_dram_addr = no_bias ? (void *)zeros :
+          (int8_t *)D + (bias_row * D_row_stride + j)*DIM*sizeof_D;
+        const uint32_t D_sp_addr_acc = D_sp_addr_start + (i*J + j)*DIM;
+        const size_t blocks = no_bias ? 1 : (j + D_blocks <= J ? D_blocks : J-j);
+        const size_t cols = blocks * DIM - (j + blocks >= J ? pad_J : 0);
+        gemmini_extended_mvin3(D_dram_addr, D_sp_addr_acc, cols, rows);
+      }
+    }
+  }
+
+  // Move-in B, but only the rows which will be multiplied by a nonzero block
+  for (size_t k = 0; k < K; k++) {
+    if (!k_nonempty[k])
+      continue;
+
+    const size_t rows = DIM - (k == K-1 ? pad_K : 0);
+    for (size_t j = 0; j < J; j += B_blocks) {
+      const elem_t * const B_dram_addr = B + (k*B_row_stride + j)*DIM;
+      const uint32_t B_sp_addr = B_sp_addr_start + (k*J + j)*DIM;
+      const size_t blocks = j + B_blocks <= J ? B_blocks : J-j;
+      const size_t cols = blocks * DIM - (j + blocks >= J ? pad_J : 0);
+      gemmini_extended_mvin2(B_dram_addr, B_sp_addr, cols, rows);
+    }
+  }
+
+  // Move-in A, skipping blocks which are entirely zero
+  for (size_t i = 0; i < I; i++) {
+    const size_t rows = DIM - (i == I-1 ? pad_I : 0);
+    for (size_t k = 0; k < K; k++) {
+      const size_t n = A_tiles[i*A_tile_cols + k];
+      const size_t n_end = A_tiles[i*A_tile_cols + k + 1];
+      if (n == n_end)
+        continue;
+
+      const uint32_t A_sp_addr = A_sp_addr_start + (i*K + k)*DIM;
+      const size_t cols = DIM - (k == K-1 ? pad_K : 0);
+      gemmini_extended_mvin_sparse_coo(A_data + n, A_coo + 2*n, n_end - n,
+          A_sp_addr, (k_start + k) * DIM, cols, (i_start + i) * DIM, rows);
+    }
+  }
+
+  // Compute
+  for (size_t j = 0; j < J; j++) {
+    for (size_t k = 0; k < K; k++) {
+      bool preloaded = false;
+
+      for (size_t i = 0; i < I; i++) {
+        if (A_tiles[i*A_tile_cols + k] == A_tiles[i*A_tile_cols + k + 1])
+          continue;
+
+        const uint32_t A_sp_addr = A_sp_addr_start + (i*K + k)*DIM;
+        const uint32_t B_sp_addr = B_sp_addr_start + (k*J + j)*DIM;
+        const uint32_t C_sp_addr = C_sp_addr_start + (i*J + j)*DIM;
+
+        const size_t A_cols = DIM - (k == K - 1 ? pad_K : 0);
+        const size_t A_rows = DIM - (i == I - 1 ? pad_I : 0);
+        const size_t B_cols = DIM - (j == J - 1 ? pad_J : 0);
+        const size_t B_rows = DIM - (k == K - 1 ? pad_K : 0);
+        const size_t C_cols = DIM - (j == J - 1 ? pad_J : 0);
+        const size_t C_rows = DIM - (i == I - 1 ? pad_I : 0);
+
+        if (!preloaded) {
+          gemmini_extended_preload(B_sp_addr, C_sp_addr, B_cols, B_rows, C_cols, C_rows);
+          gemmini_extended_compute_preloaded(A_sp_addr, GARBAGE_ADDR, A_cols, A_rows, DIM, DIM);
+          preloaded = true;
+        } else {
+          gemmini_extended_preload(GARBAGE_ADDR, C_sp_addr, B_cols, B_rows, C_cols, C_rows);
+          gemmini_extended_compute_accumulated(A_sp_addr, GARBAGE_ADDR, A_cols, A_rows, DIM, DIM);
+        }
+      }
+    }
+  }
+
+  // Move-out C
+  if (C != NULL) {
+    for (size_t i = 0; i < I; i++) {
+      for (size_t j = 0; j < J; j++) {
+        void * const C_dram_addr = (int8_t*)C + (i*C_row_stride + j)*DIM*sizeof_C;
+        const uint32_t C_sp_addr = C_sp_addr_start + (i*J + j)*DIM;
+
+        const size_t C_cols = DIM - (j == J - 1 ? pad_J : 0);
+        const size_t C_rows = DIM - (i == I - 1 ? pad_I : 0);
+
+        gemmini_extended_mvout(C_dram_addr, C_sp_addr, C_cols, C_rows);
+      }
+    }
+  }
+}
+
+static void tiled_spmm_outer(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t * A_data, const ind_t * A_coo, const ind_t * A_tile_offsets,
+        const elem_t * B, const void * D, void * C,
+        size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        size_t tile_I, size_t tile_J, size_t tile_K,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        bool full_C, bool low_D) {
+
+  const size_t dim_I_padded = (dim_I / DIM + (dim_I % DIM != 0)) * DIM;
+  const size_t dim_J_padded = (dim_J / DIM + (dim_J % DIM != 0)) * DIM;
+  const size_t dim_K_padded = (dim_K / DIM + (dim_K % DIM != 0)) * DIM;
+
+  const size_t I0 = dim_I_padded / (tile_I*DIM) + (dim_I_padded % (tile_I*DIM) != 0);
+  const size_t J0 = dim_J_padded / (tile_J*DIM) + (dim_J_padded % (tile_J*DIM) != 0);
+  const size_t K0 = dim_K_padded / (tile_K*DIM) + (dim_K_padded % (tile_K*DIM) != 0);
+
+  const size_t last_I = dim_I_padded % (tile_I*DIM) == 0 ? tile_I : (dim_I_padded/DIM) % tile_I;
+  const size_t last_J = dim_J_padded % (tile_J*DIM) == 0 ? tile_J : (dim_J_padded/DIM) % tile_J;
+  const size_t last_K = dim_K_padded % (tile_K*DIM) == 0 ? tile_K : (dim_K_padded/DIM) % tile_K;
+
+  const size_t padding_I = dim_I_padded - dim_I;
+  const size_t padding_J = dim_J_padded - dim_J;
+  const size_t padding_K = dim_K_padded - dim_K;
+
+  const bool no_bias = D == NULL;
+
+  if (no_bias) {
+    D = (void*) 1; // Dummy address which isn't NULL
+  }
+
+  const size_t sizeof_D = low_D ? sizeof(elem_t) : sizeof(acc_t) ;
+  const size_t sizeof_C = full_C ? sizeof(acc_t) : sizeof(elem_t);
+
+  gemmini_extended_config_ex(WEIGHT_STATIONARY, act, 0, scale, relu6_shift, 1, false, false);
+  gemmini_config_st(stride_C * sizeof_C);
+  gemmini_extended3_config_ld(0, A_scale_factor, false, 0);
+  gemmini_extended3_config_ld(stride_B * sizeof(elem_t), B_scale_factor, false, 1)
+  if (no_bias) {
+    gemmini_extended3_config_ld(0, MVIN_SCALE_IDENTITY, false, 2);
+  } else {
+    gemmini_extended3_config_ld(repeating_bias ? 0 : (stride_D * sizeof_D), D_scale_factor, low_D, 2);
+  }
+
+  for (size_t i0 = 0; i0 < I0; i0++)
+    for (size_t j0 = 0; j0 < J0; j0++)
+      for (size_t k0 = 0; k0 < K0; k0++) {
+
+        const void * pre;
+        if (k0 != 0) {
+          pre = NULL;
+        } else {
+          size_t bias_row = repeating_bias ? 0 : i0*tile_I*DIM;
+          pre = (int8_t*)D + (bias_row * stride_D + j0 * tile_J * DIM)*sizeof_D;
+        }
+
+        void * out = k0 == K0-1 ? (int8_t*)C + (i0*tile_I*DIM*stride_C + j0*tile_J*DIM)*sizeof_C : NULL;
+
+        const size_t I = i0 < I0-1 ? tile_I : last_I;
+        const size_t J = j0 < J0-1 ? tile_J : last_J;
+        const size_t K = k0 < K0-1 ? tile_K : last_K;
+
+        const size_t pad_I = i0 == I0-1 ? padding_I : 0;
+        const size_t pad_J = j0 == J0-1 ? padding_J : 0;
+        const size_t pad_K = k0 == K0-1 ? padding_K : 0;
+
+        const elem_t * b = B + k0*tile_K*DIM*stride_B + j0*tile_J*DIM;
+
+        sp_tiled_spmm_ws(A_data, A_coo, A_tile_offsets, dim_K_padded / DIM,
+            b, pre, out,
+            i0*tile_I, k0*tile_K,
+            I, J, K,
+            pad_I, pad_J, pad_K,
+            stride_B, stride_D, stride_C,
+            full_C, low_D,
+            no_bias, repeating_bias);
+      }
+
+  gemmini_fence();
+}
+
+static void spmm_cpu(size_t DIM_I, size_t DIM_J, size_t DIM_K,
+        const elem_t * A_data, const ind_t * A_coo, const ind_t * A_tile_offsets,
+        const elem_t* B, const acc_t * D,
+        elem_t* C,
+        size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias) {
+
+  const int no_bias = D == NULL;
+  const size_t K_total = DIM_K / DIM + (DIM_K % DIM != 0);
+
+  acc_t result[DIM][DIM_J];
+
+  // A block row's nonzeros are contiguous in tile order, and each row's
+  // nonzeros are still in column order within it
+  for (size_t i0 = 0; i0 < DIM_I; i0 += DIM) {
+    const size_t rows = DIM_I - i0 < DIM ? DIM_I - i0 : DIM;
+
+    for (size_t i = 0; i < rows; i++) {
+      const size_t bias_row = repeating_bias ? 0 : i0 + i;
+      for (size_t j = 0; j < DIM_J; j++) {
+        result[i][j] = no_bias ? 0 :
+#ifdef HAS_MVIN_ACC_SCALE
+          MVIN_SCALE_ACC(*(D + bias_row * stride_D + j), D_scale_factor);
+#else
+          *(D + bias_row * stride_D + j);
+#endif
+      }
+    }
+
+    const size_t n_end = A_tile_offsets[(i0 / DIM + 1) * K_total];
+    for (size_t n = A_tile_offsets[(i0 / DIM) * K_total]; n < n_end; n++) {
+#ifdef HAS_MVIN_SCALE
+      const elem_t a = MVIN_SCALE(A_data[n], A_scale_factor);
+#else
+      const elem_t a = A_data[n];
+#endif
+      const elem_t * const b_row = B + A_coo[2*n+1] * stride_B;
+      acc_t * const r = result[A_coo[2*n] - i0];
+
+      for (size_t j = 0; j < DIM_J; j++) {
+#ifdef HAS_MVIN_SCALE
+        r[j] += a * MVIN_SCALE(b_row[j], B_scale_factor);
+#else
+        r[j] += a * b_row[j];
+#endif
+      }
+    }
+
+    for (size_t i = 0; i < rows; i++)
+      for (size_t j = 0; j < DIM_J; j++)
+        *(C + (i0 + i)*stride_C + j) = scale_and_sat(result[i][j], act, scale, relu6_shift);
+  }
+}
+
+// This function runs a tiled sparse-dense matrix multiplication, with
+// hardcoded tiling factors. Only the WS dataflow and the CPU are supported
+void tiled_spmm(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t * A_data, const ind_t * A_coo, size_t A_nnz,
+        const ind_t * A_tile_offsets,
+        const elem_t* B, const void * D, void* C,
+        size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        size_t tile_I, size_t tile_J, size_t tile_K,
+        bool full_C, bool low_D,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+#ifdef GEMMINI_ASSERTIONS
+  if (tile_I <= 0 || tile_J <= 0 || tile_K <= 0) {
+    printf("Tiling factors must be positive\n");
+    exit(1);
+  }
+
+  if (tiled_matmul_type == OS) {
+    printf("Not implemented: OS spmm\n");
+    exit(1);
+  }
+
+  if (tiled_matmul_type == CPU && (full_C || low_D)) {
+    printf("Not implemented: CPU spmm, full_C=%d, low_D=%d\n", full_C, low_D);
+    exit(1);
+  }
+
+  const size_t total_spad_rows = (tile_I * tile_K * DIM) + (tile_K * tile_J * DIM);
+  const size_t total_acc_rows = tile_I * tile_J * DIM;
+
+  if (total_spad_rows > BANK_NUM * BANK_ROWS / 2) {
+    printf("Not enough space in scratchpad to store A and B matrices\n");
+    exit(1);
+  }
+
+  if (total_acc_rows > ACC_ROWS / 2) {
+    printf("Not enough space in accumulator to store C\n");
+    exit(1);
+  }
+
+  // The sparse mvin only has 16 bits for the row and column offsets
+  if (dim_I > 65535 || dim_K > 65535) {
+    printf("I and K dimensions must be less than 65535, to fit within the bounds of the sparse mvin\n");
+    exit(1);
+  }
+
+  if (!spmm_coo_is_tile_ordered(A_coo, A_nnz)) {
+    printf("Sparse A matrix must be sorted in tile order\n");
+    exit(1);
+  }
+#endif
+
+  if (tiled_matmul_type == WS) {
+    tiled_spmm_outer(dim_I, dim_J, dim_K,
+        A_data, A_coo, A_tile_offsets,
+        B, D, C,
+        stride_B, stride_D, stride_C,
+        A_scale_factor, B_scale_factor, D_scale_factor,
+        tile_I, tile_J, tile_K,
+        act, scale, relu6_shift, repeating_bias,
+        full_C, low_D);
+  } else /*if (tiled_matmul_type == CPU)*/ {
+    spmm_cpu(dim_I, dim_J, dim_K,
+        A_data, A_coo, A_tile_offsets,
+        B, D, (elem_t*)C,
+        stride_B, stride_D, stride_C,
+        A_scale_factor, B_scale_factor, D_scale_factor,
+        act, scale, relu6_shift, repeating_bias);
+  }
+}
+
+// This function runs a tiled sparse-dense matrix multiplication, with
+// automatically calculated tiling factors. DIM x DIM blocks of A which are
+// entirely zero are never moved in or multiplied
+void tiled_spmm_auto(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t * A_data, const ind_t * A_coo, size_t A_nnz,
+        const ind_t * A_tile_offsets,
+        const elem_t* B, const void * D, void* C,
+        size_t stride_B, size_t stride_D, size_t stride_C,
+        scale_t A_scale_factor, scale_t B_scale_factor, scale_acc_t D_scale_factor,
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        bool full_C, bool low_D,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+    size_t tile_I, tile_J, tile_K;
+    tiled_matmul_auto_tiling_factors(dim_I, dim_J, dim_K, true,
+        &tile_I, &tile_J, &tile_K);
+
+    tiled_spmm(dim_I, dim_J, dim_K,
+        A_data, A_coo, A_nnz,
+        A_tile_offsets,
+        B, D, C,
+        stride_B, stride_D, stride_C,
+        A_scale_factor, B_scale_factor, D_scale_factor,
+        act, scale, relu6_shift, repeating_bias,
+        tile_I, tile_J, tile_K,
+        full_C, low_D,
+        tiled_matmul_type);
+}
+
+//============================================================================
+// Sampled dense-dense matmuls
+//
+// These compute A * B only at the positions of a sparse mask's nonzeros,
+// which is what graph attention needs. The mask is a tile-ordered COO matrix,
+// with its tile offsets, like tiled_spmm's A matrix, but only its indices are
+// used.
+//============================================================================
+
+static void sddmm_cpu(size_t dim_K,
+        const elem_t * A, const elem_t * B,
+        const ind_t * mask_coo, size_t mask_nnz,
+        elem_t * out_values,
+        size_t stride_A, size_t stride_B,
+        int act, acc_scale_t scale) {
+  for (size_t n = 0; n < mask_nnz; n++) {
+    const elem_t * const a = A + mask_coo[2*n] * stride_A;
+    const elem_t * const b = B + mask_coo[2*n+1];
+
+    acc_t result = 0;
+    for (size_t k = 0; k < dim_K; k++)
+      result += a[k] * b[k * stride_B];
+
+    out_values[n] = scale_and_sat(result, act, scale, 0);
+  }
+}
+
+// Output tiles are moved out to tiled_sddmm_buf, which holds one block row
+// of TILED_SDDMM_WINDOW blocks, before the mask's values are gathered from it
+#ifndef TILED_SDDMM_WINDOW
+#define TILED_SDDMM_WINDOW 8
+#endif
+
+static elem_t tiled_sddmm_buf[DIM][TILED_SDDMM_WINDOW * DIM] row_align(1);
+
+// This function runs a sampled dense-dense matmul: out_values[n] is the
+// value of A * B at the row and column of the mask's n-th nonzero. Only the
+// DIM x DIM tiles of the output which the mask has any nonzeros in are
+// computed, with the same WS loop as tiled_matmul. Each block row is worked
+// through in windows of TILED_SDDMM_WINDOW blocks, starting from the mask's
+// first nonempty tile. A window's tiles are moved out to tiled_sddmm_buf, and
+// then the mask's values are gathered from it
+void tiled_sddmm_auto(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t * A, const elem_t * B,
+        const ind_t * mask_coo, size_t mask_nnz,
+        const ind_t * mask_tile_offsets,
+        elem_t * out_values,
+        size_t stride_A, size_t stride_B,
+        int act, acc_scale_t scale,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+#ifdef GEMMINI_ASSERTIONS
+  if (tiled_matmul_type == OS) {
+    printf("Not implemented: OS sddmm\n");
+    exit(1);
+  }
+
+  if (!spmm_coo_is_tile_ordered(mask_coo, mask_nnz)) {
+    printf("Sparse mask must be sorted in tile order\n");
+    exit(1);
+  }
+#endif
+
+  if (tiled_matmul_type == CPU) {
+    sddmm_cpu(dim_K, A, B, mask_coo, mask_nnz, out_values,
+        stride_A, stride_B, act, scale);
+    return;
+  }
+
+  const size_t I_total = dim_I / DIM + (dim_I % DIM != 0);
+  const size_t J_total = dim_J / DIM + (dim_J % DIM != 0);
+  const size_t K_total = dim_K / DIM + (dim_K % DIM != 0);
+
+  const size_t pad_I = I_total * DIM - dim_I;
+  const size_t pad_J = J_total * DIM - dim_J;
+  const size_t pad_K = K_total * DIM - dim_K;
+
+  // Each output tile is one block row high, and as wide as the longest run of
+  // neighboring nonempty blocks, up to tile_J
+  size_t tile_I, tile_J, tile_K;
+  tiled_matmul_auto_tiling_factors(DIM, dim_J, dim_K, true,
+      &tile_I, &tile_J, &tile_K);
+
+  const size_t K0 = K_total / tile_K + (K_total % tile_K != 0);
+
+  gemmini_extended_config_ex(WEIGHT_STATIONARY, act, 0, scale, 0, 1, false, false);
+  gemmini_config_st(TILED_SDDMM_WINDOW * DIM * sizeof(elem_t));
+  gemmini_extended3_config_ld(stride_A * sizeof(elem_t), MVIN_SCALE_IDENTITY, false, 0);
+  gemmini_extended3_config_ld(stride_B * sizeof(elem_t), MVIN_SCALE_IDENTITY, false, 1);
+
+  for (size_t i = 0; i < I_total; i++) {
+    // The mask's nonzeros in block (i, j) are tiles[j] up to tiles[j+1]
+    const ind_t * const tiles = mask_tile_offsets + i * J_total;
+
+    size_t j0 = 0;
+
+    while (true) {
+      // Start the next window at the first nonempty block which is left
+      while (j0 < J_total && tiles[j0] == tiles[j0 + 1])
+        j0++;
+
+      if (j0 == J_total)
+        break;
+
+      const size_t window_end = j0 + TILED_SDDMM_WINDOW < J_total ?
+        j0 + TILED_SDDMM_WINDOW : J_total;
+
+      for (size_t j = j0; j < window_end; ) {
+        if (tiles[j] == tiles[j + 1]) {
+          j++;
+          continue;
+        }
+
+        size_t J = 1;
+        while (J < tile_J && j + J < window_end && tiles[j + J] != tiles[j + J + 1])
+          J++;
+
+        for (size_t k0 = 0; k0 < K0; k0++) {
+          const size_t K = k0 < K0-1 ? tile_K : K_total - k0*tile_K;
+
+          // With no bias, a non-NULL D on the first k-slice is what tells the
+          // loop to overwrite the accumulator instead of accumulating into it
+          sp_tiled_matmul_ws(A + i*DIM*stride_A + k0*tile_K*DIM,
+              B + k0*tile_K*DIM*stride_B + j*DIM,
+              k0 == 0 ? (void*)1 : NULL,
+              k0 == K0-1 ? &tiled_sddmm_buf[0][(j - j0)*DIM] : NULL,
+              MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+              1, J, K,
+              i == I_total-1 ? pad_I : 0,
+              j + J == J_total ? pad_J : 0,
+              k0 == K0-1 ? pad_K : 0,
+              stride_A, stride_B, 0, TILED_SDDMM_WINDOW * DIM,
+              false, false,
+              false, false,
+              true, false);
+        }
+
+        j += J;
+      }
+
+      gemmini_fence();
+
+      for (size_t n = tiles[j0]; n < tiles[window_end]; n++)
+        out_values[n] = tiled_sddmm_buf[mask_coo[2*n] - i*DIM][mask_coo[2*n+1] - j0*DIM];
+
+      j0 = window_end;
+    }
+  }
+}
+
+//============================================================================
+// Fused GCN layers
+//
+// A GCN layer computes act(A_hat * (X * W) + bias), where A_hat is a sparse
+// N x N adjacency matrix in tile-ordered COO format, with its tile offsets,
+// like the A matrix of tiled_spmm. The
+// helpers below compute a slice of X * W's columns into the scratchpad with
+// the OS dataflow, and then aggregate it with A_hat using the WS dataflow, so
+// that X * W never has to be written out to DRAM and read back in again.
+//
+// A slice is J blocks wide, and the aggregation works on tile_I block rows of
+// A_hat at a time. The scratchpad is laid out as follows, from the bottom up:
+// 2*tile_I slots for blocks of A_hat, two slots for block rows of X, the
+// slice of W, and then the slice of X * W at the top
+//============================================================================
+
+static uint32_t tiled_gcn_X_sp_addr(size_t tile_I) {
+  return 2 * tile_I * DIM;
+}
+
+static uint32_t tiled_gcn_W_sp_addr(size_t in_features, size_t tile_I) {
+  const size_t F = in_features / DIM + (in_features % DIM != 0);
+  return tiled_gcn_X_sp_addr(tile_I) + 2 * F * DIM;
+}
+
+static uint32_t tiled_gcn_XW_sp_addr(size_t N, size_t J) {
+  const size_t I = N / DIM + (N % DIM != 0);
+  return BANK_NUM * BANK_ROWS - I * J * DIM;
+}
+
+// Picks the widest slices of X * W which fit in the scratchpad, and then as
+// many block rows of A_hat as fit in what's left of it, and in half of the
+// accumulator. The slices are balanced, so that the last one isn't much
+// narrower than the others. Returns false if the layer can't be fused at all
+static bool tiled_gcn_tiling_factors(size_t N, size_t in_features, size_t out_features,
+        size_t * J_out, size_t * tile_I_out) {
+  const size_t I = N / DIM + (N % DIM != 0);
+  const size_t F = in_features / DIM + (in_features % DIM != 0);
+  const size_t J_total = out_features / DIM + (out_features % DIM != 0);
+
+  // The sparse mvin only has 16 bits for the row and column offsets
+  if (N > 65535)
+    return false;
+
+  for (size_t J = J_total; J > 0; J--) {
+    const size_t slices = J_total / J + (J_total % J != 0);
+    const size_t J_balanced = J_total / slices + (J_total % slices != 0);
+
+    size_t tile_I = ACC_ROWS / (2 * J_balanced * DIM);
+    if (tile_I > I)
+      tile_I = I;
+
+    while (tile_I > 0 && tiled_gcn_W_sp_addr(in_features, tile_I) + F * J_balanced * DIM >
+        tiled_gcn_XW_sp_addr(N, J_balanced))
+      tile_I--;
+
+    if (tile_I > 0) {
+      *J_out = J_balanced;
+      *tile_I_out = tile_I;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Computes the J blocks of X * W's columns which start at column block
+// j_start into the scratchpad
+static void sp_tiled_gcn_transform(const elem_t * X, const elem_t * W,
+        size_t N, size_t in_features, size_t out_features,
+        size_t j_start, size_t J, size_t tile_I) {
+
+  const size_t I = N / DIM + (N % DIM != 0);
+  const size_t F = in_features / DIM + (in_features % DIM != 0);
+  const size_t J_total = out_features / DIM + (out_features % DIM != 0);
+
+  const size_t pad_I = I * DIM - N;
+  const size_t pad_F = F * DIM - in_features;
+  const size_t pad_J = j_start + J == J_total ? J_total * DIM - out_features : 0;
+
+  const uint32_t W_sp_addr_start = tiled_gcn_W_sp_addr(in_features, tile_I);
+  const uint32_t XW_sp_addr_start = tiled_gcn_XW_sp_addr(N, J);
+
+  const int X_blocks = F <= MAX_BLOCK_LEN ? F : MAX_BLOCK_LEN;
+  const int W_blocks = J <= MAX_BLOCK_LEN ? J : MAX_BLOCK_LEN;
+
+  gemmini_extended_config_ex(OUTPUT_STATIONARY, NO_ACTIVATION, 0, ACC_SCALE_IDENTITY, 0, 1, false, false);
+  gemmini_extended3_config_ld(in_features * sizeof(elem_t), MVIN_SCALE_IDENTITY, false, 0);
+  gemmini_extended3_config_ld(out_features * sizeof(elem_t), MVIN_SCALE_IDENTITY, false, 1);
+
+  // Move-in this slice of W
+  for (size_t f = 0; f < F; f++) {
+    const size_t rows = DIM - (f == F-1 ? pad_F : 0);
+    for (size_t j = 0; j < J; j += W_blocks) {
+      const elem_t * const W_dram_addr = W + f*DIM*out_features + (j_start + j)*DIM;
+      const uint32_t W_sp_addr = W_sp_addr_start + (f*J + j)*DIM;
+      const size_t blocks = j + W_blocks <= J ? W_blocks : J-j;
+      const size_t cols = blocks * DIM - (j + blocks >= J ? pad_J : 0);
+      gemmini_extended_mvin2(W_dram_addr, W_sp_addr, cols, rows);
+    }
+  }
+
+  for (size_t i = 0; i < I; i++) {
+    const uint32_t X_sp_addr_start = tiled_gcn_X_sp_addr(tile_I) + (i % 2) * F * DIM;
+    const size_t rows = DIM - (i == I-1 ? pad_I : 0);
+
+    // Move-in this block row of X
+    for (size_t f = 0; f < F; f += X_blocks) {
+      const elem_t * const X_dram_addr = X + i*DIM*in_features + f*DIM;
+      const size_t blocks = f + X_blocks <= F ? X_blocks : F-f;
+      const size_t cols = blocks * DIM - (f + blocks >= F ? pad_F : 0);
+      gemmini_extended_mvin(X_dram_addr, X_sp_addr_start + f*DIM, cols, rows);
+    }
+
+    for (size_t j = 0; j < J; j++) {
+      const uint32_t XW_sp_addr = XW_sp_addr_start + (i*J + j)*DIM;
+      const size_t C_cols = DIM - (j == J-1 ? pad_J : 0);
+
+      for (size_t f = 0; f < F; f++) {
+        const uint32_t X_sp_addr = X_sp_addr_start + f*DIM;
+        const uint32_t W_sp_addr = W_sp_addr_start + (f*J + j)*DIM;
+        const size_t X_cols = DIM - (f == F-1 ? pad_F : 0);
+
+        const uint32_t out_sp_addr = f == F-1 ? XW_sp_addr : GARBAGE_ADDR;
+
+        gemmini_extended_preload(GARBAGE_ADDR, out_sp_addr, C_cols, rows, C_cols, rows);
+
+        if (f == 0) {
+          gemmini_extended_compute_preloaded(X_sp_addr, W_sp_addr, X_cols, rows, C_cols, X_cols);
+        } else {
+          gemmini_extended_compute_accumulated(X_sp_addr, W_sp_addr, X_cols, rows, C_cols, X_cols);
+        }
+      }
+    }
+  }
+}
+
+// Multiplies A_hat by the slice of X * W which sp_tiled_gcn_transform left in
+// the scratchpad, and moves the result out to C. The blocks of A_hat are
+// streamed in with the sparse mvin, skipping blocks which are entirely zero
+static void sp_tiled_gcn_aggregate(const elem_t * A_data, const ind_t * A_coo,
+        const ind_t * A_tile_offsets,
+        const acc_t * bias, elem_t * C,
+        size_t N, size_t out_features,
+        size_t j_start, size_t J, size_t tile_I,
+        int act, size_t relu6_shift) {
+
+  const size_t I_total = N / DIM + (N % DIM != 0);
+  const size_t J_total = out_features / DIM + (out_features % DIM != 0);
+
+  const size_t pad_I = I_total * DIM - N;
+  const size_t pad_J = j_start + J == J_total ? J_total * DIM - out_features : 0;
+
+  const uint32_t XW_sp_addr_start = tiled_gcn_XW_sp_addr(N, J);
+  const uint32_t D_sp_addr_start = 1 << (ADDR_LEN-1);
+  const uint32_t C_sp_addr_start = 3 << (ADDR_LEN-2);
+
+  const size_t A_slots = 2 * tile_I;
+  const int D_blocks = bias == NULL ? 1 : (J <= MAX_BLOCK_LEN_ACC ? J : MAX_BLOCK_LEN_ACC);
+
+  static acc_t zeros[DIM] = {0};
+
+  gemmini_extended_config_ex(WEIGHT_STATIONARY, act, 0, ACC_SCALE_IDENTITY, relu6_shift, 1, false, false);
+  gemmini_extended3_config_ld(0, MVIN_SCALE_IDENTITY, false, 0);
+  gemmini_extended3_config_ld(0, MVIN_SCALE_IDENTITY, false, 2); // The bias row is repeated
+  gemmini_config_st(out_features * sizeof(elem_t));
+
+  uint32_t A_sp_addr[tile_I];
+
+  size_t slot = 0;
+
+  for (size_t i0 = 0; i0 < I_total; i0 += tile_I) {
+    const size_t I = i0 + tile_I <= I_total ? tile_I : I_total - i0;
+    const uint32_t acc_offset = ((i0 / tile_I) % 2) * tile_I * J * DIM;
+
+    // Move-in the bias. If there's no bias, then we move in zeros instead,
+    // because blocks of C which get no contributions from A_hat still need to
+    // be written out
+    for (size_t i = 0; i < I; i++) {
+      const size_t rows = DIM - (i0 + i == I_total-1 ? pad_I : 0);
+      for (size_t j = 0; j < J; j += D_blocks) {
+        const acc_t * const D_dram_addr = bias == NULL ? zeros : bias + (j_start + j)*DIM;
+        const uint32_t D_sp_addr = D_sp_addr_start + acc_offset + (i*J + j)*DIM;
+        const size_t blocks = j + D_blocks <= J ? D_blocks : J-j;
+        const size_t cols = blocks * DIM - (j + blocks >= J ? pad_J : 0);
+        gemmini_extended_mvin3(D_dram_addr, D_sp_addr, cols, rows);
+      }
+    }
+
+    // The nonzeros of block (i, k) of these rows of A_hat are
+    // A_tiles[i*I_total + k] up to the next offset
+    const ind_t * const A_tiles = A_tile_offsets + i0 * I_total;
+
+    for (size_t k = 0; k < I_total; k++) {
+      const size_t A_cols = DIM - (k == I_total-1 ? pad_I : 0);
+
+      // Move-in this column of blocks of A_hat. They cycle through twice as
+      // many slots as there are rows, so the next column's blocks can be moved
+      // in while this one's are being multiplied
+      for (size_t i = 0; i < I; i++) {
+        const size_t n = A_tiles[i*I_total + k];
+        const size_t n_end = A_tiles[i*I_total + k + 1];
+        if (n == n_end)
+          continue;
+
+        const size_t rows = DIM - (i0 + i == I_total-1 ? pad_I : 0);
+
+        A_sp_addr[i] = (slot % A_slots) * DIM;
+        slot++;
+
+        gemmini_extended_mvin_sparse_coo(A_data + n, A_coo + 2*n, n_end - n,
+            A_sp_addr[i], k * DIM, A_cols, (i0 + i) * DIM, rows);
+      }
+
+      for (size_t j = 0; j < J; j++) {
+        const uint32_t XW_sp_addr = XW_sp_addr_start + (k*J + j)*DIM;
+        const size_t C_cols = DIM - (j == J-1 ? pad_J : 0);
+        bool preloaded = false;
+
+        for (size_t i = 0; i < I; i++) {
+          if (A_tiles[i*I_total + k] == A_tiles[i*I_total + k + 1])
+            continue;
+
+          const uint32_t C_sp_addr = C_sp_addr_start + acc_offset + (i*J + j)*DIM;
+          const size_t rows = DIM - (i0 + i == I_total-1 ? pad_I : 0);
+
+          if (!preloaded) {
+            gemmini_extended_preload(XW_sp_addr, C_sp_addr, C_cols, A_cols, C_cols, rows);
+            gemmini_extended_compute_preloaded(A_sp_addr[i], GARBAGE_ADDR, A_cols, rows, DIM, DIM);
+            preloaded = true;
+          } else {
+            gemmini_extended_preload(GARBAGE_ADDR, C_sp_addr, C_cols, A_cols, C_cols, rows);
+            gemmini_extended_compute_accumulated(A_sp_addr[i], GARBAGE_ADDR, A_cols, rows, DIM, DIM);
+          }
+        }
+      }
+    }
+
+    // Move-out C
+    for (size_t i = 0; i < I; i++) {
+      const size_t rows = DIM - (i0 + i == I_total-1 ? pad_I : 0);
+      for (size_t j = 0; j < J; j++) {
+        elem_t * const C_dram_addr = C + (i0 + i)*DIM*out_features + (j_start + j)*DIM;
+        const uint32_t C_sp_addr = C_sp_addr_start + acc_offset + (i*J + j)*DIM;
+        const size_t C_cols = DIM - (j == J-1 ? pad_J : 0);
+        gemmini_extended_mvout(C_dram_addr, C_sp_addr, C_cols, rows);
+      }
+    }
+  }
 }
 
 void sp_tiled_conv(
@@ -1313,6 +4078,36 @@ void sp_tiled_conv(
     }
 }
 
+// Moves the residual of a conv tile into the accumulator rows that the tile's
+// outputs are accumulated into, so that it's added before the outputs are
+// scaled, activated, and pooled. Without a bias, the residual overwrites what
+// the accumulator held before instead
+static void sp_tiled_conv_mvin_residual(int out_dim, int out_channels,
+        int batches, int orows, int ocols, int ochs,
+        const elem_t * residual, scale_t res_scale, bool no_bias) {
+
+    const uint32_t D_sp_addr_start = 1 << (ADDR_LEN - 1);
+    const uint32_t C_sp_addr_start = 3 << (ADDR_LEN - 2);
+    const uint32_t sp_addr_start = no_bias ? D_sp_addr_start : C_sp_addr_start;
+
+    gemmini_extended2_config_ld(out_channels * sizeof(elem_t), res_scale, true);
+
+    for (int b = 0; b < batches; b++)
+        for (int orow = 0; orow < orows; orow++)
+            for (int ocol = 0; ocol < ocols; ocol += DIM) {
+                const int I = ocols - ocol > DIM ? DIM : ocols - ocol;
+
+                for (int och = 0; och < ochs; och += DIM) {
+                    const int J = ochs - och > DIM ? DIM : ochs - och;
+                    const uint32_t sp_addr = sp_addr_start + (och / DIM) * batches * orows * ocols + b * orows * ocols + orow * ocols + ocol;
+
+                    gemmini_extended_mvin(residual + (b*out_dim*out_dim + orow*out_dim + ocol) * out_channels + och,
+                            sp_addr,
+                            J, I);
+                }
+            }
+}
+
 //resnet downsampling layer (no padding, kernel size 1, stride 2)
 //due to poor instruction issue bandwidth
 void sp_tiled_conv_ds(
@@ -1334,6 +4129,7 @@ void sp_tiled_conv_ds(
         elem_t * weights,
         elem_t * output,
         acc_t * bias,
+        const elem_t * residual, scale_t res_scale,
 
 	    int act, acc_scale_t scale, int relu6_shift,
         bool no_bias, bool no_pool,
@@ -1386,6 +4182,10 @@ void sp_tiled_conv_ds(
                 }
     }
 
+    if (residual != NULL)
+        sp_tiled_conv_mvin_residual(out_dim, out_channels,
+            batches, orows, ocols, ochs, residual, res_scale, no_bias);
+
    // mvin weights if it hasn't moved-in in outer loop
 //    printf("weight move in \n");
    if(B_sp_addr_outer == 0){
@@ -2257,6 +5057,47 @@ static int tiled_conv_total_spad_rows(bool acc, bool weight,
         return A_rows;
 }
 
+// conv_cpu runs convs as matmuls of their implicit im2col (see
+// matmul_cpu_im2col_t). Each output channel accumulates the bias, then the
+// residual, and then every (krow, kcol, kch) of the kernel in order, including
+// the padding, like a plain loop over the kernel would, so the results are
+// bit-identical to it, even with floats. Pooled convs keep the unpooled rows
+// which their pools need on the stack, in at most CONV_CPU_POOL_ROWS_ELEMS
+// elements
+#ifndef CONV_CPU_POOL_ROWS_ELEMS
+#define CONV_CPU_POOL_ROWS_ELEMS (256 * DIM)
+#endif
+
+// Computes output channels [och0, och0 + ochs) of the output pixels [pixel,
+// pixel + pixels), into output, whose pixels are stride_output elements apart
+static void conv_cpu_matmul(size_t pixel, size_t pixels, int och0, int ochs,
+        int in_dim, int in_channels, int out_channels, int out_dim,
+        int stride, int padding, int kernel_dim,
+        const elem_t * input, const elem_t * weights, const acc_t * bias,
+        elem_t * output, size_t stride_output,
+        const elem_t * residual, scale_t res_scale,
+        int act, acc_scale_t scale, size_t relu6_shift) {
+
+  const struct matmul_cpu_im2col_t im2col = {
+    input,
+    in_dim, in_channels, out_dim,
+    stride, padding, kernel_dim,
+    pixel,
+  };
+
+  const struct matmul_cpu_args_t args = {
+    pixels, ochs, kernel_dim * kernel_dim * in_channels,
+    NULL, weights + och0, bias == NULL ? NULL : bias + och0, output,
+    0, out_channels, 0, stride_output,
+    MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+    act, scale, relu6_shift, true,
+    &im2col,
+    residual == NULL ? NULL : residual + pixel * out_channels + och0,
+    out_channels, res_scale,
+  };
+
+  gemmini_run_on_harts(matmul_cpu_job, &args);
+}
 
 void conv_cpu_without_pool(
         int batch_size, int in_dim, int in_channels,
@@ -2267,45 +5108,21 @@ void conv_cpu_without_pool(
         elem_t * weights,
         acc_t * bias,
         elem_t * output,
+        const elem_t * residual, scale_t res_scale,
 
         int act, acc_scale_t scale, size_t relu6_shift) {
 
-  bool no_bias = bias == NULL;
-
-  for (int b = 0; b < batch_size; b++) {
-    for (int orow = 0; orow < out_dim; orow++) {
-      for (int ocol = 0; ocol < out_dim; ocol++) {
-        for (int och = 0; och < out_channels; och++) {
-
-          acc_t opixel = no_bias ? 0 : bias[och];
-
-          for (int krow = 0; krow < kernel_dim; krow++) {
-            const int irow = orow * stride + krow - padding;
-
-            for (int kcol = 0; kcol < kernel_dim; kcol++) {
-              const int icol = ocol * stride + kcol - padding;
-
-              for (int kch = 0; kch < in_channels; kch++) {
-                elem_t ipixel = irow < 0 || irow >= in_dim || icol < 0 || icol >= in_dim ?
-                    0 :
-                    *(input + (b * in_dim * in_dim + irow * in_dim + icol) * in_channels + kch);
-
-                elem_t weight = *(weights + (krow * kernel_dim * in_channels + kcol * in_channels + kch) * out_channels + och);
-
-                //acc_t past_opixel = opixel;
-                opixel += weight * ipixel;
-              }
-            }
-          }
-
-          *(output+(b*out_dim*out_dim+orow*out_dim+ocol)*out_channels + och) =
-            scale_and_sat(opixel, act, scale, relu6_shift);
-        }
-      }
-    }
-  }
+  conv_cpu_matmul(0, batch_size * out_dim * out_dim, 0, out_channels,
+      in_dim, in_channels, out_channels, out_dim,
+      stride, padding, kernel_dim,
+      input, weights, bias, output, out_channels,
+      residual, res_scale,
+      act, scale, relu6_shift);
 }
 
+// If residual isn't NULL, it's the same shape as the conv's unpooled output,
+// and MVIN_SCALE(residual, res_scale) is added to each output pixel before
+// it's scaled, activated, and pooled
 void conv_cpu(
         int batch_size, int in_dim, int in_channels,
         int out_channels, int out_dim,
@@ -2315,6 +5132,7 @@ void conv_cpu(
         elem_t * weights,
         acc_t * bias,
         elem_t * output,
+        const elem_t * residual, scale_t res_scale,
 
         int act, acc_scale_t scale, size_t relu6_shift,
         int pool_size, int pool_stride, int pool_padding) {
@@ -2326,65 +5144,74 @@ void conv_cpu(
         out_channels, out_dim,
         stride, padding, kernel_dim,
         input, weights, bias, output,
+        residual, res_scale,
         act, scale, relu6_shift);
     return;
   }
 
-  const bool no_bias = bias == NULL;
   const int pool_out_dim = (out_dim + 2*pool_padding - pool_size) / pool_stride + 1;
 
-  for (int b = 0; b < batch_size; b++) {
-    for (int porow = 0; porow < pool_out_dim; porow++) {
-      for (int pocol = 0; pocol < pool_out_dim; pocol++) {
-        for (int poch = 0; poch < out_channels; poch++) {
-
-          elem_t running_max = 0;
-          bool running_max_initialized = false;
-
-          for (int pwrow = 0; pwrow < pool_size; pwrow++) {
-            const int orow = porow * pool_stride + pwrow - pool_padding;
+  // Each output row is computed once, into a ring of the last pool_size rows,
+  // for as many output channels at a time as fit. At least one channel is
+  // computed at a time, even if its rows don't fit
+  const int row_elems = pool_size * out_dim;
+  const int ochs_fit = CONV_CPU_POOL_ROWS_ELEMS / row_elems > 0 ?
+    CONV_CPU_POOL_ROWS_ELEMS / row_elems : 1;
+  const int ochs_per_pass = ochs_fit < out_channels ? ochs_fit : out_channels;
 
-            for (int pwcol = 0; pwcol < pool_size; pwcol++) {
-              const int ocol = pocol * pool_stride + pwcol - pool_padding;
+  elem_t rows[pool_size][out_dim][ochs_per_pass];
+  int ring_row[pool_size];
 
-              if (orow < 0 || orow >= out_dim || ocol < 0 || ocol >= out_dim) {
-                if (!running_max_initialized || running_max < 0) {
-                  running_max = 0;
-                  running_max_initialized = true;
-                }
-              } else {
-
-                acc_t opixel = no_bias ? 0 : bias[poch];
+  for (int b = 0; b < batch_size; b++) {
+    for (int och0 = 0; och0 < out_channels; och0 += ochs_per_pass) {
+      const int ochs = out_channels - och0 < ochs_per_pass ? out_channels - och0 : ochs_per_pass;
+
+      for (int r = 0; r < pool_size; r++)
+        ring_row[r] = -1;
+
+      for (int porow = 0; porow < pool_out_dim; porow++) {
+        for (int pwrow = 0; pwrow < pool_size; pwrow++) {
+          const int orow = porow * pool_stride + pwrow - pool_padding;
+
+          if (orow >= 0 && orow < out_dim && ring_row[orow % pool_size] != orow) {
+            conv_cpu_matmul((b * out_dim + orow) * out_dim, out_dim, och0, ochs,
+                in_dim, in_channels, out_channels, out_dim,
+                stride, padding, kernel_dim,
+                input, weights, bias, &rows[orow % pool_size][0][0], ochs_per_pass,
+                residual, res_scale,
+                act, scale, relu6_shift);
+            ring_row[orow % pool_size] = orow;
+          }
+        }
 
-                for (int krow = 0; krow < kernel_dim; krow++) {
-                  const int irow = orow * stride + krow - padding;
+        for (int pocol = 0; pocol < pool_out_dim; pocol++) {
+          for (int poch = 0; poch < ochs; poch++) {
 
-                  for (int kcol = 0; kcol < kernel_dim; kcol++) {
-                    const int icol = ocol * stride + kcol - padding;
+            elem_t running_max = 0;
+            bool running_max_initialized = false;
 
-                    for (int kch = 0; kch < in_channels; kch++) {
-                      elem_t ipixel = irow < 0 || irow >= in_dim || icol < 0 || icol >= in_dim ?
-                          0 :
-                          *(input + (b * in_dim * in_dim + irow * in_dim + icol) * in_channels + kch);
+            for (int pwrow = 0; pwrow < pool_size; pwrow++) {
+              const int orow = porow * pool_stride + pwrow - pool_padding;
 
-                      elem_t weight = *(weights + (krow * kernel_dim * in_channels + kcol * in_channels + kch) * out_channels + poch);
+              for (int pwcol = 0; pwcol < pool_size; pwcol++) {
+                const int ocol = pocol * pool_stride + pwcol - pool_padding;
 
-                      opixel += weight * ipixel;
-                    }
+                if (orow < 0 || orow >= out_dim || ocol < 0 || ocol >= out_dim) {
+                  if (!running_max_initialized || running_max < 0) {
+                    running_max = 0;
+                    running_max_initialized = true;
+                  }
+                } else {
+                  const elem_t opixel = rows[orow % pool_size][ocol][poch];
+                  if (!running_max_initialized || opixel > running_max) {
+                    running_max = opixel;
+                    running_max_initialized = true;
                   }
                 }
-
-                opixel = scale_and_sat(opixel, act, scale, relu6_shift);
-                if (!running_max_initialized || opixel > running_max) {
-                  running_max = opixel;
-                  running_max_initialized = true;
-                }
-              }
-
-              if (pwrow == pool_size - 1 && pwcol == pool_size - 1) {
-                *(output + (b*pool_out_dim*pool_out_dim + porow*pool_out_dim + pocol)*out_channels + poch) = running_max;
               }
             }
+
+            *(output + (b*pool_out_dim*pool_out_dim + porow*pool_out_dim + pocol)*out_channels + och0 + poch) = running_max;
           }
         }
       }
@@ -2563,6 +5390,7 @@ void tiled_conv_first(
         out_channels, out_dim,
         stride, padding, kcols,//kernel_dim,
         input, weights, bias, output,
+        NULL, 0,
         act, scale, relu6_shift,
         pool_size, pool_stride, pool_padding);
       return;
@@ -2789,6 +5617,7 @@ void sp_tiled_conv_ws(
         //elem_t * weights,
         elem_t * output,
         acc_t * bias,
+        const elem_t * residual, scale_t res_scale,
 
 	int act, acc_scale_t scale, int relu6_shift,
         bool no_bias, bool no_pool,
@@ -2847,6 +5676,10 @@ void sp_tiled_conv_ws(
                 }
     }
 
+    if (residual != NULL)
+        sp_tiled_conv_mvin_residual(out_dim, out_channels,
+            batches, orows, ocols, ochs, residual, res_scale, no_bias);
+
     // mvin input
     // printf("mvin inputs\n");
     gemmini_config_ld(in_channels * sizeof(elem_t));
@@ -3084,6 +5917,7 @@ void tiled_conv_original(
         out_channels, out_dim,
         stride, padding, kernel_dim,
         input, weights, bias, output,
+        NULL, 0,
         act, scale, relu6_shift,
         pool_size, pool_stride, pool_padding);
       return;
@@ -3232,6 +6066,7 @@ void tiled_conv_original(
 		 		    //weights + (krow*kernel_dim*in_channels + kcol*in_channels + kch) * out_channels + poch,
                                     out,
                                     bias_,
+                                    NULL, 0,
 
                                     act, scale, relu6_shift,
                                     no_bias, no_pool, 
@@ -3244,6 +6079,9 @@ void tiled_conv_original(
 }
 
 
+// If residual isn't NULL, it's added to the conv's outputs in the
+// accumulator, like the bias, so a conv followed by a residual add, an
+// activation, and a pool runs in one pass. See conv_cpu
 void tiled_conv(
         int batch_size, int in_dim, int in_channels,
         int out_channels, int out_dim,
@@ -3257,6 +6095,7 @@ void tiled_conv(
         elem_t * weights,
         acc_t * bias,
         elem_t * output,
+        const elem_t * residual, scale_t res_scale,
 
         int act, acc_scale_t scale, size_t relu6_shift,
         int pool_size, int pool_stride, int pool_padding,
@@ -3273,6 +6112,7 @@ void tiled_conv(
         out_channels, out_dim,
         stride, padding, kernel_dim,
         input, weights, bias, output,
+        residual, res_scale,
         act, scale, relu6_shift,
         pool_size, pool_stride, pool_padding);
       return;
@@ -3363,6 +6203,8 @@ void tiled_conv(
             			const int irow = orow_floored * stride - padding;//+ krow - padding;
             			const int ocol_floored = ocol < 0 ? 0 : ocol;
             			const int icol = ocol_floored * stride - padding; //+ kcol - padding;
+                                const elem_t * res = residual == NULL ? NULL :
+                                    residual + (b*out_dim*out_dim + orow_floored*out_dim + ocol_floored) * out_channels + poch;
  
                                 const int ocols_ = pocols_ * pool_stride + pool_size - 1;
                                 const int orows_ = porows_ * pool_stride + pool_size - 1;
@@ -3416,6 +6258,7 @@ void tiled_conv(
 				   // weights + kch * out_channels + poch,
 		 		    out,
                                     bias_,
+                                    res, res_scale,
 
                                     act, scale, relu6_shift,
                                     no_bias, no_pool,
@@ -3441,6 +6284,7 @@ void tiled_conv(
                                     NULL, //weights + kch * out_channels + poch,
                                     out,
                                     bias_,
+                                    res, res_scale,
 
                                     act, scale, relu6_shift,
                                     no_bias, no_pool,
@@ -3454,6 +6298,167 @@ void tiled_conv(
 //	printf("mvin total cycles %d \n", mvin_cycles);
 }
 
+static bool tiled_conv_tuning_matches(const struct tiled_conv_tuning_t * a,
+        const struct tiled_conv_tuning_t * b) {
+  return a->batch_size == b->batch_size && a->in_dim == b->in_dim &&
+    a->in_channels == b->in_channels && a->out_channels == b->out_channels &&
+    a->out_dim == b->out_dim && a->stride == b->stride &&
+    a->padding == b->padding && a->kernel_dim == b->kernel_dim &&
+    a->pool_size == b->pool_size && a->pool_stride == b->pool_stride &&
+    a->pool_padding == b->pool_padding && a->no_bias == b->no_bias;
+}
+
+// Looks up the tuned tiling factors for the conv described by "key", and
+// stores them in "key" if there are any
+static bool tiled_conv_find_tuning(struct tiled_conv_tuning_t * key) {
+  const struct tiled_conv_tuning_t * found = NULL;
+
+#ifdef GEMMINI_TUNED_TILINGS
+  for (size_t i = 0; found == NULL && tiled_conv_tuned[i].batch_size != 0; i++)
+    if (tiled_conv_tuning_matches(&tiled_conv_tuned[i], key))
+      found = &tiled_conv_tuned[i];
+#endif
+
+#ifdef GEMMINI_AUTOTUNE
+  for (size_t i = 0; found == NULL && i < tiled_conv_autotuned_n; i++)
+    if (tiled_conv_tuning_matches(&tiled_conv_autotuned[i], key))
+      found = &tiled_conv_autotuned[i];
+#endif
+
+  if (found == NULL)
+    return false;
+
+  key->batches = found->batches;
+  key->porows = found->porows;
+  key->pocols = found->pocols;
+  key->pochs = found->pochs;
+  key->kchs = found->kchs;
+  key->weight_bank = found->weight_bank;
+  return true;
+}
+
+#ifdef GEMMINI_AUTOTUNE
+// Halves a number of channels, rounding up to a multiple of DIM
+static int tiled_conv_halve_channels(int channels) {
+  if (channels <= DIM)
+    return channels;
+  const int half = channels / 2;
+  return (half / DIM + (half % DIM != 0)) * DIM;
+}
+#endif
+
+// Runs tiled_conv with the tiling factors that the tiled_conv_auto functions
+// picked, unless there are tuned ones for this conv. In GEMMINI_AUTOTUNE
+// builds, new convs are timed with the picked factors and with a few smaller
+// ones, each of which fits wherever the picked ones do. Convs which add their
+// residual in place can't be run more than once, so they aren't timed
+static void tiled_conv_with_tuning(
+        int batch_size, int in_dim, int in_channels,
+        int out_channels, int out_dim,
+        int stride, int padding, int kernel_dim,
+
+        int batches,
+        int porows, int pocols, int pochs,
+        int kchs,
+
+        elem_t * input,
+        elem_t * weights,
+        acc_t * bias,
+        elem_t * output,
+        const elem_t * residual, scale_t res_scale,
+
+        int act, acc_scale_t scale, size_t relu6_shift,
+        int pool_size, int pool_stride, int pool_padding,
+
+        int weight_bank, enum tiled_matmul_type_t tiled_conv_type) {
+
+    struct tiled_conv_tuning_t tuning = {batch_size, in_dim, in_channels,
+      out_channels, out_dim, stride, padding, kernel_dim,
+      pool_size, pool_stride, pool_padding, bias == NULL,
+      batches, porows, pocols, pochs, kchs, weight_bank};
+
+    if (tiled_conv_type != CPU && !tiled_conv_find_tuning(&tuning)) {
+#ifdef GEMMINI_AUTOTUNE
+      if (tiled_conv_autotuned_n < GEMMINI_AUTOTUNE_MAX_ENTRIES && residual != output) {
+        // {batches, porows, pocols, pochs, kchs}
+        const int candidates[][5] = {
+          {batches, porows, pocols, pochs, kchs},
+          {1, porows, pocols, pochs, kchs},
+          {batches, (porows + 1) / 2, (pocols + 1) / 2, pochs, kchs},
+          {batches, porows, pocols, tiled_conv_halve_channels(pochs), kchs},
+          {batches, porows, pocols, pochs, tiled_conv_halve_channels(kchs)},
+        };
+
+        uint64_t best_cycles = 0;
+
+        for (size_t c = 0; c < sizeof(candidates) / sizeof(candidates[0]); c++) {
+          // Skip the candidates which are the same as the picked factors
+          if (c > 0 && candidates[c][0] == batches && candidates[c][1] == porows &&
+              candidates[c][2] == pocols && candidates[c][3] == pochs &&
+              candidates[c][4] == kchs)
+            continue;
+
+          const uint64_t start = gemmini_read_cycles();
+
+          tiled_conv(
+              batch_size, in_dim, in_channels,
+              out_channels, out_dim,
+              stride, padding, kernel_dim,
+
+              candidates[c][0],
+              candidates[c][1], candidates[c][2], candidates[c][3],
+              kernel_dim, kernel_dim, candidates[c][4],
+
+              input,
+              weights,
+              bias,
+              output,
+              residual, res_scale,
+
+              act, scale, relu6_shift,
+              pool_size, pool_stride, pool_padding,
+
+              weight_bank, tiled_conv_type);
+
+          const uint64_t cycles = gemmini_read_cycles() - start;
+
+          if (c == 0 || cycles < best_cycles) {
+            tuning.batches = candidates[c][0];
+            tuning.porows = candidates[c][1];
+            tuning.pocols = candidates[c][2];
+            tuning.pochs = candidates[c][3];
+            tuning.kchs = candidates[c][4];
+            best_cycles = cycles;
+          }
+        }
+
+        tiled_conv_autotuned[tiled_conv_autotuned_n++] = tuning;
+        return;
+      }
+#endif
+    }
+
+    tiled_conv(
+        batch_size, in_dim, in_channels,
+        out_channels, out_dim,
+        stride, padding, kernel_dim,
+
+        tuning.batches,
+        tuning.porows, tuning.pocols, tuning.pochs,
+        kernel_dim, kernel_dim, tuning.kchs,
+
+        input,
+        weights,
+        bias,
+        output,
+        residual, res_scale,
+
+        act, scale, relu6_shift,
+        pool_size, pool_stride, pool_padding,
+
+        tuning.weight_bank, tiled_conv_type);
+}
+
 void tiled_conv_auto_first(
         int batch_size, int in_dim, int in_channels,
         int out_channels, int out_dim,
@@ -3862,8 +6867,6 @@ void tiled_conv_auto_largeC(
     int ocols = args[2];
     int ochs = args[3];
     int kchs = args[4];
-    int krows = kernel_dim;
-    int kcols = kernel_dim;
 /*
      printf("batches = %d\n", batches);
      printf("orows = %d\n", orows);
@@ -3874,26 +6877,302 @@ void tiled_conv_auto_largeC(
 */
 
 
-    tiled_conv(
+    tiled_conv_with_tuning(
         batch_size, in_dim, in_channels,
         out_channels, out_dim,
         stride, padding, kernel_dim,
 
         batches,
         orows, ocols, ochs,
-        krows, kcols, kchs,
+        kchs,
 
         input,
         weights,
         bias,
         output,
+        NULL, 0,
 
         act, scale, relu6_shift,
         pool_size, no_pool ? 0 : pool_stride, pool_padding,
         weight_bank, tiled_conv_type);
 }
 
-void tiled_conv_auto(
+// Convs can run with either of these algorithms (see
+// tiled_conv_auto_algorithm). WINOGRAD_CONV needs a float elem_t, and scratch
+// buffers for its transformed tiles
+enum tiled_conv_algorithm_t {DIRECT_CONV, WINOGRAD_CONV};
+
+// The buffers which Winograd convs keep their transformed inputs, V, and
+// weights, U, and their matmul outputs, M, in. Each holds elems elements, and
+// should be aligned like row_align(1), or row_align_acc(1) for M
+struct tiled_conv_winograd_scratch_t {
+  elem_t * V;
+  elem_t * U;
+  acc_t * M;
+  size_t elems;
+};
+
+#ifdef ELEM_T_IS_FLOAT
+// tiled_conv_winograd runs 3x3 stride-1 convs with Winograd's F(2x2, 3x3)
+// algorithm. Each 2x2 block of outputs is computed from a 4x4 tile of the
+// input, d, and the kernel, g, as
+//   Y = A^T ((G g G^T) * (B^T d B)) A
+// where * is elementwise. Summed over the input channels, each of the 16
+// elements of the tiles is then a matmul of the transformed inputs, with one
+// row per tile, by the transformed weights, with one row per input channel.
+// Those run on Gemmini, while the transforms run on the CPU. That's 16
+// multiplies for every 4 outputs, rather than 36, but the transforms round
+// differently from a direct conv, so the outputs are only close to its ones.
+// The transformed inputs, weights, and matmul outputs are kept, a chunk of
+// tiles and output channels at a time, in the caller's scratch buffers
+
+// The 4x4 tiles cover the outputs, with the last ones cut off if out_dim is
+// odd, so tiled_conv_winograd needs room for 16 elements of at least one
+// DIM-wide block of output channels for every input channel
+static bool tiled_conv_winograd_fits(int in_channels, int out_channels,
+        int stride, int kernel_dim, int pool_stride,
+        const struct tiled_conv_winograd_scratch_t * scratch) {
+  const int ochs = out_channels < DIM ? out_channels : DIM;
+  return kernel_dim == 3 && stride == 1 && pool_stride == 0 &&
+    scratch != NULL && 16 * in_channels * ochs <= scratch->elems;
+}
+
+struct tiled_conv_winograd_args_t {
+  int in_dim, in_channels, out_channels, out_dim, padding;
+  int tiles_dim;
+  size_t tile0, tiles;
+  int och0, ochs;
+
+  const elem_t * input;
+  const acc_t * bias;
+  elem_t * output;
+  const elem_t * residual;
+  scale_t res_scale;
+
+  int act;
+  acc_scale_t scale;
+  size_t relu6_shift;
+
+  const struct tiled_conv_winograd_scratch_t * scratch;
+};
+
+// Transforms tiles [tile0, tile0 + tiles) of the input into scratch->V, as
+// 16 matrices of tiles x in_channels
+static void tiled_conv_winograd_input_job(size_t tid, size_t nthreads, const void * job) {
+  const struct tiled_conv_winograd_args_t * args = (const struct tiled_conv_winograd_args_t *)job;
+  const int in_dim = args->in_dim;
+  const int in_channels = args->in_channels;
+  const int tiles_dim = args->tiles_dim;
+
+  for (size_t t = tid; t < args->tiles; t += nthreads) {
+    const size_t tile = args->tile0 + t;
+    const int b = tile / (tiles_dim * tiles_dim);
+    const int irow0 = ((tile / tiles_dim) % tiles_dim) * 2 - args->padding;
+    const int icol0 = (tile % tiles_dim) * 2 - args->padding;
+
+    for (int ich = 0; ich < in_channels; ich++) {
+      acc_t d[4][4];
+      for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++) {
+          const int irow = irow0 + i;
+          const int icol = icol0 + j;
+          d[i][j] = irow < 0 || irow >= in_dim || icol < 0 || icol >= in_dim ? 0 :
+            args->input[((b * in_dim + irow) * in_dim + icol) * in_channels + ich];
+        }
+
+      // B^T d
+      acc_t bd[4][4];
+      for (int j = 0; j < 4; j++) {
+        bd[0][j] = d[0][j] - d[2][j];
+        bd[1][j] = d[1][j] + d[2][j];
+        bd[2][j] = d[2][j] - d[1][j];
+        bd[3][j] = d[1][j] - d[3][j];
+      }
+
+      // (B^T d) B
+      for (int i = 0; i < 4; i++) {
+        const acc_t v[4] = {
+          bd[i][0] - bd[i][2],
+          bd[i][1] + bd[i][2],
+          bd[i][2] - bd[i][1],
+          bd[i][1] - bd[i][3],
+        };
+        for (int j = 0; j < 4; j++)
+          args->scratch->V[((i * 4 + j) * args->tiles + t) * in_channels + ich] = v[j];
+      }
+    }
+  }
+}
+
+// Transforms output channels [och0, och0 + ochs) of the weights into U, as 16
+// matrices of in_channels x ochs
+static void tiled_conv_winograd_weights(int in_channels, int out_channels,
+        int och0, int ochs, const elem_t * weights, elem_t * U) {
+  for (int ich = 0; ich < in_channels; ich++)
+    for (int o = 0; o < ochs; o++) {
+      acc_t g[3][3];
+      for (int krow = 0; krow < 3; krow++)
+        for (int kcol = 0; kcol < 3; kcol++)
+          g[krow][kcol] = weights[((krow * 3 + kcol) * in_channels + ich) * out_channels + och0 + o];
+
+      // G g
+      acc_t gg[4][3];
+      for (int j = 0; j < 3; j++) {
+        gg[0][j] = g[0][j];
+        gg[1][j] = (g[0][j] + g[1][j] + g[2][j]) / 2;
+        gg[2][j] = (g[0][j] - g[1][j] + g[2][j]) / 2;
+        gg[3][j] = g[2][j];
+      }
+
+      // (G g) G^T
+      for (int i = 0; i < 4; i++) {
+        const acc_t u[4] = {
+          gg[i][0],
+          (gg[i][0] + gg[i][1] + gg[i][2]) / 2,
+          (gg[i][0] - gg[i][1] + gg[i][2]) / 2,
+          gg[i][2],
+        };
+        for (int j = 0; j < 4; j++)
+          U[((i * 4 + j) * in_channels + ich) * ochs + o] = u[j];
+      }
+    }
+}
+
+// Transforms the matmul outputs in scratch->M back into 2x2 blocks of
+// outputs, and adds the bias and residual to them
+static void tiled_conv_winograd_output_job(size_t tid, size_t nthreads, const void * job) {
+  const struct tiled_conv_winograd_args_t * args = (const struct tiled_conv_winograd_args_t *)job;
+  const int out_dim = args->out_dim;
+  const int out_channels = args->out_channels;
+  const int tiles_dim = args->tiles_dim;
+  const int ochs = args->ochs;
+
+  for (size_t t = tid; t < args->tiles; t += nthreads) {
+    const size_t tile = args->tile0 + t;
+    const int b = tile / (tiles_dim * tiles_dim);
+    const int orow0 = ((tile / tiles_dim) % tiles_dim) * 2;
+    const int ocol0 = (tile % tiles_dim) * 2;
+
+    for (int o = 0; o < ochs; o++) {
+      const int och = args->och0 + o;
+
+      acc_t m[4][4];
+      for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+          m[i][j] = args->scratch->M[((i * 4 + j) * args->tiles + t) * ochs + o];
+
+      // A^T m
+      acc_t am[2][4];
+      for (int j = 0; j < 4; j++) {
+        am[0][j] = m[0][j] + m[1][j] + m[2][j];
+        am[1][j] = m[1][j] - m[2][j] - m[3][j];
+      }
+
+      for (int i = 0; i < 2 && orow0 + i < out_dim; i++) {
+        // (A^T m) A
+        const acc_t y[2] = {
+          am[i][0] + am[i][1] + am[i][2],
+          am[i][1] - am[i][2] - am[i][3],
+        };
+
+        for (int j = 0; j < 2 && ocol0 + j < out_dim; j++) {
+          const size_t opixel = ((b * out_dim + orow0 + i) * out_dim + ocol0 + j) * out_channels + och;
+
+          acc_t result = args->bias == NULL ? 0 : args->bias[och];
+          if (args->residual != NULL)
+            result += MVIN_SCALE(args->residual[opixel], args->res_scale);
+          result += y[j];
+
+          args->output[opixel] = scale_and_sat(result, args->act, args->scale, args->relu6_shift);
+        }
+      }
+    }
+  }
+}
+
+// Computes
+//   output = act(scale * (conv(input, weights) + bias + MVIN_SCALE(residual, res_scale)))
+// for 3x3 stride-1 convs without pools, which tiled_conv_winograd_fits has to
+// accept. The matmuls run with the tiled_matmul_type dataflow
+static void tiled_conv_winograd(
+        int batch_size, int in_dim, int in_channels,
+        int out_channels, int out_dim,
+        int padding,
+
+        const elem_t * input,
+        const elem_t * weights,
+        const acc_t * bias,
+        elem_t * output,
+        const elem_t * residual, scale_t res_scale,
+
+        int act, acc_scale_t scale, size_t relu6_shift,
+
+        const struct tiled_conv_winograd_scratch_t * scratch,
+        enum tiled_matmul_type_t tiled_matmul_type) {
+
+#ifdef GEMMINI_ASSERTIONS
+  if (!tiled_conv_winograd_fits(in_channels, out_channels, 1, 3, 0, scratch)) {
+    printf("Winograd convs need %d x %d x 16 elements\n", in_channels, DIM);
+    exit(1);
+  }
+#endif
+
+  const int tiles_dim = (out_dim + 1) / 2;
+  const size_t total_tiles = (size_t)batch_size * tiles_dim * tiles_dim;
+
+  // Take as many output channels at a time as fit, in multiples of DIM
+  int ochs = scratch->elems / (16 * in_channels);
+  ochs = ochs < out_channels ? ochs / DIM * DIM : out_channels;
+
+  const int max_ch = in_channels > ochs ? in_channels : ochs;
+  const size_t max_tiles = scratch->elems / (16 * max_ch);
+
+  for (int och0 = 0; och0 < out_channels; och0 += ochs) {
+    const int ochs_ = out_channels - och0 < ochs ? out_channels - och0 : ochs;
+
+    tiled_conv_winograd_weights(in_channels, out_channels, och0, ochs_, weights, scratch->U);
+
+    for (size_t tile0 = 0; tile0 < total_tiles; tile0 += max_tiles) {
+      const size_t tiles = total_tiles - tile0 < max_tiles ? total_tiles - tile0 : max_tiles;
+
+      const struct tiled_conv_winograd_args_t args = {
+        in_dim, in_channels, out_channels, out_dim, padding,
+        tiles_dim,
+        tile0, tiles,
+        och0, ochs_,
+        input, bias, output, residual, res_scale,
+        act, scale, relu6_shift,
+        scratch,
+      };
+
+      gemmini_run_on_harts(tiled_conv_winograd_input_job, &args);
+
+      for (int e = 0; e < 16; e++)
+        tiled_matmul_auto(tiles, ochs_, in_channels,
+            scratch->V + e * tiles * in_channels,
+            scratch->U + e * in_channels * ochs_,
+            NULL, (elem_t*)(scratch->M + e * tiles * ochs_),
+            in_channels, ochs_, ochs_, ochs_,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            true, false,
+            tiled_matmul_type);
+
+      gemmini_fence();
+
+      gemmini_run_on_harts(tiled_conv_winograd_output_job, &args);
+    }
+  }
+}
+#endif
+
+// Like tiled_conv_auto, but computes
+//   output = pool(act(scale * (conv(input, weights) + bias + MVIN_SCALE(residual, res_scale))))
+// where residual is the same shape as the conv's unpooled output. The residual
+// is moved into the accumulator along with the bias, so it never makes a
+// separate pass over the outputs. Without a pool, residual may be output
+void tiled_conv_auto_resadd(
         int batch_size, int in_dim, int in_channels,
         int out_channels, int out_dim,
         int stride, int padding, int kernel_dim,
@@ -3902,6 +7181,7 @@ void tiled_conv_auto(
         elem_t * weights,
         acc_t * bias,
         elem_t * output,
+        const elem_t * residual, scale_t res_scale,
 
         int act, acc_scale_t scale, size_t relu6_shift,
         int pool_size, int pool_stride, int pool_padding,
@@ -3909,6 +7189,14 @@ void tiled_conv_auto(
         enum tiled_matmul_type_t tiled_conv_type) {
 
     const bool no_pool = pool_stride == 0;
+
+#ifdef GEMMINI_ASSERTIONS
+    if (!no_pool && residual != NULL && residual == output) {
+        printf("A residual can't be added in place if the output is pooled\n");
+        exit(1);
+    }
+#endif
+
     if (no_pool) {
         pool_size = 1;
         pool_stride = 1;
@@ -3947,8 +7235,6 @@ void tiled_conv_auto(
     int orows = args[1];
     int ocols = args[2];
     int ochs = args[3];
-    int krows = kernel_dim;//args[4];
-    int kcols = kernel_dim;//args[5];
     int kchs = args[4];
 
 /*
@@ -3959,19 +7245,20 @@ void tiled_conv_auto(
      printf("kcols = %d\n", kernel_dim);
      printf("kchs = %d\n", kchs);
 */
-    tiled_conv(
+    tiled_conv_with_tuning(
         batch_size, in_dim, in_channels,
         out_channels, out_dim,
         stride, padding, kernel_dim,
 
         batches,
         orows, ocols, ochs,
-        krows, kcols, kchs,
+        kchs,
 
         input,
         weights,
         bias,
         output,
+        residual, res_scale,
 
         act, scale, relu6_shift,
         pool_size, no_pool ? 0 : pool_stride, pool_padding,
@@ -3979,6 +7266,139 @@ void tiled_conv_auto(
         weight_bank, tiled_conv_type);
 }
 
+void tiled_conv_auto(
+        int batch_size, int in_dim, int in_channels,
+        int out_channels, int out_dim,
+        int stride, int padding, int kernel_dim,
+
+        elem_t * input,
+        elem_t * weights,
+        acc_t * bias,
+        elem_t * output,
+
+        int act, acc_scale_t scale, size_t relu6_shift,
+        int pool_size, int pool_stride, int pool_padding,
+
+        enum tiled_matmul_type_t tiled_conv_type) {
+
+    tiled_conv_auto_resadd(
+        batch_size, in_dim, in_channels,
+        out_channels, out_dim,
+        stride, padding, kernel_dim,
+
+        input, weights, bias, output,
+        NULL, 0,
+
+        act, scale, relu6_shift,
+        pool_size, pool_stride, pool_padding,
+
+        tiled_conv_type);
+}
+
+// Like tiled_conv_auto_resadd, but runs the conv with algorithm. Convs which
+// WINOGRAD_CONV can't run, because they aren't 3x3 stride-1 convs without
+// pools, or because winograd is too small for them, run as DIRECT_CONV
+// instead, as do CPU convs. winograd may be NULL for DIRECT_CONV
+void tiled_conv_auto_algorithm(
+        int batch_size, int in_dim, int in_channels,
+        int out_channels, int out_dim,
+        int stride, int padding, int kernel_dim,
+
+        elem_t * input,
+        elem_t * weights,
+        acc_t * bias,
+        elem_t * output,
+        const elem_t * residual, scale_t res_scale,
+
+        int act, acc_scale_t scale, size_t relu6_shift,
+        int pool_size, int pool_stride, int pool_padding,
+
+        enum tiled_matmul_type_t tiled_conv_type,
+        enum tiled_conv_algorithm_t algorithm,
+        const struct tiled_conv_winograd_scratch_t * winograd) {
+
+#ifdef ELEM_T_IS_FLOAT
+    if (algorithm == WINOGRAD_CONV && tiled_conv_type != CPU &&
+            tiled_conv_winograd_fits(in_channels, out_channels, stride, kernel_dim, pool_stride, winograd)) {
+        tiled_conv_winograd(
+            batch_size, in_dim, in_channels,
+            out_channels, out_dim,
+            padding,
+            input, weights, bias, output,
+            residual, res_scale,
+            act, scale, relu6_shift,
+            winograd, tiled_conv_type);
+        return;
+    }
+#endif
+
+    tiled_conv_auto_resadd(
+        batch_size, in_dim, in_channels,
+        out_channels, out_dim,
+        stride, padding, kernel_dim,
+
+        input, weights, bias, output,
+        residual, res_scale,
+
+        act, scale, relu6_shift,
+        pool_size, pool_stride, pool_padding,
+
+        tiled_conv_type);
+}
+
+#ifdef GEMMINI_AUTOTUNE
+// Prints the tilings found by autotuning as a header, which can be passed
+// back in through GEMMINI_TUNED_TILINGS. On Linux, it is written to "path"
+// instead, unless "path" is NULL
+static void gemmini_autotune_dump(const char * path) {
+#ifdef BAREMETAL
+#define GEMMINI_AUTOTUNE_PRINT(...) printf(__VA_ARGS__)
+#else
+#define GEMMINI_AUTOTUNE_PRINT(...) fprintf(f, __VA_ARGS__)
+    FILE * f = path == NULL ? stdout : fopen(path, "w");
+    if (f == NULL) {
+      printf("could not open %s\n", path);
+      exit(1);
+    }
+#endif
+
+    const char * dataflows[] = {"OS", "WS", "CPU"};
+
+    GEMMINI_AUTOTUNE_PRINT("// Generated by gemmini_autotune_dump\n\n");
+
+    GEMMINI_AUTOTUNE_PRINT("// {dim_I, dim_J, dim_K, dataflow, transpose_A, transpose_B, no_bias, tile_I, tile_J, tile_K}\n");
+    GEMMINI_AUTOTUNE_PRINT("static const struct tiled_matmul_tuning_t tiled_matmul_tuned[] = {\n");
+    for (size_t i = 0; i < tiled_matmul_autotuned_n; i++) {
+      const struct tiled_matmul_tuning_t * t = &tiled_matmul_autotuned[i];
+      GEMMINI_AUTOTUNE_PRINT("  {%llu, %llu, %llu, %s, %d, %d, %d, %llu, %llu, %llu},\n",
+          (unsigned long long)t->dim_I, (unsigned long long)t->dim_J, (unsigned long long)t->dim_K,
+          dataflows[t->dataflow], t->transpose_A, t->transpose_B, t->no_bias,
+          (unsigned long long)t->tile_I, (unsigned long long)t->tile_J, (unsigned long long)t->tile_K);
+    }
+    GEMMINI_AUTOTUNE_PRINT("  {0},\n};\n\n");
+
+    GEMMINI_AUTOTUNE_PRINT("// {batch_size, in_dim, in_channels, out_channels, out_dim, stride, padding, kernel_dim,\n");
+    GEMMINI_AUTOTUNE_PRINT("//  pool_size, pool_stride, pool_padding, no_bias,\n");
+    GEMMINI_AUTOTUNE_PRINT("//  batches, porows, pocols, pochs, kchs, weight_bank}\n");
+    GEMMINI_AUTOTUNE_PRINT("static const struct tiled_conv_tuning_t tiled_conv_tuned[] = {\n");
+    for (size_t i = 0; i < tiled_conv_autotuned_n; i++) {
+      const struct tiled_conv_tuning_t * t = &tiled_conv_autotuned[i];
+      GEMMINI_AUTOTUNE_PRINT("  {%d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d},\n",
+          t->batch_size, t->in_dim, t->in_channels, t->out_channels, t->out_dim,
+          t->stride, t->padding, t->kernel_dim,
+          t->pool_size, t->pool_stride, t->pool_padding, t->no_bias,
+          t->batches, t->porows, t->pocols, t->pochs, t->kchs, t->weight_bank);
+    }
+    GEMMINI_AUTOTUNE_PRINT("  {0},\n};\n");
+
+#ifndef BAREMETAL
+    if (f != stdout)
+      fclose(f);
+#endif
+#undef GEMMINI_AUTOTUNE_PRINT
+}
+#endif
+
 void resadd_cpu(const size_t I, const size_t J,
         const scale_t A_scale,
         const scale_t B_scale,
@@ -3990,6 +7410,23 @@ void resadd_cpu(const size_t I, const size_t J,
 
 	const int minimum = relu ? 0 : elem_t_min;
 
+#ifdef GEMMINI_RVV_ELEMS
+    // A, B and C are contiguous, so they're treated as one long row
+    for (size_t i = 0; i < I * J;) {
+        const size_t vl = __riscv_vsetvl_e32m4(I * J - i);
+
+        vfloat32m4_t result = __riscv_vfadd_vv_f32m4(
+            __riscv_vfmul_vf_f32m4(__riscv_vle32_v_f32m4(A + i, vl), A_scale, vl),
+            __riscv_vfmul_vf_f32m4(__riscv_vle32_v_f32m4(B + i, vl), B_scale, vl), vl);
+        result = __riscv_vfmul_vf_f32m4(result, C_scale, vl);
+        result = clip_rvv(result, minimum, elem_t_max, vl);
+        __riscv_vse32_v_f32m4(C + i, result, vl);
+
+        i += vl;
+    }
+    return;
+#endif
+
     for (size_t i = 0; i < I; i++) {
         for (size_t j = 0; j < J; j++) {
             const elem_t * a = A + i * J + j;
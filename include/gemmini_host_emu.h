@@ -0,0 +1,986 @@
+// See LICENSE for license details.
+
+#ifndef SRC_MAIN_C_GEMMINI_HOST_EMU_H
+#define SRC_MAIN_C_GEMMINI_HOST_EMU_H
+
+// A functional model of Gemmini which runs on the host, so that the tests can
+// be built and run natively without the RISC-V toolchain or spike. Build with
+// -DGEMMINI_HOST_EMU, and every gemmini_* macro will call into this model
+// instead of issuing a RoCC instruction.
+//
+// This file is included by gemmini.h, after the opcodes and the bit-conversion
+// functions are defined. Don't include it directly.
+//
+// The gemmini-cisc opcodes share their funct values with the LOOP_WS and MVIN3
+// opcodes, so they aren't modelled. Neither is the hardware im2col unit which
+// sp_tiled_conv_ws configures with gemmini_extended2_config_ex, except for 1x1,
+// stride 1 convs, whose im2col just reads their input rows in order.
+//
+// The emulator also estimates how many cycles Gemmini would take, and
+// read_cycles() returns that estimate. Only Gemmini is modelled, so code which
+// runs on the CPU between instructions takes no time at all. The model is
+// described above gemmini_emu_timing_t below.
+//
+// Each thread gets its own emulated Gemmini, with its own scratchpad,
+// accumulator, and cycle count, just like each hart on a multi-accelerator SoC
+// drives the Gemmini attached to it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define GEMMINI_EMU_SPAD_ROWS (BANK_NUM * BANK_ROWS)
+
+// Timing parameters. These can be overridden on the command line to see how
+// sensitive a schedule is to them
+#ifndef GEMMINI_EMU_DRAM_LATENCY
+#define GEMMINI_EMU_DRAM_LATENCY 64
+#endif
+
+#ifndef GEMMINI_EMU_ROB_ENTRIES
+#define GEMMINI_EMU_ROB_ENTRIES 16
+#endif
+
+#define GEMMINI_EMU_ACC_BANKS 2
+#define GEMMINI_EMU_MESH_LATENCY (2*DIM)
+
+static elem_t scale_and_sat(acc_t x, int act, acc_scale_t scale, size_t relu6_shift);
+
+struct gemmini_emu_state_t {
+  elem_t spad[GEMMINI_EMU_SPAD_ROWS][DIM];
+  acc_t acc[ACC_ROWS][DIM];
+
+  // Set by config_ex
+  int dataflow;
+  int act;
+  size_t sys_shift;
+  size_t relu6_shift;
+  acc_scale_t acc_scale;
+  bool a_transpose;
+  bool b_transpose;
+  bool im2col;
+
+  // Set by config_ex too, for the 1x1, stride 1 convs whose im2col is
+  // modelled. Each compute reads the next DIM rows of the input image, and
+  // goes back to its first rows after row_turn+1 computes
+  bool im2col_1x1;
+  size_t im2col_row_turn;
+  size_t im2col_turn;
+
+  // Set by config_ld. There is one load configuration each for mvin, mvin2,
+  // and mvin3
+  size_t ld_stride[3];
+  uint32_t ld_scale_bits[3];
+  bool ld_shrunk[3];
+
+  // Set by config_st
+  size_t st_stride;
+  int pool_stride, pool_size, pool_out_dim;
+  int porows, pocols, orows, ocols;
+  int upad, lpad;
+
+  // Set by preload
+  uint32_t preload_sp_addr, output_sp_addr;
+  size_t preload_cols, preload_rows;
+  size_t output_cols, output_rows;
+
+  // The contents of the systolic array. In the WS dataflow, these are the
+  // preloaded weights. In the OS dataflow, these are the partial sums
+  acc_t pe_state[DIM][DIM];
+
+  // Set by the LOOP_WS config instructions
+  uint64_t loop_ws_pads, loop_ws_bounds;
+  uint64_t loop_ws_A, loop_ws_B, loop_ws_D, loop_ws_C;
+  uint64_t loop_ws_A_stride, loop_ws_B_stride, loop_ws_D_stride, loop_ws_C_stride;
+
+  // Set by MVIN_SP_CONFIG and MVIN_SP_CONFIG_PTR
+  uint64_t sp_dat, sp_ind, sp_ptr, sp_tile_cols;
+};
+
+static __thread struct gemmini_emu_state_t gemmini_emu_state;
+
+// The timing model is an in-order issue, out-of-order completion model of
+// Gemmini's reservation station and its load, store, and execute pipelines:
+//
+//   - Instructions are issued one per cycle, and at most
+//     GEMMINI_EMU_ROB_ENTRIES of them can be in flight at once.
+//   - mvin, mvin2, and mvin3 each have their own load pipeline, which moves
+//     MAX_BYTES per cycle, and takes GEMMINI_EMU_DRAM_LATENCY more cycles
+//     before the data lands. Each scratchpad and accumulator bank has only one
+//     write port though, so loads from different pipelines into the same bank
+//     conflict, and have to wait for each other.
+//   - mvout has its own store pipeline, which also moves MAX_BYTES per cycle.
+//   - Each compute streams DIM rows through the systolic array, taking DIM
+//     cycles, and its results land GEMMINI_EMU_MESH_LATENCY cycles later. In
+//     the WS dataflow, preloading weights is overlapped with the previous
+//     compute. In the OS dataflow, preloading a bias, and writing the results
+//     out, each take another DIM cycles.
+//   - Instructions wait for the scratchpad and accumulator rows they read to be
+//     written, and for the rows they write to be read by earlier instructions.
+//
+// The utilization reported by the tests is the number of DIM x DIM x DIM
+// computes that a perfectly utilized array would take, divided by the cycles
+// which the model estimates.
+#define GEMMINI_EMU_TIMED_ROWS (GEMMINI_EMU_SPAD_ROWS + ACC_ROWS)
+#define GEMMINI_EMU_BANKS (BANK_NUM + GEMMINI_EMU_ACC_BANKS)
+
+struct gemmini_emu_timing_t {
+  uint64_t now;
+  uint64_t last_finish;
+
+  // When each in-flight instruction finishes
+  uint64_t rob[GEMMINI_EMU_ROB_ENTRIES];
+  size_t rob_head;
+
+  // When each pipeline, and each bank's write port, is next free
+  uint64_t ld_free[3];
+  uint64_t st_free;
+  uint64_t ex_free;
+  uint64_t bank_free[GEMMINI_EMU_BANKS];
+
+  // When each row is last written, and last read
+  uint64_t row_written[GEMMINI_EMU_TIMED_ROWS];
+  uint64_t row_read[GEMMINI_EMU_TIMED_ROWS];
+
+  // Statistics
+  uint64_t ld_cycles;
+  uint64_t st_cycles;
+  uint64_t ex_cycles;
+  uint64_t bank_conflict_cycles;
+  uint64_t computes;
+};
+
+static __thread struct gemmini_emu_timing_t gemmini_emu_timing;
+
+static void gemmini_emu_error(const char * msg, uint32_t addr) {
+  printf("Gemmini emulator: %s (address 0x%x)\n", msg, addr);
+  exit(1);
+}
+
+static elem_t gemmini_emu_sat(acc_t x) {
+  return x > elem_t_max ? elem_t_max : (x < elem_t_min ? elem_t_min : x);
+}
+
+static elem_t gemmini_emu_activate(acc_t x) {
+  x = gemmini_emu_sat(x);
+  if (gemmini_emu_state.act == RELU) {
+    x = x < 0 ? 0 : x;
+  } else if (gemmini_emu_state.act == RELU6) {
+    int max = 6 << gemmini_emu_state.relu6_shift;
+    x = x < 0 ? 0 : (x > max ? max : x);
+  }
+  return x;
+}
+
+// Returns the row of the scratchpad or accumulator which a local address
+// points to, checking that it is in bounds
+static uint32_t gemmini_emu_row(uint32_t sp_addr, size_t offset) {
+  const bool is_acc = (sp_addr >> (ADDR_LEN-1)) & 1;
+  const uint32_t row = (sp_addr & ((1 << (ADDR_LEN-3)) - 1)) + offset;
+
+  if (is_acc && row >= ACC_ROWS) {
+    gemmini_emu_error("accumulator address out of range", sp_addr + offset);
+  } else if (!is_acc && row >= GEMMINI_EMU_SPAD_ROWS) {
+    gemmini_emu_error("scratchpad address out of range", sp_addr + offset);
+  }
+
+  return row;
+}
+
+#define GEMMINI_EMU_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Issues an instruction, stalling if the ROB is full
+static uint64_t gemmini_emu_issue() {
+  struct gemmini_emu_timing_t * const t = &gemmini_emu_timing;
+  t->now = GEMMINI_EMU_MAX(t->now + 1, t->rob[t->rob_head]);
+  return t->now;
+}
+
+static void gemmini_emu_retire(uint64_t finish) {
+  struct gemmini_emu_timing_t * const t = &gemmini_emu_timing;
+  t->rob[t->rob_head] = finish;
+  t->rob_head = (t->rob_head + 1) % GEMMINI_EMU_ROB_ENTRIES;
+  t->last_finish = GEMMINI_EMU_MAX(t->last_finish, finish);
+}
+
+static size_t gemmini_emu_timed_row(uint32_t sp_addr, size_t offset) {
+  const bool is_acc = (sp_addr >> (ADDR_LEN-1)) & 1;
+  const uint32_t row = gemmini_emu_row(sp_addr, offset);
+  return is_acc ? GEMMINI_EMU_SPAD_ROWS + row : row;
+}
+
+static size_t gemmini_emu_bank(uint32_t sp_addr) {
+  const bool is_acc = (sp_addr >> (ADDR_LEN-1)) & 1;
+  const uint32_t row = gemmini_emu_row(sp_addr, 0);
+  return is_acc ? BANK_NUM + row / (ACC_ROWS / GEMMINI_EMU_ACC_BANKS) : row / BANK_ROWS;
+}
+
+// Returns the latest time at which any of the rows that a rows x cols mvin or
+// mvout would touch is written or read
+static uint64_t gemmini_emu_rows_busy(uint32_t sp_addr, size_t cols, size_t rows,
+        bool written, bool read) {
+  uint64_t busy = 0;
+  if (sp_addr == GARBAGE_ADDR)
+    return busy;
+
+  for (size_t block = 0; block * DIM < cols; block++)
+    for (size_t r = 0; r < rows; r++) {
+      const size_t row = gemmini_emu_timed_row(sp_addr, block * DIM + r);
+      if (written)
+        busy = GEMMINI_EMU_MAX(busy, gemmini_emu_timing.row_written[row]);
+      if (read)
+        busy = GEMMINI_EMU_MAX(busy, gemmini_emu_timing.row_read[row]);
+    }
+
+  return busy;
+}
+
+static void gemmini_emu_rows_touch(uint32_t sp_addr, size_t cols, size_t rows,
+        uint64_t * times, uint64_t t) {
+  if (sp_addr == GARBAGE_ADDR)
+    return;
+
+  for (size_t block = 0; block * DIM < cols; block++)
+    for (size_t r = 0; r < rows; r++) {
+      const size_t row = gemmini_emu_timed_row(sp_addr, block * DIM + r);
+      times[row] = GEMMINI_EMU_MAX(times[row], t);
+    }
+}
+
+static uint64_t gemmini_emu_beats(size_t bytes) {
+  return bytes / MAX_BYTES + (bytes % MAX_BYTES != 0);
+}
+
+static void gemmini_emu_time_mvin(int id, uint32_t sp_addr, size_t cols,
+        size_t rows, uint64_t beats) {
+  struct gemmini_emu_timing_t * const t = &gemmini_emu_timing;
+
+  const uint64_t issued = gemmini_emu_issue();
+  const size_t bank = gemmini_emu_bank(sp_addr);
+
+  uint64_t start = GEMMINI_EMU_MAX(issued, t->ld_free[id]);
+  start = GEMMINI_EMU_MAX(start, gemmini_emu_rows_busy(sp_addr, cols, rows, true, true));
+  if (t->bank_free[bank] > start) {
+    t->bank_conflict_cycles += t->bank_free[bank] - start;
+    start = t->bank_free[bank];
+  }
+
+  const uint64_t finish = start + beats + GEMMINI_EMU_DRAM_LATENCY;
+
+  t->ld_free[id] = start + beats;
+  t->bank_free[bank] = start + beats;
+  t->ld_cycles += beats;
+  gemmini_emu_rows_touch(sp_addr, cols, rows, t->row_written, finish);
+  gemmini_emu_retire(finish);
+}
+
+// Pooled mvouts read "src_rows" accumulator rows, and write "rows" rows out
+static void gemmini_emu_time_mvout(uint32_t sp_addr, size_t cols, size_t src_rows,
+        size_t rows, size_t row_bytes) {
+  struct gemmini_emu_timing_t * const t = &gemmini_emu_timing;
+
+  const uint64_t issued = gemmini_emu_issue();
+  const uint64_t beats = GEMMINI_EMU_MAX(rows * gemmini_emu_beats(row_bytes), src_rows);
+
+  uint64_t start = GEMMINI_EMU_MAX(issued, t->st_free);
+  start = GEMMINI_EMU_MAX(start, gemmini_emu_rows_busy(sp_addr, cols, src_rows, true, false));
+
+  const uint64_t finish = start + beats + GEMMINI_EMU_DRAM_LATENCY;
+
+  t->st_free = start + beats;
+  t->st_cycles += beats;
+  gemmini_emu_rows_touch(sp_addr, cols, src_rows, t->row_read, start + beats);
+  gemmini_emu_retire(finish);
+}
+
+static void gemmini_emu_time_compute(uint32_t a_addr, size_t a_rows,
+        uint32_t bd_addr, size_t bd_rows, bool preload) {
+  struct gemmini_emu_timing_t * const t = &gemmini_emu_timing;
+
+  const bool ws = gemmini_emu_state.dataflow == WEIGHT_STATIONARY;
+  const uint32_t pre_addr = preload ? gemmini_emu_state.preload_sp_addr : GARBAGE_ADDR;
+  const size_t pre_rows = !preload ? 0 : (ws && gemmini_emu_state.b_transpose ?
+      gemmini_emu_state.preload_cols : gemmini_emu_state.preload_rows);
+  const uint32_t c_addr = gemmini_emu_state.output_sp_addr;
+  const size_t c_rows = gemmini_emu_state.output_rows;
+
+  const uint64_t issued = gemmini_emu_issue();
+
+  uint64_t start = GEMMINI_EMU_MAX(issued, t->ex_free);
+  start = GEMMINI_EMU_MAX(start, gemmini_emu_rows_busy(a_addr, DIM, a_rows, true, false));
+  start = GEMMINI_EMU_MAX(start, gemmini_emu_rows_busy(bd_addr, DIM, bd_rows, true, false));
+  start = GEMMINI_EMU_MAX(start, gemmini_emu_rows_busy(pre_addr, DIM, pre_rows, true, false));
+  start = GEMMINI_EMU_MAX(start, gemmini_emu_rows_busy(c_addr, DIM, c_rows, true, true));
+
+  uint64_t cycles = DIM;
+  if (!ws && pre_addr != GARBAGE_ADDR)
+    cycles += DIM;
+  if (!ws && c_addr != GARBAGE_ADDR)
+    cycles += DIM;
+
+  const uint64_t finish = start + cycles + GEMMINI_EMU_MESH_LATENCY;
+
+  t->ex_free = start + cycles;
+  t->ex_cycles += cycles;
+  t->computes++;
+  gemmini_emu_rows_touch(a_addr, DIM, a_rows, t->row_read, start + cycles);
+  gemmini_emu_rows_touch(bd_addr, DIM, bd_rows, t->row_read, start + cycles);
+  gemmini_emu_rows_touch(pre_addr, DIM, pre_rows, t->row_read, start + cycles);
+  gemmini_emu_rows_touch(c_addr, DIM, c_rows, t->row_written, finish);
+  gemmini_emu_retire(finish);
+}
+
+static void gemmini_emu_mvin(int id, const void * dram_addr, uint32_t sp_addr,
+        size_t cols, size_t rows) {
+
+  const bool is_acc = (sp_addr >> (ADDR_LEN-1)) & 1;
+  const bool accumulate = (sp_addr >> (ADDR_LEN-2)) & 1;
+  const size_t stride = gemmini_emu_state.ld_stride[id];
+  const bool shrunk = gemmini_emu_state.ld_shrunk[id];
+
+  gemmini_emu_time_mvin(id, sp_addr, cols, rows,
+      rows * gemmini_emu_beats(cols * (is_acc && !shrunk ? sizeof(acc_t) : sizeof(elem_t))));
+
+  for (size_t r = 0; r < rows; r++) {
+    const int8_t * const dram_row = (const int8_t *)dram_addr + r * stride;
+
+    for (size_t c = 0; c < cols; c++) {
+      const uint32_t row = gemmini_emu_row(sp_addr, (c / DIM) * DIM + r);
+
+      if (is_acc) {
+        acc_t x = shrunk ? ((const elem_t *)dram_row)[c] : ((const acc_t *)dram_row)[c];
+#ifdef HAS_MVIN_ACC_SCALE
+        x = MVIN_SCALE_ACC(x, scale_acc_t_bits_to_scale_acc_t(gemmini_emu_state.ld_scale_bits[id]));
+#elif defined(HAS_MVIN_SCALE)
+        // Without an accumulator scaler, shrunk inputs share the scratchpad's
+        if (shrunk)
+          x = MVIN_SCALE(x, scale_t_bits_to_scale_t(gemmini_emu_state.ld_scale_bits[id]));
+#endif
+        gemmini_emu_state.acc[row][c % DIM] = accumulate ?
+          gemmini_emu_state.acc[row][c % DIM] + x : x;
+      } else {
+        acc_t x = ((const elem_t *)dram_row)[c];
+#ifdef HAS_MVIN_SCALE
+        x = MVIN_SCALE(x, scale_t_bits_to_scale_t(gemmini_emu_state.ld_scale_bits[id]));
+#endif
+        gemmini_emu_state.spad[row][c % DIM] = gemmini_emu_sat(x);
+      }
+    }
+  }
+}
+
+// Reads an output value the way mvout would write it out to DRAM
+static elem_t gemmini_emu_output(uint32_t sp_addr, size_t offset, size_t col) {
+  const bool is_acc = (sp_addr >> (ADDR_LEN-1)) & 1;
+  const uint32_t row = gemmini_emu_row(sp_addr, offset);
+
+  if (is_acc) {
+    return scale_and_sat(gemmini_emu_state.acc[row][col], gemmini_emu_state.act,
+        gemmini_emu_state.acc_scale, gemmini_emu_state.relu6_shift);
+  }
+
+  return gemmini_emu_state.spad[row][col];
+}
+
+static void gemmini_emu_mvout(void * dram_addr, uint32_t sp_addr,
+        size_t cols, size_t rows) {
+
+  const bool is_acc = (sp_addr >> (ADDR_LEN-1)) & 1;
+  const bool full = (sp_addr >> (ADDR_LEN-3)) & 1;
+  const size_t stride = gemmini_emu_state.st_stride;
+
+  // sp_tiled_conv_ds moves out its whole orows x ocols output image at once,
+  // into rows which are pool_out_dim pixels wide, by configuring a pool_size
+  // of 1 with a pool_stride of 0. That's the same as a 1x1 pool with a stride
+  // of 1
+  const bool image = gemmini_emu_state.pool_stride == 0 &&
+    gemmini_emu_state.pool_size == 1 && rows == 0;
+  const bool pooled = gemmini_emu_state.pool_stride != 0 || image;
+
+  const int pool_stride = image ? 1 : gemmini_emu_state.pool_stride;
+  const int pool_size = gemmini_emu_state.pool_size;
+  const int porows = image ? gemmini_emu_state.orows : gemmini_emu_state.porows;
+  const int pocols = image ? gemmini_emu_state.ocols : gemmini_emu_state.pocols;
+  const int upad = image ? 0 : gemmini_emu_state.upad;
+  const int lpad = image ? 0 : gemmini_emu_state.lpad;
+
+  if (!pooled) {
+    gemmini_emu_time_mvout(sp_addr, cols, rows, rows,
+        cols * (is_acc && full ? sizeof(acc_t) : sizeof(elem_t)));
+  } else {
+    gemmini_emu_time_mvout(sp_addr, DIM,
+        gemmini_emu_state.orows * gemmini_emu_state.ocols,
+        porows * pocols, cols * sizeof(elem_t));
+  }
+
+  if (!pooled) {
+    for (size_t r = 0; r < rows; r++) {
+      int8_t * const dram_row = (int8_t *)dram_addr + r * stride;
+
+      for (size_t c = 0; c < cols; c++) {
+        const size_t offset = (c / DIM) * DIM + r;
+
+        if (is_acc && full) {
+          ((acc_t *)dram_row)[c] = gemmini_emu_state.acc[gemmini_emu_row(sp_addr, offset)][c % DIM];
+        } else {
+          ((elem_t *)dram_row)[c] = gemmini_emu_output(sp_addr, offset, c % DIM);
+        }
+      }
+    }
+  } else {
+    // Max-pool the orows x ocols output image which starts at sp_addr. The
+    // "cols" are the channels
+    for (int porow = 0; porow < porows; porow++) {
+      for (int pocol = 0; pocol < pocols; pocol++) {
+        elem_t * const pout = (elem_t *)((int8_t *)dram_addr +
+            (porow * gemmini_emu_state.pool_out_dim + pocol) * stride);
+
+        for (size_t c = 0; c < cols; c++) {
+          elem_t result = elem_t_min;
+
+          for (int wrow = 0; wrow < pool_size; wrow++) {
+            for (int wcol = 0; wcol < pool_size; wcol++) {
+              const int orow = porow * pool_stride + wrow - upad;
+              const int ocol = pocol * pool_stride + wcol - lpad;
+
+              elem_t x = 0;
+              if (orow >= 0 && orow < gemmini_emu_state.orows &&
+                  ocol >= 0 && ocol < gemmini_emu_state.ocols) {
+                x = gemmini_emu_output(sp_addr, orow * gemmini_emu_state.ocols + ocol, c);
+              }
+
+              result = x > result ? x : result;
+            }
+          }
+
+          pout[c] = result;
+        }
+      }
+    }
+  }
+}
+
+// Reads a rows x cols matrix out of the scratchpad into a DIM x DIM matrix,
+// padding it with zeros. If "transpose" is set, the matrix is stored
+// transposed in the scratchpad
+static void gemmini_emu_read_matrix(uint32_t sp_addr, size_t cols, size_t rows,
+        bool transpose, acc_t out[DIM][DIM]) {
+
+  for (size_t r = 0; r < DIM; r++)
+    for (size_t c = 0; c < DIM; c++)
+      out[r][c] = 0;
+
+  if (sp_addr == GARBAGE_ADDR)
+    return;
+
+  for (size_t r = 0; r < rows && r < DIM; r++)
+    for (size_t c = 0; c < cols && c < DIM; c++)
+      out[r][c] = transpose ?
+        gemmini_emu_state.spad[gemmini_emu_row(sp_addr, c)][r] :
+        gemmini_emu_state.spad[gemmini_emu_row(sp_addr, r)][c];
+}
+
+static void gemmini_emu_preload(uint32_t bd_addr, uint32_t c_addr,
+        size_t bd_cols, size_t bd_rows, size_t c_cols, size_t c_rows) {
+  gemmini_emu_retire(gemmini_emu_issue());
+
+  gemmini_emu_state.preload_sp_addr = bd_addr;
+  gemmini_emu_state.output_sp_addr = c_addr;
+  gemmini_emu_state.preload_cols = bd_cols;
+  gemmini_emu_state.preload_rows = bd_rows;
+  gemmini_emu_state.output_cols = c_cols;
+  gemmini_emu_state.output_rows = c_rows;
+}
+
+static void gemmini_emu_compute(uint32_t a_addr, uint32_t bd_addr,
+        size_t a_cols, size_t a_rows, size_t bd_cols, size_t bd_rows,
+        bool preload) {
+
+  static __thread acc_t A[DIM][DIM], BD[DIM][DIM], results[DIM][DIM];
+
+  const bool ws = gemmini_emu_state.dataflow == WEIGHT_STATIONARY;
+
+  if (gemmini_emu_state.im2col) {
+    printf("Gemmini emulator: the hardware im2col unit is not supported\n");
+    exit(1);
+  }
+
+  if (gemmini_emu_state.im2col_1x1 && a_addr != GARBAGE_ADDR) {
+    a_addr += gemmini_emu_state.im2col_turn * DIM;
+    gemmini_emu_state.im2col_turn = gemmini_emu_state.im2col_turn ==
+      gemmini_emu_state.im2col_row_turn ? 0 : gemmini_emu_state.im2col_turn + 1;
+  }
+
+  // The rows which are read depend on whether the operands are transposed
+  const bool a_t = gemmini_emu_state.a_transpose;
+  const bool bd_t = !ws && gemmini_emu_state.b_transpose;
+  gemmini_emu_time_compute(a_addr, a_t ? a_cols : a_rows,
+      bd_addr, bd_t ? bd_cols : bd_rows, preload);
+
+  gemmini_emu_read_matrix(a_addr, a_cols, a_rows, gemmini_emu_state.a_transpose, A);
+
+  if (preload) {
+    gemmini_emu_read_matrix(gemmini_emu_state.preload_sp_addr,
+        gemmini_emu_state.preload_cols, gemmini_emu_state.preload_rows,
+        ws && gemmini_emu_state.b_transpose, gemmini_emu_state.pe_state);
+  }
+
+  // In the WS dataflow, BD is the bias. In the OS dataflow, it is B
+  gemmini_emu_read_matrix(bd_addr, bd_cols, bd_rows,
+      !ws && gemmini_emu_state.b_transpose, BD);
+
+  for (size_t i = 0; i < DIM; i++) {
+    for (size_t j = 0; j < DIM; j++) {
+      if (ws) {
+        acc_t result = BD[i][j];
+        for (size_t k = 0; k < DIM; k++)
+          result += A[i][k] * gemmini_emu_state.pe_state[k][j];
+        results[i][j] = result;
+      } else {
+        for (size_t k = 0; k < DIM; k++)
+          gemmini_emu_state.pe_state[i][j] += A[i][k] * BD[k][j];
+        results[i][j] = gemmini_emu_state.pe_state[i][j];
+      }
+    }
+  }
+
+  const uint32_t c_addr = gemmini_emu_state.output_sp_addr;
+  if (c_addr == GARBAGE_ADDR)
+    return;
+
+  const bool is_acc = (c_addr >> (ADDR_LEN-1)) & 1;
+  const bool accumulate = (c_addr >> (ADDR_LEN-2)) & 1;
+
+  for (size_t i = 0; i < gemmini_emu_state.output_rows; i++) {
+    const uint32_t row = gemmini_emu_row(c_addr, i);
+
+    for (size_t j = 0; j < gemmini_emu_state.output_cols; j++) {
+      if (is_acc) {
+        gemmini_emu_state.acc[row][j] = accumulate ?
+          gemmini_emu_state.acc[row][j] + results[i][j] : results[i][j];
+      } else {
+        const acc_t shifted = ws ? results[i][j] :
+          ROUNDING_RIGHT_SHIFT(results[i][j], gemmini_emu_state.sys_shift);
+        gemmini_emu_state.spad[row][j] = gemmini_emu_activate(shifted);
+      }
+    }
+  }
+}
+
+// The LOOP_WS instruction is unrolled the same way the hardware unrolls it
+static void gemmini_emu_loop_ws(bool ex_accumulate, bool full_C, bool low_D,
+        bool a_transpose, bool b_transpose) {
+
+  const size_t I = gemmini_emu_state.loop_ws_bounds & 0xFFFF;
+  const size_t J = (gemmini_emu_state.loop_ws_bounds >> 16) & 0xFFFF;
+  const size_t K = (gemmini_emu_state.loop_ws_bounds >> 32) & 0xFFFF;
+  const size_t pad_I = gemmini_emu_state.loop_ws_pads & 0xFFFF;
+  const size_t pad_J = (gemmini_emu_state.loop_ws_pads >> 16) & 0xFFFF;
+  const size_t pad_K = (gemmini_emu_state.loop_ws_pads >> 32) & 0xFFFF;
+
+  const elem_t * const A = (const elem_t *)(uintptr_t)gemmini_emu_state.loop_ws_A;
+  const elem_t * const B = (const elem_t *)(uintptr_t)gemmini_emu_state.loop_ws_B;
+  const void * const D = (const void *)(uintptr_t)gemmini_emu_state.loop_ws_D;
+  void * const C = (void *)(uintptr_t)gemmini_emu_state.loop_ws_C;
+
+  const size_t A_row_stride = gemmini_emu_state.loop_ws_A_stride;
+  const size_t B_row_stride = gemmini_emu_state.loop_ws_B_stride;
+  const size_t D_row_stride = gemmini_emu_state.loop_ws_D_stride;
+  const size_t C_row_stride = gemmini_emu_state.loop_ws_C_stride;
+
+  // Like the hardware, consecutive loops alternate between the two halves of
+  // the scratchpad if they fit, so that one loop's mvins can overlap with the
+  // previous loop's computes
+  static __thread int loop_id = 0;
+  const bool fits_in_half = (I + J) * K * DIM <= GEMMINI_EMU_SPAD_ROWS / 2;
+  const uint32_t spad_start = fits_in_half ? loop_id * (GEMMINI_EMU_SPAD_ROWS / 2) : 0;
+  const uint32_t spad_end = fits_in_half ? spad_start + GEMMINI_EMU_SPAD_ROWS / 2 : GEMMINI_EMU_SPAD_ROWS;
+  loop_id = fits_in_half ? 1 - loop_id : 0;
+
+  const uint32_t A_sp_addr_start = spad_start;
+  const uint32_t B_sp_addr_start = spad_end - K * J * DIM;
+  const uint32_t D_sp_addr_start = 1 << (ADDR_LEN-1);
+  const uint32_t C_sp_addr_start = (3 << (ADDR_LEN-2)) | (full_C << (ADDR_LEN-3));
+
+  const size_t A_blocks = a_transpose ? (I <= MAX_BLOCK_LEN ? I : MAX_BLOCK_LEN) :
+    (K <= MAX_BLOCK_LEN ? K : MAX_BLOCK_LEN);
+  const size_t B_blocks = b_transpose ? (K <= MAX_BLOCK_LEN ? K : MAX_BLOCK_LEN) :
+    (J <= MAX_BLOCK_LEN ? J : MAX_BLOCK_LEN);
+  const size_t D_blocks = low_D ? (J <= MAX_BLOCK_LEN ? J : MAX_BLOCK_LEN) :
+    (J <= MAX_BLOCK_LEN_ACC ? J : MAX_BLOCK_LEN_ACC);
+
+  const size_t sizeof_D = low_D ? sizeof(elem_t) : sizeof(acc_t);
+  const size_t sizeof_C = full_C ? sizeof(acc_t) : sizeof(elem_t);
+
+  // Move-in D
+  if (D != NULL) {
+    for (size_t i = 0; i < I; i++) {
+      const size_t rows = DIM - (i == I-1 ? pad_I : 0);
+      for (size_t j = 0; j < J; j += D_blocks) {
+        const void * const D_dram_addr = (const int8_t *)D + (i * D_row_stride + j)*DIM*sizeof_D;
+        const uint32_t D_sp_addr_acc = D_sp_addr_start + (i*J + j)*DIM;
+        const size_t blocks = j + D_blocks <= J ? D_blocks : J-j;
+        const size_t cols = blocks * DIM - (j + blocks >= J ? pad_J : 0);
+        gemmini_emu_mvin(2, D_dram_addr, D_sp_addr_acc, cols, rows);
+      }
+    }
+  }
+
+  for (size_t j = 0; j < J; j++) {
+    for (size_t k = 0; k < K; k++) {
+      for (size_t i = 0; i < I; i++) {
+        const uint32_t A_sp_addr = a_transpose ? (A_sp_addr_start + (k*I + i)*DIM) :
+          (A_sp_addr_start + (i*K + k)*DIM);
+        const uint32_t B_sp_addr = b_transpose ? (B_sp_addr_start + (j*K + k)*DIM) :
+          (B_sp_addr_start + (k*J + j)*DIM);
+        const uint32_t C_sp_addr = C_sp_addr_start + (i*J + j)*DIM;
+
+        // Mvin A
+        if (a_transpose) {
+          if (j == 0 && i % A_blocks == 0) {
+            const elem_t * const A_dram_addr = A + (k*A_row_stride + i)*DIM;
+            const size_t blocks = i + A_blocks <= I ? A_blocks : I-i;
+            const size_t cols = blocks * DIM - (i + blocks >= I ? pad_I : 0);
+            const size_t rows = DIM - (k == K-1 ? pad_K : 0);
+            gemmini_emu_mvin(0, A_dram_addr, A_sp_addr, cols, rows);
+          }
+        } else {
+          if (j == 0 && k % A_blocks == 0) {
+            const elem_t * const A_dram_addr = A + (i*A_row_stride + k)*DIM;
+            const size_t blocks = k + A_blocks <= K ? A_blocks : K-k;
+            const size_t cols = blocks * DIM - (k + blocks >= K ? pad_K : 0);
+            const size_t rows = DIM - (i == I-1 ? pad_I : 0);
+            gemmini_emu_mvin(0, A_dram_addr, A_sp_addr, cols, rows);
+          }
+        }
+
+        // Mvin B
+        if (b_transpose) {
+          if (i == 0 && k % B_blocks == 0) {
+            const elem_t * const B_dram_addr = B + (j*B_row_stride + k)*DIM;
+            const size_t blocks = k + B_blocks <= K ? B_blocks : K-k;
+            const size_t cols = blocks * DIM - (k + blocks >= K ? pad_K : 0);
+            const size_t rows = DIM - (j == J-1 ? pad_J : 0);
+            gemmini_emu_mvin(1, B_dram_addr, B_sp_addr, cols, rows);
+          }
+        } else {
+          if (i == 0 && j % B_blocks == 0) {
+            const elem_t * const B_dram_addr = B + (k*B_row_stride + j)*DIM;
+            const size_t blocks = j + B_blocks <= J ? B_blocks : J-j;
+            const size_t cols = blocks * DIM - (j + blocks >= J ? pad_J : 0);
+            const size_t rows = DIM - (k == K-1 ? pad_K : 0);
+            gemmini_emu_mvin(1, B_dram_addr, B_sp_addr, cols, rows);
+          }
+        }
+
+        // Compute
+        {
+          const uint32_t pre_sp_addr = i == 0 ? B_sp_addr : GARBAGE_ADDR;
+          uint32_t out_sp_addr = C_sp_addr;
+
+          // If we're not using a bias, then we want to overwrite what's in the
+          // accumulator, rather than writing over it
+          if (D == NULL && !ex_accumulate && k == 0) {
+            out_sp_addr &= ~(1 << (ADDR_LEN-2));
+          }
+
+          const size_t A_cols = DIM - (k == K - 1 ? pad_K : 0);
+          const size_t A_rows = DIM - (i == I - 1 ? pad_I : 0);
+          const size_t B_cols = DIM - (j == J - 1 ? pad_J : 0);
+          const size_t B_rows = DIM - (k == K - 1 ? pad_K : 0);
+          const size_t C_cols = DIM - (j == J - 1 ? pad_J : 0);
+          const size_t C_rows = DIM - (i == I - 1 ? pad_I : 0);
+
+          gemmini_emu_preload(pre_sp_addr, out_sp_addr, B_cols, B_rows, C_cols, C_rows);
+          gemmini_emu_compute(A_sp_addr, GARBAGE_ADDR, A_cols, A_rows, DIM, DIM, i == 0);
+        }
+
+        // Move-out C
+        if (C != NULL && k == K-1) {
+          void * const C_dram_addr = (int8_t*)C + (i*C_row_stride + j)*DIM*sizeof_C;
+
+          const size_t C_cols = DIM - (j == J - 1 ? pad_J : 0);
+          const size_t C_rows = DIM - (i == I - 1 ? pad_I : 0);
+
+          gemmini_emu_mvout(C_dram_addr, C_sp_addr, C_cols, C_rows);
+        }
+      }
+    }
+  }
+}
+
+// Moves a DIM x DIM (or smaller) block of a row-major sorted COO matrix into
+// the scratchpad, writing zeros wherever there is no nonzero. The scan starts
+// at the nonzero which sp_dat and sp_ind point to, and stops once it passes
+// the last row, runs out of the array_dim nonzeros it was given, or reaches an
+// entry which is out of order
+static void gemmini_emu_mvin_sparse_coo(uint32_t sp_addr, size_t cols, size_t rows,
+        size_t start_row, size_t start_col, size_t array_dim) {
+
+  const elem_t * const dat = (const elem_t *)(uintptr_t)gemmini_emu_state.sp_dat;
+  const ind_t * const ind = (const ind_t *)(uintptr_t)gemmini_emu_state.sp_ind;
+
+  for (size_t r = 0; r < rows; r++)
+    for (size_t c = 0; c < cols; c++)
+      gemmini_emu_state.spad[gemmini_emu_row(sp_addr, r)][c] = 0;
+
+  size_t n;
+  for (n = 0; n < array_dim; n++) {
+    const size_t row = ind[2*n];
+    const size_t col = ind[2*n+1];
+
+    if (row >= start_row + rows)
+      break;
+
+    if (n > 0 && (row < ind[2*(n-1)] ||
+          (row == ind[2*(n-1)] && col <= ind[2*(n-1)+1])))
+      break;
+
+    if (row < start_row || col < start_col || col >= start_col + cols)
+      continue;
+
+    acc_t x = dat[n];
+#ifdef HAS_MVIN_SCALE
+    x = MVIN_SCALE(x, scale_t_bits_to_scale_t(gemmini_emu_state.ld_scale_bits[0]));
+#endif
+    gemmini_emu_state.spad[gemmini_emu_row(sp_addr, row - start_row)][col - start_col] =
+      gemmini_emu_sat(x);
+  }
+
+  // Each nonzero that was scanned had to be read from DRAM, and each row has
+  // to be written into the scratchpad
+  const uint64_t beats = gemmini_emu_beats(n * (sizeof(elem_t) + 2*sizeof(ind_t)));
+  gemmini_emu_time_mvin(0, sp_addr, cols, rows, GEMMINI_EMU_MAX(beats, rows));
+}
+
+// Moves a tile of a CSR matrix into the scratchpad. The tile pointers say
+// where each of the tile's rows starts and ends, so only the tile's own
+// nonzeros are read
+static void gemmini_emu_mvin_sparse_csr(uint32_t sp_addr, size_t cols, size_t rows,
+        size_t start_row, size_t start_col) {
+
+  const elem_t * const dat = (const elem_t *)(uintptr_t)gemmini_emu_state.sp_dat;
+  const ind_t * const ind = (const ind_t *)(uintptr_t)gemmini_emu_state.sp_ind;
+  const ind_t * const ptr = (const ind_t *)(uintptr_t)gemmini_emu_state.sp_ptr;
+  const size_t tile_cols = gemmini_emu_state.sp_tile_cols;
+
+  size_t nnz = 0;
+
+  for (size_t r = 0; r < rows; r++) {
+    const size_t t = (start_row + r) * tile_cols + start_col / DIM;
+
+    for (size_t c = 0; c < cols; c++)
+      gemmini_emu_state.spad[gemmini_emu_row(sp_addr, r)][c] = 0;
+
+    for (size_t n = ptr[t]; n < ptr[t+1]; n++) {
+      acc_t x = dat[n];
+#ifdef HAS_MVIN_SCALE
+      x = MVIN_SCALE(x, scale_t_bits_to_scale_t(gemmini_emu_state.ld_scale_bits[0]));
+#endif
+      gemmini_emu_state.spad[gemmini_emu_row(sp_addr, r)][ind[n] - start_col] =
+        gemmini_emu_sat(x);
+    }
+
+    nnz += ptr[t+1] - ptr[t];
+  }
+
+  // Two tile pointers per row, and the tile's nonzeros, have to be read from
+  // DRAM
+  const uint64_t beats = gemmini_emu_beats(2 * rows * sizeof(ind_t) +
+      nnz * (sizeof(elem_t) + sizeof(ind_t)));
+  gemmini_emu_time_mvin(0, sp_addr, cols, rows, GEMMINI_EMU_MAX(beats, rows));
+}
+
+// Moves a DIM x DIM block of a blocked-CSR matrix into the scratchpad, or
+// zeros if the block isn't stored. The block's two tile pointers say whether
+// it's stored, and where
+static void gemmini_emu_mvin_sparse_bcsr(uint32_t sp_addr, size_t cols, size_t rows,
+        size_t block_row, size_t block_col) {
+
+  const elem_t * const dat = (const elem_t *)(uintptr_t)gemmini_emu_state.sp_dat;
+  const ind_t * const ptr = (const ind_t *)(uintptr_t)gemmini_emu_state.sp_ptr;
+
+  const size_t t = block_row * gemmini_emu_state.sp_tile_cols + block_col;
+  const elem_t * const block = ptr[t] < ptr[t+1] ? dat + ptr[t]*DIM*DIM : NULL;
+
+  for (size_t r = 0; r < rows; r++)
+    for (size_t c = 0; c < cols; c++) {
+      acc_t x = block == NULL ? 0 : block[r*DIM + c];
+#ifdef HAS_MVIN_SCALE
+      x = MVIN_SCALE(x, scale_t_bits_to_scale_t(gemmini_emu_state.ld_scale_bits[0]));
+#endif
+      gemmini_emu_state.spad[gemmini_emu_row(sp_addr, r)][c] = gemmini_emu_sat(x);
+    }
+
+  // The two tile pointers have to be read, and then the block itself, if
+  // it's there
+  uint64_t beats = gemmini_emu_beats(2 * sizeof(ind_t));
+  if (block != NULL)
+    beats += rows * gemmini_emu_beats(cols * sizeof(elem_t));
+  gemmini_emu_time_mvin(0, sp_addr, cols, rows, GEMMINI_EMU_MAX(beats, rows));
+}
+
+static void gemmini_emu_config(uint64_t rs1, uint64_t rs2) {
+  const int cmd = rs1 & 3;
+
+  if (cmd == CONFIG_EX) {
+    gemmini_emu_state.dataflow = (rs1 >> 2) & 1;
+    gemmini_emu_state.act = (rs1 >> 3) & 3;
+    gemmini_emu_state.a_transpose = (rs1 >> 8) & 1;
+    gemmini_emu_state.b_transpose = (rs1 >> 9) & 1;
+    gemmini_emu_state.acc_scale = acc_scale_t_bits_to_acc_scale_t(rs1 >> 32);
+    gemmini_emu_state.sys_shift = rs2 & 0xFFFFFFFF;
+    gemmini_emu_state.relu6_shift = rs2 >> 32;
+  } else if (cmd == CONFIG_LD) {
+    const int id = (rs1 >> 3) & 3;
+    gemmini_emu_state.ld_stride[id] = rs2;
+    gemmini_emu_state.ld_scale_bits[id] = rs1 >> 32;
+    gemmini_emu_state.ld_shrunk[id] = (rs1 >> 2) & 1;
+  } else if (cmd == CONFIG_ST) {
+    gemmini_emu_state.st_stride = rs2;
+    gemmini_emu_state.pool_stride = (rs1 >> 4) & 3;
+    gemmini_emu_state.pool_size = (rs1 >> 6) & 3;
+    gemmini_emu_state.upad = (rs1 >> 8) & 3;
+    gemmini_emu_state.lpad = (rs1 >> 10) & 3;
+    gemmini_emu_state.pool_out_dim = (rs1 >> 24) & 0xFF;
+    gemmini_emu_state.porows = (rs1 >> 32) & 0xFF;
+    gemmini_emu_state.pocols = (rs1 >> 40) & 0xFF;
+    gemmini_emu_state.orows = (rs1 >> 48) & 0xFF;
+    gemmini_emu_state.ocols = (rs1 >> 56) & 0xFF;
+  } else if (cmd == CONFIG_IM2COL) {
+    // gemmini_extended_config_ex zeroes out every im2col field. A 1x1, stride
+    // 1 conv over whole blocks of channels, like the ones sp_tiled_conv_ds
+    // runs, reads its input rows in order, so its im2col is modelled too
+    const size_t stride = (rs2 >> 20) & 7;
+    const size_t channels = (rs2 >> 23) & 0x1FFFFF;
+    const size_t kdim = (rs2 >> 44) & 0xF;
+    const size_t kdim2 = (rs2 >> 48) & 0xFF;
+    const bool enabled = (rs1 >> 2) != 0 || rs2 != 0;
+    const bool is_1x1 = stride == 1 && kdim == 1 && kdim2 == 1 &&
+      channels % DIM == 0;
+
+    gemmini_emu_state.im2col = enabled && !is_1x1;
+    gemmini_emu_state.im2col_1x1 = enabled && is_1x1;
+    gemmini_emu_state.im2col_row_turn = (rs1 >> 42) & 0xFFF;
+    gemmini_emu_state.im2col_turn = 0;
+  }
+}
+
+static void gemmini_emu_rocc(int funct, uint64_t rs1, uint64_t rs2) {
+  const uint32_t rs1_addr = rs1 & 0xFFFFFFFF;
+  const uint32_t rs2_addr = rs2 & 0xFFFFFFFF;
+  const size_t rs1_cols = (rs1 >> ADDR_LEN) & 0xFFFF;
+  const size_t rs1_rows = (rs1 >> (ADDR_LEN + 16)) & 0xFFFF;
+  const size_t rs2_cols = (rs2 >> ADDR_LEN) & 0xFFFF;
+  const size_t rs2_rows = (rs2 >> (ADDR_LEN + 16)) & 0xFFFF;
+
+  switch (funct) {
+    case k_CONFIG:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_config(rs1, rs2);
+      break;
+    case k_MVIN:
+      gemmini_emu_mvin(0, (const void *)(uintptr_t)rs1, rs2_addr, rs2_cols, rs2_rows);
+      break;
+    case k_MVIN2:
+      gemmini_emu_mvin(1, (const void *)(uintptr_t)rs1, rs2_addr, rs2_cols, rs2_rows);
+      break;
+    case k_MVIN3:
+      gemmini_emu_mvin(2, (const void *)(uintptr_t)rs1, rs2_addr, rs2_cols, rs2_rows);
+      break;
+    case k_MVOUT:
+      gemmini_emu_mvout((void *)(uintptr_t)rs1, rs2_addr, rs2_cols, rs2_rows);
+      break;
+    case k_PRELOAD:
+      gemmini_emu_preload(rs1_addr, rs2_addr, rs1_cols, rs1_rows, rs2_cols, rs2_rows);
+      break;
+    case k_COMPUTE_PRELOADED:
+    case k_COMPUTE_ACCUMULATE:
+      gemmini_emu_compute(rs1_addr, rs2_addr, rs1_cols, rs1_rows, rs2_cols, rs2_rows,
+          funct == k_COMPUTE_PRELOADED);
+      break;
+    case k_FLUSH:
+      gemmini_emu_retire(gemmini_emu_issue());
+      break;
+    case k_LOOP_WS_CONFIG_BOUNDS:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_state.loop_ws_pads = rs1;
+      gemmini_emu_state.loop_ws_bounds = rs2;
+      break;
+    case k_LOOP_WS_CONFIG_ADDRS_AB:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_state.loop_ws_A = rs1;
+      gemmini_emu_state.loop_ws_B = rs2;
+      break;
+    case k_LOOP_WS_CONFIG_ADDRS_DC:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_state.loop_ws_D = rs1;
+      gemmini_emu_state.loop_ws_C = rs2;
+      break;
+    case k_LOOP_WS_CONFIG_STRIDES_AB:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_state.loop_ws_A_stride = rs1;
+      gemmini_emu_state.loop_ws_B_stride = rs2;
+      break;
+    case k_LOOP_WS_CONFIG_STRIDES_DC:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_state.loop_ws_D_stride = rs1;
+      gemmini_emu_state.loop_ws_C_stride = rs2;
+      break;
+    case k_LOOP_WS:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_loop_ws(rs1 & 1, (rs1 >> 1) & 1, (rs1 >> 2) & 1,
+          rs2 & 1, (rs2 >> 1) & 1);
+      break;
+    case k_MVIN_SP_CONFIG:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_state.sp_dat = rs1;
+      gemmini_emu_state.sp_ind = rs2;
+      break;
+    case k_MVIN_SP_COO:
+      gemmini_emu_mvin_sparse_coo(rs1_addr, rs1_cols, rs1_rows,
+          (rs2 >> 16) & 0xFFFF, rs2 & 0xFFFF, rs2 >> 32);
+      break;
+    case k_MVIN_SP_CONFIG_PTR:
+      gemmini_emu_retire(gemmini_emu_issue());
+      gemmini_emu_state.sp_ptr = rs1;
+      gemmini_emu_state.sp_tile_cols = rs2;
+      break;
+    case k_MVIN_SP_CSR:
+      gemmini_emu_mvin_sparse_csr(rs1_addr, rs1_cols, rs1_rows,
+          (rs2 >> 16) & 0xFFFF, rs2 & 0xFFFF);
+      break;
+    case k_MVIN_SP_BCSR:
+      gemmini_emu_mvin_sparse_bcsr(rs1_addr, rs1_cols, rs1_rows,
+          (rs2 >> 16) & 0xFFFF, rs2 & 0xFFFF);
+      break;
+    default:
+      printf("Gemmini emulator: unsupported funct %d\n", funct);
+      exit(1);
+  }
+}
+
+// The emulator executes every instruction as soon as it is issued, so a
+// fence only has to wait for the timing model to catch up
+static void gemmini_emu_fence() {
+  gemmini_emu_timing.now = GEMMINI_EMU_MAX(gemmini_emu_timing.now,
+      gemmini_emu_timing.last_finish);
+}
+
+static uint64_t gemmini_emu_read_cycles() {
+  return gemmini_emu_timing.now;
+}
+
+// Prints how busy each of the pipelines was since the start of the program
+static void gemmini_emu_print_stats() {
+  const struct gemmini_emu_timing_t * const t = &gemmini_emu_timing;
+  printf("Estimated cycles: %llu\n", (unsigned long long)t->now);
+  printf("  Load cycles: %llu\n", (unsigned long long)t->ld_cycles);
+  printf("  Store cycles: %llu\n", (unsigned long long)t->st_cycles);
+  printf("  Execute cycles: %llu (%llu computes)\n", (unsigned long long)t->ex_cycles,
+      (unsigned long long)t->computes);
+  printf("  Bank conflict stalls: %llu\n", (unsigned long long)t->bank_conflict_cycles);
+}
+
+#endif  // SRC_MAIN_C_GEMMINI_HOST_EMU_H
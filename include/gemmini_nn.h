@@ -37,6 +37,13 @@ struct FcParams {
     int I, J, K;
 };
 
+// Cycles spent on each phase of a GCN layer (see gcn_layer)
+struct GcnCycles {
+    uint64_t transform; // X * W
+    uint64_t aggregate; // A_hat * (X * W)
+    bool fused;
+};
+
 #define HIST_IMAGES(IMAGES) \
     for (int num = -128; num <= 127; num++) { \
         int count = 0; \
@@ -151,6 +158,182 @@ static void tiled_matmul_nn_auto(size_t dim_I, size_t dim_J, size_t dim_K,
     }
 }
 
+// Like tiled_matmul_nn_auto, but returns without waiting for Gemmini to finish
+// (see tiled_matmul_auto_async). Checking the result needs it to be finished
+// though, so with check set, this waits anyway
+static gemmini_handle_t tiled_matmul_nn_auto_async(size_t dim_I, size_t dim_J, size_t dim_K,
+        const elem_t A[dim_I][dim_K], const elem_t B[dim_K][dim_J],
+        const void * D, elem_t C[dim_I][dim_J],
+        int act, acc_scale_t scale, size_t relu6_shift, bool repeating_bias,
+        enum tiled_matmul_type_t tiled_matmul_type,
+        bool check, char * layer_name)
+{
+    if (check) {
+        tiled_matmul_nn_auto(dim_I, dim_J, dim_K, A, B, D, C,
+            act, scale, relu6_shift, repeating_bias,
+            tiled_matmul_type, check, layer_name);
+        return 0;
+    }
+
+    return tiled_matmul_auto_async(dim_I, dim_J, dim_K,
+        (elem_t*)A, (elem_t*)B, D, (elem_t*)C,
+        dim_K, dim_J, dim_J, dim_J,
+        MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+        act, scale, relu6_shift, repeating_bias,
+        false, false,
+        false, false,
+        tiled_matmul_type);
+}
+
+// This function runs the fully-connected layers of an MLP one after another,
+// keeping the activations between them on-chip wherever they fit (see
+// tiled_matmul_chain). Layer l's output is written to outputs[l] only if it
+// has to go through DRAM, except for the last layer's, which always is. With
+// check set, the CPU's outputs are computed into gold, which has to have room
+// for two of the layers' outputs, and the last one is compared with Gemmini's
+static void tiled_matmul_nn_chain(size_t n_layers, const struct FcParams params[],
+        const elem_t * input, const elem_t * const weights[],
+        const acc_t * const biases[], elem_t * const outputs[],
+        int act, size_t relu6_shift,
+        enum tiled_matmul_type_t tiled_matmul_type,
+        bool check, elem_t * gold, char * layer_name)
+{
+    size_t dims[n_layers + 1];
+    const acc_t * D[n_layers];
+    int acts[n_layers];
+    acc_scale_t scales[n_layers];
+
+    dims[0] = params[0].in_features;
+    for (size_t l = 0; l < n_layers; l++) {
+        dims[l+1] = params[l].out_features;
+        D[l] = params[l].bias ? biases[l] : NULL;
+        acts[l] = act;
+        scales[l] = params[l].output_scale;
+    }
+
+    if (check)
+        printf("%s: gemmini\n", layer_name);
+
+    tiled_matmul_chain(n_layers, params[0].batch_size, dims,
+        input, weights, D, outputs,
+        acts, scales, relu6_shift,
+        tiled_matmul_type);
+
+    if (check) {
+        printf("%s: CPU\n", layer_name);
+
+        const size_t dim_I = params[0].batch_size;
+        const size_t dim_J = dims[n_layers];
+
+        size_t max_dim = 0;
+        for (size_t l = 1; l <= n_layers; l++)
+            if (dims[l] > max_dim)
+                max_dim = dims[l];
+
+        const elem_t * A = input;
+
+        for (size_t l = 0; l < n_layers; l++) {
+            elem_t * C = gold + (l % 2) * dim_I * max_dim;
+
+            tiled_matmul_auto(dim_I, dims[l+1], dims[l],
+                A, weights[l], D[l], C,
+                dims[l], dims[l+1], dims[l+1], dims[l+1],
+                MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+                acts[l], scales[l], relu6_shift, D[l] != NULL,
+                false, false,
+                false, false,
+                CPU);
+
+            A = C;
+        }
+
+        if (!MAT_IS_EQUAL(dim_I, dim_J, ((elem_t (*)[dim_J])outputs[n_layers-1]),
+                    ((elem_t (*)[dim_J])A))) {
+            printf("Layer calculated incorrectly: %s\n", layer_name);
+            exit(1);
+        }
+    }
+}
+
+// This function runs one GCN layer, act(A_hat * (X * W) + bias), where A_hat
+// is a sparse N x N adjacency matrix in tile-ordered COO format, with its tile
+// offsets (see spmm_coo_tile_offsets). If a
+// slice of X * W's columns fits in the scratchpad, then each slice is
+// computed there and aggregated with A_hat straight away, so that X * W
+// never goes through DRAM (see sp_tiled_gcn_transform). Otherwise, X * W is
+// written to the XW buffer, which can only be NULL if the layer is fused.
+// The returned struct holds the cycles spent on each phase; the phases are
+// fenced off from each other so that they can be timed separately
+static struct GcnCycles gcn_layer(size_t N, size_t in_features, size_t out_features,
+        const elem_t * A_data, const ind_t * A_coo, size_t A_nnz,
+        const ind_t * A_tile_offsets,
+        const elem_t X[N][in_features], const elem_t W[in_features][out_features],
+        const acc_t * bias, elem_t * XW, elem_t out[N][out_features],
+        int act, size_t relu6_shift,
+        enum tiled_matmul_type_t tiled_matmul_type,
+        char * layer_name)
+{
+    struct GcnCycles cycles = {0, 0, false};
+
+    const size_t J_total = out_features / DIM + (out_features % DIM != 0);
+    size_t J, tile_I;
+
+    cycles.fused = tiled_matmul_type != CPU &&
+        tiled_gcn_tiling_factors(N, in_features, out_features, &J, &tile_I);
+
+#ifdef GEMMINI_ASSERTIONS
+    if (!cycles.fused && XW == NULL) {
+        printf("%s: GCN layer can't be fused, so it needs an XW buffer\n", layer_name);
+        exit(1);
+    }
+#endif
+
+    if (cycles.fused) {
+        for (size_t j = 0; j < J_total; j += J) {
+            const size_t slice = j + J <= J_total ? J : J_total - j;
+
+            uint64_t start = read_cycles();
+            sp_tiled_gcn_transform((elem_t*)X, (elem_t*)W,
+                N, in_features, out_features, j, slice, tile_I);
+            gemmini_fence();
+            uint64_t mid = read_cycles();
+            sp_tiled_gcn_aggregate(A_data, A_coo, A_tile_offsets, bias, (elem_t*)out,
+                N, out_features, j, slice, tile_I, act, relu6_shift);
+            gemmini_fence();
+            uint64_t end = read_cycles();
+
+            cycles.transform += mid - start;
+            cycles.aggregate += end - mid;
+        }
+    } else {
+        uint64_t start = read_cycles();
+        tiled_matmul_auto(N, out_features, in_features,
+            (elem_t*)X, (elem_t*)W, NULL, XW,
+            in_features, out_features, out_features, out_features,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            NO_ACTIVATION, ACC_SCALE_IDENTITY, 0, false,
+            false, false,
+            false, false,
+            tiled_matmul_type);
+        uint64_t mid = read_cycles();
+        tiled_spmm_auto(N, out_features, N,
+            A_data, A_coo, A_nnz,
+            A_tile_offsets,
+            XW, bias, (elem_t*)out,
+            out_features, 0, out_features,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            act, ACC_SCALE_IDENTITY, relu6_shift, true,
+            false, false,
+            tiled_matmul_type == CPU ? CPU : WS);
+        uint64_t end = read_cycles();
+
+        cycles.transform = mid - start;
+        cycles.aggregate = end - mid;
+    }
+
+    return cycles;
+}
+
 // This function runs a tiled matrix multiplication, with automatically
 // calculated tiling factors
 static void tiled_matmul_nn_auto_cisc(
@@ -173,8 +356,10 @@ static void tiled_matmul_nn_auto_cisc(
         tiled_matmul_auto(dim_I, dim_J, dim_K,
             (elem_t*)A, (elem_t*)B, D, (elem_t*)gold, 
             dim_K, dim_J, dim_J, dim_J,
-            MVIN_SCALE_ONE, MVIN_SCALE_ONE, MVIN_SCALE_ONE,
-            act, shift, relu6_shift, repeating_bias,
+            MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY, MVIN_SCALE_IDENTITY,
+            act, ACC_SCALE_IDENTITY / (1 << shift), relu6_shift, repeating_bias,
+            false, false,
+            false, false,
             CPU);
 
         if (!MAT_IS_EQUAL(dim_I, dim_J, C, gold)) {
@@ -194,6 +379,54 @@ static void conv_dw(size_t I, size_t J,
     elem_t output [I][J],
     const struct ConvParams * params)
 {
+#ifdef GEMMINI_RVV_ELEMS
+    // Vectorized across channels. The inputs and outputs are contiguous across
+    // channels, but the weights are strided by the size of a kernel
+    const ptrdiff_t weight_stride = kernel_size * kernel_size * sizeof(elem_t);
+
+    for (int batch = 0; batch < batch_size; batch++) {
+        for (int out_row = 0; out_row < out_dim; out_row++) {
+            for (int out_col = 0; out_col < out_dim; out_col++) {
+                size_t r = batch * params->out_dim * params->out_dim + out_row * params->out_dim + out_col;
+
+                for (size_t channel = 0; channel < channels;) {
+                    const size_t vl = __riscv_vsetvl_e32m4(channels - channel);
+                    int in_row = out_row * params->stride - params->padding;
+
+                    vfloat32m4_t result = params->bias ?
+                        __riscv_vle32_v_f32m4(bias + channel, vl) :
+                        __riscv_vfmv_v_f_f32m4(0, vl);
+
+                    for (int kernel_row = 0; kernel_row < params->kernel_size; kernel_row++) {
+                        int in_col = out_col * params->stride - params->padding;
+
+                        for (int kernel_col = 0; kernel_col < params->kernel_size; kernel_col++) {
+                            if (in_row >= 0 && in_row < params->in_dim && in_col >= 0 && in_col < params->in_dim) {
+                                const vfloat32m4_t in = __riscv_vle32_v_f32m4(&input[batch][in_row][in_col][channel], vl);
+                                const vfloat32m4_t w = __riscv_vlse32_v_f32m4(&weight[channel][kernel_row][kernel_col], weight_stride, vl);
+                                result = __riscv_vfadd_vv_f32m4(result, __riscv_vfmul_vv_f32m4(in, w, vl), vl);
+                            }
+
+                            in_col++;
+                        }
+
+                        in_row++;
+                    }
+
+                    result = clip_rvv(result, 0, INFINITY, vl);
+                    result = __riscv_vfmul_vf_f32m4(result, params->output_scale, vl);
+                    result = clip_rvv(result, elem_t_min, elem_t_max, vl);
+
+                    __riscv_vse32_v_f32m4(&output[r][channel], result, vl);
+
+                    channel += vl;
+                }
+            }
+        }
+    }
+    return;
+#endif
+
     for (int batch = 0; batch < batch_size; batch++) {
         for (int channel = 0; channel < channels; channel++) {
             for (int out_row = 0; out_row < out_dim; out_row++) {
@@ -491,6 +724,47 @@ void pool(size_t batch_size, size_t channels, size_t in_dim, size_t out_dim,
     // size_t in_dim = params->out_dim;
     size_t padding = params->pool_padding;
 
+#ifdef GEMMINI_RVV_ELEMS
+    // Vectorized across channels, which are contiguous in NHWC. The maxes are
+    // merged on compares, so that zeros keep the signs the scalar code gives
+    // them
+    for (int batch = 0; batch < batch_size; batch++) {
+        for (int out_row = 0; out_row < out_dim; out_row++) {
+            for (int out_col = 0; out_col < out_dim; out_col++) {
+                for (size_t channel = 0; channel < channels;) {
+                    const size_t vl = __riscv_vsetvl_e32m4(channels - channel);
+                    int in_row = out_row * stride - padding;
+
+                    vfloat32m4_t result = __riscv_vfmv_v_f_f32m4(elem_t_min, vl);
+
+                    for (int kernel_row = 0; kernel_row < kernel_size; kernel_row++) {
+                        int in_col = out_col * stride - padding;
+
+                        for (int kernel_col = 0; kernel_col < kernel_size; kernel_col++) {
+                            if (in_row >= 0 && in_row < in_dim && in_col >= 0 && in_col < in_dim) {
+                                const vfloat32m4_t in = __riscv_vle32_v_f32m4(&input[batch][in_row][in_col][channel], vl);
+                                result = __riscv_vmerge_vvm_f32m4(result, in,
+                                    __riscv_vmfgt_vv_f32m4_b8(in, result, vl), vl);
+                            } else {
+                                result = clip_rvv(result, 0, INFINITY, vl);
+                            }
+
+                            in_col++;
+                        }
+
+                        in_row++;
+                    }
+
+                    __riscv_vse32_v_f32m4(&output[batch][out_row][out_col][channel], result, vl);
+
+                    channel += vl;
+                }
+            }
+        }
+    }
+    return;
+#endif
+
     for (int batch = 0; batch < batch_size; batch++) {
         for (int channel = 0; channel < channels; channel++) {
             for (int out_row = 0; out_row < out_dim; out_row++) {
@@ -568,5 +842,605 @@ void pool_with_col2im(size_t I, size_t J,
     }
 }
 
+//============================================================================
+// Graph runtime
+//
+// A network is described by an array of nn_layer_t, in the order in which its
+// layers are run. Each layer reads one or two tensors, and writes one, where
+// tensors are numbered, and tensor 0 is the network's input. nn_runtime_init
+// works out the shape of every other tensor from the layer which writes it,
+// and plans where each of them goes in an arena which the caller provides,
+// and which can be reused for every inference. nn_run then runs each layer
+// with the kernel that fits it, and adds up how many cycles each kind of op
+// takes.
+//
+// A tensor only needs its space in the arena from the layer which first
+// writes it to the layer which last reads it, so tensors whose lifetimes
+// don't overlap share space. The plan places the largest tensors first, each
+// at the lowest offset which doesn't overlap any tensor that's live at the
+// same time. The im2col buffer of a conv, and the accumulators of a layer with
+// per-channel scales, live only while that layer runs.
+//
+// Like the imagenet drivers, convolutions are either run as a CPU im2col
+// followed by a matmul, or, with conv set, with tiled_conv_auto. With conv
+// set, a pool which directly follows the conv whose output it pools, and which
+// is the only layer which reads that output, is fused into the conv.
+//============================================================================
+
+enum nn_op_t {NN_CONV, NN_CONV_DW, NN_FC, NN_POOL, NN_GLOBAL_AVG_POOL, NN_RESADD, NN_OPS};
+
+static const char * const nn_op_names[NN_OPS] = {
+    "conv", "conv_dw", "fc", "pool", "global_avg_pool", "resadd",
+};
+
+#ifndef NN_MAX_LAYERS
+#define NN_MAX_LAYERS 128
+#endif
+
+#ifndef NN_MAX_TENSORS
+#define NN_MAX_TENSORS (NN_MAX_LAYERS + 1)
+#endif
+
+// Tensors in the arena are aligned like row_align(1)
+#define NN_ARENA_ALIGN (DIM * sizeof(elem_t))
+
+// The most accumulators that a layer with per-channel scales moves out at
+// once (see tiled_matmul_auto_per_channel)
+#ifndef NN_REQUANT_ELEMS
+#define NN_REQUANT_ELEMS (64 * 256)
+#endif
+
+struct nn_layer_t {
+    enum nn_op_t op;
+    char * name;
+
+    // NN_FC layers are described by fc_params, and every other layer by
+    // conv_params. NN_POOL and NN_GLOBAL_AVG_POOL use the conv_params of the
+    // conv whose output they pool, and NN_RESADD those of the conv whose
+    // output it adds to
+    const struct ConvParams * conv_params;
+    const struct FcParams * fc_params;
+
+    // NN_CONV weights are laid out like the B matrix of the conv's im2col
+    // matmul, NN_CONV_DW weights are [channels][kernel_size][kernel_size],
+    // and NN_FC weights are [in_features][out_features]. With conv set,
+    // NN_CONV_DW layers use weights_flat, in the layout tiled_conv_auto_dw
+    // expects, instead
+    const elem_t * weights;
+    const elem_t * weights_flat;
+    const acc_t * bias;
+    int act;
+
+    // NN_RESADD adds residual to input. Its output can be its input
+    int input, residual, output;
+
+    // Per-output-channel scales, which NN_CONV and NN_FC layers use instead of
+    // their output_scale if they're set (see tiled_matmul_auto_per_channel).
+    // Convs with them always run as im2col matmuls, even with conv set
+    const acc_scale_t * out_scales;
+};
+
+struct nn_runtime_t {
+    const struct nn_layer_t * layers;
+    size_t n_layers;
+    size_t n_tensors;
+
+    // Every tensor is a rows x cols matrix. Activations are stored in NHWC
+    // order, so rows is batch_size * dim * dim, and cols is channels
+    elem_t * tensors[NN_MAX_TENSORS];
+    size_t rows[NN_MAX_TENSORS], cols[NN_MAX_TENSORS];
+
+    // Each conv's im2col buffer, followed by the accumulators of each layer
+    // with per-channel scales, if a layer needs either
+    elem_t * scratch[NN_MAX_LAYERS];
+
+    // The bytes of arena that the plan uses, the most bytes which are live at
+    // once, and the bytes that would be needed if nothing shared any space
+    size_t arena_bytes, peak_bytes, total_bytes;
+
+    // Pools which are fused into the conv before them
+    bool fused[NN_MAX_LAYERS];
+
+    bool conv;
+    bool check;
+    enum tiled_matmul_type_t tiled_matmul_type;
+
+    uint64_t op_cycles[NN_OPS];
+    uint64_t layer_cycles[NN_MAX_LAYERS];
+};
+
+static size_t nn_align(size_t bytes) {
+    return (bytes + NN_ARENA_ALIGN - 1) / NN_ARENA_ALIGN * NN_ARENA_ALIGN;
+}
+
+// Works out the shape of the tensor which a layer writes
+static void nn_layer_output_shape(const struct nn_runtime_t * rt,
+        const struct nn_layer_t * layer, size_t * rows, size_t * cols) {
+
+    const struct ConvParams * p = layer->conv_params;
+
+    switch (layer->op) {
+        case NN_CONV:
+        case NN_CONV_DW:
+            *rows = p->batch_size * p->out_dim * p->out_dim;
+            *cols = p->out_channels;
+            break;
+        case NN_FC:
+            *rows = layer->fc_params->I;
+            *cols = layer->fc_params->J;
+            break;
+        case NN_POOL:
+            *rows = p->batch_size * p->out_dim_pooled * p->out_dim_pooled;
+            *cols = p->out_channels;
+            break;
+        case NN_GLOBAL_AVG_POOL:
+            *rows = p->batch_size;
+            *cols = p->out_channels;
+            break;
+        default: /* case NN_RESADD: */
+            *rows = rt->rows[layer->input];
+            *cols = rt->cols[layer->input];
+            break;
+    }
+}
+
+// Whether a conv can skip im2col, because its input already is its im2col
+static bool nn_conv_is_pointwise(const struct ConvParams * p) {
+    return p->kernel_size == 1 && p->stride == 1 && p->padding == 0;
+}
+
+// Whether a conv runs as an im2col matmul, rather than with tiled_conv_auto
+static bool nn_conv_is_matmul(const struct nn_runtime_t * rt,
+        const struct nn_layer_t * layer) {
+    return !rt->conv || layer->out_scales != NULL ||
+        nn_conv_is_pointwise(layer->conv_params);
+}
+
+// The bytes of a conv's scratch buffer which its im2col uses
+static size_t nn_im2col_bytes(const struct ConvParams * p) {
+    return nn_conv_is_pointwise(p) ? 0 : nn_align((size_t)p->I * p->K * sizeof(elem_t));
+}
+
+// The accumulators that an I x J matmul with per-channel scales moves out at
+// once, which are as many as it has, rounded up to whole blocks, up to
+// NN_REQUANT_ELEMS
+static size_t nn_requant_elems(const struct nn_layer_t * layer, size_t I, size_t J) {
+    if (layer->out_scales == NULL)
+        return 0;
+
+    const size_t elems = (I + DIM - 1) / DIM * DIM * ((J + DIM - 1) / DIM * DIM);
+    return elems < NN_REQUANT_ELEMS ? elems : NN_REQUANT_ELEMS;
+}
+
+// A tensor or scratch buffer which needs space in the arena from layer first
+// to layer last
+struct nn_buffer_t {
+    size_t bytes;
+    size_t first, last;
+    size_t offset;
+    elem_t ** ptr;
+};
+
+// Places every buffer at the lowest offset at which it doesn't overlap any
+// buffer which has already been placed, and which is live at the same time,
+// going from the largest buffer to the smallest. Returns the size of the
+// arena which is needed
+static size_t nn_plan_buffers(struct nn_buffer_t * buffers, size_t n) {
+    // Sort the buffers from largest to smallest
+    for (size_t i = 1; i < n; i++)
+        for (size_t j = i; j > 0 && buffers[j].bytes > buffers[j-1].bytes; j--) {
+            struct nn_buffer_t tmp = buffers[j];
+            buffers[j] = buffers[j-1];
+            buffers[j-1] = tmp;
+        }
+
+    size_t arena_bytes = 0;
+
+    for (size_t b = 0; b < n; b++) {
+        size_t offset = 0;
+
+        // Keep moving the buffer past whatever it collides with, until it
+        // doesn't collide with anything. Each move goes past the end of a
+        // placed buffer, so this takes at most b passes
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            for (size_t p = 0; p < b; p++) {
+                const struct nn_buffer_t * placed = &buffers[p];
+                const bool live_together = placed->first <= buffers[b].last &&
+                    buffers[b].first <= placed->last;
+                const bool overlap = placed->offset < offset + buffers[b].bytes &&
+                    offset < placed->offset + placed->bytes;
+
+                if (live_together && overlap) {
+                    offset = placed->offset + placed->bytes;
+                    moved = true;
+                }
+            }
+        }
+
+        buffers[b].offset = offset;
+        if (offset + buffers[b].bytes > arena_bytes)
+            arena_bytes = offset + buffers[b].bytes;
+    }
+
+    return arena_bytes;
+}
+
+// Sets up rt to run layers, with input as tensor 0, and the rest of the
+// tensors in arena, which should be aligned like row_align(1). Returns the
+// number of bytes of arena which are needed, which is more than arena_bytes
+// if the arena is too small, in which case nothing can be run. Pass a NULL
+// arena to find out how large it should be
+static size_t nn_runtime_init(struct nn_runtime_t * rt,
+        const struct nn_layer_t * layers, size_t n_layers,
+        const elem_t * input, size_t input_rows, size_t input_cols,
+        void * arena, size_t arena_bytes,
+        bool conv, enum tiled_matmul_type_t tiled_matmul_type, bool check) {
+
+#ifdef GEMMINI_ASSERTIONS
+    if (n_layers > NN_MAX_LAYERS) {
+        printf("Too many layers (more than NN_MAX_LAYERS)\n");
+        exit(1);
+    }
+#endif
+
+    rt->layers = layers;
+    rt->n_layers = n_layers;
+    rt->conv = conv;
+    rt->check = check;
+    rt->tiled_matmul_type = tiled_matmul_type;
+
+    rt->n_tensors = 1;
+    rt->tensors[0] = (elem_t *)input;
+    rt->rows[0] = input_rows;
+    rt->cols[0] = input_cols;
+
+    for (size_t op = 0; op < NN_OPS; op++)
+        rt->op_cycles[op] = 0;
+
+    // When each tensor is first written, and last used. Tensors which no
+    // layer writes are left empty
+    size_t first[NN_MAX_TENSORS], last[NN_MAX_TENSORS];
+
+    for (size_t t = 1; t < NN_MAX_TENSORS; t++) {
+        rt->rows[t] = rt->cols[t] = 0;
+        first[t] = last[t] = 0;
+    }
+
+    for (size_t l = 0; l < n_layers; l++) {
+        const struct nn_layer_t * layer = &layers[l];
+
+        rt->layer_cycles[l] = 0;
+        rt->fused[l] = false;
+        rt->scratch[l] = NULL;
+
+#ifdef GEMMINI_ASSERTIONS
+        if (layer->output >= NN_MAX_TENSORS || layer->input >= rt->n_tensors ||
+                (layer->op == NN_RESADD && layer->residual >= rt->n_tensors)) {
+            printf("%s reads a tensor before it's written, or writes too many tensors\n", layer->name);
+            exit(1);
+        }
+#endif
+
+        last[layer->input] = l;
+        if (layer->op == NN_RESADD)
+            last[layer->residual] = l;
+
+        // Only tiled_conv_auto can pool its output, so a pool can't be fused
+        // into a conv which runs as a matmul
+        if (layer->op == NN_POOL && conv && l > 0 &&
+                layers[l-1].op == NN_CONV && !nn_conv_is_matmul(rt, &layers[l-1]) &&
+                layers[l-1].output == layer->input) {
+            bool only_reader = true;
+            for (size_t r = l+1; r < n_layers; r++)
+                if (layers[r].input == layer->input ||
+                        (layers[r].op == NN_RESADD && layers[r].residual == layer->input))
+                    only_reader = false;
+            rt->fused[l] = only_reader;
+        }
+
+        // Tensors which are written more than once, like the output of an
+        // in-place resadd, keep their first shape
+        if (layer->output < rt->n_tensors) {
+            last[layer->output] = l;
+            continue;
+        }
+
+        rt->n_tensors = layer->output + 1;
+
+        size_t rows, cols;
+        nn_layer_output_shape(rt, layer, &rows, &cols);
+
+        rt->rows[layer->output] = rows;
+        rt->cols[layer->output] = cols;
+
+        // A fused pool's output is written by the conv before it
+        first[layer->output] = rt->fused[l] ? l-1 : l;
+        last[layer->output] = l;
+    }
+
+    // The network's output has to outlive the network
+    last[layers[n_layers-1].output] = n_layers;
+
+    struct nn_buffer_t buffers[NN_MAX_TENSORS + NN_MAX_LAYERS];
+    size_t n_buffers = 0;
+
+    rt->total_bytes = 0;
+
+    for (size_t t = 1; t < rt->n_tensors; t++) {
+        // The output of a conv which is fused with its pool is never written
+        const bool unused = first[t] + 1 < n_layers && rt->fused[first[t] + 1] &&
+            layers[first[t] + 1].input == t;
+
+        rt->tensors[t] = NULL;
+        if (unused)
+            continue;
+
+        struct nn_buffer_t * b = &buffers[n_buffers++];
+        b->bytes = nn_align(rt->rows[t] * rt->cols[t] * sizeof(elem_t));
+        b->first = first[t];
+        b->last = last[t];
+        b->ptr = &rt->tensors[t];
+    }
+
+    for (size_t l = 0; l < n_layers; l++) {
+        const struct nn_layer_t * layer = &layers[l];
+        size_t bytes = 0;
+
+        if (layer->op == NN_CONV && nn_conv_is_matmul(rt, layer)) {
+            const struct ConvParams * p = layer->conv_params;
+            bytes = nn_im2col_bytes(p) + nn_requant_elems(layer, p->I, p->J) * sizeof(acc_t);
+        } else if (layer->op == NN_FC) {
+            const struct FcParams * f = layer->fc_params;
+            bytes = nn_requant_elems(layer, f->I, f->J) * sizeof(acc_t);
+        }
+
+        if (bytes > 0) {
+            struct nn_buffer_t * b = &buffers[n_buffers++];
+            b->bytes = nn_align(bytes);
+            b->first = l;
+            b->last = l;
+            b->ptr = &rt->scratch[l];
+        }
+    }
+
+    for (size_t b = 0; b < n_buffers; b++)
+        rt->total_bytes += buffers[b].bytes;
+
+    rt->peak_bytes = 0;
+    for (size_t l = 0; l <= n_layers; l++) {
+        size_t live = 0;
+        for (size_t b = 0; b < n_buffers; b++)
+            if (buffers[b].first <= l && l <= buffers[b].last)
+                live += buffers[b].bytes;
+        if (live > rt->peak_bytes)
+            rt->peak_bytes = live;
+    }
+
+    rt->arena_bytes = nn_plan_buffers(buffers, n_buffers);
+
+    for (size_t b = 0; b < n_buffers; b++)
+        *buffers[b].ptr = (elem_t *)((int8_t *)arena + buffers[b].offset);
+
+    return rt->arena_bytes;
+}
+
+// Prints how much memory the network's activations take up
+static void nn_print_memory(const struct nn_runtime_t * rt) {
+    printf("Arena: %llu bytes, peak live activations: %llu bytes, all activations: %llu bytes\n",
+        (unsigned long long)rt->arena_bytes, (unsigned long long)rt->peak_bytes,
+        (unsigned long long)rt->total_bytes);
+}
+
+// Runs the matmul of an NN_FC layer, or of a conv's im2col
+static void nn_run_matmul(const struct nn_runtime_t * rt,
+        const struct nn_layer_t * layer, size_t I, size_t J, size_t K,
+        const elem_t * A, elem_t * C, acc_scale_t output_scale) {
+
+    if (layer->out_scales == NULL) {
+        tiled_matmul_nn_auto(I, J, K,
+            (elem_t (*)[K])A, (elem_t (*)[J])layer->weights, layer->bias,
+            (elem_t (*)[J])C,
+            layer->act, output_scale, 0, true,
+            rt->tiled_matmul_type, rt->check, layer->name);
+        return;
+    }
+
+    if (rt->check)
+        printf("%s: gemmini\n", layer->name);
+
+    // The accumulators come after the im2col in the layer's scratch buffer
+    const size_t im2col_bytes = layer->op == NN_CONV ? nn_im2col_bytes(layer->conv_params) : 0;
+    acc_t * requant = (acc_t *)((int8_t *)rt->scratch[layer - rt->layers] + im2col_bytes);
+
+    tiled_matmul_auto_per_channel(I, J, K,
+        A, layer->weights, layer->bias, C,
+        K, J, J, J,
+        layer->act, layer->out_scales, 0, true,
+        requant, nn_requant_elems(layer, I, J),
+        rt->tiled_matmul_type);
+
+    if (rt->check) {
+        printf("%s: CPU\n", layer->name);
+        elem_t (*out)[J] = (elem_t (*)[J])C;
+        elem_t gold[I][J];
+        tiled_matmul_auto_per_channel(I, J, K,
+            A, layer->weights, layer->bias, (elem_t*)gold,
+            K, J, J, J,
+            layer->act, layer->out_scales, 0, true,
+            NULL, 0,
+            CPU);
+
+        if (!MAT_IS_EQUAL(I, J, out, gold)) {
+            printf("Layer calculated incorrectly: %s\n", layer->name);
+            exit(1);
+        }
+    }
+}
+
+static void nn_run_conv(const struct nn_runtime_t * rt,
+        const struct nn_layer_t * layer, const struct nn_layer_t * pool) {
+
+    const struct ConvParams * p = layer->conv_params;
+    elem_t * in = rt->tensors[layer->input];
+    elem_t * out = rt->tensors[pool != NULL ? pool->output : layer->output];
+
+    if (nn_conv_is_matmul(rt, layer)) {
+        const elem_t * A = in;
+
+        if (!nn_conv_is_pointwise(p)) {
+            elem_t * scratch = rt->scratch[layer - rt->layers];
+
+            // im2col leaves the padding alone, and the arena isn't cleared
+            // between layers, so it has to be zeroed first
+            memset(scratch, 0, (size_t)p->I * p->K * sizeof(elem_t));
+            im2col_with_col2im(rt->rows[layer->input], rt->cols[layer->input],
+                p->I, p->K, (elem_t (*)[rt->cols[layer->input]])in,
+                (elem_t (*)[p->K])scratch, p);
+            A = scratch;
+        }
+
+        nn_run_matmul(rt, layer, p->I, p->J, p->K, A, out, p->output_scale);
+        return;
+    }
+
+    const int pool_size = pool != NULL ? p->pool_size : 0;
+    const int pool_stride = pool != NULL ? p->pool_stride : 0;
+    const int pool_padding = pool != NULL ? p->pool_padding : 0;
+
+    void (*tiled_conv_fn)(int, int, int, int, int, int, int, int,
+        elem_t *, elem_t *, acc_t *, elem_t *,
+        int, acc_scale_t, size_t, int, int, int,
+        enum tiled_matmul_type_t) = p->in_channels == 3 ? tiled_conv_auto_first : tiled_conv_auto;
+
+    tiled_conv_fn(
+        p->batch_size, p->in_dim, p->in_channels,
+        p->out_channels, p->out_dim,
+        p->stride, p->padding, p->kernel_size,
+
+        in, (elem_t*)layer->weights, (acc_t*)layer->bias, out,
+
+        layer->act, p->output_scale, 0,
+        pool_size, pool_stride, pool_padding,
+
+        rt->tiled_matmul_type);
+}
+
+static void nn_run_layer(const struct nn_runtime_t * rt, size_t l) {
+    const struct nn_layer_t * layer = &rt->layers[l];
+    const struct ConvParams * p = layer->conv_params;
+
+    elem_t * in = rt->tensors[layer->input];
+    elem_t * out = rt->tensors[layer->output];
+    const size_t in_rows = rt->rows[layer->input], in_cols = rt->cols[layer->input];
+
+    switch (layer->op) {
+        case NN_CONV:
+            nn_run_conv(rt, layer,
+                l+1 < rt->n_layers && rt->fused[l+1] ? &rt->layers[l+1] : NULL);
+            break;
+
+        case NN_CONV_DW:
+            if (!rt->conv) {
+                conv_dw_with_col2im(in_rows, in_cols, p->I, p->J,
+                    p->batch_size, p->in_channels, p->out_dim, p->kernel_size,
+                    (elem_t (*)[in_cols])in,
+                    (elem_t (*)[p->kernel_size][p->kernel_size])layer->weights,
+                    layer->bias, (elem_t (*)[p->J])out, p);
+            } else {
+                tiled_conv_auto_dw(
+                    p->batch_size, p->in_dim, p->in_channels,
+                    p->out_channels, p->out_dim,
+                    p->stride, p->padding, p->kernel_size,
+
+                    in, (elem_t*)layer->weights_flat, (acc_t*)layer->bias, out,
+
+                    layer->act, p->output_scale, 0,
+                    0, 0, 0,
+
+                    rt->tiled_matmul_type);
+            }
+            break;
+
+        case NN_FC: {
+            const struct FcParams * f = layer->fc_params;
+            nn_run_matmul(rt, layer, f->I, f->J, f->K, in, out, f->output_scale);
+            break;
+        }
+
+        case NN_POOL:
+            if (!rt->fused[l]) {
+                pool_with_col2im(in_rows, in_cols,
+                    p->batch_size, p->out_channels, p->out_dim_pooled,
+                    (elem_t (*)[in_cols])in,
+                    (elem_t (*)[p->out_dim_pooled][p->out_dim_pooled][p->out_channels])out, p);
+            }
+            break;
+
+        case NN_GLOBAL_AVG_POOL: {
+            const size_t pixels = p->out_dim * p->out_dim;
+
+            for (size_t batch = 0; batch < p->batch_size; batch++) {
+                for (size_t channel = 0; channel < in_cols; channel++) {
+                    acc_t sum = 0;
+                    for (size_t pixel = 0; pixel < pixels; pixel++)
+                        sum += in[(batch * pixels + pixel) * in_cols + channel];
+
+#ifdef ELEM_T_IS_FLOAT
+                    out[batch * in_cols + channel] = sum / pixels;
+#else
+                    out[batch * in_cols + channel] = (sum + pixels/2) / pixels;
+#endif
+                }
+            }
+            break;
+        }
+
+        default: /* case NN_RESADD: */
+            tiled_resadd_auto(in_rows, in_cols,
+                p->res_scale,
+                MVIN_SCALE_IDENTITY,
+                ACC_SCALE_IDENTITY,
+                rt->tensors[layer->residual],
+                in,
+                out,
+                layer->act == RELU,
+                rt->tiled_matmul_type == CPU ? CPU : WS);
+            break;
+    }
+}
+
+// Runs every layer of the network, and returns its output tensor
+static elem_t * nn_run(struct nn_runtime_t * rt) {
+    for (size_t l = 0; l < rt->n_layers; l++) {
+        const uint64_t start = read_cycles();
+        nn_run_layer(rt, l);
+        const uint64_t end = read_cycles();
+
+        rt->layer_cycles[l] += end - start;
+        rt->op_cycles[rt->layers[l].op] += end - start;
+    }
+
+    return rt->tensors[rt->layers[rt->n_layers - 1].output];
+}
+
+// Prints how many cycles each kind of op, and each layer, has taken so far
+static void nn_print_cycles(const struct nn_runtime_t * rt) {
+    uint64_t total_cycles = 0;
+    for (size_t op = 0; op < NN_OPS; op++)
+        total_cycles += rt->op_cycles[op];
+
+    printf("\nTotal cycles: %llu (100%%)\n", total_cycles);
+    for (size_t op = 0; op < NN_OPS; op++)
+        if (rt->op_cycles[op] != 0)
+            printf("%s cycles: %llu (%d%%)\n", nn_op_names[op], rt->op_cycles[op],
+                (int)(rt->op_cycles[op] * 100 / total_cycles));
+
+    for (size_t l = 0; l < rt->n_layers; l++)
+        printf("  %s: %llu%s\n", rt->layers[l].name, rt->layer_cycles[l],
+            rt->fused[l] ? " (fused)" : "");
+}
+
 #endif // GEMMINI_NN_H
 
@@ -11,10 +11,84 @@
 #define BANK_ROWS 1024
 #define ACC_ROWS 1024
 #define MAX_BYTES 64
+
+typedef uint32_t ind_t; 
+
+// Build with GEMMINI_INT8 for int8 activations and weights, with int32
+// accumulators, which are scaled back down to int8 by a float acc_scale_t
+#ifdef GEMMINI_INT8
+
+#define MAX_BLOCK_LEN (MAX_BYTES/(DIM*1))
+#define MAX_BLOCK_LEN_ACC (MAX_BYTES/(DIM*4))
+
+typedef int8_t elem_t;
+static const elem_t elem_t_max = 127;
+static const elem_t elem_t_min = -128;
+typedef int32_t acc_t;
+typedef int64_t full_t;
+
+#define HAS_MVIN_SCALE
+typedef float scale_t;
+typedef uint32_t scale_t_bits;
+
+typedef int32_t scale_acc_t;
+typedef uint32_t scale_acc_t_bits;
+
+typedef float acc_scale_t;
+typedef uint32_t acc_scale_t_bits;
+
+// Build with GEMMINI_BF16 or GEMMINI_FP16 for 16-bit floating-point
+// activations and weights, with float accumulators. Half the bytes per elem_t
+// means twice as many blocks per mvin. Products of two elem_ts are exact in a
+// float, so only the sums, and the conversions back to elem_t, are rounded.
+// __bf16 arithmetic needs GCC 13 or Clang 17, while _Float16 needs GCC 12
+#elif defined(GEMMINI_BF16) || defined(GEMMINI_FP16)
+
+#define MAX_BLOCK_LEN (MAX_BYTES/(DIM*2))
+#define MAX_BLOCK_LEN_ACC (MAX_BYTES/(DIM*4))
+
+#ifdef GEMMINI_BF16
+#ifndef __BFLT16_MANT_DIG__
+#error "GEMMINI_BF16 needs a compiler with __bf16 arithmetic, like GCC 13 or Clang 17"
+#endif
+typedef __bf16 elem_t;
+static const elem_t elem_t_max = 3.38953139E38;
+static const elem_t elem_t_min = -3.38953139E38;
+#define ELEM_T_EXP_BITS 8
+#define ELEM_T_SIG_BITS 8
+#else
+typedef _Float16 elem_t;
+static const elem_t elem_t_max = 65504;
+static const elem_t elem_t_min = -65504;
+#define ELEM_T_EXP_BITS 5
+#define ELEM_T_SIG_BITS 11
+#endif
+
+typedef float acc_t;
+typedef double full_t;
+
+#define ELEM_T_IS_FLOAT
+#define ACC_T_EXP_BITS 8
+#define ACC_T_SIG_BITS 24
+typedef uint16_t elem_t_bits;
+typedef uint32_t acc_t_bits;
+
+#define HAS_MVIN_SCALE
+typedef float scale_t;
+typedef uint32_t scale_t_bits;
+
+#define HAS_MVIN_ACC_SCALE
+typedef float scale_acc_t;
+typedef uint32_t scale_acc_t_bits;
+
+typedef float acc_scale_t;
+typedef uint32_t acc_scale_t_bits;
+
+#else
+
 #define MAX_BLOCK_LEN (MAX_BYTES/(DIM*4))
 #define MAX_BLOCK_LEN_ACC (MAX_BYTES/(DIM*4))
 
-typedef uint32_t ind_t; 
 typedef float elem_t;
 static const elem_t elem_t_max = 3.4028235E38;
 static const elem_t elem_t_min = -3.4028235E38;
@@ -40,6 +114,8 @@ typedef uint32_t scale_acc_t_bits;
 typedef float acc_scale_t;
 typedef uint32_t acc_scale_t_bits;
 
+#endif
+
 #define row_align(blocks) __attribute__((aligned(blocks*DIM*sizeof(elem_t))))
 #define row_align_acc(blocks) __attribute__((aligned(blocks*DIM*sizeof(acc_t))))
 
@@ -47,9 +123,6 @@ typedef uint32_t acc_scale_t_bits;
 
 #define ACC_SCALE_IDENTITY 1.0
 
-#define ROUNDING_RIGHT_SHIFT(x, shift) \
-    ((x) / (1 << (shift)))
-
 #ifdef __cplusplus
 #define SAME_TYPE(x) decltype(x)
 #else
@@ -72,6 +145,35 @@ typedef uint32_t acc_scale_t_bits;
     (((shift) == 0 ? 0 : (((x) >> ((shift)-1)) & 1)) & \
          ((((shift) <= 1 ? 0 : ((x) & ((1 << ((shift)-1)) - 1))) != 0) | (((x) >> (shift)) & 1)))) : ((x) << (-(shift))))
 
+#ifdef GEMMINI_INT8
+// Integers are shifted the same way that the hardware shifts them, rather than
+// divided, which rounds towards zero
+#define ROUNDING_RIGHT_SHIFT(x, shift) ROUNDING_RIGHT_SHIFT_BITS(x, shift)
+
+#define ACC_SCALE(x, scale) \
+    ({float y = ROUND_NEAR_EVEN((x) * (scale)); y > INT_MAX ? INT_MAX : (y < INT_MIN ? INT_MIN : (acc_t)y);})
+
+#define MVIN_SCALE(x, scale) \
+    ({float y = ROUND_NEAR_EVEN((x) * (scale)); y > INT8_MAX ? INT8_MAX : (y < INT8_MIN ? INT8_MIN : (elem_t)y);})
+
+#define MVIN_SCALE_ACC(x, scale) (x)
+#elif defined(GEMMINI_BF16) || defined(GEMMINI_FP16)
+#define ROUNDING_RIGHT_SHIFT(x, shift) \
+    ((x) / (1 << (shift)))
+
+#define ACC_SCALE(x, scale) \
+    ((x) * (scale))
+
+// Scaled inputs are rounded back to an elem_t, which saturates
+#define MVIN_SCALE(x, scale) \
+    ({float y = (x) * (scale); (elem_t)(y > elem_t_max ? elem_t_max : (y < elem_t_min ? elem_t_min : y));})
+
+#define MVIN_SCALE_ACC(x, scale) \
+    ((x) * (scale))
+#else
+#define ROUNDING_RIGHT_SHIFT(x, shift) \
+    ((x) / (1 << (shift)))
+
 #define ACC_SCALE(x, scale) \
     ((x) * (scale))
 
@@ -80,6 +182,7 @@ typedef uint32_t acc_scale_t_bits;
 
 #define MVIN_SCALE_ACC(x, scale) \
     ((x) * (scale))
+#endif
 
 #define ACC_SCALE_T_IS_FLOAT
 #define ACC_SCALE_EXP_BITS 8
@@ -321,9 +321,13 @@ int is_equal_transposed(elem_t x[DIM][DIM], elem_t y[DIM][DIM]) {
 # define PCT(n, d) ((100.0*(double)n/(double)d))
 
 uint64_t read_cycles() {
+#ifdef GEMMINI_HOST_EMU
+    return gemmini_emu_read_cycles();
+#else
     uint64_t cycles;
     asm volatile ("rdcycle %0" : "=r" (cycles));
     return cycles;
+#endif
 
     // const uint32_t * mtime = (uint32_t *)(33554432 + 0xbff8);
     // const uint32_t * mtime = (uint32_t *)(33554432 + 0xbffc);
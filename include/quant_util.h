@@ -0,0 +1,165 @@
+// See LICENSE for license details.
+
+#ifndef __QUANT_UTIL__
+#define __QUANT_UTIL__
+
+// Host-side calibration for quantized inference. A float model is quantized
+// symmetrically to int8: activations get one scale per tensor, which is
+// calibrated from sample activations, while weights get one scale per output
+// channel. A layer's int32 accumulators are then scaled back down to int8 by
+// a multiplier per output channel, which tiled_matmul_auto_per_channel takes.
+// A real value x is represented by round(x / scale).
+//
+// Everything here is meant to run once per model, before inference. With a
+// float elem_t the quantized values are just stored as floats, which lets the
+// same model run either way.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "include/gemmini.h"
+
+#define QUANT_MAX 127
+
+// Records the largest magnitude seen in the sample activations of a tensor
+struct quant_observer_t {
+  float absmax;
+  size_t samples;
+};
+
+static void quant_observer_init(struct quant_observer_t * obs) {
+  obs->absmax = 0;
+  obs->samples = 0;
+}
+
+static void quant_observe(struct quant_observer_t * obs, size_t len, const float * x) {
+  for (size_t i = 0; i < len; i++) {
+    const float mag = x[i] < 0 ? -x[i] : x[i];
+    if (mag > obs->absmax)
+      obs->absmax = mag;
+  }
+  obs->samples++;
+}
+
+// The scale which maps absmax to QUANT_MAX
+static float quant_scale(float absmax) {
+  // A tensor which is all zeros can have any scale
+  return absmax > 0 ? absmax / QUANT_MAX : 1;
+}
+
+static float quant_observer_scale(const struct quant_observer_t * obs) {
+  if (obs->samples == 0) {
+    printf("quant_util: no activations have been observed\n");
+    exit(1);
+  }
+  return quant_scale(obs->absmax);
+}
+
+static elem_t quant_value(float x, float scale) {
+  float q = ROUND_NEAR_EVEN(x / scale);
+  q = q > QUANT_MAX ? QUANT_MAX : (q < -QUANT_MAX ? -QUANT_MAX : q);
+  return (elem_t)q;
+}
+
+static float dequant_value(elem_t q, float scale) {
+  return q * scale;
+}
+
+static void quant_tensor(size_t len, const float * x, float scale, elem_t * q) {
+  for (size_t i = 0; i < len; i++)
+    q[i] = quant_value(x[i], scale);
+}
+
+static void dequant_tensor(size_t len, const elem_t * q, float scale, float * x) {
+  for (size_t i = 0; i < len; i++)
+    x[i] = dequant_value(q[i], scale);
+}
+
+// Quantizes the K x J weights W, which are laid out like the B matrix of a
+// matmul, with one scale per column, which is stored in w_scales
+static void quant_weights_per_channel(size_t K, size_t J,
+        const float * W, size_t stride_W, float * w_scales, elem_t * Wq) {
+  for (size_t j = 0; j < J; j++) {
+    float absmax = 0;
+    for (size_t k = 0; k < K; k++) {
+      const float w = W[k*stride_W + j];
+      const float mag = w < 0 ? -w : w;
+      if (mag > absmax)
+        absmax = mag;
+    }
+    w_scales[j] = quant_scale(absmax);
+  }
+
+  for (size_t k = 0; k < K; k++)
+    for (size_t j = 0; j < J; j++)
+      Wq[k*J + j] = quant_value(W[k*stride_W + j], w_scales[j]);
+}
+
+// The bias is added straight to the accumulators, so it's quantized to their
+// scale, which is in_scale * w_scales[j]
+static void quant_bias(size_t J, const float * bias,
+        float in_scale, const float * w_scales, acc_t * bias_q) {
+  for (size_t j = 0; j < J; j++) {
+    const float acc_scale = in_scale * w_scales[j];
+    bias_q[j] = (acc_t)ROUND_NEAR_EVEN(bias[j] / acc_scale);
+  }
+}
+
+// The multipliers which take each column's accumulators down to out_scale
+static void quant_requant_scales(size_t J, float in_scale,
+        const float * w_scales, float out_scale, acc_scale_t * scales) {
+  for (size_t j = 0; j < J; j++)
+    scales[j] = in_scale * w_scales[j] / out_scale;
+}
+
+// Calibrates a fully-connected layer, or a conv given its im2col, from
+// n_samples float inputs of I x K each. The float weights and bias (which
+// may be NULL) are quantized per channel into W_q and bias_q, and the
+// requantization multipliers are stored in scales. The input and output
+// scales are returned through in_scale and out_scale. An in_scale which is
+// already known, like the out_scale of the layer before, can be passed in by
+// setting fix_in_scale.
+static void quant_calibrate_fc(size_t I, size_t J, size_t K,
+        size_t n_samples, const float * samples,
+        const float * W, const float * bias,
+        elem_t * W_q, acc_t * bias_q, float * w_scales, acc_scale_t * scales,
+        bool fix_in_scale, float * in_scale, float * out_scale, bool relu) {
+
+  if (!fix_in_scale) {
+    struct quant_observer_t in_obs;
+    quant_observer_init(&in_obs);
+    for (size_t s = 0; s < n_samples; s++)
+      quant_observe(&in_obs, I*K, samples + s*I*K);
+    *in_scale = quant_observer_scale(&in_obs);
+  }
+
+  // The output scale is calibrated from the float layer's outputs
+  struct quant_observer_t out_obs;
+  quant_observer_init(&out_obs);
+
+  float row[J];
+  for (size_t s = 0; s < n_samples; s++) {
+    const float * X = samples + s*I*K;
+    for (size_t i = 0; i < I; i++) {
+      for (size_t j = 0; j < J; j++) {
+        float sum = bias == NULL ? 0 : bias[j];
+        for (size_t k = 0; k < K; k++)
+          sum += X[i*K + k] * W[k*J + j];
+        row[j] = relu && sum < 0 ? 0 : sum;
+      }
+      quant_observe(&out_obs, J, row);
+    }
+  }
+  *out_scale = quant_observer_scale(&out_obs);
+
+  quant_weights_per_channel(K, J, W, J, w_scales, W_q);
+
+  if (bias != NULL)
+    quant_bias(J, bias, *in_scale, w_scales, bias_q);
+
+  quant_requant_scales(J, *in_scale, w_scales, *out_scale, scales);
+}
+
+#endif // __QUANT_UTIL__
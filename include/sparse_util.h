@@ -0,0 +1,469 @@
+// See LICENSE for license details.
+
+#ifndef __SPARSE_UTIL__
+#define __SPARSE_UTIL__
+
+// Host-side preprocessing for sparse operands: converting dense matrices to
+// COO, CSR, and blocked CSR, sorting COO matrices, and building per-tile
+// offset tables. Everything here is meant to run once per matrix, before any
+// of the tiled kernels that use it, so the arrays are allocated with malloc
+// at exactly the size they need to be.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "include/gemmini.h"
+
+// coo[2*n] and coo[2*n+1] are the row and column of the n-th nonzero
+struct sparse_coo_t {
+  size_t rows, cols, nnz;
+  elem_t * data;
+  ind_t * coo;
+};
+
+// row_ptr has rows+1 entries, and tile_ptr, which the CSR mvin takes, has
+// rows*tile_cols+1. See gemmini_extended_mvin_sparse_csr and spmm_csr_tile_ptr
+struct sparse_csr_t {
+  size_t rows, cols, nnz, tile_cols;
+  elem_t * data;
+  ind_t * col_idx;
+  ind_t * row_ptr;
+  ind_t * tile_ptr;
+};
+
+// A CSR matrix of DIM x DIM blocks, whose tile pointers have one entry per
+// block, plus one. See gemmini_extended_mvin_sparse_bcsr
+struct sparse_bcsr_t {
+  size_t rows, cols, blocks, tile_cols;
+  elem_t * data;
+  ind_t * col_idx;
+  ind_t * row_ptr;
+  ind_t * tile_ptr;
+};
+
+static void * sparse_alloc(size_t bytes) {
+  // malloc(0) may return NULL, which would look like a failure
+  void * p = malloc(bytes > 0 ? bytes : 1);
+  if (p == NULL) {
+    printf("sparse_util: failed to allocate %zu bytes\n", bytes);
+    exit(1);
+  }
+  return p;
+}
+
+//============================================================================
+// conversion from dense matrices
+//============================================================================
+static size_t sparse_count_nnz(size_t rows, size_t cols,
+        const elem_t * dense, size_t stride) {
+  size_t nnz = 0;
+  for (size_t i = 0; i < rows; i++)
+    for (size_t j = 0; j < cols; j++)
+      nnz += dense[i*stride + j] != 0;
+  return nnz;
+}
+
+// The nonzeros come out in row-major order, which is the order the CSR
+// conversions need. With tile_order, they are grouped by DIM x DIM tile
+// instead, with the tiles in row-major order and the nonzeros in row-major
+// order within each tile, which is the order tiled_spmm needs (see
+// sparse_coo_tile_offsets)
+static struct sparse_coo_t sparse_dense_to_coo(size_t rows, size_t cols,
+        const elem_t * dense, size_t stride, bool tile_order) {
+  struct sparse_coo_t m;
+  m.rows = rows;
+  m.cols = cols;
+  m.nnz = sparse_count_nnz(rows, cols, dense, stride);
+  m.data = (elem_t *)sparse_alloc(m.nnz * sizeof(elem_t));
+  m.coo = (ind_t *)sparse_alloc(2 * m.nnz * sizeof(ind_t));
+
+  const size_t tile_rows = tile_order ? DIM : rows;
+  const size_t tile_cols = tile_order ? DIM : cols;
+
+  size_t n = 0;
+  for (size_t i0 = 0; i0 < rows; i0 += tile_rows)
+    for (size_t j0 = 0; j0 < cols; j0 += tile_cols)
+      for (size_t i = i0; i < rows && i < i0 + tile_rows; i++)
+        for (size_t j = j0; j < cols && j < j0 + tile_cols; j++)
+          if (dense[i*stride + j] != 0) {
+            m.data[n] = dense[i*stride + j];
+            m.coo[2*n] = i;
+            m.coo[2*n+1] = j;
+            n++;
+          }
+
+  return m;
+}
+
+static struct sparse_csr_t sparse_dense_to_csr(size_t rows, size_t cols,
+        const elem_t * dense, size_t stride) {
+  struct sparse_csr_t m;
+  m.rows = rows;
+  m.cols = cols;
+  m.nnz = sparse_count_nnz(rows, cols, dense, stride);
+  m.data = (elem_t *)sparse_alloc(m.nnz * sizeof(elem_t));
+  m.col_idx = (ind_t *)sparse_alloc(m.nnz * sizeof(ind_t));
+  m.row_ptr = (ind_t *)sparse_alloc((rows + 1) * sizeof(ind_t));
+
+  size_t n = 0;
+  for (size_t i = 0; i < rows; i++) {
+    m.row_ptr[i] = n;
+    for (size_t j = 0; j < cols; j++)
+      if (dense[i*stride + j] != 0) {
+        m.data[n] = dense[i*stride + j];
+        m.col_idx[n] = j;
+        n++;
+      }
+  }
+  m.row_ptr[rows] = n;
+
+  m.tile_cols = cols / DIM + (cols % DIM != 0);
+  m.tile_ptr = (ind_t *)sparse_alloc((rows * m.tile_cols + 1) * sizeof(ind_t));
+  spmm_csr_tile_ptr(rows, m.tile_cols, DIM, m.col_idx, m.row_ptr, m.tile_ptr);
+
+  return m;
+}
+
+static bool sparse_block_is_zero(size_t rows, size_t cols,
+        const elem_t * dense, size_t stride, size_t i0, size_t j0) {
+  for (size_t i = i0; i < rows && i < i0 + DIM; i++)
+    for (size_t j = j0; j < cols && j < j0 + DIM; j++)
+      if (dense[i*stride + j] != 0)
+        return false;
+  return true;
+}
+
+static struct sparse_bcsr_t sparse_dense_to_bcsr(size_t rows, size_t cols,
+        const elem_t * dense, size_t stride) {
+  const size_t I = rows / DIM + (rows % DIM != 0);
+  const size_t J = cols / DIM + (cols % DIM != 0);
+
+  struct sparse_bcsr_t m;
+  m.rows = rows;
+  m.cols = cols;
+  m.blocks = 0;
+
+  for (size_t i = 0; i < I; i++)
+    for (size_t j = 0; j < J; j++)
+      m.blocks += !sparse_block_is_zero(rows, cols, dense, stride, i*DIM, j*DIM);
+
+  m.data = (elem_t *)sparse_alloc(m.blocks * DIM * DIM * sizeof(elem_t));
+  m.col_idx = (ind_t *)sparse_alloc(m.blocks * sizeof(ind_t));
+  m.row_ptr = (ind_t *)sparse_alloc((I + 1) * sizeof(ind_t));
+
+  size_t b = 0;
+  for (size_t i = 0; i < I; i++) {
+    m.row_ptr[i] = b;
+    for (size_t j = 0; j < J; j++) {
+      if (sparse_block_is_zero(rows, cols, dense, stride, i*DIM, j*DIM))
+        continue;
+
+      // The values which pad out the edge blocks are zeros
+      elem_t * const block = m.data + b*DIM*DIM;
+      for (size_t r = 0; r < DIM; r++)
+        for (size_t c = 0; c < DIM; c++)
+          block[r*DIM + c] = i*DIM + r < rows && j*DIM + c < cols ?
+            dense[(i*DIM + r)*stride + j*DIM + c] : 0;
+
+      m.col_idx[b] = j;
+      b++;
+    }
+  }
+  m.row_ptr[I] = b;
+
+  m.tile_cols = J;
+  m.tile_ptr = (ind_t *)sparse_alloc((I * J + 1) * sizeof(ind_t));
+  spmm_csr_tile_ptr(I, J, 1, m.col_idx, m.row_ptr, m.tile_ptr);
+
+  return m;
+}
+
+static void sparse_free_coo(struct sparse_coo_t * m) {
+  free(m->data);
+  free(m->coo);
+}
+
+static void sparse_free_csr(struct sparse_csr_t * m) {
+  free(m->data);
+  free(m->col_idx);
+  free(m->row_ptr);
+  free(m->tile_ptr);
+}
+
+static void sparse_free_bcsr(struct sparse_bcsr_t * m) {
+  free(m->data);
+  free(m->col_idx);
+  free(m->row_ptr);
+  free(m->tile_ptr);
+}
+
+//============================================================================
+// sorting
+//============================================================================
+
+// One stable counting-sort pass over the nonzeros of m, by key(row, col),
+// which must be less than n_keys
+static void sparse_coo_sort_pass(struct sparse_coo_t * m, size_t n_keys,
+        size_t (*key)(size_t row, size_t col)) {
+  size_t * const count = (size_t *)sparse_alloc((n_keys + 1) * sizeof(size_t));
+  elem_t * const data = (elem_t *)sparse_alloc(m->nnz * sizeof(elem_t));
+  ind_t * const coo = (ind_t *)sparse_alloc(2 * m->nnz * sizeof(ind_t));
+
+  memset(count, 0, (n_keys + 1) * sizeof(size_t));
+  for (size_t n = 0; n < m->nnz; n++)
+    count[key(m->coo[2*n], m->coo[2*n+1]) + 1]++;
+  for (size_t k = 0; k < n_keys; k++)
+    count[k+1] += count[k];
+
+  for (size_t n = 0; n < m->nnz; n++) {
+    const size_t dst = count[key(m->coo[2*n], m->coo[2*n+1])]++;
+    data[dst] = m->data[n];
+    coo[2*dst] = m->coo[2*n];
+    coo[2*dst+1] = m->coo[2*n+1];
+  }
+
+  memcpy(m->data, data, m->nnz * sizeof(elem_t));
+  memcpy(m->coo, coo, 2 * m->nnz * sizeof(ind_t));
+
+  free(count);
+  free(data);
+  free(coo);
+}
+
+static size_t sparse_key_row(size_t row, size_t col) { return row; }
+static size_t sparse_key_col(size_t row, size_t col) { return col; }
+static size_t sparse_key_tile_row(size_t row, size_t col) { return row / DIM; }
+static size_t sparse_key_tile_col(size_t row, size_t col) { return col / DIM; }
+
+// Sorts the nonzeros of a COO matrix, which can be in any order, into the
+// same order that sparse_dense_to_coo would have produced them in. This is a
+// radix sort, so it takes linear time
+static void sparse_coo_sort(struct sparse_coo_t * m, bool tile_order) {
+  sparse_coo_sort_pass(m, m->cols, sparse_key_col);
+  sparse_coo_sort_pass(m, m->rows, sparse_key_row);
+
+  if (tile_order) {
+    sparse_coo_sort_pass(m, m->cols / DIM + 1, sparse_key_tile_col);
+    sparse_coo_sort_pass(m, m->rows / DIM + 1, sparse_key_tile_row);
+  }
+}
+
+//============================================================================
+// tile offsets
+//============================================================================
+
+// Returns a table with one entry for each DIM x DIM tile of a tile-ordered
+// COO matrix, plus one. Entry i*K + k, where K is the number of tile columns,
+// is the index of tile (i, k)'s first nonzero, and the entry after it is one
+// past its last nonzero. The COO mvin needs its data and index pointers to
+// point at the first nonzero of the tile it moves in, so a tile can be moved
+// in directly with:
+//
+//   gemmini_extended_mvin_sparse_coo(m.data + offsets[t], m.coo + 2*offsets[t],
+//       offsets[t+1] - offsets[t], spad_addr, k*DIM, cols, i*DIM, rows);
+//
+// which only reads that tile's nonzeros
+static ind_t * sparse_coo_tile_offsets(const struct sparse_coo_t * m) {
+  const size_t I = m->rows / DIM + (m->rows % DIM != 0);
+  const size_t K = m->cols / DIM + (m->cols % DIM != 0);
+
+  ind_t * const offsets = (ind_t *)sparse_alloc((I * K + 1) * sizeof(ind_t));
+  spmm_coo_tile_offsets(m->rows, m->cols, m->coo, m->nnz, offsets);
+
+#ifdef GEMMINI_ASSERTIONS
+  if (offsets[I * K] != m->nnz) {
+    printf("sparse_coo_tile_offsets: COO matrix is not in tile order\n");
+    exit(1);
+  }
+#endif
+
+  return offsets;
+}
+
+//============================================================================
+// graph reordering
+//
+// With a random node order, the nonzeros of a graph's adjacency matrix are
+// scattered across almost every DIM x DIM block, so the tiled kernels can't
+// skip many blocks, and each sparse mvin only finds a few nonzeros. The
+// functions below find a permutation of the nodes which clusters the
+// nonzeros instead. The adjacency matrix is treated as symmetric, which it
+// is for undirected graphs.
+//
+// A permutation is stored as perm[new] = old. Apply it to the adjacency
+// matrix with sparse_coo_permute, to the rows of the feature matrix with
+// sparse_permute_rows, and undo it on the output with sparse_unpermute_rows.
+//============================================================================
+
+// Fills row_ptr, which must have rows+1 entries, for a row-major COO matrix
+static void sparse_coo_row_ptr(const struct sparse_coo_t * m, ind_t * row_ptr) {
+  size_t n = 0;
+  for (size_t i = 0; i < m->rows; i++) {
+    row_ptr[i] = n;
+    while (n < m->nnz && m->coo[2*n] == i)
+      n++;
+  }
+  row_ptr[m->rows] = n;
+}
+
+// Reverse Cuthill-McKee ordering. Each connected component is walked
+// breadth-first, starting from its lowest-degree node and visiting each
+// node's neighbors in order of increasing degree, which keeps neighbors
+// close together. The whole order is then reversed. The matrix must be
+// square, and sorted in row-major order
+static void sparse_rcm_permutation(const struct sparse_coo_t * m, ind_t * perm) {
+  const size_t N = m->rows;
+
+  ind_t * const row_ptr = (ind_t *)sparse_alloc((N + 1) * sizeof(ind_t));
+  bool * const visited = (bool *)sparse_alloc(N * sizeof(bool));
+  ind_t * const order = (ind_t *)sparse_alloc(N * sizeof(ind_t));
+
+  sparse_coo_row_ptr(m, row_ptr);
+
+  for (size_t i = 0; i < N; i++)
+    visited[i] = false;
+
+  size_t head = 0, tail = 0;
+
+  while (tail < N) {
+    // Start the next component from its lowest-degree node
+    size_t start = N;
+    for (size_t i = 0; i < N; i++)
+      if (!visited[i] && (start == N || row_ptr[i+1] - row_ptr[i] < row_ptr[start+1] - row_ptr[start]))
+        start = i;
+
+    visited[start] = true;
+    order[tail++] = start;
+
+    for (; head < tail; head++) {
+      const size_t node = order[head];
+      const size_t first = tail;
+
+      for (size_t n = row_ptr[node]; n < row_ptr[node+1]; n++) {
+        const size_t neighbor = m->coo[2*n+1];
+        if (!visited[neighbor]) {
+          visited[neighbor] = true;
+          order[tail++] = neighbor;
+        }
+      }
+
+      // Insertion sort the new neighbors by degree. Stable, so ties keep the
+      // order they were found in
+      for (size_t a = first + 1; a < tail; a++) {
+        const ind_t x = order[a];
+        const size_t deg = row_ptr[x+1] - row_ptr[x];
+        size_t b = a;
+        for (; b > first && row_ptr[order[b-1]+1] - row_ptr[order[b-1]] > deg; b--)
+          order[b] = order[b-1];
+        order[b] = x;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < N; i++)
+    perm[i] = order[N - 1 - i];
+
+  free(row_ptr);
+  free(visited);
+  free(order);
+}
+
+// Degree bucketing: sorts the nodes by decreasing degree, so that the
+// high-degree nodes, which most edges touch, end up in the same few blocks.
+// It's much cheaper than RCM, but only helps graphs with skewed degrees
+static void sparse_degree_permutation(const struct sparse_coo_t * m, ind_t * perm) {
+  const size_t N = m->rows;
+
+  ind_t * const row_ptr = (ind_t *)sparse_alloc((N + 1) * sizeof(ind_t));
+  sparse_coo_row_ptr(m, row_ptr);
+
+  size_t max_deg = 0;
+  for (size_t i = 0; i < N; i++)
+    if (row_ptr[i+1] - row_ptr[i] > max_deg)
+      max_deg = row_ptr[i+1] - row_ptr[i];
+
+  size_t * const count = (size_t *)sparse_alloc((max_deg + 2) * sizeof(size_t));
+  memset(count, 0, (max_deg + 2) * sizeof(size_t));
+
+  for (size_t i = 0; i < N; i++)
+    count[max_deg - (row_ptr[i+1] - row_ptr[i]) + 1]++;
+  for (size_t d = 0; d <= max_deg; d++)
+    count[d+1] += count[d];
+  for (size_t i = 0; i < N; i++)
+    perm[count[max_deg - (row_ptr[i+1] - row_ptr[i])]++] = i;
+
+  free(row_ptr);
+  free(count);
+}
+
+// Applies a permutation to both the rows and the columns of a square COO
+// matrix, and re-sorts it in row-major order
+static void sparse_coo_permute(struct sparse_coo_t * m, const ind_t * perm) {
+  ind_t * const inv = (ind_t *)sparse_alloc(m->rows * sizeof(ind_t));
+  for (size_t i = 0; i < m->rows; i++)
+    inv[perm[i]] = i;
+
+  for (size_t n = 0; n < m->nnz; n++) {
+    m->coo[2*n] = inv[m->coo[2*n]];
+    m->coo[2*n+1] = inv[m->coo[2*n+1]];
+  }
+
+  free(inv);
+  sparse_coo_sort(m, false);
+}
+
+// dst[i] = src[perm[i]], for each row of a dense matrix
+static void sparse_permute_rows(size_t rows, size_t cols, const elem_t * src,
+        elem_t * dst, size_t stride, const ind_t * perm) {
+  for (size_t i = 0; i < rows; i++)
+    memcpy(dst + i*stride, src + perm[i]*stride, cols * sizeof(elem_t));
+}
+
+// dst[perm[i]] = src[i], for each row of a dense matrix
+static void sparse_unpermute_rows(size_t rows, size_t cols, const elem_t * src,
+        elem_t * dst, size_t stride, const ind_t * perm) {
+  for (size_t i = 0; i < rows; i++)
+    memcpy(dst + perm[i]*stride, src + i*stride, cols * sizeof(elem_t));
+}
+
+// How the nonzeros of a matrix are spread over its DIM x DIM blocks
+struct sparse_block_stats_t {
+  size_t nnz;
+  size_t blocks;          // Blocks with any nonzeros in them
+  size_t total_blocks;
+  size_t max_block_nnz;
+};
+
+static struct sparse_block_stats_t sparse_coo_block_stats(const struct sparse_coo_t * m) {
+  const size_t I = m->rows / DIM + (m->rows % DIM != 0);
+  const size_t K = m->cols / DIM + (m->cols % DIM != 0);
+
+  size_t * const count = (size_t *)sparse_alloc(I * K * sizeof(size_t));
+  memset(count, 0, I * K * sizeof(size_t));
+
+  for (size_t n = 0; n < m->nnz; n++)
+    count[(m->coo[2*n] / DIM) * K + m->coo[2*n+1] / DIM]++;
+
+  struct sparse_block_stats_t stats = {m->nnz, 0, I * K, 0};
+  for (size_t b = 0; b < I * K; b++) {
+    stats.blocks += count[b] != 0;
+    if (count[b] > stats.max_block_nnz)
+      stats.max_block_nnz = count[b];
+  }
+
+  free(count);
+  return stats;
+}
+
+static void sparse_print_block_stats(const char * name, struct sparse_block_stats_t stats) {
+  printf("%s: %zu nonzeros in %zu of %zu blocks (%zu%%), %zu per nonempty block on average, %zu at most\n",
+      name, stats.nnz, stats.blocks, stats.total_blocks,
+      stats.total_blocks == 0 ? 0 : 100 * stats.blocks / stats.total_blocks,
+      stats.blocks == 0 ? 0 : stats.nnz / stats.blocks,
+      stats.max_block_nnz);
+}
+
+#endif // __SPARSE_UTIL__